@@ -0,0 +1,183 @@
+/* acpi.c - ACPI table discovery */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "acpi.h"
+#include "paging.h"
+#include "pmm.h"
+#include "x86.h"
+
+/*
+ * Virtual window the tables are mapped into. It sits above the heap and
+ * below the APIC registers, so firmware tables near the top of RAM do
+ * not have to be identity-mapped over heap addresses.
+ */
+#define ACPI_WINDOW_BASE    0xFF800000u
+#define ACPI_WINDOW_PAGES   256
+
+/* Where the RSDP may be: first KB of the EBDA, or the BIOS ROM area */
+#define BDA_EBDA_SEGMENT    0x0E    // Offset in the BIOS data area
+#define BIOS_AREA_START     0xE0000
+#define BIOS_AREA_END       0x100000
+
+/*
+ * AcpiRsdp - Root System Description Pointer
+ */
+typedef struct {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;           // Over the first 20 bytes
+    char oemId[6];
+    uint8_t revision;           // 0 for ACPI 1.0, 2 and up have the XSDT
+    uint32_t rsdtAddress;
+    uint32_t length;            // Revision 2+: whole structure
+    uint64_t xsdtAddress;
+    uint8_t extendedChecksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) AcpiRsdp;
+
+/* State */
+static const AcpiSdtHeader* rootTable = NULL;
+static bool rootIsXsdt = false;
+static uint32_t windowUsed = 0;     // Pages of the window handed out
+
+/*
+ * checksumOk - ACPI checksums make the byte sum zero
+ */
+static bool checksumOk(const void* data, uint32_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/*
+ * signatureIs - Compare a four-character signature
+ */
+static bool signatureIs(const char* a, const char* b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+/*
+ * mapPhysical - Map a physical range into the window
+ *
+ * Returns a pointer to phys, or NULL once the window is full.
+ */
+static const void* mapPhysical(uintptr_t phys, uint32_t length)
+{
+    uintptr_t first = phys & ~(uintptr_t)(PAGE_SIZE - 1);
+    uint32_t pages = (uint32_t)((phys + length - first + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (windowUsed + pages > ACPI_WINDOW_PAGES) {
+        return NULL;
+    }
+
+    uintptr_t virt = ACPI_WINDOW_BASE + windowUsed * PAGE_SIZE;
+    for (uint32_t i = 0; i < pages; i++) {
+        if (!PagingMapPage(virt + i * PAGE_SIZE, first + i * PAGE_SIZE, PAGE_PRESENT)) {
+            return NULL;
+        }
+    }
+    windowUsed += pages;
+
+    return (const void*)(virt + (phys - first));
+}
+
+/*
+ * mapTable - Map a whole table given its physical address
+ */
+static const AcpiSdtHeader* mapTable(uintptr_t phys)
+{
+    const AcpiSdtHeader* header = mapPhysical(phys, sizeof(AcpiSdtHeader));
+    if (!header || header->length < sizeof(AcpiSdtHeader)) {
+        return NULL;
+    }
+
+    // Map again at full length now that we know it
+    const AcpiSdtHeader* table = mapPhysical(phys, header->length);
+    if (!table || !checksumOk(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+/*
+ * scanRsdp - Search a physical range (below 1 MB, identity-mapped) for the RSDP
+ */
+static const AcpiRsdp* scanRsdp(uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t addr = start; addr + 20 <= end; addr += 16) {
+        const AcpiRsdp* rsdp = (const AcpiRsdp*)addr;
+        if (signatureIs(rsdp->signature, "RSD ") && signatureIs(rsdp->signature + 4, "PTR ") &&
+            checksumOk(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * AcpiInitialize - Find the RSDP and root table
+ */
+bool AcpiInitialize(void)
+{
+    if (rootTable) {
+        return true;
+    }
+
+    uintptr_t ebda = (uintptr_t)bda_read16(BDA_EBDA_SEGMENT) << 4;
+
+    const AcpiRsdp* rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = scanRsdp(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = scanRsdp(BIOS_AREA_START, BIOS_AREA_END);
+    }
+    if (!rsdp) {
+        return false;
+    }
+
+    // Prefer the XSDT when it is there and reachable from 32-bit mode
+    if (rsdp->revision >= 2 && rsdp->xsdtAddress != 0 && (rsdp->xsdtAddress >> 32) == 0 &&
+        checksumOk(rsdp, rsdp->length)) {
+        rootTable = mapTable((uintptr_t)rsdp->xsdtAddress);
+        rootIsXsdt = rootTable != NULL;
+    }
+    if (!rootTable) {
+        rootTable = mapTable(rsdp->rsdtAddress);
+    }
+
+    return rootTable != NULL;
+}
+
+/*
+ * AcpiFindTable - Look up a table by signature
+ */
+const AcpiSdtHeader* AcpiFindTable(const char* signature)
+{
+    if (!rootTable) {
+        return NULL;
+    }
+
+    uint32_t entrySize = rootIsXsdt ? 8 : 4;
+    uint32_t entries = (rootTable->length - sizeof(AcpiSdtHeader)) / entrySize;
+    const uint8_t* entry = (const uint8_t*)rootTable + sizeof(AcpiSdtHeader);
+
+    for (uint32_t i = 0; i < entries; i++, entry += entrySize) {
+        uint64_t phys = rootIsXsdt ? *(const uint64_t*)entry : *(const uint32_t*)entry;
+        if (phys == 0 || (phys >> 32) != 0) {
+            continue;
+        }
+
+        const AcpiSdtHeader* header = mapPhysical((uintptr_t)phys, sizeof(AcpiSdtHeader));
+        if (header && signatureIs(header->signature, signature)) {
+            return mapTable((uintptr_t)phys);
+        }
+    }
+
+    return NULL;
+}
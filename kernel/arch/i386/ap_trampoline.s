@@ -0,0 +1,80 @@
+/* ap_trampoline.s - Real-mode entry point for application processors */
+
+/*
+ * smp.c copies everything from apTrampolineStart to apTrampolineEnd to
+ * TRAMPOLINE_BASE (below 1 MB and page aligned, as a startup IPI needs)
+ * and fills in apTrampolineParams before starting each AP. The code runs
+ * at the copy's address, so every absolute reference is computed as
+ * TRAMPOLINE_BASE + offset from apTrampolineStart.
+ *
+ * The AP goes straight from real mode to protected mode with paging on
+ * the kernel's page directory (low memory is identity-mapped), switches
+ * to its own stack and calls entry(cpu). entry does not return.
+ */
+
+.set TRAMPOLINE_BASE, 0x7000
+
+.section .text
+
+.global apTrampolineStart
+.global apTrampolineParams
+.global apTrampolineEnd
+
+.code16
+apTrampolineStart:
+    cli
+    cld
+    xorw %ax, %ax
+    movw %ax, %ds
+
+    /* Flat 4 GB code and data with a temporary GDT, then protected mode */
+    lgdtl TRAMPOLINE_BASE + (trampolineGdtPointer - apTrampolineStart)
+    movl %cr0, %eax
+    orl $0x1, %eax
+    movl %eax, %cr0
+    ljmpl $0x08, $(TRAMPOLINE_BASE + (trampoline32 - apTrampolineStart))
+
+.code32
+trampoline32:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    /* Kernel page directory, then paging on */
+    movl TRAMPOLINE_BASE + (apTrampolineParams - apTrampolineStart), %eax
+    movl %eax, %cr3
+    movl %cr0, %eax
+    orl $0x80000000, %eax
+    movl %eax, %cr0
+
+    /* Own stack, then entry(cpu) */
+    movl TRAMPOLINE_BASE + (apTrampolineParams - apTrampolineStart) + 4, %esp
+    pushl TRAMPOLINE_BASE + (apTrampolineParams - apTrampolineStart) + 12
+    movl TRAMPOLINE_BASE + (apTrampolineParams - apTrampolineStart) + 8, %eax
+    call *%eax
+
+1:
+    cli
+    hlt
+    jmp 1b
+
+.align 8
+trampolineGdt:
+    .quad 0x0000000000000000    /* Null */
+    .quad 0x00CF9A000000FFFF    /* 0x08: ring 0 code, flat */
+    .quad 0x00CF92000000FFFF    /* 0x10: ring 0 data, flat */
+trampolineGdtPointer:
+    .word 3 * 8 - 1
+    .long TRAMPOLINE_BASE + (trampolineGdt - apTrampolineStart)
+
+/* Filled in by smp.c for each AP (see ApTrampolineParams there) */
+.align 4
+apTrampolineParams:
+    .long 0     /* Page directory (physical) */
+    .long 0     /* Stack top */
+    .long 0     /* C entry point */
+    .long 0     /* CPU index */
+apTrampolineEnd:
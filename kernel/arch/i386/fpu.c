@@ -0,0 +1,367 @@
+/* fpu.c - x87/SSE state management */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "fpu.h"
+#include "isr.h"
+#include "x86.h"
+#include "kheap.h"
+#include "panic.h"
+#include "process.h"
+#include "smp.h"
+
+/* Device-not-available exception, raised by FPU instructions while CR0.TS is set */
+#define FPU_TRAP_VECTOR 7
+
+/* CR0 bits */
+#define CR0_MP (1u << 1)    /* WAIT/FWAIT honour TS too */
+#define CR0_EM (1u << 2)    /* Emulate FPU (trap every FPU instruction) */
+#define CR0_TS (1u << 3)    /* Task switched: next FPU instruction traps */
+#define CR0_NE (1u << 5)    /* Report x87 errors as #MF, not through the PIC */
+
+/* CR4 bits */
+#define CR4_OSFXSR     (1u << 9)    /* FXSAVE/FXRSTOR and SSE instructions enabled */
+#define CR4_OSXMMEXCPT (1u << 10)   /* Unmasked SSE exceptions raise #XM */
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_FEATURE_FPU  (1u << 0)
+#define CPUID_FEATURE_FXSR (1u << 24)
+#define CPUID_FEATURE_SSE  (1u << 25)
+
+/* MXCSR after reset: all SSE exceptions masked, round to nearest */
+#define MXCSR_DEFAULT 0x1F80
+
+/*
+ * FpuCpu - Per-CPU lazy switching state
+ *
+ * Each CPU has its own registers, so each has its own owner. Only
+ * touched by the CPU itself with interrupts off, except that FpuDrop()
+ * may clear another CPU's owner and FpuIsLoaded() reads it.
+ */
+typedef struct {
+    FpuState* owner;        // Whose registers are loaded, if anyone's
+    bool trapArmed;         // Mirrors CR0.TS
+    uint64_t switches;
+    uint64_t traps;
+    uint64_t saves;
+} FpuCpu;
+
+/* FPU state */
+static bool hasFpu = false;
+static bool hasFxsr = false;
+static bool hasSse = false;
+static FpuCpu fpuCpus[SMP_MAX_CPUS];
+
+/* Forward declarations */
+static void fpuTrap(registers_t* regs);
+static void enableOnCpu(void);
+static void saveState(FpuCpu* cpu, FpuState* state);
+static void loadState(FpuState* state);
+
+/*
+ * thisCpu - Lazy switching state of the calling CPU (interrupts off)
+ */
+static inline FpuCpu* thisCpu(void)
+{
+    return &fpuCpus[SmpGetCurrentCpu()];
+}
+
+/*
+ * armTrap - Set CR0.TS unless it already is
+ */
+static inline void armTrap(FpuCpu* cpu)
+{
+    if (!cpu->trapArmed) {
+        write_cr0(read_cr0() | CR0_TS);
+        cpu->trapArmed = true;
+    }
+}
+
+/*
+ * disarmTrap - Clear CR0.TS unless it already is
+ */
+static inline void disarmTrap(FpuCpu* cpu)
+{
+    if (cpu->trapArmed) {
+        clts();
+        cpu->trapArmed = false;
+    }
+}
+
+/*
+ * FpuInitialize - Enable the x87 FPU and SSE and install the lazy switch trap
+ */
+bool FpuInitialize(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    hasFpu = (edx & CPUID_FEATURE_FPU) != 0;
+    hasFxsr = hasFpu && (edx & CPUID_FEATURE_FXSR) != 0;
+    hasSse = hasFxsr && (edx & CPUID_FEATURE_SSE) != 0;
+
+    // Without an FPU, EM stays set and the trap handler reports the
+    // instruction instead of handing out registers
+    IsrRegisterHandler(FPU_TRAP_VECTOR, fpuTrap);
+    if (!hasFpu) {
+        return false;
+    }
+
+    enableOnCpu();
+    return true;
+}
+
+/*
+ * FpuInitializeCpu - Enable the FPU on an application processor
+ */
+void FpuInitializeCpu(void)
+{
+    if (hasFpu) {
+        enableOnCpu();
+    }
+}
+
+/*
+ * FpuStateAllocate - Allocate an empty, aligned FPU save area
+ */
+FpuState* FpuStateAllocate(void)
+{
+    void* block = KAllocateMemory(sizeof(FpuState) + 15);
+    if (!block) {
+        return NULL;
+    }
+
+    FpuState* state = (FpuState*)(((uintptr_t)block + 15) & ~(uintptr_t)15);
+    state->block = block;
+    state->used = false;
+    return state;
+}
+
+/*
+ * FpuStateFree - Free a save area from FpuStateAllocate()
+ */
+void FpuStateFree(FpuState* state)
+{
+    if (!state) return;
+
+    FpuDrop(state);
+    KFreeMemory(state->block);
+}
+
+/*
+ * FpuSwitch - Arm the lazy switch for the next process
+ */
+void FpuSwitch(FpuState* next)
+{
+    if (!hasFpu) return;
+
+    FpuCpu* cpu = thisCpu();
+    cpu->switches++;
+
+    // Coming back to the owner: its registers are still loaded
+    if (next && next == cpu->owner) {
+        disarmTrap(cpu);
+    } else {
+        armTrap(cpu);
+    }
+}
+
+/*
+ * FpuDrop - Forget the live registers of a state without saving them
+ */
+void FpuDrop(FpuState* state)
+{
+    if (!state) return;
+
+    uint32_t flags = irq_save();
+
+    // Normally loaded (if at all) on this CPU; a CPU that still holds it
+    // is running something else, so its trap is already armed
+    FpuCpu* self = thisCpu();
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        FpuCpu* cpu = &fpuCpus[i];
+        FpuState* expected = state;
+        if (__atomic_compare_exchange_n(&cpu->owner, &expected, NULL, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) && cpu == self) {
+            armTrap(cpu);
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/*
+ * FpuIsLoaded - Check whether a state's registers are live on some CPU
+ */
+bool FpuIsLoaded(const FpuState* state)
+{
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (__atomic_load_n(&fpuCpus[i].owner, __ATOMIC_ACQUIRE) == state) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * FpuFlush - Save a state's registers if they are live on this CPU
+ */
+void FpuFlush(FpuState* state)
+{
+    if (!state || !hasFpu) return;
+
+    uint32_t flags = irq_save();
+
+    // Not running, so the trap is armed; saving with CR0.TS set would trap
+    FpuCpu* cpu = thisCpu();
+    if (cpu->owner == state) {
+        disarmTrap(cpu);
+        saveState(cpu, state);
+        cpu->owner = NULL;
+        armTrap(cpu);
+    }
+
+    irq_restore(flags);
+}
+
+/*
+ * FpuKernelBegin - Let kernel code use the FPU/SSE registers
+ */
+uint32_t FpuKernelBegin(void)
+{
+    uint32_t flags = irq_save();
+
+    if (hasFpu) {
+        FpuCpu* cpu = thisCpu();
+        disarmTrap(cpu);
+        if (cpu->owner) {
+            saveState(cpu, cpu->owner);
+            cpu->owner = NULL;
+        }
+        __asm__ volatile ("fninit");
+    }
+
+    return flags;
+}
+
+/*
+ * FpuKernelEnd - End a FpuKernelBegin() section
+ */
+void FpuKernelEnd(uint32_t flags)
+{
+    if (hasFpu) {
+        armTrap(thisCpu());
+    }
+
+    irq_restore(flags);
+}
+
+/*
+ * FpuGetStats - Lazy switching counters since boot
+ */
+void FpuGetStats(uint64_t* traps, uint64_t* saves, uint64_t* avoided)
+{
+    uint64_t switches = 0, trapCount = 0, saveCount = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        switches += fpuCpus[i].switches;
+        trapCount += fpuCpus[i].traps;
+        saveCount += fpuCpus[i].saves;
+    }
+
+    if (traps) *traps = trapCount;
+    if (saves) *saves = saveCount;
+    if (avoided) *avoided = switches > saveCount ? switches - saveCount : 0;
+}
+
+/*
+ * fpuTrap - Device-not-available handler (ISR 7)
+ *
+ * The running process used the FPU for the first time since it was
+ * switched in. Save whoever's registers are loaded, load its own (or a
+ * fresh FNINIT state the first time) and let the instruction restart.
+ */
+static void fpuTrap(registers_t* regs)
+{
+    if (!hasFpu) {
+        KPanicRegs(regs, "FPU instruction executed, but there is no FPU");
+    }
+
+    FpuCpu* cpu = thisCpu();
+    cpu->traps++;
+    disarmTrap(cpu);
+
+    Process* current = ProcessGetCurrent();
+    FpuState* state = current ? current->fpuState : NULL;
+    if (state && state == cpu->owner) {
+        return;
+    }
+
+    if (cpu->owner) {
+        saveState(cpu, cpu->owner);
+    }
+    loadState(state);
+    cpu->owner = state;
+}
+
+/*
+ * enableOnCpu - Turn on the FPU and SSE on the calling CPU
+ */
+static void enableOnCpu(void)
+{
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (hasFxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (hasSse) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    // Start clean with nobody owning the registers
+    FpuCpu* cpu = thisCpu();
+    clts();
+    __asm__ volatile ("fninit");
+    cpu->owner = NULL;
+    cpu->trapArmed = false;
+    armTrap(cpu);
+}
+
+/*
+ * saveState - Store the live registers in a save area
+ */
+static void saveState(FpuCpu* cpu, FpuState* state)
+{
+    if (hasFxsr) {
+        __asm__ volatile ("fxsave %0" : "=m"(state->area));
+    } else {
+        __asm__ volatile ("fnsave %0" : "=m"(state->area));
+    }
+    state->used = true;
+    cpu->saves++;
+}
+
+/*
+ * loadState - Load a save area into the registers, or reset them
+ */
+static void loadState(FpuState* state)
+{
+    if (!state || !state->used) {
+        __asm__ volatile ("fninit");
+        if (hasSse) {
+            uint32_t mxcsr = MXCSR_DEFAULT;
+            __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+        }
+        return;
+    }
+
+    if (hasFxsr) {
+        __asm__ volatile ("fxrstor %0" : : "m"(state->area));
+    } else {
+        __asm__ volatile ("frstor %0" : : "m"(state->area));
+    }
+}
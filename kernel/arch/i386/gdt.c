@@ -3,14 +3,17 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "gdt.h"
+#include "smp.h"
+#include "percpu.h"
 #include "early_console.h"
 
-/* Number of GDT entries */
-#define GDT_ENTRIES 5
+/* Number of GDT entries: null, kernel code/data, user code/data, TSS, per-CPU */
+#define GDT_ENTRIES 7
 
-/* GDT table */
-static struct gdt_entry gdtEntries[GDT_ENTRIES];
-static struct gdt_ptr gdtPointer;
+/* Per-CPU tables: each CPU needs its own TSS, and so its own GDT */
+static struct gdt_entry gdtEntries[SMP_MAX_CPUS][GDT_ENTRIES];
+static struct gdt_ptr gdtPointers[SMP_MAX_CPUS];
+static struct tss_entry tssEntries[SMP_MAX_CPUS];
 
 /* External assembly function to load GDT */
 extern void gdtFlush(uint32_t);
@@ -18,58 +21,95 @@ extern void gdtFlush(uint32_t);
 /*
  * gdtSetGate - Set a GDT entry
  */
-static void gdtSetGate(int32_t num, uint32_t base, uint32_t limit,
-                       uint8_t access, uint8_t gran)
+static void gdtSetGate(struct gdt_entry* entries, int32_t num, uint32_t base,
+                       uint32_t limit, uint8_t access, uint8_t gran)
 {
-    gdtEntries[num].baseLow = (base & 0xFFFF);
-    gdtEntries[num].baseMiddle = (base >> 16) & 0xFF;
-    gdtEntries[num].baseHigh = (base >> 24) & 0xFF;
+    entries[num].baseLow = (base & 0xFFFF);
+    entries[num].baseMiddle = (base >> 16) & 0xFF;
+    entries[num].baseHigh = (base >> 24) & 0xFF;
 
-    gdtEntries[num].limitLow = (limit & 0xFFFF);
-    gdtEntries[num].granularity = (limit >> 16) & 0x0F;
-    gdtEntries[num].granularity |= gran & 0xF0;
+    entries[num].limitLow = (limit & 0xFFFF);
+    entries[num].granularity = (limit >> 16) & 0x0F;
+    entries[num].granularity |= gran & 0xF0;
 
-    gdtEntries[num].access = access;
+    entries[num].access = access;
 }
 
 /*
  * GdtInitialize - Initialize the Global Descriptor Table
  *
  * Sets up a flat memory model with separate code and data segments
- * for both kernel (ring 0) and user mode (ring 3).
+ * for both kernel (ring 0) and user mode (ring 3), and the boot CPU's TSS.
  */
 void GdtInitialize(void)
 {
-    gdtPointer.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
-    gdtPointer.base = (uint32_t)&gdtEntries;
+    GdtInitializeCpu(0);
+}
+
+/*
+ * GdtInitializeCpu - Build and load the GDT and TSS of one CPU
+ */
+void GdtInitializeCpu(uint32_t cpu)
+{
+    struct gdt_entry* entries = gdtEntries[cpu];
+    struct tss_entry* tss = &tssEntries[cpu];
+
+    gdtPointers[cpu].limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+    gdtPointers[cpu].base = (uint32_t)entries;
 
     // Null segment (required)
-    gdtSetGate(0, 0, 0, 0, 0);
+    gdtSetGate(entries, 0, 0, 0, 0, 0);
 
     // Kernel code segment
-    gdtSetGate(1, 0, 0xFFFFFFFF,
+    gdtSetGate(entries, 1, 0, 0xFFFFFFFF,
                GDT_ACCESS_PRESENT | GDT_ACCESS_DESCRIPTOR | GDT_ACCESS_PRIV_RING0 |
                GDT_ACCESS_EXECUTABLE | GDT_ACCESS_RW,
                GDT_GRAN_4K | GDT_GRAN_32BIT);
 
     // Kernel data segment
-    gdtSetGate(2, 0, 0xFFFFFFFF,
+    gdtSetGate(entries, 2, 0, 0xFFFFFFFF,
                GDT_ACCESS_PRESENT | GDT_ACCESS_DESCRIPTOR | GDT_ACCESS_PRIV_RING0 |
                GDT_ACCESS_RW,
                GDT_GRAN_4K | GDT_GRAN_32BIT);
 
     // User code segment
-    gdtSetGate(3, 0, 0xFFFFFFFF,
+    gdtSetGate(entries, 3, 0, 0xFFFFFFFF,
                GDT_ACCESS_PRESENT | GDT_ACCESS_DESCRIPTOR | GDT_ACCESS_PRIV_RING3 |
                GDT_ACCESS_EXECUTABLE | GDT_ACCESS_RW,
                GDT_GRAN_4K | GDT_GRAN_32BIT);
 
     // User data segment
-    gdtSetGate(4, 0, 0xFFFFFFFF,
+    gdtSetGate(entries, 4, 0, 0xFFFFFFFF,
                GDT_ACCESS_PRESENT | GDT_ACCESS_DESCRIPTOR | GDT_ACCESS_PRIV_RING3 |
                GDT_ACCESS_RW,
                GDT_GRAN_4K | GDT_GRAN_32BIT);
 
-    // Load the GDT
-    gdtFlush((uint32_t)&gdtPointer);
+    // Task state segment: only the ring 0 stack is used, for entries from ring 3
+    for (size_t i = 0; i < sizeof(*tss); i++) {
+        ((uint8_t*)tss)[i] = 0;
+    }
+    tss->ss0 = GDT_KERNEL_DATA_SELECTOR;
+    tss->iomapBase = sizeof(*tss);
+    gdtSetGate(entries, 5, (uint32_t)tss, sizeof(*tss) - 1,
+               GDT_ACCESS_PRESENT | GDT_ACCESS_PRIV_RING0 | GDT_ACCESS_TSS32, 0);
+
+    // Per-CPU data: a small segment over just this CPU's area (percpu.h)
+    PerCpu* area = PerCpuSetup(cpu);
+    gdtSetGate(entries, 6, (uint32_t)area, sizeof(*area) - 1,
+               GDT_ACCESS_PRESENT | GDT_ACCESS_DESCRIPTOR | GDT_ACCESS_PRIV_RING0 |
+               GDT_ACCESS_RW,
+               GDT_GRAN_32BIT);
+
+    // Load the GDT, the task register and GS
+    gdtFlush((uint32_t)&gdtPointers[cpu]);
+    __asm__ volatile ("ltr %0" : : "r"((uint16_t)GDT_TSS_SELECTOR));
+    __asm__ volatile ("mov %0, %%gs" : : "r"((uint16_t)GDT_PERCPU_SELECTOR) : "memory");
+}
+
+/*
+ * GdtSetKernelStack - Set the stack a CPU switches to on entry from ring 3
+ */
+void GdtSetKernelStack(uint32_t cpu, uint32_t esp0)
+{
+    tssEntries[cpu].esp0 = esp0;
 }
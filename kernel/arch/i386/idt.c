@@ -42,3 +42,11 @@ void IdtInitialize(void)
     // Load the IDT
     idtFlush((uint32_t)&idtPointer);
 }
+
+/*
+ * IdtLoad - Load the (shared) IDT on the calling CPU
+ */
+void IdtLoad(void)
+{
+    idtFlush((uint32_t)&idtPointer);
+}
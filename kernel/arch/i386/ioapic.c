@@ -0,0 +1,255 @@
+/* ioapic.c - I/O APIC */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ioapic.h"
+#include "irq.h"
+#include "acpi.h"
+#include "paging.h"
+#include "spinlock.h"
+
+/* Most I/O APICs used; real machines have one or two */
+#define IOAPIC_MAX 4
+
+/* Register window: write a register index to IOREGSEL, access it at IOWIN */
+#define IOAPIC_IOREGSEL 0x00
+#define IOAPIC_IOWIN    0x10
+
+/* Registers */
+#define IOAPIC_REG_VER      0x01    /* Bits 16-23: highest redirection entry */
+#define IOAPIC_REG_REDTBL   0x10    /* Two registers per input */
+
+/* Redirection entry bits (low word; the destination is in the high word) */
+#define REDTBL_ACTIVE_LOW   (1u << 13)
+#define REDTBL_LEVEL        (1u << 15)
+#define REDTBL_MASKED       (1u << 16)
+#define REDTBL_DEST_SHIFT   24
+
+/*
+ * Ioapic - One I/O APIC
+ */
+typedef struct {
+    volatile uint32_t* base;
+    uint32_t gsiBase;           // Global system interrupt of input 0
+    uint32_t inputs;
+} Ioapic;
+
+/*
+ * IoapicLine - Where an IRQ arrives, once routed
+ */
+typedef struct {
+    Ioapic* ioapic;             // NULL until routed
+    uint32_t pin;
+    uint32_t low;               // Redirection entry, mask bit included
+} IoapicLine;
+
+/* State */
+static Ioapic ioapics[IOAPIC_MAX];
+static uint32_t ioapicCount = 0;
+static IoapicLine lines[IRQ_LINES];
+static Spinlock ioapicLock = SPINLOCK_INIT;    // Register window, any CPU
+
+/* ISA IRQs as the MADT overrides them; identity, edge, active high otherwise */
+static uint32_t isaGsi[16];
+static uint16_t isaFlags[16];
+
+/*
+ * ioapicRead - Read an I/O APIC register
+ */
+static uint32_t ioapicRead(Ioapic* ioapic, uint32_t reg)
+{
+    ioapic->base[IOAPIC_IOREGSEL / 4] = reg;
+    return ioapic->base[IOAPIC_IOWIN / 4];
+}
+
+/*
+ * ioapicWrite - Write an I/O APIC register
+ */
+static void ioapicWrite(Ioapic* ioapic, uint32_t reg, uint32_t value)
+{
+    ioapic->base[IOAPIC_IOREGSEL / 4] = reg;
+    ioapic->base[IOAPIC_IOWIN / 4] = value;
+}
+
+/*
+ * addIoapic - Map an I/O APIC from the MADT and mask its inputs
+ */
+static void addIoapic(const AcpiMadtIoapic* entry)
+{
+    if (ioapicCount >= IOAPIC_MAX ||
+        !PagingMapPage(entry->address, entry->address,
+                       PAGE_PRESENT | PAGE_WRITE | PAGE_NOCACHE)) {
+        return;
+    }
+
+    Ioapic* ioapic = &ioapics[ioapicCount++];
+    ioapic->base = (volatile uint32_t*)(uintptr_t)entry->address;
+    ioapic->gsiBase = entry->gsiBase;
+    ioapic->inputs = ((ioapicRead(ioapic, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+
+    for (uint32_t pin = 0; pin < ioapic->inputs; pin++) {
+        ioapicWrite(ioapic, IOAPIC_REG_REDTBL + pin * 2, REDTBL_MASKED);
+    }
+}
+
+/*
+ * findInput - The I/O APIC and pin a global system interrupt arrives on
+ */
+static Ioapic* findInput(uint32_t gsi, uint32_t* pin)
+{
+    for (uint32_t i = 0; i < ioapicCount; i++) {
+        Ioapic* ioapic = &ioapics[i];
+        if (gsi >= ioapic->gsiBase && gsi < ioapic->gsiBase + ioapic->inputs) {
+            *pin = gsi - ioapic->gsiBase;
+            return ioapic;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * writeLine - Store a routed line's redirection entry
+ *
+ * Called with ioapicLock held. The high word goes first so the entry
+ * never points at a half-written destination while unmasked.
+ */
+static void writeLine(IoapicLine* line, uint8_t apicId)
+{
+    uint32_t reg = IOAPIC_REG_REDTBL + line->pin * 2;
+    ioapicWrite(line->ioapic, reg + 1, (uint32_t)apicId << REDTBL_DEST_SHIFT);
+    ioapicWrite(line->ioapic, reg, line->low);
+}
+
+/*
+ * IoapicInitialize - Find and map the I/O APICs
+ */
+bool IoapicInitialize(void)
+{
+    if (!AcpiInitialize()) {
+        return false;
+    }
+
+    const AcpiMadt* madt = (const AcpiMadt*)AcpiFindTable("APIC");
+    if (!madt) {
+        return false;
+    }
+
+    for (uint32_t irq = 0; irq < 16; irq++) {
+        isaGsi[irq] = irq;
+        isaFlags[irq] = 0;
+    }
+
+    const uint8_t* entry = (const uint8_t*)madt + sizeof(AcpiMadt);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        if (entry[0] == ACPI_MADT_IOAPIC) {
+            addIoapic((const AcpiMadtIoapic*)entry);
+        } else if (entry[0] == ACPI_MADT_INTERRUPT_OVERRIDE) {
+            const AcpiMadtInterruptOverride* override = (const AcpiMadtInterruptOverride*)entry;
+            if (override->bus == 0 && override->source < 16) {
+                isaGsi[override->source] = override->gsi;
+                isaFlags[override->source] = override->flags;
+            }
+        }
+        entry += entry[1];
+    }
+
+    return ioapicCount > 0;
+}
+
+/*
+ * IoapicRoute - Program the redirection entry of a line
+ *
+ * ISA lines default to edge-triggered, active high, and keep whatever
+ * the override changes; "conforming" flags mean the bus default.
+ */
+bool IoapicRoute(uint8_t irq, uint8_t vector, uint8_t apicId)
+{
+    if (irq >= IRQ_LINES) {
+        return false;
+    }
+
+    uint32_t gsi = irq;
+    uint32_t low = REDTBL_MASKED | vector;
+    if (irq < 16) {
+        gsi = isaGsi[irq];
+        if ((isaFlags[irq] & ACPI_MADT_POLARITY_MASK) == ACPI_MADT_POLARITY_LOW) {
+            low |= REDTBL_ACTIVE_LOW;
+        }
+        if ((isaFlags[irq] & ACPI_MADT_TRIGGER_MASK) == ACPI_MADT_TRIGGER_LEVEL) {
+            low |= REDTBL_LEVEL;
+        }
+    } else {
+        low |= REDTBL_ACTIVE_LOW | REDTBL_LEVEL;
+    }
+
+    // An input another ISA IRQ was moved onto belongs to that IRQ (usually
+    // IRQ 0 takes input 2, which the cascade no longer needs)
+    for (uint32_t source = 0; source < 16; source++) {
+        if (source != irq && isaGsi[source] == gsi) {
+            return false;
+        }
+    }
+
+    uint32_t pin;
+    Ioapic* ioapic = findInput(gsi, &pin);
+    if (!ioapic) {
+        return false;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&ioapicLock);
+    IoapicLine* line = &lines[irq];
+    line->ioapic = ioapic;
+    line->pin = pin;
+    line->low = low;
+    writeLine(line, apicId);
+    SpinlockReleaseIrqRestore(&ioapicLock, flags);
+    return true;
+}
+
+/*
+ * IoapicSetDestination - Deliver a routed line to another local APIC
+ */
+void IoapicSetDestination(uint8_t irq, uint8_t apicId)
+{
+    if (irq >= IRQ_LINES || !lines[irq].ioapic) {
+        return;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&ioapicLock);
+    writeLine(&lines[irq], apicId);
+    SpinlockReleaseIrqRestore(&ioapicLock, flags);
+}
+
+/*
+ * IoapicMask - Disable a routed line
+ */
+void IoapicMask(uint8_t irq)
+{
+    if (irq >= IRQ_LINES || !lines[irq].ioapic) {
+        return;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&ioapicLock);
+    IoapicLine* line = &lines[irq];
+    line->low |= REDTBL_MASKED;
+    ioapicWrite(line->ioapic, IOAPIC_REG_REDTBL + line->pin * 2, line->low);
+    SpinlockReleaseIrqRestore(&ioapicLock, flags);
+}
+
+/*
+ * IoapicUnmask - Enable a routed line
+ */
+void IoapicUnmask(uint8_t irq)
+{
+    if (irq >= IRQ_LINES || !lines[irq].ioapic) {
+        return;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&ioapicLock);
+    IoapicLine* line = &lines[irq];
+    line->low &= ~REDTBL_MASKED;
+    ioapicWrite(line->ioapic, IOAPIC_REG_REDTBL + line->pin * 2, line->low);
+    SpinlockReleaseIrqRestore(&ioapicLock, flags);
+}
@@ -6,10 +6,64 @@
 #include "idt.h"
 #include "isr.h"
 #include "pic.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "smp.h"
+#include "kcmdline.h"
+#include "softirq.h"
+#include "semaphore.h"
+#include "spinlock.h"
+#include "process.h"
+#include "rcu.h"
+#include "tsc.h"
+#include "x86.h"
+#include "econ_writer.h"
+#include "clc/printf.h"
+#include "clc/math.h"
 
-/* IRQ handler table */
-static IrqHandlerFunc irqHandlers[16];
-static IrqHandlerRegFunc irqHandlerRegs[16];
+/*
+ * IrqThread - Threaded handler of one IRQ line
+ *
+ * The process is created on the first threaded registration and kept;
+ * handler is NULL while the line has no threaded handler.
+ */
+typedef struct {
+    uint8_t irq;
+    IrqHandlerFunc volatile handler;
+    Semaphore wake;             // Raised by the top half, once per interrupt
+    Process* process;
+} IrqThread;
+
+/*
+ * IRQ handler table. A line has one handler of its own (plain, with
+ * registers or threaded) or a chain of shared ones, never both. The chains
+ * are walked under RcuReadLock(); registerLock serialises the writers,
+ * which all run in process context.
+ */
+static IrqHandlerFunc irqHandlers[IRQ_LINES];
+static IrqHandlerRegFunc irqHandlerRegs[IRQ_LINES];
+static IrqThread irqThreads[IRQ_LINES];
+static IrqAction* irqChains[IRQ_LINES];
+static Spinlock registerLock = SPINLOCK_INIT;
+static IrqExitFunc exitHook = NULL;
+
+/* Per-line statistics for IrqStatDump() */
+static uint64_t irqCount[IRQ_LINES];
+static uint64_t irqUnhandled[IRQ_LINES];    // Chain walks nobody claimed
+static uint64_t irqCycles[IRQ_LINES];       // In the line's own handler
+
+/* Set once the I/O APIC has taken over from the 8259 */
+static bool apicMode = false;
+
+/* TSC when each line's latest interrupt reached irqHandler() */
+static volatile uint64_t irqRaisedAt[IRQ_LINES];
+
+/* Forward declarations */
+static void irqThreadMain(void);
+static bool runChain(uint8_t irq, bool timed);
+static bool lineExists(uint8_t irq);
+static bool lineHasOwnHandler(uint8_t irq);
+static uint32_t cyclesToNs(uint64_t cycles);
 
 /* External assembly IRQ stubs */
 extern void irq0(void);
@@ -28,6 +82,14 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void irq16(void);
+extern void irq17(void);
+extern void irq18(void);
+extern void irq19(void);
+extern void irq20(void);
+extern void irq21(void);
+extern void irq22(void);
+extern void irq23(void);
 
 /*
  * IrqInitialize - Initialize IRQ infrastructure
@@ -35,12 +97,17 @@ extern void irq15(void);
 void IrqInitialize(void)
 {
     /* Clear handler tables */
-    for (int i = 0; i < 16; i++) {
+    for (int i = 0; i < IRQ_LINES; i++) {
         irqHandlers[i] = NULL;
         irqHandlerRegs[i] = NULL;
+        irqChains[i] = NULL;
+        irqThreads[i].irq = (uint8_t)i;
+        irqThreads[i].handler = NULL;
+        SemaphoreInit(&irqThreads[i].wake, 0);
+        irqThreads[i].process = NULL;
     }
 
-    /* Install IRQ handlers in IDT (interrupts 32-47) */
+    /* Install IRQ handlers in IDT (interrupts 32-55) */
     IdtSetGate(32, (uint32_t)irq0, 0x08, 0x8E);
     IdtSetGate(33, (uint32_t)irq1, 0x08, 0x8E);
     IdtSetGate(34, (uint32_t)irq2, 0x08, 0x8E);
@@ -57,16 +124,122 @@ void IrqInitialize(void)
     IdtSetGate(45, (uint32_t)irq13, 0x08, 0x8E);
     IdtSetGate(46, (uint32_t)irq14, 0x08, 0x8E);
     IdtSetGate(47, (uint32_t)irq15, 0x08, 0x8E);
+    IdtSetGate(48, (uint32_t)irq16, 0x08, 0x8E);
+    IdtSetGate(49, (uint32_t)irq17, 0x08, 0x8E);
+    IdtSetGate(50, (uint32_t)irq18, 0x08, 0x8E);
+    IdtSetGate(51, (uint32_t)irq19, 0x08, 0x8E);
+    IdtSetGate(52, (uint32_t)irq20, 0x08, 0x8E);
+    IdtSetGate(53, (uint32_t)irq21, 0x08, 0x8E);
+    IdtSetGate(54, (uint32_t)irq22, 0x08, 0x8E);
+    IdtSetGate(55, (uint32_t)irq23, 0x08, 0x8E);
+}
+
+/*
+ * IrqInitializeApic - Move device interrupts from the 8259 to the I/O APIC
+ *
+ * Every line keeps its vector (32 + IRQ), so handlers do not notice. The
+ * lines enabled at the PIC are enabled at the I/O APIC before the PIC is
+ * masked for good.
+ */
+bool IrqInitializeApic(void)
+{
+    if (KCmdLineHasFlag("noapic") || !IoapicInitialize() || !LapicInitialize(0)) {
+        return false;
+    }
+
+    uint32_t flags = irq_save();
+    uint16_t picMask = PicGetMask();
+    PicDisable();
+    LapicMaskLint0();
+
+    uint8_t apicId = LapicGetId();
+    for (uint8_t irq = 0; irq < IRQ_LINES; irq++) {
+        bool enabled = irq < IRQ_PIC_LINES && irq != IRQ2 && !(picMask & (1u << irq));
+        if (IoapicRoute(irq, (uint8_t)(IRQ_VECTOR_BASE + irq), apicId) && enabled) {
+            IoapicUnmask(irq);
+        }
+    }
+    apicMode = true;
+
+    irq_restore(flags);
+    return true;
+}
+
+/*
+ * IrqUsesApic - Check whether device interrupts come through the I/O APIC
+ */
+bool IrqUsesApic(void)
+{
+    return apicMode;
+}
+
+/*
+ * IrqMask - Disable an IRQ line at its interrupt controller
+ */
+void IrqMask(uint8_t irq)
+{
+    if (apicMode) {
+        IoapicMask(irq);
+    } else if (irq < IRQ_PIC_LINES) {
+        PicSetMask(irq);
+    }
+}
+
+/*
+ * IrqUnmask - Enable an IRQ line at its interrupt controller
+ */
+void IrqUnmask(uint8_t irq)
+{
+    if (apicMode) {
+        IoapicUnmask(irq);
+    } else if (irq < IRQ_PIC_LINES) {
+        PicClearMask(irq);
+    }
+}
+
+/*
+ * IrqSendEoi - Acknowledge an interrupt at its controller
+ */
+void IrqSendEoi(uint8_t irq)
+{
+    if (apicMode) {
+        LapicSendEoi();
+    } else {
+        PicSendEoi(irq);
+    }
+}
+
+/*
+ * IrqSetAffinity - Deliver an IRQ line to another CPU
+ *
+ * CPU 0 forwards the PIT's ticks to the others, so IRQ 0 stays there.
+ */
+bool IrqSetAffinity(uint8_t irq, uint32_t cpu)
+{
+    if (!apicMode || irq >= IRQ_LINES || irq == IRQ0 || !SmpIsCpuOnline(cpu)) {
+        return false;
+    }
+
+    IoapicSetDestination(irq, SmpGetApicId(cpu));
+    return true;
 }
 
 /*
  * IrqRegisterHandler - Register a handler for an IRQ
  */
-void IrqRegisterHandler(uint8_t irq, IrqHandlerFunc handler)
+bool IrqRegisterHandler(uint8_t irq, IrqHandlerFunc handler)
 {
-    if (irq < 16) {
+    if (!lineExists(irq)) {
+        return false;
+    }
+
+    SpinlockAcquire(&registerLock);
+    bool available = !lineHasOwnHandler(irq) && !irqChains[irq];
+    if (available) {
         irqHandlers[irq] = handler;
     }
+    SpinlockRelease(&registerLock);
+    return available;
 }
 
 /*
@@ -74,42 +247,348 @@ void IrqRegisterHandler(uint8_t irq, IrqHandlerFunc handler)
  */
 void IrqUnregisterHandler(uint8_t irq)
 {
-    if (irq < 16) {
+    if (irq < IRQ_LINES) {
+        SpinlockAcquire(&registerLock);
         irqHandlers[irq] = NULL;
+        irqHandlerRegs[irq] = NULL;
+        irqThreads[irq].handler = NULL;
+        SpinlockRelease(&registerLock);
     }
 }
 
 /*
  * IrqRegisterHandlerWithRegs - Register a handler that receives register state
  */
-void IrqRegisterHandlerWithRegs(uint8_t irq, IrqHandlerRegFunc handler)
+bool IrqRegisterHandlerWithRegs(uint8_t irq, IrqHandlerRegFunc handler)
 {
-    if (irq < 16) {
+    if (!lineExists(irq)) {
+        return false;
+    }
+
+    SpinlockAcquire(&registerLock);
+    bool available = !lineHasOwnHandler(irq) && !irqChains[irq];
+    if (available) {
         irqHandlerRegs[irq] = handler;
-        irqHandlers[irq] = NULL;  /* Clear simple handler if any */
     }
+    SpinlockRelease(&registerLock);
+    return available;
+}
+
+/*
+ * IrqRegisterThreadedHandler - Run an IRQ's handler in its own kernel process
+ *
+ * The process is created outside registerLock, since creating it
+ * allocates; if two first registrations race, the lock picks one process
+ * and the other just idles.
+ */
+Process* IrqRegisterThreadedHandler(uint8_t irq, IrqHandlerFunc handler, uint32_t priority)
+{
+    if (!lineExists(irq) || !handler) {
+        return NULL;
+    }
+
+    IrqThread* thread = &irqThreads[irq];
+    if (!thread->process) {
+        char name[8];
+        ClcSPrintf(name, "irq/%u", irq);
+        Process* process = ProcessCreateWithData(name, irqThreadMain, priority, thread);
+        if (!process) {
+            return NULL;
+        }
+        SpinlockAcquire(&registerLock);
+        if (!thread->process) {
+            thread->process = process;
+        }
+        SpinlockRelease(&registerLock);
+    }
+
+    SpinlockAcquire(&registerLock);
+    bool available = !lineHasOwnHandler(irq) && !irqChains[irq];
+    if (available) {
+        thread->handler = handler;
+    }
+    SpinlockRelease(&registerLock);
+    return available ? thread->process : NULL;
+}
+
+/*
+ * IrqActionSetup - Prepare a shared handler for IrqAddSharedHandler()
+ */
+void IrqActionSetup(IrqAction* action, const char* name, IrqSharedFunc handler, void* cookie)
+{
+    action->next = NULL;
+    action->name = name;
+    action->handler = handler;
+    action->cookie = cookie;
+    action->calls = 0;
+    action->handled = 0;
+    action->cycles = 0;
+}
+
+/*
+ * IrqAddSharedHandler - Add a handler to a line's chain
+ *
+ * The action is complete before it is linked in, so a walk running on
+ * another CPU sees either the old tail or the whole new action.
+ */
+bool IrqAddSharedHandler(uint8_t irq, IrqAction* action)
+{
+    if (!lineExists(irq) || !action->handler) {
+        return false;
+    }
+
+    SpinlockAcquire(&registerLock);
+    bool allowed = !lineHasOwnHandler(irq);
+    if (allowed) {
+        bool first = irqChains[irq] == NULL;
+        IrqAction** link = &irqChains[irq];
+        while (*link) {
+            link = &(*link)->next;
+        }
+        action->next = NULL;
+        RCU_ASSIGN_POINTER(*link, action);
+        if (first) {
+            IrqUnmask(irq);
+        }
+    }
+    SpinlockRelease(&registerLock);
+    return allowed;
+}
+
+/*
+ * IrqRemoveSharedHandler - Take a handler off a line's chain
+ *
+ * The action's next pointer is left alone, so a walk that has just
+ * reached it carries on down the chain; the grace period waits for such
+ * walks to finish.
+ */
+IrqAction* IrqRemoveSharedHandler(uint8_t irq, void* cookie)
+{
+    if (irq >= IRQ_LINES) {
+        return NULL;
+    }
+
+    SpinlockAcquire(&registerLock);
+    IrqAction* action = NULL;
+    for (IrqAction** link = &irqChains[irq]; *link; link = &(*link)->next) {
+        if ((*link)->cookie == cookie) {
+            action = *link;
+            RCU_ASSIGN_POINTER(*link, action->next);
+            break;
+        }
+    }
+    if (action && !irqChains[irq]) {
+        IrqMask(irq);
+    }
+    SpinlockRelease(&registerLock);
+
+    if (action) {
+        RcuSynchronize();
+    }
+    return action;
+}
+
+/*
+ * IrqStatDump - Print interrupt statistics to the serial console
+ */
+void IrqStatDump(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    bool timed = TscGetKhz() != 0;
+
+    ClcPrintfWriter(serial, "\n=== IRQ Statistics ===\n");
+    ClcPrintfWriter(serial, "Delivered through the %s (times in ns%s)\n",
+                    apicMode ? "I/O APIC" : "8259 PIC", timed ? "" : ", unavailable without a TSC");
+
+    SpinlockAcquire(&registerLock);
+    for (uint8_t irq = 0; irq < IRQ_LINES; irq++) {
+        uint64_t count = irqCount[irq];
+        if (count == 0 && !lineHasOwnHandler(irq) && !irqChains[irq]) {
+            continue;
+        }
+
+        ClcPrintfWriter(serial, "  IRQ %u: %u interrupts", irq, (uint32_t)count);
+        if (irqUnhandled[irq] > 0) {
+            ClcPrintfWriter(serial, ", %u unhandled", (uint32_t)irqUnhandled[irq]);
+        }
+        if (lineHasOwnHandler(irq) && count > 0) {
+            ClcPrintfWriter(serial, ", %s handler avg %u",
+                            irqThreads[irq].handler ? "threaded" : "own",
+                            cyclesToNs(ClcDivU64(irqCycles[irq], (uint32_t)count, NULL)));
+        }
+        ClcPrintfWriter(serial, "\n");
+
+        for (IrqAction* action = irqChains[irq]; action; action = action->next) {
+            uint32_t calls = (uint32_t)action->calls;
+            ClcPrintfWriter(serial, "    %s: %u calls, %u handled, avg %u\n",
+                            action->name, calls, (uint32_t)action->handled,
+                            calls ? cyclesToNs(ClcDivU64(action->cycles, calls, NULL)) : 0);
+        }
+    }
+    SpinlockRelease(&registerLock);
+
+    ClcPrintfWriter(serial, "Spurious: %u at the PIC, %u at the local APICs\n",
+                    PicGetSpuriousCount(), LapicGetSpuriousCount());
+}
+
+/*
+ * IrqGetRaisedAt - TSC when the latest interrupt on a line reached irqHandler()
+ */
+uint64_t IrqGetRaisedAt(uint8_t irq)
+{
+    return irq < IRQ_LINES ? irqRaisedAt[irq] : 0;
+}
+
+/*
+ * IrqSetExitHook - Set the hook run at the end of every IRQ
+ */
+void IrqSetExitHook(IrqExitFunc hook)
+{
+    exitHook = hook;
 }
 
 /*
  * irqHandler - Common C IRQ handler
  *
- * Called from assembly stub. Dispatches to registered handler
- * and sends EOI to PIC.
+ * Called from assembly stub. Dispatches to registered handler,
+ * sends EOI to the interrupt controller, runs pending softirqs, then runs
+ * the exit hook.
  */
 void irqHandler(registers_t* regs)
 {
-    /* Convert interrupt number to IRQ number (32-47 -> 0-15) */
-    uint8_t irq = (uint8_t)(regs->intNo - 32);
+    /* Convert interrupt number to IRQ number (32-55 -> 0-23) */
+    uint8_t irq = (uint8_t)(regs->intNo - IRQ_VECTOR_BASE);
+
+    /* A PIC glitch on its lowest-priority line: no handler, no EOI */
+    if (!apicMode && (irq == IRQ7 || irq == IRQ15) && PicIsSpurious(irq)) {
+        return;
+    }
 
-    /* Call registered handler (with or without regs) */
-    if (irq < 16) {
-        if (irqHandlerRegs[irq] != NULL) {
+    /* Call registered handler (with or without regs), or the shared chain */
+    if (irq < IRQ_LINES) {
+        bool timed = TscGetKhz() != 0;
+        uint64_t start = timed ? TscRead() : 0;
+        irqRaisedAt[irq] = start;
+        irqCount[irq]++;
+
+        if (irqThreads[irq].handler != NULL) {
+            /* Threaded: keep the line quiet until the handler has run */
+            IrqMask(irq);
+            SemaphoreUp(&irqThreads[irq].wake);
+        } else if (irqHandlerRegs[irq] != NULL) {
             irqHandlerRegs[irq](regs);
+            if (timed) {
+                irqCycles[irq] += TscRead() - start;
+            }
         } else if (irqHandlers[irq] != NULL) {
             irqHandlers[irq]();
+            if (timed) {
+                irqCycles[irq] += TscRead() - start;
+            }
+        } else if (!runChain(irq, timed)) {
+            irqUnhandled[irq]++;
         }
     }
 
-    /* Send End-Of-Interrupt to PIC */
-    PicSendEoi(irq);
+    /* Send End-Of-Interrupt to the PIC or the local APIC */
+    IrqSendEoi(irq);
+
+    /* Deferred work the handler raised, with interrupts back on */
+    SoftirqRunPending();
+
+    /* May switch to another process; we return here when switched back */
+    if (exitHook) {
+        exitHook();
+    }
+}
+
+/*
+ * irqThreadMain - Process running one line's threaded handler
+ *
+ * Each wakeup is one interrupt, taken with the line masked; unmasking it
+ * once the handler is done lets the next one in. The line was unmasked
+ * before the interrupt, so it is unmasked again even if the handler was
+ * unregistered in between.
+ */
+static void irqThreadMain(void)
+{
+    IrqThread* thread = (IrqThread*)ProcessGetData();
+
+    while (1) {
+        SemaphoreDown(&thread->wake);
+
+        IrqHandlerFunc handler = thread->handler;
+        if (handler) {
+            uint64_t start = TscGetKhz() != 0 ? TscRead() : 0;
+            handler();
+            if (start) {
+                irqCycles[thread->irq] += TscRead() - start;
+            }
+        }
+        IrqUnmask(thread->irq);
+    }
+}
+
+/*
+ * runChain - Offer an interrupt to every shared handler on its line
+ *
+ * Every handler is called, even after one has claimed the interrupt: on
+ * a shared line several devices may be asserting it at once. Each
+ * action's statistics are only written by the CPU the line is delivered
+ * to, with interrupts off.
+ *
+ * Returns: true if any handler claimed it
+ */
+static bool runChain(uint8_t irq, bool timed)
+{
+    bool handled = false;
+
+    RcuReadLock();
+    for (IrqAction* action = RCU_DEREFERENCE(irqChains[irq]); action;
+         action = RCU_DEREFERENCE(action->next)) {
+        uint64_t start = timed ? TscRead() : 0;
+        IrqReturn ret = action->handler(action->cookie);
+        if (timed) {
+            action->cycles += TscRead() - start;
+        }
+
+        action->calls++;
+        if (ret == IRQ_HANDLED) {
+            action->handled++;
+            handled = true;
+        }
+    }
+    RcuReadUnlock();
+
+    return handled;
+}
+
+/*
+ * lineExists - Check whether the interrupt controller in use has a line
+ *
+ * The 8259 pair only has the ISA lines, so handlers for lines 16 and up
+ * can only be registered once IrqInitializeApic() has succeeded.
+ */
+static bool lineExists(uint8_t irq)
+{
+    return irq < (apicMode ? IRQ_LINES : IRQ_PIC_LINES);
+}
+
+/*
+ * lineHasOwnHandler - Check whether a line has a handler other than a chain
+ *
+ * Called with registerLock held.
+ */
+static bool lineHasOwnHandler(uint8_t irq)
+{
+    return irqHandlers[irq] || irqHandlerRegs[irq] || irqThreads[irq].handler;
+}
+
+/*
+ * cyclesToNs - Convert TSC cycles to nanoseconds, 0 without a TSC
+ */
+static uint32_t cyclesToNs(uint64_t cycles)
+{
+    uint32_t khz = TscGetKhz();
+    return khz ? (uint32_t)ClcDivU64(cycles * 1000000, khz, NULL) : 0;
 }
@@ -15,7 +15,8 @@ irq\num:
     jmp irqCommonStub
 .endm
 
-/* Define all 16 IRQ handlers (IRQ 0-15 map to interrupts 32-47) */
+/* Define all 24 IRQ handlers (IRQ 0-23 map to interrupts 32-55; 16-23
+   only exist on the I/O APIC) */
 IRQ 0, 32
 IRQ 1, 33
 IRQ 2, 34
@@ -32,21 +33,32 @@ IRQ 12, 44
 IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
+IRQ 16, 48
+IRQ 17, 49
+IRQ 18, 50
+IRQ 19, 51
+IRQ 20, 52
+IRQ 21, 53
+IRQ 22, 54
+IRQ 23, 55
 
 /* Common IRQ stub - saves state and calls C handler */
 irqCommonStub:
     /* Save all registers (pusha order: eax, ecx, edx, ebx, esp, ebp, esi, edi) */
     pusha
 
-    /* Save data segment */
-    mov %ds, %ax
-    push %eax
+    /* Save segment registers */
+    push %ds
+    push %es
+    push %fs
+    push %gs
 
-    /* Load kernel data segment */
+    /* Load kernel data segment, and GS for this CPU's per-CPU area */
     mov $0x10, %ax
     mov %ax, %ds
     mov %ax, %es
     mov %ax, %fs
+    mov $0x30, %ax
     mov %ax, %gs
 
     /* Call C handler (registers_t* on stack) */
@@ -54,12 +66,11 @@ irqCommonStub:
     call irqHandler
     add $4, %esp
 
-    /* Restore data segment */
-    pop %eax
-    mov %ax, %ds
-    mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
+    /* Restore segment registers */
+    pop %gs
+    pop %fs
+    pop %es
+    pop %ds
 
     /* Restore registers */
     popa
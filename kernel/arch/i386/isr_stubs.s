@@ -55,20 +55,30 @@ ISR_NOERRCODE 29    /* Reserved */
 ISR_NOERRCODE 30    /* Reserved */
 ISR_NOERRCODE 31    /* Reserved */
 
+/* Inter-processor interrupts (see smp.h) */
+ISR_NOERRCODE 240   /* Timer tick */
+ISR_NOERRCODE 241   /* Timer sub-tick */
+ISR_NOERRCODE 242   /* Reschedule */
+ISR_NOERRCODE 243   /* Stop */
+ISR_NOERRCODE 255   /* Local APIC spurious */
+
 /* Common ISR stub - saves state and calls C handler */
 isr_common_stub:
     /* Save all registers */
     pusha
 
-    /* Save data segment */
-    mov %ds, %ax
-    push %eax
+    /* Save segment registers */
+    push %ds
+    push %es
+    push %fs
+    push %gs
 
-    /* Load kernel data segment */
+    /* Load kernel data segment, and GS for this CPU's per-CPU area */
     mov $0x10, %ax
     mov %ax, %ds
     mov %ax, %es
     mov %ax, %fs
+    mov $0x30, %ax
     mov %ax, %gs
 
     /* Call C handler (registers_t* on stack) */
@@ -76,12 +86,11 @@ isr_common_stub:
     call isrHandler
     add $4, %esp
 
-    /* Restore data segment */
-    pop %eax
-    mov %ax, %ds
-    mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
+    /* Restore segment registers */
+    pop %gs
+    pop %fs
+    pop %es
+    pop %ds
 
     /* Restore registers */
     popa
@@ -0,0 +1,270 @@
+/* lapic.c - Local APIC */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "lapic.h"
+#include "smp.h"
+#include "idt.h"
+#include "isr.h"
+#include "gdt.h"
+#include "paging.h"
+#include "tsc.h"
+#include "x86.h"
+
+/* Register offsets */
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080   /* Task priority */
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0   /* Spurious interrupt vector */
+#define LAPIC_ESR       0x280   /* Error status */
+#define LAPIC_ICR_LOW   0x300   /* Interrupt command */
+#define LAPIC_ICR_HIGH  0x310
+#define LAPIC_LVT_LINT0 0x350   /* Where the 8259 comes in (virtual wire) */
+
+/* LVT bits */
+#define LAPIC_LVT_MASKED (1u << 16)
+
+/* SVR bits */
+#define LAPIC_SVR_ENABLE 0x100
+
+/* ICR bits */
+#define ICR_FIXED        0x00000
+#define ICR_INIT         0x00500
+#define ICR_STARTUP      0x00600
+#define ICR_PENDING      0x01000    /* Delivery status: still being sent */
+#define ICR_ASSERT       0x04000
+#define ICR_LEVEL        0x08000
+#define ICR_ALL_OTHERS   0xC0000    /* Destination shorthand */
+
+/* IA32_APIC_BASE MSR */
+#define MSR_APIC_BASE        0x1B
+#define MSR_APIC_BASE_ENABLE (1u << 11)
+#define MSR_APIC_BASE_MASK   0xFFFFF000u
+
+/* CPUID leaf 1 EDX feature bit */
+#define CPUID_FEATURE_APIC (1u << 9)
+
+/* State */
+static volatile uint32_t* lapicBase = NULL;
+static volatile uint32_t spuriousCount = 0;
+
+/*
+ * lapicRead - Read a local APIC register
+ */
+static inline uint32_t lapicRead(uint32_t reg)
+{
+    return lapicBase[reg / 4];
+}
+
+/*
+ * lapicWrite - Write a local APIC register
+ */
+static inline void lapicWrite(uint32_t reg, uint32_t value)
+{
+    lapicBase[reg / 4] = value;
+}
+
+/*
+ * waitIcrIdle - Wait until the previous IPI has been accepted
+ */
+static void waitIcrIdle(void)
+{
+    while (lapicRead(LAPIC_ICR_LOW) & ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/*
+ * sendIcr - Issue an interrupt command
+ *
+ * Interrupt handlers send IPIs too (the PIT tick is forwarded to the
+ * other CPUs), so one landing between the two writes would leave its own
+ * destination in ICR_HIGH for this command.
+ */
+static void sendIcr(uint8_t apicId, uint32_t command)
+{
+    uint32_t flags = irq_save();
+    waitIcrIdle();
+    lapicWrite(LAPIC_ICR_HIGH, (uint32_t)apicId << 24);
+    lapicWrite(LAPIC_ICR_LOW, command);
+    irq_restore(flags);
+}
+
+/*
+ * delayUs - Busy-wait for at least a number of microseconds
+ */
+static void delayUs(uint32_t us)
+{
+    uint64_t start = TscGetNanoseconds();
+    while (TscGetNanoseconds() - start < (uint64_t)us * 1000) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/*
+ * spuriousInterrupt - Interrupt withdrawn before it was delivered
+ *
+ * Nothing is in service, so it must not be acknowledged.
+ */
+static void spuriousInterrupt(registers_t* regs)
+{
+    (void)regs;
+
+    __atomic_add_fetch(&spuriousCount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * enableLocal - Software-enable the calling CPU's local APIC
+ */
+static void enableLocal(void)
+{
+    lapicWrite(LAPIC_TPR, 0);
+    lapicWrite(LAPIC_SVR, LAPIC_SVR_ENABLE | SMP_VECTOR_SPURIOUS);
+}
+
+/*
+ * LapicInitialize - Map and enable the boot CPU's local APIC
+ */
+bool LapicInitialize(uintptr_t physBase)
+{
+    if (lapicBase) {
+        return true;
+    }
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_FEATURE_APIC)) {
+        return false;
+    }
+
+    // Globally enable it (firmware normally has) and find it if not told
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(MSR_APIC_BASE));
+    if (!(low & MSR_APIC_BASE_ENABLE)) {
+        low |= MSR_APIC_BASE_ENABLE;
+        __asm__ volatile ("wrmsr" : : "a"(low), "d"(high), "c"(MSR_APIC_BASE));
+    }
+    if (physBase == 0) {
+        physBase = low & MSR_APIC_BASE_MASK;
+    }
+
+    if (!PagingMapPage(physBase, physBase, PAGE_PRESENT | PAGE_WRITE | PAGE_NOCACHE)) {
+        return false;
+    }
+    lapicBase = (volatile uint32_t*)physBase;
+
+    // The IDT is shared, so this covers the APs too
+    IdtSetGate(SMP_VECTOR_SPURIOUS, (uint32_t)isr255, GDT_KERNEL_CODE_SELECTOR,
+               IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_GATE_32);
+    IsrRegisterHandler(SMP_VECTOR_SPURIOUS, spuriousInterrupt);
+
+    enableLocal();
+    return true;
+}
+
+/*
+ * LapicInitializeCpu - Enable the local APIC of an application processor
+ */
+void LapicInitializeCpu(void)
+{
+    enableLocal();
+
+    // Clear anything latched while the AP was starting
+    lapicWrite(LAPIC_ESR, 0);
+    lapicWrite(LAPIC_ESR, 0);
+    lapicWrite(LAPIC_EOI, 0);
+}
+
+/*
+ * LapicMaskLint0 - Stop 8259 interrupts reaching this CPU
+ */
+void LapicMaskLint0(void)
+{
+    lapicWrite(LAPIC_LVT_LINT0, lapicRead(LAPIC_LVT_LINT0) | LAPIC_LVT_MASKED);
+}
+
+/*
+ * LapicIsEnabled - Check whether LapicInitialize() succeeded
+ */
+bool LapicIsEnabled(void)
+{
+    return lapicBase != NULL;
+}
+
+/*
+ * LapicGetId - APIC ID of the calling CPU
+ */
+uint8_t LapicGetId(void)
+{
+    return (uint8_t)(lapicRead(LAPIC_ID) >> 24);
+}
+
+/*
+ * LapicGetSpuriousCount - Spurious interrupts seen since boot, all CPUs
+ */
+uint32_t LapicGetSpuriousCount(void)
+{
+    return spuriousCount;
+}
+
+/*
+ * LapicSendEoi - Acknowledge the interrupt being handled
+ */
+void LapicSendEoi(void)
+{
+    lapicWrite(LAPIC_EOI, 0);
+}
+
+/*
+ * LapicSendIpi - Send a fixed interrupt to one CPU
+ */
+void LapicSendIpi(uint8_t apicId, uint8_t vector)
+{
+    sendIcr(apicId, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+/*
+ * LapicSendIpiAllOthers - Send a fixed interrupt to every other CPU
+ */
+void LapicSendIpiAllOthers(uint8_t vector)
+{
+    sendIcr(0, ICR_ALL_OTHERS | ICR_FIXED | ICR_ASSERT | vector);
+}
+
+/*
+ * LapicStartAp - Start an application processor with INIT-SIPI-SIPI
+ *
+ * The timings are the ones in the Intel MP specification: 10 ms after
+ * INIT, then two STARTUPs 200 us apart (the second is ignored by CPUs
+ * that took the first).
+ */
+void LapicStartAp(uint8_t apicId, uint8_t startPage)
+{
+    lapicWrite(LAPIC_ESR, 0);
+
+    sendIcr(apicId, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    delayUs(200);
+    sendIcr(apicId, ICR_INIT | ICR_LEVEL);
+    delayUs(10000);
+
+    for (int i = 0; i < 2; i++) {
+        sendIcr(apicId, ICR_STARTUP | startPage);
+        delayUs(200);
+    }
+    waitIcrIdle();
+}
+
+/*
+ * LapicStopAp - Put an application processor back to waiting for a STARTUP
+ *
+ * INIT resets the AP wherever it is, so it runs nothing more until it is
+ * started again.
+ */
+void LapicStopAp(uint8_t apicId)
+{
+    sendIcr(apicId, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    delayUs(200);
+    sendIcr(apicId, ICR_INIT | ICR_LEVEL);
+    waitIcrIdle();
+}
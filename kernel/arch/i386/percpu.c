@@ -0,0 +1,49 @@
+/* percpu.c - Per-CPU data area addressed through GS */
+
+#include "percpu.h"
+
+/* One area per CPU, each on its own cache lines */
+static PerCpu perCpuAreas[SMP_MAX_CPUS];
+
+/*
+ * PerCpuSetup - Initialize a CPU's area
+ */
+PerCpu* PerCpuSetup(uint32_t cpu)
+{
+    PerCpu* area = &perCpuAreas[cpu];
+    area->self = area;
+    area->cpu = cpu;
+    return area;
+}
+
+/*
+ * PerCpuGetArea - Any CPU's area
+ */
+PerCpu* PerCpuGetArea(uint32_t cpu)
+{
+    return &perCpuAreas[cpu];
+}
+
+/*
+ * PerCpuCounterAdd - Add to the running CPU's delta of a counter
+ *
+ * Like perCpuAdd(), but the offset is only known at run time. One
+ * instruction, so the process cannot move to another CPU halfway.
+ */
+void PerCpuCounterAdd(PerCpuCounter counter, int32_t delta)
+{
+    uint32_t offset = offsetof(PerCpu, counters) + counter * sizeof(int32_t);
+    __asm__ volatile ("addl %0, %%gs:(%1)" : : "ri"(delta), "r"(offset) : "memory", "cc");
+}
+
+/*
+ * PerCpuCounterSum - Total of a counter over all CPUs
+ */
+int64_t PerCpuCounterSum(PerCpuCounter counter)
+{
+    int64_t sum = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        sum += __atomic_load_n(&perCpuAreas[cpu].counters[counter], __ATOMIC_RELAXED);
+    }
+    return sum;
+}
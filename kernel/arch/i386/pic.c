@@ -1,7 +1,9 @@
 /* pic.c - 8259 Programmable Interrupt Controller */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "pic.h"
+#include "spinlock.h"
 #include "x86.h"
 
 /* PIC I/O ports */
@@ -12,6 +14,7 @@
 
 /* PIC commands */
 #define PIC_EOI         0x20    /* End-of-interrupt command */
+#define PIC_READ_ISR    0x0B    /* OCW3: next command port read is the ISR */
 
 /* Initialization Command Words (ICW) */
 #define ICW1_ICW4       0x01    /* ICW4 needed */
@@ -26,6 +29,19 @@
 #define ICW4_BUF_MASTER 0x0C    /* Buffered mode/master */
 #define ICW4_SFNM       0x10    /* Special fully nested mode */
 
+/* IRQ line the slave PIC is cascaded through */
+#define PIC_CASCADE_IRQ 2
+
+/* Lowest-priority line of each PIC, which spurious interrupts arrive on */
+#define PIC_SPURIOUS_MASTER 7
+#define PIC_SPURIOUS_SLAVE  15
+
+/* Mask updates are read-modify-write and come from any CPU (threaded IRQs) */
+static Spinlock maskLock = SPINLOCK_INIT;
+
+/* Spurious IRQ 7s and 15s seen */
+static volatile uint32_t spuriousCount = 0;
+
 /*
  * PicInitialize - Initialize the 8259 PIC
  */
@@ -97,17 +113,22 @@ void PicSetMask(uint8_t irq)
         irq -= 8;
     }
 
+    uint32_t flags = SpinlockAcquireIrqSave(&maskLock);
     value = inb(port) | (1 << irq);
     outb(port, value);
+    SpinlockReleaseIrqRestore(&maskLock, flags);
 }
 
 /*
  * PicClearMask - Enable an IRQ line
+ *
+ * A slave line also opens the cascade line on the master.
  */
 void PicClearMask(uint8_t irq)
 {
     uint16_t port;
     uint8_t value;
+    bool slave = irq >= 8;
 
     if (irq < 8) {
         port = PIC1_DATA;
@@ -116,6 +137,70 @@ void PicClearMask(uint8_t irq)
         irq -= 8;
     }
 
+    uint32_t flags = SpinlockAcquireIrqSave(&maskLock);
     value = inb(port) & ~(1 << irq);
     outb(port, value);
+    if (slave) {
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << PIC_CASCADE_IRQ));
+    }
+    SpinlockReleaseIrqRestore(&maskLock, flags);
+}
+
+/*
+ * PicGetMask - Read both mask registers
+ */
+uint16_t PicGetMask(void)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&maskLock);
+    uint16_t mask = (uint16_t)(inb(PIC1_DATA) | (inb(PIC2_DATA) << 8));
+    SpinlockReleaseIrqRestore(&maskLock, flags);
+    return mask;
+}
+
+/*
+ * PicDisable - Mask every line for good
+ */
+void PicDisable(void)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&maskLock);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    SpinlockReleaseIrqRestore(&maskLock, flags);
+}
+
+/*
+ * PicIsSpurious - Check whether an IRQ 7 or 15 was really raised
+ *
+ * When a request goes away between the PIC signalling the CPU and the
+ * CPU acknowledging it, the PIC answers with its lowest-priority line
+ * without setting that line's in-service bit. Such an interrupt must not
+ * get an EOI, which would end some other interrupt in service, except at
+ * the master for a slave spurious interrupt: the master did take the
+ * cascade line in service.
+ */
+bool PicIsSpurious(uint8_t irq)
+{
+    if (irq != PIC_SPURIOUS_MASTER && irq != PIC_SPURIOUS_SLAVE) {
+        return false;
+    }
+
+    uint16_t port = irq == PIC_SPURIOUS_MASTER ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, PIC_READ_ISR);
+    if (inb(port) & (1 << (irq & 7))) {
+        return false;
+    }
+
+    if (irq == PIC_SPURIOUS_SLAVE) {
+        outb(PIC1_COMMAND, PIC_EOI);
+    }
+    __atomic_add_fetch(&spuriousCount, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+ * PicGetSpuriousCount - Spurious IRQ 7s and 15s seen since boot
+ */
+uint32_t PicGetSpuriousCount(void)
+{
+    return spuriousCount;
 }
@@ -5,7 +5,7 @@
 #include "pit.h"
 #include "irq.h"
 #include "isr.h"
-#include "pic.h"
+#include "softirq.h"
 #include "x86.h"
 
 /* PIT I/O ports */
@@ -14,21 +14,54 @@
 #define PIT_CHANNEL2    0x42    /* Channel 2 data port (R/W) */
 #define PIT_COMMAND     0x43    /* Mode/Command register (W) */
 
-/* PIT frequency (1.193182 MHz) */
-#define PIT_BASE_FREQ   1193182
-
 /* Timer state */
 static volatile uint64_t timerTicks = 0;
 static uint32_t timerFrequency = 0;
+static uint32_t tickDivisor = 0;        // Channel 0 divisor for one tick
 static PitTickHandler tickHandler = NULL;
 
+/* Sub-tick state: the hardware fires subTicks times per tick */
+static uint32_t subTicks = 1;
+static uint32_t subTickCount = 0;
+static PitTickHandler subTickHandler = NULL;
+
+/*
+ * programChannel0 - Load a divisor into channel 0 (square wave mode)
+ */
+static void programChannel0(uint32_t divisor)
+{
+    /* Send command byte:
+     * Bits 6-7: Channel 0
+     * Bits 4-5: Access mode (lobyte/hibyte)
+     * Bits 1-3: Mode 3 (square wave generator)
+     * Bit 0:    Binary mode (not BCD)
+     */
+    outb(PIT_COMMAND, 0x36);
+
+    /* Send frequency divisor (low byte, then high byte) */
+    outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
+    outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
+}
+
 /*
  * pitIrqHandler - Timer interrupt handler (with register state)
  */
 static void pitIrqHandler(registers_t* regs)
 {
+    /* Interrupts between tick boundaries only go to the sub-tick handler */
+    if (subTicks > 1 && ++subTickCount < subTicks) {
+        if (subTickHandler) {
+            subTickHandler(regs);
+        }
+        return;
+    }
+    subTickCount = 0;
+
     timerTicks++;
 
+    /* Timers expire in the softirq, once this interrupt is acknowledged */
+    SoftirqRaise(SOFTIRQ_TIMER);
+
     /* Call registered tick handler if present */
     if (tickHandler) {
         tickHandler(regs);
@@ -53,24 +86,17 @@ void PitInitialize(uint32_t frequency)
 
     /* Store actual frequency */
     timerFrequency = PIT_BASE_FREQ / divisor;
+    tickDivisor = divisor;
+    subTicks = 1;
+    subTickCount = 0;
 
-    /* Send command byte:
-     * Bits 6-7: Channel 0
-     * Bits 4-5: Access mode (lobyte/hibyte)
-     * Bits 1-3: Mode 3 (square wave generator)
-     * Bit 0:    Binary mode (not BCD)
-     */
-    outb(PIT_COMMAND, 0x36);
-
-    /* Send frequency divisor (low byte, then high byte) */
-    outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
-    outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
+    programChannel0(divisor);
 
     /* Register IRQ handler for IRQ0 (timer) with register state */
     IrqRegisterHandlerWithRegs(IRQ0, pitIrqHandler);
 
-    /* Enable IRQ0 (unmask it in PIC) */
-    PicClearMask(IRQ0);
+    /* Enable IRQ0 at the interrupt controller */
+    IrqUnmask(IRQ0);
 }
 
 /*
@@ -81,6 +107,34 @@ void PitRegisterTickHandler(PitTickHandler handler)
     tickHandler = handler;
 }
 
+/*
+ * PitSetSubTicks - Split each tick into several timer interrupts
+ */
+void PitSetSubTicks(uint32_t count)
+{
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > tickDivisor) {
+        count = tickDivisor;
+    }
+    if (count == subTicks) {
+        return;
+    }
+
+    subTicks = count;
+    subTickCount = 0;
+    programChannel0(tickDivisor / count);
+}
+
+/*
+ * PitRegisterSubTickHandler - Register a handler for sub-tick interrupts
+ */
+void PitRegisterSubTickHandler(PitTickHandler handler)
+{
+    subTickHandler = handler;
+}
+
 /*
  * PitGetTicks - Get the number of timer ticks since boot
  */
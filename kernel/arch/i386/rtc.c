@@ -0,0 +1,98 @@
+/* rtc.c - CMOS real-time clock periodic interrupt */
+
+#include <stdint.h>
+#include "rtc.h"
+#include "spinlock.h"
+#include "x86.h"
+
+/* CMOS I/O ports; bit 7 of the index keeps NMIs off while it is selected */
+#define CMOS_INDEX      0x70
+#define CMOS_DATA       0x71
+#define CMOS_NMI_OFF    0x80
+
+/* RTC status registers */
+#define RTC_REG_A       0x0A    /* Divider and rate selection */
+#define RTC_REG_B       0x0B    /* Interrupt enables */
+#define RTC_REG_C       0x0C    /* Interrupt flags, cleared by reading */
+
+#define RTC_B_PERIODIC  0x40    /* Periodic interrupt enable */
+#define RTC_C_IRQF      0x80    /* An enabled interrupt is pending */
+#define RTC_RATE_MASK   0x0F
+
+/* Rate r gives RTC_BASE_FREQ >> (r - 1) Hz; below 3 the divider misbehaves */
+#define RTC_BASE_FREQ   32768u
+#define RTC_RATE_FASTEST 3
+#define RTC_RATE_SLOWEST 15
+
+/* Index and data writes must stay paired */
+static Spinlock cmosLock = SPINLOCK_INIT;
+
+/*
+ * cmosRead - Read a CMOS register (cmosLock held)
+ */
+static uint8_t cmosRead(uint8_t reg)
+{
+    outb(CMOS_INDEX, CMOS_NMI_OFF | reg);
+    return inb(CMOS_DATA);
+}
+
+/*
+ * cmosWrite - Write a CMOS register (cmosLock held)
+ */
+static void cmosWrite(uint8_t reg, uint8_t value)
+{
+    outb(CMOS_INDEX, CMOS_NMI_OFF | reg);
+    outb(CMOS_DATA, value);
+}
+
+/*
+ * cmosUnlock - Deselect with NMIs enabled again, and release cmosLock
+ */
+static void cmosUnlock(uint32_t flags)
+{
+    outb(CMOS_INDEX, RTC_REG_C);
+    SpinlockReleaseIrqRestore(&cmosLock, flags);
+}
+
+/*
+ * RtcStartPeriodic - Have the RTC raise IRQ 8 at a fixed rate
+ */
+uint32_t RtcStartPeriodic(uint32_t frequency)
+{
+    uint32_t rate = RTC_RATE_SLOWEST;
+    while (rate > RTC_RATE_FASTEST && (RTC_BASE_FREQ >> (rate - 1)) < frequency) {
+        rate--;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&cmosLock);
+    cmosWrite(RTC_REG_A, (uint8_t)((cmosRead(RTC_REG_A) & ~RTC_RATE_MASK) | rate));
+    cmosWrite(RTC_REG_B, cmosRead(RTC_REG_B) | RTC_B_PERIODIC);
+
+    // A flag left set from before would hold off the first interrupt
+    cmosRead(RTC_REG_C);
+    cmosUnlock(flags);
+
+    return RTC_BASE_FREQ >> (rate - 1);
+}
+
+/*
+ * RtcStopPeriodic - Stop the periodic interrupt
+ */
+void RtcStopPeriodic(void)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&cmosLock);
+    cmosWrite(RTC_REG_B, cmosRead(RTC_REG_B) & ~RTC_B_PERIODIC);
+    cmosRead(RTC_REG_C);
+    cmosUnlock(flags);
+}
+
+/*
+ * RtcAcknowledge - Acknowledge an RTC interrupt
+ */
+bool RtcAcknowledge(void)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&cmosLock);
+    uint8_t status = cmosRead(RTC_REG_C);
+    cmosUnlock(flags);
+    return (status & RTC_C_IRQF) != 0;
+}
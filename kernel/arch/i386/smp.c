@@ -0,0 +1,510 @@
+/* smp.c - Multiprocessor bring-up and inter-processor interrupts */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "smp.h"
+#include "percpu.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "isr.h"
+#include "fpu.h"
+#include "tsc.h"
+#include "paging.h"
+#include "process.h"
+#include "softirq.h"
+#include "kheap.h"
+#include "kcmdline.h"
+#include "x86.h"
+#include "clc/printf.h"
+#include "econ_writer.h"
+
+/* Where the real-mode trampoline is copied (see ap_trampoline.s) */
+#define TRAMPOLINE_BASE     0x7000
+
+/* Stack each AP runs its idle process on */
+#define AP_STACK_SIZE       8192
+
+/* How long to wait for a started AP to check in */
+#define AP_START_TIMEOUT_NS 200000000ull
+
+/* MP specification floating pointer and configuration table */
+#define MP_FLOATING_SIGNATURE   0x5F504D5F  // "_MP_"
+#define MP_CONFIG_SIGNATURE     0x504D4350  // "PCMP"
+#define MP_ENTRY_PROCESSOR      0
+#define MP_PROCESSOR_ENABLED    0x1
+
+typedef struct {
+    uint32_t signature;
+    uint32_t configTable;       // Physical address of the configuration table
+    uint8_t length;             // In 16-byte units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) MpFloatingPointer;
+
+typedef struct {
+    uint32_t signature;
+    uint16_t baseLength;
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[8];
+    char productId[12];
+    uint32_t oemTable;
+    uint16_t oemTableSize;
+    uint16_t entryCount;
+    uint32_t lapicAddress;
+    uint16_t extendedLength;
+    uint8_t extendedChecksum;
+    uint8_t reserved;
+} __attribute__((packed)) MpConfigTable;
+
+typedef struct {
+    uint8_t type;
+    uint8_t apicId;
+    uint8_t apicVersion;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) MpProcessorEntry;
+
+/* Parameter block at the end of the trampoline */
+typedef struct {
+    uint32_t pageDirectory;
+    uint32_t stackTop;
+    uint32_t entry;
+    uint32_t cpu;
+} ApTrampolineParams;
+
+/* Trampoline image (arch/i386/ap_trampoline.s) */
+extern uint8_t apTrampolineStart[];
+extern uint8_t apTrampolineParams[];
+extern uint8_t apTrampolineEnd[];
+
+/* CPUs found in the firmware tables, by APIC ID */
+static uint8_t apicIds[SMP_MAX_CPUS];
+static uint32_t cpusFound = 0;
+static uint32_t cpusSkipped = 0;        // Beyond SMP_MAX_CPUS
+static uintptr_t lapicPhysBase = 0;
+
+/* Set once the IPI handlers are installed */
+static bool smpStarted = false;
+
+/* Online CPUs */
+static volatile bool cpuOnline[SMP_MAX_CPUS];
+static uint8_t cpuApicId[SMP_MAX_CPUS];
+static volatile uint32_t cpusOnline = 1;
+
+/* startAp() and the AP it starts race for the AP's slot (see startAp()) */
+#define AP_STARTING     1
+#define AP_ARRIVED      2
+#define AP_ABANDONED    3
+static uint32_t apStart[SMP_MAX_CPUS];
+
+/* Forward declarations */
+static bool findCpusAcpi(void);
+static bool findCpusMpTable(void);
+static void addCpu(uint8_t apicId);
+static bool startAp(uint32_t cpu, uint8_t apicId);
+static void apMain(uint32_t cpu) __attribute__((noreturn));
+static void installIpiHandlers(void);
+static void tickIpi(registers_t* regs);
+static void subTickIpi(registers_t* regs);
+static void rescheduleIpi(registers_t* regs);
+static void stopIpi(registers_t* regs);
+
+/*
+ * SmpInitialize - Find the other CPUs and start them
+ */
+uint32_t SmpInitialize(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    cpuOnline[0] = true;
+    if (LapicIsEnabled()) {
+        cpuApicId[0] = LapicGetId();
+    }
+
+    if (KCmdLineHasFlag("nosmp")) {
+        ClcPrintfWriter(serial, "SMP: disabled by nosmp\n");
+        return 1;
+    }
+
+    // ACPI first; the MP table only on machines too old to have a MADT
+    const char* source = "ACPI MADT";
+    if (!findCpusAcpi()) {
+        source = "MP table";
+        if (!findCpusMpTable()) {
+            ClcPrintfWriter(serial, "SMP: no MADT or MP table, single CPU\n");
+            return 1;
+        }
+    }
+
+    if (!LapicInitialize(lapicPhysBase)) {
+        ClcPrintfWriter(serial, "SMP: no local APIC, single CPU\n");
+        return 1;
+    }
+
+    ClcPrintfWriter(serial, "SMP: %u CPUs in %s, local APIC at 0x%x\n",
+                    cpusFound + cpusSkipped, source, (uint32_t)lapicPhysBase);
+    if (cpusSkipped) {
+        ClcPrintfWriter(serial, "SMP: ignoring %u CPUs beyond %u\n", cpusSkipped, SMP_MAX_CPUS);
+    }
+
+    // The boot CPU is CPU 0 whatever its APIC ID
+    cpuApicId[0] = LapicGetId();
+
+    installIpiHandlers();
+    smpStarted = true;
+
+    // Copy the trampoline below 1 MB (reserved by the PMM, identity-mapped)
+    size_t size = (size_t)(apTrampolineEnd - apTrampolineStart);
+    uint8_t* trampoline = (uint8_t*)TRAMPOLINE_BASE;
+    for (size_t i = 0; i < size; i++) {
+        trampoline[i] = apTrampolineStart[i];
+    }
+
+    uint32_t next = 1;
+    for (uint32_t i = 0; i < cpusFound; i++) {
+        if (apicIds[i] == cpuApicId[0]) {
+            continue;
+        }
+
+        // An index is never tried twice, even if its AP did not start
+        if (!startAp(next++, apicIds[i])) {
+            ClcPrintfWriter(serial, "SMP: CPU with APIC ID %u did not start\n", apicIds[i]);
+        }
+    }
+
+    ClcPrintfWriter(serial, "SMP: %u CPUs online\n", cpusOnline);
+    return cpusOnline;
+}
+
+/*
+ * SmpGetCurrentCpu - Index of the CPU this runs on
+ */
+uint32_t SmpGetCurrentCpu(void)
+{
+    return PER_CPU_READ(cpu);
+}
+
+/*
+ * SmpGetCpuCount - Number of CPUs online
+ */
+uint32_t SmpGetCpuCount(void)
+{
+    return cpusOnline;
+}
+
+/*
+ * SmpIsCpuOnline - Check whether a CPU index is online
+ */
+bool SmpIsCpuOnline(uint32_t cpu)
+{
+    return cpu < SMP_MAX_CPUS && cpuOnline[cpu];
+}
+
+/*
+ * SmpGetApicId - Local APIC ID of an online CPU
+ */
+uint8_t SmpGetApicId(uint32_t cpu)
+{
+    return SmpIsCpuOnline(cpu) ? cpuApicId[cpu] : 0;
+}
+
+/*
+ * SmpSendIpi - Send an inter-processor interrupt to one CPU
+ */
+void SmpSendIpi(uint32_t cpu, uint8_t vector)
+{
+    if (!SmpIsCpuOnline(cpu) || cpusOnline < 2) {
+        return;
+    }
+
+    LapicSendIpi(cpuApicId[cpu], vector);
+}
+
+/*
+ * SmpForwardTick - Pass a timer tick or sub-tick on to the other CPUs
+ */
+void SmpForwardTick(bool subTick)
+{
+    if (cpusOnline < 2) {
+        return;
+    }
+
+    LapicSendIpiAllOthers(subTick ? SMP_VECTOR_SUBTICK : SMP_VECTOR_TICK);
+}
+
+/*
+ * SmpStopOthers - Halt every other CPU
+ */
+void SmpStopOthers(void)
+{
+    if (!smpStarted || cpusOnline < 2) {
+        return;
+    }
+
+    LapicSendIpiAllOthers(SMP_VECTOR_STOP);
+}
+
+/*
+ * findCpusAcpi - List the enabled local APICs in the MADT
+ */
+static bool findCpusAcpi(void)
+{
+    if (!AcpiInitialize()) {
+        return false;
+    }
+
+    const AcpiMadt* madt = (const AcpiMadt*)AcpiFindTable("APIC");
+    if (!madt) {
+        return false;
+    }
+
+    lapicPhysBase = madt->lapicAddress;
+
+    const uint8_t* entry = (const uint8_t*)madt + sizeof(AcpiMadt);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        if (entry[0] == ACPI_MADT_LAPIC) {
+            const AcpiMadtLapic* lapic = (const AcpiMadtLapic*)entry;
+            if (lapic->flags & ACPI_MADT_LAPIC_ENABLED) {
+                addCpu(lapic->apicId);
+            }
+        }
+        entry += entry[1];
+    }
+
+    return cpusFound > 0;
+}
+
+/*
+ * findMpFloating - Search a physical range (below 1 MB) for the MP floating pointer
+ */
+static const MpFloatingPointer* findMpFloating(uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t addr = start; addr + sizeof(MpFloatingPointer) <= end; addr += 16) {
+        const MpFloatingPointer* mp = (const MpFloatingPointer*)addr;
+        if (mp->signature != MP_FLOATING_SIGNATURE) {
+            continue;
+        }
+
+        uint8_t sum = 0;
+        for (size_t i = 0; i < sizeof(MpFloatingPointer); i++) {
+            sum += ((const uint8_t*)mp)[i];
+        }
+        if (sum == 0) {
+            return mp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * findCpusMpTable - List the enabled processors in the Intel MP table
+ *
+ * Only configuration tables below 1 MB (where every BIOS puts them) are
+ * read, since that is what is identity-mapped.
+ */
+static bool findCpusMpTable(void)
+{
+    uintptr_t ebda = (uintptr_t)bda_read16(0x0E) << 4;       // EBDA segment
+    uintptr_t baseTop = (uintptr_t)bda_read16(0x13) * 1024;  // Base memory in KB
+
+    const MpFloatingPointer* mp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        mp = findMpFloating(ebda, ebda + 1024);
+    }
+    if (!mp && baseTop >= 1024 && baseTop <= 0xA0000) {
+        mp = findMpFloating(baseTop - 1024, baseTop);
+    }
+    if (!mp) {
+        mp = findMpFloating(0xF0000, 0x100000);
+    }
+    if (!mp || mp->configTable == 0 || mp->configTable >= 0x100000) {
+        return false;
+    }
+
+    const MpConfigTable* config = (const MpConfigTable*)mp->configTable;
+    if (config->signature != MP_CONFIG_SIGNATURE) {
+        return false;
+    }
+
+    lapicPhysBase = config->lapicAddress;
+
+    // Processor entries are 20 bytes, all others 8
+    const uint8_t* entry = (const uint8_t*)config + sizeof(MpConfigTable);
+    for (uint32_t i = 0; i < config->entryCount; i++) {
+        if (entry[0] == MP_ENTRY_PROCESSOR) {
+            const MpProcessorEntry* cpu = (const MpProcessorEntry*)entry;
+            if (cpu->flags & MP_PROCESSOR_ENABLED) {
+                addCpu(cpu->apicId);
+            }
+            entry += sizeof(MpProcessorEntry);
+        } else {
+            entry += 8;
+        }
+    }
+
+    return cpusFound > 0;
+}
+
+/*
+ * addCpu - Remember a CPU found in the firmware tables
+ */
+static void addCpu(uint8_t apicId)
+{
+    if (cpusFound < SMP_MAX_CPUS) {
+        apicIds[cpusFound++] = apicId;
+    } else {
+        cpusSkipped++;
+    }
+}
+
+/*
+ * startAp - Start one application processor and wait for it to check in
+ */
+static bool startAp(uint32_t cpu, uint8_t apicId)
+{
+    if (cpu >= SMP_MAX_CPUS) {
+        return false;
+    }
+
+    void* stack = KAllocateMemory(AP_STACK_SIZE);
+    if (!stack) {
+        return false;
+    }
+
+    cpuApicId[cpu] = apicId;
+
+    ApTrampolineParams* params = (ApTrampolineParams*)
+        (TRAMPOLINE_BASE + (uintptr_t)(apTrampolineParams - apTrampolineStart));
+    params->pageDirectory = (uint32_t)PagingGetCurrentDirectory();
+    params->stackTop = (uint32_t)stack + AP_STACK_SIZE;
+    params->entry = (uint32_t)apMain;
+    params->cpu = cpu;
+
+    apStart[cpu] = AP_STARTING;
+    LapicStartAp(apicId, TRAMPOLINE_BASE >> 12);
+
+    uint64_t start = TscGetNanoseconds();
+    while (!cpuOnline[cpu]) {
+        if (TscGetNanoseconds() - start > AP_START_TIMEOUT_NS) {
+            // Once apMain() has claimed the slot the AP is only finishing
+            // its setup, so keep waiting. Otherwise it may still be on its
+            // way: INIT stops it before the next AP's parameters go into
+            // the one block it reads, and it never touches this stack again
+            uint32_t expected = AP_STARTING;
+            if (__atomic_compare_exchange_n(&apStart[cpu], &expected, AP_ABANDONED,
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                LapicStopAp(apicId);
+                KFreeMemory(stack);
+                return false;
+            }
+        }
+        __asm__ volatile ("pause");
+    }
+
+    return true;
+}
+
+/*
+ * apMain - C entry point of an application processor
+ *
+ * Entered from the trampoline with paging on, interrupts off and the
+ * temporary GDT loaded. Sets up the CPU's own descriptor tables and idle
+ * process, then idles like the boot CPU does.
+ */
+static void apMain(uint32_t cpu)
+{
+    // Too late: startAp() gave up on this AP and is sending it INIT
+    uint32_t expected = AP_STARTING;
+    if (!__atomic_compare_exchange_n(&apStart[cpu], &expected, AP_ARRIVED,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        for (;;) {
+            __asm__ volatile ("cli; hlt");
+        }
+    }
+
+    GdtInitializeCpu(cpu);
+    IdtLoad();
+    LapicInitializeCpu();
+    FpuInitializeCpu();
+    ProcessInitializeCpu(cpu);
+
+    __atomic_add_fetch(&cpusOnline, 1, __ATOMIC_RELEASE);
+    cpuOnline[cpu] = true;
+
+    ProcessIdle();
+}
+
+/*
+ * installIpiHandlers - Route the IPI vectors to their handlers
+ */
+static void installIpiHandlers(void)
+{
+    uint8_t flags = IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_GATE_32;
+
+    IdtSetGate(SMP_VECTOR_TICK, (uint32_t)isr240, GDT_KERNEL_CODE_SELECTOR, flags);
+    IdtSetGate(SMP_VECTOR_SUBTICK, (uint32_t)isr241, GDT_KERNEL_CODE_SELECTOR, flags);
+    IdtSetGate(SMP_VECTOR_RESCHEDULE, (uint32_t)isr242, GDT_KERNEL_CODE_SELECTOR, flags);
+    IdtSetGate(SMP_VECTOR_STOP, (uint32_t)isr243, GDT_KERNEL_CODE_SELECTOR, flags);
+
+    IsrRegisterHandler(SMP_VECTOR_TICK, tickIpi);
+    IsrRegisterHandler(SMP_VECTOR_SUBTICK, subTickIpi);
+    IsrRegisterHandler(SMP_VECTOR_RESCHEDULE, rescheduleIpi);
+    IsrRegisterHandler(SMP_VECTOR_STOP, stopIpi);
+}
+
+/*
+ * tickIpi - Timer tick forwarded by CPU 0
+ *
+ * Same work as the PIT tick handler on CPU 0, including the softirqs and
+ * the switch on the way out that irq.c does there.
+ */
+static void tickIpi(registers_t* regs)
+{
+    ProcessSchedule(regs);
+    LapicSendEoi();
+    SoftirqRunPending();
+    ProcessPreemptIrq();
+}
+
+/*
+ * subTickIpi - Timer sub-tick forwarded by CPU 0
+ */
+static void subTickIpi(registers_t* regs)
+{
+    ProcessScheduleSubTick(regs);
+    LapicSendEoi();
+    SoftirqRunPending();
+    ProcessPreemptIrq();
+}
+
+/*
+ * rescheduleIpi - Another CPU made a process ready that should run here
+ */
+static void rescheduleIpi(registers_t* regs)
+{
+    (void)regs;
+
+    LapicSendEoi();
+    SoftirqRunPending();
+    ProcessPreemptIrq();
+}
+
+/*
+ * stopIpi - Halt for good (another CPU panicked)
+ */
+static void stopIpi(registers_t* regs)
+{
+    (void)regs;
+
+    while (1) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
@@ -0,0 +1,36 @@
+/* switch_to.s - Kernel stack switch */
+
+.section .text
+
+/*
+ * switchTo(uint32_t* prevEsp, uint32_t nextEsp)
+ *
+ * Saves the callee-saved registers on the current stack, stores ESP in
+ * *prevEsp, loads nextEsp and restores the registers saved there. The
+ * ret then continues wherever the next process last called switchTo(),
+ * or in the entry frame ProcessCreate() built for a new one. Everything
+ * else (caller-saved registers, EFLAGS, any interrupt frame) is already
+ * on the process's own stack. Called with interrupts disabled.
+ */
+.global switchTo
+.type switchTo, @function
+
+switchTo:
+    mov 4(%esp), %eax       /* prevEsp */
+    mov 8(%esp), %edx       /* nextEsp */
+
+    push %ebp
+    push %ebx
+    push %esi
+    push %edi
+
+    mov %esp, (%eax)
+    mov %edx, %esp
+
+    pop %edi
+    pop %esi
+    pop %ebx
+    pop %ebp
+    ret
+
+.size switchTo, . - switchTo
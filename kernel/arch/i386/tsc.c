@@ -0,0 +1,106 @@
+/* tsc.c - Time Stamp Counter clock */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "tsc.h"
+#include "pit.h"
+#include "x86.h"
+#include "clc/math.h"
+
+/* PIT channel 2 and its gate (system control port B) */
+#define PIT_CHANNEL2    0x42
+#define PIT_COMMAND     0x43
+#define PIT_GATE_PORT   0x61
+#define PIT_GATE_ENABLE 0x01    /* Channel 2 gate input */
+#define PIT_SPEAKER     0x02    /* Speaker data enable */
+#define PIT_OUT2        0x20    /* Channel 2 output state */
+
+/* Calibration window */
+#define CALIBRATE_MS    10
+
+/* Fixed-point shift for the cycles-to-nanoseconds multiplier */
+#define NS_SHIFT        24
+
+/* CPUID leaf 1 EDX feature bit */
+#define CPUID_FEATURE_TSC (1u << 4)
+
+/* Clock state */
+static uint32_t tscKhz = 0;
+static uint32_t nsMultiplier = 0;   // (10^6 << NS_SHIFT) / tscKhz
+static uint64_t tscBase = 0;
+
+/*
+ * hasTsc - Check CPUID for a time stamp counter
+ */
+static bool hasTsc(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_FEATURE_TSC) != 0;
+}
+
+/*
+ * TscInitialize - Detect and calibrate the TSC
+ */
+bool TscInitialize(void)
+{
+    if (!hasTsc()) {
+        return false;
+    }
+
+    // Gate channel 2 on with the speaker disconnected
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~PIT_SPEAKER) | PIT_GATE_ENABLE);
+
+    // Channel 2, lobyte/hibyte, mode 0: OUT2 goes high when the count expires
+    uint32_t latch = PIT_BASE_FREQ / (1000 / CALIBRATE_MS);
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, (uint8_t)(latch & 0xFF));
+    outb(PIT_CHANNEL2, (uint8_t)((latch >> 8) & 0xFF));
+
+    uint64_t start = TscRead();
+    while ((inb(PIT_GATE_PORT) & PIT_OUT2) == 0) {
+        // Spin until the one-shot fires
+    }
+    uint64_t end = TscRead();
+
+    outb(PIT_GATE_PORT, gate);
+
+    uint32_t khz = (uint32_t)ClcDivU64(end - start, CALIBRATE_MS, NULL);
+    if (khz == 0) {
+        return false;
+    }
+
+    tscKhz = khz;
+    nsMultiplier = (uint32_t)ClcDivU64(1000000ull << NS_SHIFT, khz, NULL);
+    tscBase = TscRead();
+    return true;
+}
+
+/*
+ * TscGetKhz - Get the calibrated TSC rate
+ */
+uint32_t TscGetKhz(void)
+{
+    return tscKhz;
+}
+
+/*
+ * TscGetNanoseconds - High-resolution monotonic clock
+ */
+uint64_t TscGetNanoseconds(void)
+{
+    if (tscKhz == 0) {
+        uint32_t frequency = PitGetFrequency();
+        return frequency ? PitGetTicks() * (1000000000u / frequency) : 0;
+    }
+
+    // Split the cycle count so each product fits in 64 bits
+    uint64_t cycles = TscRead() - tscBase;
+    uint32_t high = (uint32_t)(cycles >> 32);
+    uint32_t low = (uint32_t)cycles;
+
+    return (((uint64_t)high * nsMultiplier) << (32 - NS_SHIFT))
+           + (((uint64_t)low * nsMultiplier) >> NS_SHIFT);
+}
@@ -0,0 +1,42 @@
+/* condvar.c - Condition variables */
+
+#include "condvar.h"
+
+/*
+ * CondVarInit - Initialize a condition variable
+ */
+void CondVarInit(CondVar* cv)
+{
+    WaitQueueInit(&cv->waiters);
+}
+
+/*
+ * CondVarWait - Unlock a mutex and sleep until signalled, then relock it
+ */
+void CondVarWait(CondVar* cv, Mutex* mutex)
+{
+    // Signallers hold the mutex, so once we hold the queue lock with the
+    // mutex still ours no signal can slip in before we are queued
+    uint32_t flags = SpinlockAcquireIrqSave(&cv->waiters.lock);
+    MutexUnlock(mutex);
+    WaitQueueSleepLocked(&cv->waiters);
+    SpinlockReleaseIrqRestore(&cv->waiters.lock, flags);
+
+    MutexLock(mutex);
+}
+
+/*
+ * CondVarSignal - Wake one waiter, if any
+ */
+void CondVarSignal(CondVar* cv)
+{
+    WaitQueueWakeOne(&cv->waiters);
+}
+
+/*
+ * CondVarBroadcast - Wake every waiter
+ */
+void CondVarBroadcast(CondVar* cv)
+{
+    WaitQueueWakeAll(&cv->waiters);
+}
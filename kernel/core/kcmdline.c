@@ -3,21 +3,54 @@
 #include "kcmdline.h"
 #include "multiboot.h"
 #include "clc/string.h"
+#include "clk/arena.h"
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Maximum command line length */
 #define CMDLINE_MAX_LEN 256
 
+/* Parsed command line token ("key" or "key=value") */
+typedef struct CmdLineEntry {
+    const char* key;
+    const char* value;              // NULL for boolean flags
+    struct CmdLineEntry* next;
+} CmdLineEntry;
+
+/*
+ * Storage for parsed tokens, sized for the worst case: a line of
+ * one-character tokens ("a a a ..."), one per two bytes. Each token takes
+ * an entry and up to two copied strings, each padded to CLK_ARENA_ALIGN;
+ * the copies' characters come from the line itself, plus a NUL each.
+ */
+#define CMDLINE_MAX_TOKENS (CMDLINE_MAX_LEN / 2)
+#define CMDLINE_ARENA_SIZE (sizeof(ClkArenaChunk) + sizeof(ClkArena) + 2 * CLK_ARENA_ALIGN + \
+                            CMDLINE_MAX_TOKENS * (sizeof(CmdLineEntry) + 3 * CLK_ARENA_ALIGN) + \
+                            CMDLINE_MAX_LEN)
+
 /* Parsed command line */
 static char cmdLine[CMDLINE_MAX_LEN];
 static bool cmdLineValid = false;
 
+/*
+ * Tokens are parsed once at boot into a buffer-backed arena. This runs
+ * before the heap exists, and lookups no longer rescan the raw string.
+ */
+static uint8_t cmdLineArenaBuffer[CMDLINE_ARENA_SIZE];
+static CmdLineEntry* cmdLineEntries = NULL;
+
+/* Forward declarations */
+static const char* copyToken(ClkArena* arena, const char* start, size_t len);
+static const CmdLineEntry* findEntry(const char* key);
+
 /*
  * KCmdLineInitialize - Parse kernel command line from multiboot
  */
 void KCmdLineInitialize(multiboot_info_t* mbootInfo)
 {
+    cmdLineEntries = NULL;
+
     // Check if command line is available
     if (!(mbootInfo->flags & (1 << 2))) {
         cmdLineValid = false;
@@ -28,21 +61,12 @@ void KCmdLineInitialize(multiboot_info_t* mbootInfo)
     const char* bootCmdLine = (const char*)mbootInfo->cmdline;
     ClcStrCopy(cmdLine, bootCmdLine, CMDLINE_MAX_LEN);
     cmdLineValid = true;
-}
 
-/*
- * KCmdLineHasFlag - Check if a flag is present
- */
-bool KCmdLineHasFlag(const char* flag)
-{
-    if (!cmdLineValid) {
-        return false;
-    }
+    ClkArena* arena = ClkArenaCreateInBuffer(cmdLineArenaBuffer, CMDLINE_ARENA_SIZE);
+    CmdLineEntry** tail = &cmdLineEntries;
 
-    // Iterate through command line tokens
+    // Split into whitespace-separated tokens
     const char* ptr = cmdLine;
-    size_t flagLen = ClcStrLen(flag);
-
     while (*ptr) {
         // Skip whitespace
         while (*ptr == ' ' || *ptr == '\t') {
@@ -53,36 +77,51 @@ bool KCmdLineHasFlag(const char* flag)
             break;
         }
 
-        // Find end of token
-        const char* tokenStart = ptr;
+        // Key runs up to '=' or end of token
+        const char* keyStart = ptr;
         while (*ptr && *ptr != ' ' && *ptr != '\t' && *ptr != '=') {
             ptr++;
         }
-
-        // Calculate token length
-        size_t tokenLen = ptr - tokenStart;
-
-        // Check if token matches flag
-        if (tokenLen == flagLen) {
-            bool match = true;
-            for (size_t i = 0; i < flagLen; i++) {
-                if (tokenStart[i] != flag[i]) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) {
-                return true;
+        size_t keyLen = ptr - keyStart;
+
+        // Value (if any) runs to end of token
+        const char* valueStart = NULL;
+        size_t valueLen = 0;
+        if (*ptr == '=') {
+            valueStart = ++ptr;
+            while (*ptr && *ptr != ' ' && *ptr != '\t') {
+                ptr++;
             }
+            valueLen = ptr - valueStart;
         }
 
-        // Skip to next token
-        while (*ptr && *ptr != ' ' && *ptr != '\t') {
-            ptr++;
+        CmdLineEntry* entry = (CmdLineEntry*)ClkArenaAlloc(arena, sizeof(CmdLineEntry));
+        if (entry == NULL) {
+            break;  // Cannot happen: the arena fits the longest line
+        }
+
+        entry->key = copyToken(arena, keyStart, keyLen);
+        entry->value = valueStart ? copyToken(arena, valueStart, valueLen) : NULL;
+        entry->next = NULL;
+        if (entry->key == NULL || (valueStart && entry->value == NULL)) {
+            break;
         }
+
+        *tail = entry;
+        tail = &entry->next;
+    }
+}
+
+/*
+ * KCmdLineHasFlag - Check if a flag is present
+ */
+bool KCmdLineHasFlag(const char* flag)
+{
+    if (!cmdLineValid) {
+        return false;
     }
 
-    return false;
+    return findEntry(flag) != NULL;
 }
 
 /*
@@ -94,49 +133,40 @@ const char* KCmdLineGetValue(const char* key)
         return NULL;
     }
 
-    static char valueBuffer[CMDLINE_MAX_LEN];
-    size_t keyLen = ClcStrLen(key);
-
-    // Iterate through command line tokens
-    const char* ptr = cmdLine;
-    while (*ptr) {
-        // Skip whitespace
-        while (*ptr == ' ' || *ptr == '\t') {
-            ptr++;
-        }
-
-        if (*ptr == '\0') {
-            break;
-        }
-
-        // Check if this token starts with "key="
-        if (ClcStrStartsWith(ptr, key) && ptr[keyLen] == '=') {
-            // Found the key, extract value
-            const char* valueStart = ptr + keyLen + 1;
-            const char* valueEnd = valueStart;
+    const CmdLineEntry* entry = findEntry(key);
+    if (entry == NULL) {
+        return NULL;
+    }
 
-            // Find end of value
-            while (*valueEnd && *valueEnd != ' ' && *valueEnd != '\t') {
-                valueEnd++;
-            }
+    return entry->value;
+}
 
-            // Copy value to buffer
-            size_t valueLen = valueEnd - valueStart;
-            if (valueLen >= CMDLINE_MAX_LEN) {
-                valueLen = CMDLINE_MAX_LEN - 1;
-            }
+/*
+ * copyToken - Copy a token into the arena as a null-terminated string
+ */
+static const char* copyToken(ClkArena* arena, const char* start, size_t len)
+{
+    char* copy = (char*)ClkArenaAlloc(arena, len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
 
-            for (size_t i = 0; i < valueLen; i++) {
-                valueBuffer[i] = valueStart[i];
-            }
-            valueBuffer[valueLen] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        copy[i] = start[i];
+    }
+    copy[len] = '\0';
 
-            return valueBuffer;
-        }
+    return copy;
+}
 
-        // Skip to next token
-        while (*ptr && *ptr != ' ' && *ptr != '\t') {
-            ptr++;
+/*
+ * findEntry - Find the first parsed token with the given key
+ */
+static const CmdLineEntry* findEntry(const char* key)
+{
+    for (const CmdLineEntry* entry = cmdLineEntries; entry != NULL; entry = entry->next) {
+        if (ClcStrEqual(entry->key, key)) {
+            return entry;
         }
     }
 
@@ -6,6 +6,9 @@
 #include "early_console.h"
 #include "clc/printf.h"
 #include "econ_writer.h"
+#include "clk/allocator.h"
+#include "spinlock.h"
+#include "percpu.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -19,6 +22,7 @@
 typedef struct BlockHeader {
     size_t size;                   // Size of block (excluding header)
     bool free;                     // Is block free?
+    uint16_t site;                 // Profiler call-site slot (0 = none)
     struct BlockHeader* next;      // Next block in list
 } BlockHeader;
 
@@ -27,11 +31,47 @@ static uintptr_t heapStart = HEAP_START;
 static uintptr_t heapEnd = HEAP_START;
 static uintptr_t heapMax = HEAP_MAX;
 static BlockHeader* firstBlock = NULL;
-
-/* Statistics */
-static size_t totalSize = 0;
-static size_t usedSize = 0;
-static size_t freeSize = 0;
+static Spinlock heapLock = SPINLOCK_INIT;  // Block list, statistics and profile
+
+/* Statistics are PER_CPU_HEAP_TOTAL_BYTES, _USED_BYTES and _FREE_BYTES */
+
+/* Profiler configuration */
+#define PROFILE_SITES   128         // Call-site hash table slots (power of 2)
+#define PROFILE_BUCKETS 10          // Size classes: <=16, <=32, ... <=4096, >4096
+
+/* Per-call-site allocation profile */
+typedef struct {
+    uintptr_t callSite;             // Return address of the allocating call
+    uint32_t allocCount;            // Allocations made from this site
+    uint32_t freeCount;             // Of those, how many were freed
+    size_t liveBytes;               // Bytes currently allocated
+    size_t peakLiveBytes;           // High-water mark of liveBytes
+    uint32_t histogram[PROFILE_BUCKETS];  // Allocation count per size class
+} ProfileSite;
+
+/* Profiler state (only touched when enabled) */
+static bool profileEnabled = false;
+static ProfileSite profileSites[PROFILE_SITES];
+static uint32_t profileDropped = 0;  // Allocations with no free slot
+
+/* Forward declarations */
+static void* heapAllocate(size_t size, void* callSite);
+static void* allocateLocked(size_t size, void* callSite);
+static uint16_t profileRecordAlloc(void* callSite, size_t size);
+static void profileRecordFree(BlockHeader* block);
+static void* heapAllocatorAllocate(void* data, size_t size);
+static void heapAllocatorFree(void* data, void* ptr);
+
+/* Allocator interface */
+static const ClkAllocatorVTable heapAllocatorVTable = {
+    .allocate = heapAllocatorAllocate,
+    .free = heapAllocatorFree
+};
+
+static ClkAllocator heapAllocator = {
+    .data = NULL,
+    .vtable = &heapAllocatorVTable
+};
 
 /* Alignment */
 #define ALIGN_UP(n, align) (((n) + (align) - 1) & ~((align) - 1))
@@ -67,6 +107,7 @@ static bool heapExpand(size_t increment)
     BlockHeader* newBlock = (BlockHeader*)heapEnd;
     newBlock->size = increment - sizeof(BlockHeader);
     newBlock->free = true;
+    newBlock->site = 0;
     newBlock->next = NULL;
 
     // Add to block list
@@ -82,8 +123,8 @@ static bool heapExpand(size_t increment)
     }
 
     heapEnd += increment;
-    totalSize += increment - sizeof(BlockHeader);
-    freeSize += increment - sizeof(BlockHeader);
+    PerCpuCounterAdd(PER_CPU_HEAP_TOTAL_BYTES, (int32_t)(increment - sizeof(BlockHeader)));
+    PerCpuCounterAdd(PER_CPU_HEAP_FREE_BYTES, (int32_t)(increment - sizeof(BlockHeader)));
 
     return true;
 }
@@ -102,8 +143,9 @@ static void heapMergeBlocks(void)
             uintptr_t nextStart = (uintptr_t)current->next;
 
             if (currentEnd == nextStart) {
-                // Merge blocks
+                // Merge blocks (the absorbed header becomes free space too)
                 current->size += sizeof(BlockHeader) + current->next->size;
+                PerCpuCounterAdd(PER_CPU_HEAP_FREE_BYTES, (int32_t)sizeof(BlockHeader));
                 current->next = current->next->next;
                 continue;  // Check again with same block
             }
@@ -136,6 +178,25 @@ void KHeapInitialize(void)
  * KAllocateMemory - Allocate memory from kernel heap
  */
 void* KAllocateMemory(size_t size)
+{
+    return heapAllocate(size, __builtin_return_address(0));
+}
+
+/*
+ * heapAllocate - First-fit allocation, attributed to callSite when profiling
+ */
+static void* heapAllocate(size_t size, void* callSite)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&heapLock);
+    void* ptr = allocateLocked(size, callSite);
+    SpinlockReleaseIrqRestore(&heapLock, flags);
+    return ptr;
+}
+
+/*
+ * allocateLocked - heapAllocate() with the heap lock held
+ */
+static void* allocateLocked(size_t size, void* callSite)
 {
     if (size == 0) {
         return NULL;
@@ -156,19 +217,21 @@ void* KAllocateMemory(size_t size)
                 BlockHeader* newBlock = (BlockHeader*)((uintptr_t)current + sizeof(BlockHeader) + size);
                 newBlock->size = current->size - size - sizeof(BlockHeader);
                 newBlock->free = true;
+                newBlock->site = 0;
                 newBlock->next = current->next;
 
                 current->size = size;
                 current->next = newBlock;
 
-                freeSize -= size + sizeof(BlockHeader);
+                PerCpuCounterAdd(PER_CPU_HEAP_FREE_BYTES, -(int32_t)(size + sizeof(BlockHeader)));
             } else {
                 // Use entire block
-                freeSize -= current->size;
+                PerCpuCounterAdd(PER_CPU_HEAP_FREE_BYTES, -(int32_t)current->size);
             }
 
             current->free = false;
-            usedSize += current->size;
+            current->site = profileEnabled ? profileRecordAlloc(callSite, current->size) : 0;
+            PerCpuCounterAdd(PER_CPU_HEAP_USED_BYTES, (int32_t)current->size);
 
             return (void*)((uintptr_t)current + sizeof(BlockHeader));
         }
@@ -186,7 +249,7 @@ void* KAllocateMemory(size_t size)
     }
 
     // Try allocation again (should succeed now)
-    return KAllocateMemory(size);
+    return allocateLocked(size, callSite);
 }
 
 /*
@@ -201,13 +264,20 @@ void KFreeMemory(void* ptr)
     // Get block header
     BlockHeader* block = (BlockHeader*)((uintptr_t)ptr - sizeof(BlockHeader));
 
+    uint32_t flags = SpinlockAcquireIrqSave(&heapLock);
+
     // Mark as free
+    if (block->site != 0) {
+        profileRecordFree(block);
+    }
     block->free = true;
-    usedSize -= block->size;
-    freeSize += block->size;
+    PerCpuCounterAdd(PER_CPU_HEAP_USED_BYTES, -(int32_t)block->size);
+    PerCpuCounterAdd(PER_CPU_HEAP_FREE_BYTES, (int32_t)block->size);
 
     // Merge adjacent free blocks
     heapMergeBlocks();
+
+    SpinlockReleaseIrqRestore(&heapLock, flags);
 }
 
 /*
@@ -234,8 +304,8 @@ void* KReallocateMemory(void* ptr, size_t size)
         return ptr;
     }
 
-    // Allocate new block
-    void* newPtr = KAllocateMemory(size);
+    // Allocate new block (attributed to our caller, not to realloc)
+    void* newPtr = heapAllocate(size, __builtin_return_address(0));
     if (newPtr == NULL) {
         return NULL;
     }
@@ -256,10 +326,202 @@ void* KReallocateMemory(void* ptr, size_t size)
 
 /*
  * KHeapGetStats - Get heap statistics
+ *
+ * Taken under the heap lock, so the three totals agree with each other.
  */
 void KHeapGetStats(size_t* totalSizeOut, size_t* usedSizeOut, size_t* freeSizeOut)
 {
-    if (totalSizeOut) *totalSizeOut = totalSize;
-    if (usedSizeOut) *usedSizeOut = usedSize;
-    if (freeSizeOut) *freeSizeOut = freeSize;
+    uint32_t flags = SpinlockAcquireIrqSave(&heapLock);
+
+    if (totalSizeOut) *totalSizeOut = PerCpuCounterRead(PER_CPU_HEAP_TOTAL_BYTES);
+    if (usedSizeOut) *usedSizeOut = PerCpuCounterRead(PER_CPU_HEAP_USED_BYTES);
+    if (freeSizeOut) *freeSizeOut = PerCpuCounterRead(PER_CPU_HEAP_FREE_BYTES);
+
+    SpinlockReleaseIrqRestore(&heapLock, flags);
+}
+
+/*
+ * KHeapGetFreeListStats - Get free-list shape for fragmentation metrics
+ */
+void KHeapGetFreeListStats(size_t* freeBlocksOut, size_t* largestFreeOut)
+{
+    size_t freeBlocks = 0;
+    size_t largestFree = 0;
+
+    uint32_t flags = SpinlockAcquireIrqSave(&heapLock);
+    for (BlockHeader* block = firstBlock; block != NULL; block = block->next) {
+        if (block->free) {
+            freeBlocks++;
+            if (block->size > largestFree) {
+                largestFree = block->size;
+            }
+        }
+    }
+    SpinlockReleaseIrqRestore(&heapLock, flags);
+
+    if (freeBlocksOut) *freeBlocksOut = freeBlocks;
+    if (largestFreeOut) *largestFreeOut = largestFree;
+}
+
+/*
+ * KHeapGetAllocator - Get ClkAllocator interface for the kernel heap
+ */
+ClkAllocator* KHeapGetAllocator(void)
+{
+    return &heapAllocator;
+}
+
+/*
+ * heapAllocatorAllocate - ClkAllocator allocate implementation
+ */
+static void* heapAllocatorAllocate(void* data, size_t size)
+{
+    (void)data;  // Unused
+    return heapAllocate(size, __builtin_return_address(0));
+}
+
+/*
+ * heapAllocatorFree - ClkAllocator free implementation
+ */
+static void heapAllocatorFree(void* data, void* ptr)
+{
+    (void)data;  // Unused
+    KFreeMemory(ptr);
+}
+
+/*
+ * KHeapProfileEnable - Start recording allocation call sites
+ */
+void KHeapProfileEnable(void)
+{
+    for (size_t i = 0; i < PROFILE_SITES; i++) {
+        profileSites[i].callSite = 0;
+    }
+    profileDropped = 0;
+    profileEnabled = true;
+}
+
+/*
+ * KHeapProfileDump - Print the allocation profile to the serial console
+ */
+void KHeapProfileDump(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    if (!profileEnabled) {
+        ClcPrintfWriter(serial, "Heap profiler disabled (boot with heapprof)\n");
+        return;
+    }
+
+    size_t totalSize;
+    size_t usedSize;
+    size_t freeSize;
+    size_t freeBlocks;
+    size_t largestFree;
+    KHeapGetStats(&totalSize, &usedSize, &freeSize);
+    KHeapGetFreeListStats(&freeBlocks, &largestFree);
+
+    // External fragmentation: share of free memory outside the largest hole
+    // (scaled down so the multiply fits in 32 bits; no 64-bit divide here)
+    uint32_t fragPercent = 0;
+    if (freeSize > 0) {
+        unsigned shift = (freeSize > 0x00FFFFFF) ? 8 : 0;
+        fragPercent = 100 - (uint32_t)(((largestFree >> shift) * 100) / (freeSize >> shift));
+    }
+
+    ClcPrintfWriter(serial, "\n=== Heap Profile ===\n");
+    ClcPrintfWriter(serial, "Heap: %u bytes total, %u used, %u free\n",
+                    (uint32_t)totalSize, (uint32_t)usedSize, (uint32_t)freeSize);
+    ClcPrintfWriter(serial, "Free blocks: %u, largest: %u bytes, fragmentation: %u%%\n",
+                    (uint32_t)freeBlocks, (uint32_t)largestFree, fragPercent);
+    if (profileDropped > 0) {
+        ClcPrintfWriter(serial, "Unattributed allocations (table full): %u\n",
+                        profileDropped);
+    }
+
+    for (size_t i = 0; i < PROFILE_SITES; i++) {
+        ProfileSite* site = &profileSites[i];
+        if (site->callSite == 0) {
+            continue;
+        }
+
+        ClcPrintfWriter(serial, "  site %p: %u allocs, %u frees, %u live bytes (peak %u)\n",
+                        (void*)site->callSite, site->allocCount, site->freeCount,
+                        (uint32_t)site->liveBytes, (uint32_t)site->peakLiveBytes);
+
+        ClcPrintfWriter(serial, "    sizes:");
+        for (size_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            if (site->histogram[bucket] == 0) {
+                continue;
+            }
+            if (bucket == PROFILE_BUCKETS - 1) {
+                ClcPrintfWriter(serial, " >%u:%u", 16u << (bucket - 1),
+                                site->histogram[bucket]);
+            } else {
+                ClcPrintfWriter(serial, " <=%u:%u", 16u << bucket,
+                                site->histogram[bucket]);
+            }
+        }
+        ClcPrintfWriter(serial, "\n");
+    }
+}
+
+/*
+ * profileRecordAlloc - Account an allocation to its call site
+ *
+ * Returns the slot number plus one (stored in the block header), or 0
+ * if the table is full.
+ */
+static uint16_t profileRecordAlloc(void* callSite, size_t size)
+{
+    uintptr_t key = (uintptr_t)callSite;
+
+    // Open addressing with linear probing
+    size_t index = (key >> 2) & (PROFILE_SITES - 1);
+    for (size_t probe = 0; probe < PROFILE_SITES; probe++) {
+        ProfileSite* site = &profileSites[index];
+
+        if (site->callSite == 0) {
+            // Claim an empty slot
+            site->callSite = key;
+            site->allocCount = 0;
+            site->freeCount = 0;
+            site->liveBytes = 0;
+            site->peakLiveBytes = 0;
+            for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+                site->histogram[i] = 0;
+            }
+        }
+
+        if (site->callSite == key) {
+            size_t bucket = 0;
+            while (bucket < PROFILE_BUCKETS - 1 && size > (16u << bucket)) {
+                bucket++;
+            }
+
+            site->allocCount++;
+            site->histogram[bucket]++;
+            site->liveBytes += size;
+            if (site->liveBytes > site->peakLiveBytes) {
+                site->peakLiveBytes = site->liveBytes;
+            }
+            return (uint16_t)(index + 1);
+        }
+
+        index = (index + 1) & (PROFILE_SITES - 1);
+    }
+
+    profileDropped++;
+    return 0;
+}
+
+/*
+ * profileRecordFree - Credit a freed block back to its call site
+ */
+static void profileRecordFree(BlockHeader* block)
+{
+    ProfileSite* site = &profileSites[block->site - 1];
+    site->freeCount++;
+    site->liveBytes -= block->size;
+    block->site = 0;
 }
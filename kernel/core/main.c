@@ -9,6 +9,9 @@
 #include "irq.h"
 #include "pic.h"
 #include "pit.h"
+#include "tsc.h"
+#include "timer.h"
+#include "fpu.h"
 #include "early_console.h"
 #include "clc/printf.h"
 #include "vid_writer.h"
@@ -18,6 +21,11 @@
 #include "kheap.h"
 #include "kcmdline.h"
 #include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "rcu.h"
+#include "selftest.h"
 #include "panic.h"
 
 /* VGA text mode buffer */
@@ -55,9 +63,6 @@ static uint16_t* terminalBuffer;
 static inline uint8_t vgaEntryColor(enum vga_color fg, enum vga_color bg);
 static inline uint16_t vgaEntry(unsigned char uc, uint8_t color);
 static void pageFaultHandler(registers_t* regs);
-static void testProcess1(void);
-static void testProcess2(void);
-static void testProcess3(void);
 
 /*
  * VidInitialize - Initialize VGA text mode display
@@ -172,6 +177,13 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
     // Register page fault handler (ISR 14)
     IsrRegisterHandler(14, pageFaultHandler);
 
+    // Enable x87/SSE; registers are switched lazily through ISR 7
+    if (FpuInitialize()) {
+        ClcPrintfWriter(serialWriter, "FPU: enabled, lazy switching\n");
+    } else {
+        ClcPrintfWriter(serialWriter, "FPU: not present\n");
+    }
+
     // Initialize IRQs
     ClcPrintfWriter(vgaWriter, "Initializing IRQs... ");
     IrqInitialize();
@@ -182,11 +194,25 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
     PicInitialize();
     ClcPrintfWriter(vgaWriter, "OK\n");
 
-    // Initialize PIT timer (100 Hz)
+    // Initialize PIT timer (100 Hz), which drives the timer wheel
     ClcPrintfWriter(vgaWriter, "Initializing PIT... ");
+    TimerInitialize();
     PitInitialize(100);
     ClcPrintfWriter(vgaWriter, "OK (100 Hz)\n");
 
+    // Calibrate the TSC against the PIT for the high-resolution clock
+    if (TscInitialize()) {
+        ClcPrintfWriter(serialWriter, "TSC: %u kHz\n", TscGetKhz());
+    } else {
+        ClcPrintfWriter(serialWriter, "TSC: not available, using PIT ticks\n");
+    }
+
+    // Time every spinlock from here on if requested (needs the TSC)
+    if (KCmdLineHasFlag("lockstat")) {
+        ClcPrintfWriter(serialWriter, "Lock statistics: %s\n",
+                        SpinlockStatEnable() ? "enabled" : "unavailable without a TSC");
+    }
+
     // Initialize Physical Memory Manager
     ClcPrintfWriter(serialWriter, "\nInitializing PMM...\n");
     ClcPrintfWriter(vgaWriter, "Initializing PMM... ");
@@ -236,6 +262,12 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
     KHeapInitialize();
     ClcPrintfWriter(vgaWriter, "OK\n");
 
+    // Enable heap profiler if requested
+    if (KCmdLineHasFlag("heapprof")) {
+        ClcPrintfWriter(serialWriter, "Heap profiler: enabled\n");
+        KHeapProfileEnable();
+    }
+
     // Run boot tests if requested
     if (KCmdLineHasFlag("boottest")) {
         // Test memory allocation
@@ -330,6 +362,11 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
         ClcPrintfWriter(vgaWriter, "\nAll tests passed!\n");
     }
 
+    // Dump heap profile gathered during boot
+    if (KCmdLineHasFlag("heapprof")) {
+        KHeapProfileDump();
+    }
+
     ClcPrintfWriter(serialWriter, "\n=== Boot Complete ===\n");
 
     // Test panic system if requested
@@ -348,26 +385,42 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
         (void)value;  // Suppress unused warning
     }
 
+    // Move device interrupts to the I/O APIC when there is one
+    if (IrqInitializeApic()) {
+        ClcPrintfWriter(serialWriter, "IRQ: I/O APIC, EOI through the local APIC\n");
+    } else {
+        ClcPrintfWriter(serialWriter, "IRQ: 8259 PIC\n");
+    }
+
     // Initialize process management
     ClcPrintfWriter(vgaWriter, "\nInitializing processes... ");
     ClcPrintfWriter(serialWriter, "\n=== Process Management Initialization ===\n");
     ProcessInitialize();
     ClcPrintfWriter(vgaWriter, "OK\n");
 
-    // Create test processes
-    ClcPrintfWriter(vgaWriter, "Creating test processes... ");
-    Process* proc1 = ProcessCreate("test1", testProcess1, PROCESS_MODE_KERNEL);
-    Process* proc2 = ProcessCreate("test2", testProcess2, PROCESS_MODE_KERNEL);
-    Process* proc3 = ProcessCreate("test3", testProcess3, PROCESS_MODE_KERNEL);
-    ClcPrintfWriter(vgaWriter, "OK\n");
+    // Bring up the other CPUs; they idle until the scheduler hands them work
+    ClcPrintfWriter(vgaWriter, "Starting application processors... ");
+    uint32_t cpus = SmpInitialize();
+    ClcPrintfWriter(vgaWriter, "%u CPU%s\n", cpus, cpus == 1 ? "" : "s");
 
-    if (!proc1 || !proc2 || !proc3) {
+    // Workers for deferred work that may sleep; they start with the scheduler
+    WorkQueueInitialize();
+
+    // Grace periods advance with the scheduler's ticks
+    RcuInitialize();
+
+    // Create the processes of the test or benchmark asked for, or the demo
+    ClcPrintfWriter(vgaWriter, "Creating test processes... ");
+    if (!SelfTestStart()) {
         ClcPrintfWriter(vgaWriter, "Failed to create processes!\n");
         while (1) __asm__ volatile ("hlt");
     }
+    ClcPrintfWriter(vgaWriter, "OK\n");
 
     // Register scheduler with timer
     PitRegisterTickHandler(ProcessSchedule);
+    PitRegisterSubTickHandler(ProcessScheduleSubTick);
+    IrqSetExitHook(ProcessPreemptIrq);
 
     // Enable scheduler
     ClcPrintfWriter(vgaWriter, "Enabling scheduler...\n");
@@ -376,10 +429,8 @@ void KMain(uint32_t magic, multiboot_info_t* mbootInfo)
 
     ClcPrintfWriter(vgaWriter, "\nMultitasking started!\n\n");
 
-    // Idle loop - this is now PID 0
-    while (1) {
-        __asm__ volatile ("hlt");
-    }
+    // This context is now PID 0
+    ProcessIdle();
 }
 
 /*
@@ -421,55 +472,3 @@ static inline uint16_t vgaEntry(unsigned char uc, uint8_t color)
 {
     return (uint16_t)uc | (uint16_t)color << 8;
 }
-
-/*
- * Test processes - demonstrate multitasking
- */
-
-static void testProcess1(void)
-{
-    ClcWriter* vga = VidGetWriter();
-    ClcWriter* serial = EConGetWriter();
-
-    for (int i = 0; i < 5; i++) {
-        ClcPrintfWriter(vga, "[P1:%d] ", i);
-        ClcPrintfWriter(serial, "Process 1 iteration %d\n", i);
-
-        // Busy wait to simulate work
-        for (volatile int j = 0; j < 1000000; j++);
-    }
-
-    ClcPrintfWriter(serial, "Process 1 exiting\n");
-}
-
-static void testProcess2(void)
-{
-    ClcWriter* vga = VidGetWriter();
-    ClcWriter* serial = EConGetWriter();
-
-    for (int i = 0; i < 5; i++) {
-        ClcPrintfWriter(vga, "[P2:%d] ", i);
-        ClcPrintfWriter(serial, "Process 2 iteration %d\n", i);
-
-        // Busy wait to simulate work
-        for (volatile int j = 0; j < 1000000; j++);
-    }
-
-    ClcPrintfWriter(serial, "Process 2 exiting\n");
-}
-
-static void testProcess3(void)
-{
-    ClcWriter* vga = VidGetWriter();
-    ClcWriter* serial = EConGetWriter();
-
-    for (int i = 0; i < 5; i++) {
-        ClcPrintfWriter(vga, "[P3:%d] ", i);
-        ClcPrintfWriter(serial, "Process 3 iteration %d\n", i);
-
-        // Busy wait to simulate work
-        for (volatile int j = 0; j < 1000000; j++);
-    }
-
-    ClcPrintfWriter(serial, "Process 3 exiting\n");
-}
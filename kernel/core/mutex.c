@@ -0,0 +1,275 @@
+/* mutex.c - Sleeping locks with priority inheritance */
+
+#include "mutex.h"
+#include "smp.h"
+#include "panic.h"
+#include "x86.h"
+#include <stddef.h>
+
+/*
+ * Polls of the owner before giving up and sleeping. A few microseconds:
+ * about what a sleep and wakeup would cost anyway.
+ */
+#define MUTEX_SPIN_LIMIT        1000
+
+/* Owners followed when passing a priority boost down a chain of mutexes */
+#define MUTEX_CHAIN_LIMIT       8
+
+/* Mutex::inherited when nobody is waiting */
+#define MUTEX_NO_INHERIT        PROCESS_PRIORITY_LEVELS
+
+/* Forward declarations */
+static bool tryAcquire(Mutex* mutex, Process* self);
+static bool spinOnOwner(Mutex* mutex, Process* self);
+static void boostOwners(Mutex* mutex, uint32_t priority);
+static uint32_t topWaiterPriority(Mutex* mutex);
+static void restorePriority(Process* self);
+
+/*
+ * MutexInit - Initialize an unlocked mutex
+ */
+void MutexInit(Mutex* mutex)
+{
+    mutex->owner = NULL;
+    mutex->waiterCount = 0;
+    mutex->inherited = MUTEX_NO_INHERIT;
+    WaitQueueInit(&mutex->waiters);
+    ClkListInit(&mutex->heldNode);
+}
+
+/*
+ * MutexLock - Lock a mutex, sleeping until it is free
+ */
+void MutexLock(Mutex* mutex)
+{
+    Process* self = ProcessGetCurrent();
+    KAssert(mutex->owner != self, "Mutex locked recursively by PID %u", self->pid);
+
+    if (tryAcquire(mutex, self) || spinOnOwner(mutex, self)) {
+        return;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&mutex->waiters.lock);
+
+    // Counted before the last try: an unlock that clears the owner after
+    // it sees the count and wakes us (see MutexUnlock())
+    __atomic_add_fetch(&mutex->waiterCount, 1, __ATOMIC_SEQ_CST);
+
+    while (!tryAcquire(mutex, self)) {
+        self->blockedOn = mutex;
+        if (self->priority < mutex->inherited) {
+            mutex->inherited = self->priority;
+        }
+        boostOwners(mutex, self->priority);
+        WaitQueueSleepLocked(&mutex->waiters);
+    }
+
+    self->blockedOn = NULL;
+    __atomic_sub_fetch(&mutex->waiterCount, 1, __ATOMIC_SEQ_CST);
+
+    // Whoever is still waiting now waits on us
+    mutex->inherited = topWaiterPriority(mutex);
+    if (mutex->inherited < self->priority) {
+        ProcessSetEffectivePriority(self, mutex->inherited);
+    }
+
+    SpinlockReleaseIrqRestore(&mutex->waiters.lock, flags);
+}
+
+/*
+ * MutexTryLock - Lock a mutex if it is free
+ */
+bool MutexTryLock(Mutex* mutex)
+{
+    return tryAcquire(mutex, ProcessGetCurrent());
+}
+
+/*
+ * MutexUnlock - Unlock a mutex held by the current process
+ */
+void MutexUnlock(Mutex* mutex)
+{
+    Process* self = ProcessGetCurrent();
+    KAssert(mutex->owner == self, "Mutex unlocked by PID %u, which does not hold it",
+            self->pid);
+
+    ClkListRemove(&mutex->heldNode);
+
+    // Pairs with the waiter's increment before its last try: either it
+    // sees the mutex free, or we see it counted and wake it
+    __atomic_store_n(&mutex->owner, NULL, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mutex->waiterCount, __ATOMIC_SEQ_CST) != 0) {
+        uint32_t flags = SpinlockAcquireIrqSave(&mutex->waiters.lock);
+
+        // Highest priority first; oldest first among equals
+        WaitQueueEntry* top = NULL;
+        for (ClkListNode* node = mutex->waiters.waiters.next;
+             node != &mutex->waiters.waiters; node = node->next) {
+            WaitQueueEntry* entry = CLK_LIST_ENTRY(node, WaitQueueEntry, node);
+            if (!top || entry->process->priority < top->process->priority) {
+                top = entry;
+            }
+        }
+
+        if (top) {
+            ClkListRemove(&top->node);
+            ProcessUnblock(top->process);
+        }
+
+        SpinlockReleaseIrqRestore(&mutex->waiters.lock, flags);
+    }
+
+    restorePriority(self);
+}
+
+/*
+ * MutexIsLocked - Check whether a mutex is held by anyone
+ */
+bool MutexIsLocked(Mutex* mutex)
+{
+    return __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) != NULL;
+}
+
+/*
+ * tryAcquire - Take the mutex if it is free
+ */
+static bool tryAcquire(Mutex* mutex, Process* self)
+{
+    Process* expected = NULL;
+    if (!__atomic_compare_exchange_n(&mutex->owner, &expected, self, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    ClkListAddTail(&self->heldMutexes, &mutex->heldNode);
+    return true;
+}
+
+/*
+ * spinOnOwner - Wait for the mutex while its owner is running
+ *
+ * An owner running on another CPU is probably about to unlock, and
+ * catching that is cheaper than sleeping. Once the owner is switched out
+ * it could be a long time, so we stop and go to sleep. Pointless with a
+ * single CPU: the owner cannot run while we spin.
+ */
+static bool spinOnOwner(Mutex* mutex, Process* self)
+{
+    if (SmpGetCpuCount() < 2) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < MUTEX_SPIN_LIMIT; i++) {
+        Process* owner = __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED);
+        if (!owner) {
+            if (tryAcquire(mutex, self)) {
+                return true;
+            }
+            continue;
+        }
+
+        if (owner->state != PROCESS_STATE_RUNNING) {
+            return false;
+        }
+        cpu_relax();
+    }
+
+    return false;
+}
+
+/*
+ * boostOwners - Raise the owner of a mutex, and whoever it waits for, to priority
+ *
+ * Called with mutex->waiters.lock held. Each further mutex in the chain
+ * is only try-locked, as their order is arbitrary; a busy one ends the
+ * walk early. Under each mutex's lock its owner cannot unlock it (and so
+ * recompute its priority) until we are done.
+ */
+static void boostOwners(Mutex* mutex, uint32_t priority)
+{
+    Process* owner = mutex->owner;
+    if (!owner) {
+        return;
+    }
+    if (owner->priority > priority) {
+        ProcessSetEffectivePriority(owner, priority);
+    }
+
+    for (int depth = 1; depth < MUTEX_CHAIN_LIMIT; depth++) {
+        Mutex* next = owner->blockedOn;
+        if (!next || next == mutex || !SpinlockTryAcquire(&next->waiters.lock)) {
+            return;
+        }
+
+        // Still waiting there? blockedOn only changes under this lock
+        Process* nextOwner = NULL;
+        if (owner->blockedOn == next) {
+            if (priority < next->inherited) {
+                next->inherited = priority;
+            }
+            nextOwner = next->owner;
+            if (nextOwner && nextOwner->priority > priority) {
+                ProcessSetEffectivePriority(nextOwner, priority);
+            }
+        }
+
+        SpinlockRelease(&next->waiters.lock);
+        if (!nextOwner) {
+            return;
+        }
+        owner = nextOwner;
+    }
+}
+
+/*
+ * topWaiterPriority - Highest priority among a mutex's sleeping waiters
+ *
+ * Called with mutex->waiters.lock held.
+ */
+static uint32_t topWaiterPriority(Mutex* mutex)
+{
+    uint32_t priority = MUTEX_NO_INHERIT;
+    for (ClkListNode* node = mutex->waiters.waiters.next;
+         node != &mutex->waiters.waiters; node = node->next) {
+        WaitQueueEntry* entry = CLK_LIST_ENTRY(node, WaitQueueEntry, node);
+        if (entry->process->priority < priority) {
+            priority = entry->process->priority;
+        }
+    }
+    return priority;
+}
+
+/*
+ * inheritedPriority - Priority the current process is owed
+ *
+ * Its own, or that of the most urgent waiter on a mutex it still holds.
+ */
+static uint32_t inheritedPriority(Process* self)
+{
+    uint32_t priority = self->basePriority;
+    for (ClkListNode* node = self->heldMutexes.next;
+         node != &self->heldMutexes; node = node->next) {
+        Mutex* held = CLK_LIST_ENTRY(node, Mutex, heldNode);
+        uint32_t inherited = __atomic_load_n(&held->inherited, __ATOMIC_RELAXED);
+        if (inherited < priority) {
+            priority = inherited;
+        }
+    }
+    return priority;
+}
+
+/*
+ * restorePriority - Drop boosts the current process is no longer owed
+ *
+ * A waiter may raise a held mutex's inherited priority and boost us
+ * between our reading it and lowering our priority, so recheck after
+ * the change and go again until it sticks.
+ */
+static void restorePriority(Process* self)
+{
+    uint32_t priority = inheritedPriority(self);
+    while (self->priority != priority) {
+        ProcessSetEffectivePriority(self, priority);
+        priority = inheritedPriority(self);
+    }
+}
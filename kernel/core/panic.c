@@ -2,6 +2,7 @@
 
 #include "panic.h"
 #include "early_console.h"
+#include "smp.h"
 #include <stdarg.h>
 
 /* Forward declarations */
@@ -68,8 +69,9 @@ void KPanicImpl(const char* file, int line, const char* fmt, ...)
 {
     char numBuf[12];
 
-    // Disable interrupts - we're in a bad state
+    // Disable interrupts and halt the other CPUs - we're in a bad state
     __asm__ volatile ("cli");
+    SmpStopOthers();
 
     // Print panic header to both outputs
     VidWriteString("\n\n!!! KERNEL PANIC !!!\n");
@@ -163,8 +165,9 @@ void KPanicWithRegsImpl(const char* file, int line, registers_t* regs,
 {
     char numBuf[12];
 
-    // Disable interrupts
+    // Disable interrupts and halt the other CPUs
     __asm__ volatile ("cli");
+    SmpStopOthers();
 
     // Print panic header
     VidWriteString("\n\n!!! KERNEL PANIC !!!\n");
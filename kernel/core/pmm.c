@@ -2,6 +2,8 @@
 
 #include "pmm.h"
 #include "multiboot.h"
+#include "spinlock.h"
+#include "percpu.h"
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -10,8 +12,9 @@
 static uint32_t* pageBitmap = NULL;
 static size_t bitmapSize = 0;       // Size in uint32_t entries
 static size_t totalPages = 0;
-static size_t freePages = 0;
-static size_t usedPages = 0;
+static Spinlock pmmLock = SPINLOCK_INIT;    // Bitmap after boot
+
+/* Used and free page counts are PER_CPU_PMM_USED_PAGES and _FREE_PAGES */
 
 /* Kernel end symbol (defined in linker script) */
 extern uint32_t kernelEnd;
@@ -50,8 +53,8 @@ static void markPageUsed(size_t page)
 
     if (!BITMAP_TEST(page)) {
         BITMAP_SET(page);
-        usedPages++;
-        freePages--;
+        PerCpuCounterAdd(PER_CPU_PMM_USED_PAGES, 1);
+        PerCpuCounterAdd(PER_CPU_PMM_FREE_PAGES, -1);
     }
 }
 
@@ -66,8 +69,8 @@ static void markPageFree(size_t page)
 
     if (BITMAP_TEST(page)) {
         BITMAP_CLEAR(page);
-        freePages++;
-        usedPages--;
+        PerCpuCounterAdd(PER_CPU_PMM_FREE_PAGES, 1);
+        PerCpuCounterAdd(PER_CPU_PMM_USED_PAGES, -1);
     }
 }
 
@@ -138,8 +141,7 @@ void PmmInitialize(multiboot_info_t* mbootInfo)
     for (size_t i = 0; i < bitmapSize; i++) {
         pageBitmap[i] = 0xFFFFFFFF;  // All bits set = all used
     }
-    usedPages = totalPages;
-    freePages = 0;
+    PerCpuCounterAdd(PER_CPU_PMM_USED_PAGES, (int32_t)totalPages);
 
     // Now parse memory map and mark available regions as free
     if (mbootInfo->flags & (1 << 6)) {
@@ -176,27 +178,31 @@ void PmmInitialize(multiboot_info_t* mbootInfo)
  */
 uintptr_t PmmAllocPage(void)
 {
+    uintptr_t addr = 0;
+    uint32_t flags = SpinlockAcquireIrqSave(&pmmLock);
+
     // Find first free page
-    for (size_t i = 0; i < bitmapSize; i++) {
+    for (size_t i = 0; i < bitmapSize && addr == 0; i++) {
         if (pageBitmap[i] != 0xFFFFFFFF) {
             // This uint32_t has at least one free page
             for (size_t bit = 0; bit < 32; bit++) {
                 size_t page = i * 32 + bit;
                 if (page >= totalPages) {
-                    return 0;  // Out of bounds
+                    break;  // Out of bounds
                 }
 
                 if (!BITMAP_TEST(page)) {
                     // Found free page
                     markPageUsed(page);
-                    return pageToAddress(page);
+                    addr = pageToAddress(page);
+                    break;
                 }
             }
         }
     }
 
-    // Out of memory
-    return 0;
+    SpinlockReleaseIrqRestore(&pmmLock, flags);
+    return addr;  // 0 if out of memory
 }
 
 /*
@@ -210,7 +216,10 @@ void PmmFreePage(uintptr_t addr)
     }
 
     size_t page = addressToPage(addr);
+
+    uint32_t flags = SpinlockAcquireIrqSave(&pmmLock);
     markPageFree(page);
+    SpinlockReleaseIrqRestore(&pmmLock, flags);
 }
 
 /*
@@ -226,7 +235,7 @@ size_t PmmGetTotalMemory(void)
  */
 size_t PmmGetFreeMemory(void)
 {
-    return freePages * PAGE_SIZE;
+    return PerCpuCounterRead(PER_CPU_PMM_FREE_PAGES) * PAGE_SIZE;
 }
 
 /*
@@ -234,5 +243,5 @@ size_t PmmGetFreeMemory(void)
  */
 size_t PmmGetUsedMemory(void)
 {
-    return usedPages * PAGE_SIZE;
+    return PerCpuCounterRead(PER_CPU_PMM_USED_PAGES) * PAGE_SIZE;
 }
@@ -0,0 +1,65 @@
+/* preempt.c - Per-CPU preemption control */
+
+#include "preempt.h"
+#include "percpu.h"
+#include "process.h"
+#include "panic.h"
+#include "x86.h"
+
+/*
+ * PreemptDisable - Keep the current process on this CPU until PreemptEnable()
+ *
+ * A single increment of this CPU's count through GS: a switch either
+ * happens before it, and the count is the new CPU's, or not until after.
+ */
+void PreemptDisable(void)
+{
+    PER_CPU_ADD(preemptCount, 1);
+}
+
+/*
+ * PreemptEnable - Undo PreemptDisable(), switching if a reschedule is pending
+ */
+void PreemptEnable(void)
+{
+    uint32_t flags = irq_save();
+    uint32_t count = PER_CPU_READ(preemptCount);
+    KAssert(count > 0, "Preempt count underflow on CPU %u", PER_CPU_READ(cpu));
+    PER_CPU_WRITE(preemptCount, count - 1);
+
+    // With interrupts off the switch waits for their return instead
+    if (count == 1 && (flags & EFLAGS_IF)) {
+        ProcessPreemptIrq();
+    }
+    irq_restore(flags);
+}
+
+/*
+ * PreemptEnableNoResched - Undo PreemptDisable() without a preemption point
+ */
+void PreemptEnableNoResched(void)
+{
+    KAssert(PER_CPU_READ(preemptCount) > 0, "Preempt count underflow on CPU %u",
+            PER_CPU_READ(cpu));
+    PER_CPU_ADD(preemptCount, -1);
+}
+
+/*
+ * PreemptCheck - Switch now if a reschedule is pending and allowed
+ */
+void PreemptCheck(void)
+{
+    uint32_t flags = irq_save();
+    if (flags & EFLAGS_IF) {
+        ProcessPreemptIrq();
+    }
+    irq_restore(flags);
+}
+
+/*
+ * PreemptGetCount - This CPU's preempt count
+ */
+uint32_t PreemptGetCount(void)
+{
+    return PER_CPU_READ(preemptCount);
+}
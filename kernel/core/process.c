@@ -1,11 +1,25 @@
 /* process.c - Process Management Implementation */
 
 #include "process.h"
+#include "sched.h"
+#include "tsc.h"
+#include "timer.h"
+#include "x86.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "smp.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "preempt.h"
+#include "softirq.h"
+#include "rcu.h"
 #include "kheap.h"
 #include "pmm.h"
 #include "paging.h"
 #include "isr.h"
+#include "kcmdline.h"
 #include "panic.h"
+#include "clc/string.h"
 #include "clc/printf.h"
 #include "econ_writer.h"
 #include "vid_writer.h"
@@ -14,19 +28,140 @@
 /* Memory layout constants */
 #define KERNEL_STACK_SIZE 8192  // 8 KB kernel stack per process
 
+/*
+ * Each thread's PCB and kernel stack come from an arena of its own, in
+ * one heap block: created together, freed together by ProcessDestroy().
+ */
+#define PROCESS_ARENA_SIZE (sizeof(ClkArenaChunk) + sizeof(ClkArena) + sizeof(Process) + \
+                            KERNEL_STACK_SIZE + 3 * CLK_ARENA_ALIGN)
+
+/* Exited processes the reaper lets pile up before it is woken (idle wakes it sooner) */
+#define REAPER_BATCH      8
+
+/* Load balancing: periodic pass interval, and how long a process stays cache hot */
+#define BALANCE_INTERVAL_MS 100
+#define BALANCE_HOT_NS      500000ull
+
+/*
+ * CpuRunQueue - Per-CPU scheduler state
+ *
+ * The lock covers these fields, the scheduling classes' queues for the
+ * CPU and the state of every process on them. It is only taken with
+ * interrupts off, and is held across switchTo(): the process switched
+ * in releases it in finishSwitch().
+ */
+typedef struct {
+    Spinlock lock;
+    Process* current;           // Running process (also PerCpu::current)
+    Process* idle;              // PID 0 of this CPU; runs when no class has work
+    Process* prev;              // Just switched out, for finishSwitch()
+    bool needResched;           // Switch on the way out of the next interrupt
+    uint32_t nrRunning;         // Ready and running processes, idle not counted
+    ClkListNode processes;      // Every process assigned here except idle
+    uint32_t balanceTicks;      // Ticks until the next periodic balance
+    uint64_t switches;          // Context switches on this CPU
+    uint64_t steals;            // Processes stolen while out of work
+    uint64_t migrations;        // Processes moved here by the balancer
+    uint64_t start;             // Clock when idle time started counting (ns)
+} CpuRunQueue;
+
 /* Process management state */
-static Process* currentProcess = NULL;
-static Process* readyQueueHead = NULL;
-static Process* readyQueueTail = NULL;
+static CpuRunQueue runQueues[SMP_MAX_CPUS];
 static uint32_t nextPid = 1;
 static bool schedulerEnabled = false;
+static uint32_t balanceInterval = 1;    // Ticks between periodic balance passes
+static uint32_t isolatedCpus = 0;       // isolcpus=: kept out of placement and balancing
+static uint32_t defaultAffinity = PROCESS_AFFINITY_ALL;
+
+/* Exited processes waiting to be freed, linked through next */
+static Spinlock zombieLock = SPINLOCK_INIT;
+static Process* zombieList = NULL;
+static uint32_t zombieCount = 0;
+static Process* reaperProcess = NULL;
+
+/* Scheduling class, chosen with sched=<name> */
+static const SchedClass* schedClass = &SchedRoundRobinClass;
+static const SchedClass* const schedClasses[] = {
+    &SchedRoundRobinClass,
+    &SchedFairClass,
+    &SchedFeedbackClass,
+};
+
+/* Deadline processes are always picked ahead of schedClass */
+static const SchedClass* const deadlineClass = &SchedDeadlineClass;
+
+/* Kernel stack switch (arch/i386/switch_to.s) */
+extern void switchTo(uintptr_t* prevEsp, uintptr_t nextEsp);
 
 /* Forward declarations */
-static void processEntry(void);
-static void enqueueProcess(Process* process);
-static Process* dequeueProcess(void);
-static void saveContext(Process* process, registers_t* regs);
-static void restoreContext(Process* process, registers_t* regs);
+static Process* createIdle(uint32_t cpu);
+static Process* createProcess(const char* name, void (*entryPoint)(void), ProcessMode mode,
+                              uint32_t priority, Process* owner, void* data);
+static uint32_t pickCpu(uint32_t affinity);
+static void fixAffinity(Process* process);
+static uint32_t parseCpuList(const char* list);
+static void processEntry(void (*entryPoint)(void));
+static void reaperMain(void);
+static void reapLater(Process* process);
+static void sleepTimeout(void* data);
+static void chargeCurrent(CpuRunQueue* rq);
+static bool runClassTimers(Process* current);
+static void wakePreempt(CpuRunQueue* rq, Process* process);
+static void schedule(CpuRunQueue* rq);
+static void finishSwitch(void);
+static bool idleSteal(CpuRunQueue* rq);
+static bool rebalance(CpuRunQueue* rq);
+static void balanceSoftirq(void);
+
+/*
+ * classOf - Scheduling class a process belongs to
+ */
+static inline const SchedClass* classOf(Process* process)
+{
+    return process->policy == PROCESS_POLICY_DEADLINE ? deadlineClass : schedClass;
+}
+
+/*
+ * thisRq - Run queue of the calling CPU (interrupts must be off)
+ */
+static inline CpuRunQueue* thisRq(void)
+{
+    return PER_CPU_READ(runQueue);
+}
+
+/*
+ * isIdle - Check whether a process is one of the idle processes
+ */
+static inline bool isIdle(Process* process)
+{
+    return process == runQueues[process->cpu].idle;
+}
+
+/*
+ * cpuAllowed - Check a CPU against a process's affinity mask
+ */
+static inline bool cpuAllowed(Process* process, uint32_t cpu)
+{
+    return (process->affinity & (1u << cpu)) != 0;
+}
+
+/*
+ * lockRunQueue - Lock the run queue a process is on (interrupts must be off)
+ *
+ * Rechecks the CPU once the lock is held, in case the process moved
+ * while we waited for it.
+ */
+static CpuRunQueue* lockRunQueue(Process* process)
+{
+    while (1) {
+        CpuRunQueue* rq = &runQueues[__atomic_load_n(&process->cpu, __ATOMIC_RELAXED)];
+        SpinlockAcquire(&rq->lock);
+        if (rq == &runQueues[process->cpu]) {
+            return rq;
+        }
+        SpinlockRelease(&rq->lock);
+    }
+}
 
 /*
  * ProcessInitialize - Initialize the process management system
@@ -36,142 +171,352 @@ void ProcessInitialize(void)
     ClcWriter* serial = EConGetWriter();
     ClcPrintfWriter(serial, "Initializing process management...\n");
 
+    // Pick the scheduling class
+    const char* schedArg = KCmdLineGetValue("sched");
+    if (schedArg) {
+        bool found = false;
+        for (size_t i = 0; i < sizeof(schedClasses) / sizeof(schedClasses[0]); i++) {
+            if (ClcStrEqual(schedArg, schedClasses[i]->name)) {
+                schedClass = schedClasses[i];
+                found = true;
+            }
+        }
+        if (!found) {
+            ClcPrintfWriter(serial, "Unknown sched=%s, using %s\n", schedArg, schedClass->name);
+        }
+    }
+    schedClass->initialize();
+    deadlineClass->initialize();
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        SpinlockInit(&runQueues[cpu].lock);
+        ClkListInit(&runQueues[cpu].processes);
+        PerCpuGetArea(cpu)->runQueue = &runQueues[cpu];
+    }
+    balanceInterval = (uint32_t)TimerMsToTicks(BALANCE_INTERVAL_MS);
+    SoftirqRegister(SOFTIRQ_SCHED, balanceSoftirq);
+
+    // CPUs reserved for processes pinned there; the boot CPU always stays general
+    const char* isolArg = KCmdLineGetValue("isolcpus");
+    if (isolArg) {
+        isolatedCpus = parseCpuList(isolArg);
+        if (isolatedCpus & 1u) {
+            ClcPrintfWriter(serial, "isolcpus: CPU 0 cannot be isolated\n");
+            isolatedCpus &= ~1u;
+        }
+        defaultAffinity = PROCESS_AFFINITY_ALL & ~isolatedCpus;
+        ClcPrintfWriter(serial, "isolcpus: mask 0x%x\n", isolatedCpus);
+    }
+
     // Create the initial kernel process (represents current execution context)
-    currentProcess = (Process*)KAllocateMemory(sizeof(Process));
-    if (!currentProcess) {
+    Process* idle = createIdle(0);
+    if (!idle) {
         ClcPrintfWriter(serial, "Failed to allocate initial process!\n");
         return;
     }
 
-    // Initialize fields
-    currentProcess->pid = 0;
-    const char* initName = "idle";
-    for (int i = 0; i < 32; i++) currentProcess->name[i] = 0;
-    for (int i = 0; initName[i] && i < 31; i++) {
-        currentProcess->name[i] = initName[i];
+    // Never queued in the scheduling class
+    runQueues[0].current = idle;
+    runQueues[0].idle = idle;
+    PerCpuGetArea(0)->current = idle;
+    runQueues[0].start = idle->execStart;
+
+    // Frees the stacks and PCBs of exited processes
+    reaperProcess = ProcessCreate("reaper", reaperMain, PROCESS_MODE_KERNEL);
+    if (!reaperProcess) {
+        KPanic("Failed to create reaper process");
     }
 
-    currentProcess->state = PROCESS_STATE_RUNNING;
-    currentProcess->mode = PROCESS_MODE_KERNEL;
-    currentProcess->pageDirectory = PagingGetCurrentDirectory();
-    currentProcess->kernelStack = 0;  // Using boot stack
-    currentProcess->userStack = 0;
-    currentProcess->timeslice = 10;
-    currentProcess->priority = 0;
-    currentProcess->next = NULL;
+    ClcPrintfWriter(serial, "Process management initialized (PID 0: idle, scheduler: %s)\n",
+                    schedClass->name);
+}
 
-    // Initialize ready queue
-    readyQueueHead = NULL;
-    readyQueueTail = NULL;
+/*
+ * ProcessInitializeCpu - Give an application processor its run queue
+ */
+void ProcessInitializeCpu(uint32_t cpu)
+{
+    Process* idle = createIdle(cpu);
+    if (!idle) {
+        KPanic("Failed to allocate idle process for CPU %u", cpu);
+    }
 
-    ClcPrintfWriter(serial, "Process management initialized (PID 0: idle)\n");
+    CpuRunQueue* rq = &runQueues[cpu];
+    uint32_t flags = irq_save();
+    SpinlockAcquire(&rq->lock);
+    rq->current = idle;
+    rq->idle = idle;
+    rq->start = idle->execStart;
+    rq->balanceTicks = balanceInterval;
+    PerCpuGetArea(cpu)->current = idle;
+    SpinlockRelease(&rq->lock);
+    irq_restore(flags);
 }
 
 /*
  * ProcessCreate - Create a new process
  */
 Process* ProcessCreate(const char* name, void (*entryPoint)(void), ProcessMode mode)
+{
+    return ProcessCreateWithPriority(name, entryPoint, mode, PROCESS_PRIORITY_DEFAULT);
+}
+
+/*
+ * ProcessCreateWithPriority - Create a new process with a given priority
+ */
+Process* ProcessCreateWithPriority(const char* name, void (*entryPoint)(void),
+                                   ProcessMode mode, uint32_t priority)
+{
+    return createProcess(name, entryPoint, mode, priority, NULL, NULL);
+}
+
+/*
+ * ProcessCreateWithData - Create a kernel process handed a pointer
+ */
+Process* ProcessCreateWithData(const char* name, void (*entryPoint)(void), uint32_t priority,
+                               void* data)
+{
+    return createProcess(name, entryPoint, PROCESS_MODE_KERNEL, priority, NULL, data);
+}
+
+/*
+ * ProcessCreateThread - Start another thread in an existing process
+ */
+Process* ProcessCreateThread(Process* parent, const char* name, void (*entryPoint)(void))
+{
+    if (!parent || isIdle(parent)) return NULL;
+
+    return createProcess(name, entryPoint, parent->mode, parent->basePriority, parent->owner,
+                         NULL);
+}
+
+/*
+ * createProcess - Create a thread, and a new process for it unless owner is given
+ */
+static Process* createProcess(const char* name, void (*entryPoint)(void), ProcessMode mode,
+                              uint32_t priority, Process* owner, void* data)
 {
     ClcWriter* serial = EConGetWriter();
 
-    // Allocate process structure
-    Process* process = (Process*)KAllocateMemory(sizeof(Process));
+    if (priority > PROCESS_PRIORITY_LOWEST) {
+        priority = PROCESS_PRIORITY_LOWEST;
+    }
+
+    // Allocate kernel stack and process structure; the stack comes first so
+    // that it does not grow down into the PCB
+    ClkArena* arena = ClkArenaCreate(KHeapGetAllocator(), PROCESS_ARENA_SIZE);
+    uintptr_t kernelStack = arena ? (uintptr_t)ClkArenaAlloc(arena, KERNEL_STACK_SIZE) : 0;
+    Process* process = kernelStack ? (Process*)ClkArenaAlloc(arena, sizeof(Process)) : NULL;
     if (!process) {
-        ClcPrintfWriter(serial, "Failed to allocate process structure\n");
+        ClcPrintfWriter(serial, "Failed to allocate process structure and kernel stack\n");
+        ClkArenaDestroy(arena);
         return NULL;
     }
-
-    // Initialize basic fields
-    process->pid = nextPid++;
+    process->arena = arena;
+    process->kernelStack = kernelStack;
+
+    // Initialize basic fields; a new process's ID is that of its first thread
+    process->tid = __atomic_fetch_add(&nextPid, 1, __ATOMIC_RELAXED);
+    process->pid = owner ? owner->pid : process->tid;
+    process->owner = owner ? owner : process;
+    process->threadCount = 1;
     for (int i = 0; i < 32; i++) process->name[i] = 0;
     for (int i = 0; name && name[i] && i < 31; i++) {
         process->name[i] = name[i];
     }
     process->state = PROCESS_STATE_READY;
     process->mode = mode;
-    process->timeslice = 10;
-    process->priority = 0;
+    process->affinity = owner ? owner->affinity : defaultAffinity;
+    process->cpu = pickCpu(process->affinity);
+    ClkListInit(&process->cpuNode);
+    process->lastRan = 0;
+    process->policy = PROCESS_POLICY_NORMAL;
+    process->priority = priority;
+    process->basePriority = priority;
+    process->blockedOn = NULL;
+    ClkListInit(&process->heldMutexes);
+    process->runtime = 0;
+    process->execStart = 0;
+    process->quantum = 0;
+    process->timeslice = 0;
+    process->vruntime = 0;
+    process->sliceStart = 0;
+    process->mlfqLevel = 0;
+    process->mlfqBoostEpoch = 0;
+    process->mlfqUsed = 0;
+    process->dlRuntime = 0;
+    process->dlDeadline = 0;
+    process->dlPeriod = 0;
+    process->dlBandwidth = 0;
+    process->dlAbsDeadline = 0;
+    process->dlBudget = 0;
+    process->dlThrottled = false;
+    process->dlMissed = false;
+    process->dlMisses = 0;
+    process->data = data;
     process->next = NULL;
 
-    // Allocate kernel stack
-    process->kernelStack = (uintptr_t)KAllocateMemory(KERNEL_STACK_SIZE);
-    if (!process->kernelStack) {
-        ClcPrintfWriter(serial, "Failed to allocate kernel stack\n");
-        KFreeMemory(process);
+    // FPU registers are only loaded once the process uses them
+    process->fpuState = FpuStateAllocate();
+    if (!process->fpuState) {
+        ClcPrintfWriter(serial, "Failed to allocate FPU state\n");
+        ClkArenaDestroy(arena);
         return NULL;
     }
 
-    // For now, all processes use the kernel page directory
-    process->pageDirectory = PagingGetCurrentDirectory();
+    // Threads share their process's address space; for now every process
+    // uses the kernel page directory
+    process->pageDirectory = owner ? owner->pageDirectory : PagingGetCurrentDirectory();
     process->userStack = 0;
+    if (owner) {
+        __atomic_add_fetch(&owner->threadCount, 1, __ATOMIC_RELAXED);
+    }
 
-    // Set up initial context
-    // We'll manually create a context that looks like it was interrupted
-    // Stack grows downward
-    uintptr_t stackTop = process->kernelStack + KERNEL_STACK_SIZE;
-
-    // Set up the stack to contain:
-    // 1. Entry point address (for wrapper to call)
-    // 2. Fake interrupt frame
-
-    uint32_t* stack = (uint32_t*)stackTop;
+    // Build the stack switchTo() expects to find: callee-saved registers,
+    // then a return into processEntry() with the entry point as its
+    // argument. Every process starts in kernel mode for now; user mode
+    // needs a TSS to get back from ring 3.
+    uint32_t* stack = (uint32_t*)(process->kernelStack + KERNEL_STACK_SIZE);
+    *(--stack) = (uint32_t)entryPoint;      // processEntry() argument
+    *(--stack) = 0;                         // processEntry() return address (never used)
+    *(--stack) = (uint32_t)processEntry;    // switchTo() returns here
+    *(--stack) = 0;                         // EBP
+    *(--stack) = 0;                         // EBX
+    *(--stack) = 0;                         // ESI
+    *(--stack) = 0;                         // EDI
+    process->kernelEsp = (uintptr_t)stack;
+
+    // Add to its CPU's ready queue
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
+    ClkListAddTail(&rq->processes, &process->cpuNode);
+    schedClass->enqueue(process);
+    rq->nrRunning++;
+    wakePreempt(rq, process);
+    SpinlockRelease(&rq->lock);
+    irq_restore(flags);
+
+    if (owner) {
+        ClcPrintfWriter(serial, "Created thread TID %u of PID %u: %s (CPU %u)\n",
+                        process->tid, process->pid, process->name, process->cpu);
+    } else {
+        ClcPrintfWriter(serial, "Created process PID %u: %s (%s mode, priority %u, CPU %u)\n",
+                        process->pid, process->name,
+                        mode == PROCESS_MODE_KERNEL ? "kernel" : "user", priority, process->cpu);
+    }
 
-    // Push entry point (will be used by processEntry wrapper)
-    *(--stack) = (uint32_t)entryPoint;
+    return process;
+}
 
-    // Now set up fake interrupt frame (as if process was interrupted)
-    // This matches what the isr_common_stub expects when returning
+/*
+ * ProcessSetQuantum - Override the timeslice length of a process
+ */
+void ProcessSetQuantum(Process* process, uint32_t ticks)
+{
+    if (!process) return;
 
-    if (mode == PROCESS_MODE_USER) {
-        // User mode (not fully implemented yet)
-        *(--stack) = 0x23;      // SS (user data segment with RPL=3)
-        *(--stack) = 0xC0000000;  // User ESP
-    }
+    process->quantum = ticks;
+}
 
-    *(--stack) = 0x202;         // EFLAGS (IF=1, reserved bit 1=1)
-    *(--stack) = (mode == PROCESS_MODE_KERNEL) ? 0x08 : 0x1B;  // CS
-    *(--stack) = (uint32_t)processEntry;  // EIP (entry wrapper)
+/*
+ * ProcessSetDeadline - Give a process a real-time CPU reservation
+ */
+bool ProcessSetDeadline(Process* process, uint32_t runtimeNs,
+                        uint32_t deadlineNs, uint32_t periodNs)
+{
+    if (!process || isIdle(process)) return false;
+
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
+
+    // A queued process moves between (or within) class queues
+    bool queued = process->state == PROCESS_STATE_READY;
+    bool admitted = true;
+
+    if (runtimeNs == 0) {
+        if (process->policy == PROCESS_POLICY_DEADLINE) {
+            if (queued) {
+                deadlineClass->dequeue(process);
+            }
+            SchedDeadlineRelease(process);
+            process->policy = PROCESS_POLICY_NORMAL;
+            if (queued) {
+                schedClass->enqueue(process);
+            }
+        }
+    } else if (!cpuAllowed(process, process->cpu)) {
+        // Due to move off this CPU, which would leave the reservation behind
+        admitted = false;
+    } else {
+        if (queued) {
+            classOf(process)->dequeue(process);
+        }
 
-    *(--stack) = 0;             // Error code (not used)
-    *(--stack) = 0;             // Interrupt number (not used)
+        admitted = SchedDeadlineAdmit(process, runtimeNs, deadlineNs, periodNs);
+        if (admitted) {
+            process->policy = PROCESS_POLICY_DEADLINE;
+        }
 
-    *(--stack) = (mode == PROCESS_MODE_KERNEL) ? 0x10 : 0x23;  // DS
+        if (queued) {
+            classOf(process)->enqueue(process);
+            wakePreempt(rq, process);
+        }
+    }
 
-    // PUSHA register values (all zeroed for new process)
-    *(--stack) = 0;             // EDI
-    *(--stack) = 0;             // ESI
-    *(--stack) = 0;             // EBP
-    *(--stack) = 0;             // ESP (ignored by POPA)
-    *(--stack) = 0;             // EBX
-    *(--stack) = 0;             // EDX
-    *(--stack) = 0;             // ECX
-    *(--stack) = 0;             // EAX
+    SpinlockRelease(&rq->lock);
+    irq_restore(flags);
+    PreemptCheck();
+    return admitted;
+}
 
-    // Now set the process's ESP to point to this prepared stack
-    process->context.esp = (uint32_t)stack;
-    process->context.eip = (uint32_t)processEntry;
-    process->context.cs = (mode == PROCESS_MODE_KERNEL) ? 0x08 : 0x1B;
-    process->context.eflags = 0x202;
-    process->context.ss = (mode == PROCESS_MODE_KERNEL) ? 0x10 : 0x23;
-    process->context.ds = (mode == PROCESS_MODE_KERNEL) ? 0x10 : 0x23;
-    process->context.es = process->context.ds;
-    process->context.fs = process->context.ds;
-    process->context.gs = process->context.ds;
+/*
+ * ProcessSetAffinity - Restrict the CPUs a process may run on
+ */
+bool ProcessSetAffinity(Process* process, uint32_t mask)
+{
+    if (!process || isIdle(process)) return false;
 
-    // Other registers
-    process->context.eax = process->context.ebx = process->context.ecx = 0;
-    process->context.edx = process->context.esi = process->context.edi = 0;
-    process->context.ebp = 0;
-    process->context.useresp = (mode == PROCESS_MODE_USER) ? 0xC0000000 : 0;
+    uint32_t online = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (SmpIsCpuOnline(cpu)) {
+            online |= 1u << cpu;
+        }
+    }
+    if ((mask & online) == 0) {
+        return false;
+    }
 
-    // Add to ready queue
-    enqueueProcess(process);
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
 
-    ClcPrintfWriter(serial, "Created process PID %u: %s (%s mode)\n",
-                    process->pid, process->name,
-                    mode == PROCESS_MODE_KERNEL ? "kernel" : "user");
+    // Admission is per CPU, so a deadline process may not leave its own
+    if (process->policy == PROCESS_POLICY_DEADLINE && !(mask & (1u << process->cpu))) {
+        SpinlockRelease(&rq->lock);
+        irq_restore(flags);
+        return false;
+    }
+    process->affinity = mask;
+
+    // A running process moves once it is switched out (see finishSwitch());
+    // a blocked one when it is woken
+    bool moveNow = false;
+    if (!cpuAllowed(process, process->cpu)) {
+        if (process->state == PROCESS_STATE_RUNNING) {
+            rq->needResched = true;
+            if (rq != thisRq()) {
+                SmpSendIpi(process->cpu, SMP_VECTOR_RESCHEDULE);
+            }
+        } else if (process->state == PROCESS_STATE_READY) {
+            moveNow = true;
+        }
+    }
+    SpinlockRelease(&rq->lock);
 
-    return process;
+    if (moveNow) {
+        fixAffinity(process);
+    }
+    irq_restore(flags);
+    return true;
 }
 
 /*
@@ -181,13 +526,31 @@ void ProcessDestroy(Process* process)
 {
     if (!process) return;
 
-    // Free kernel stack
-    if (process->kernelStack) {
-        KFreeMemory((void*)process->kernelStack);
+    // Take it off the run queues and give back any reservation
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
+    if (process->state == PROCESS_STATE_READY) {
+        classOf(process)->dequeue(process);
+        rq->nrRunning--;
+    }
+    if (process->policy == PROCESS_POLICY_DEADLINE) {
+        SchedDeadlineRelease(process);
     }
+    ClkListRemove(&process->cpuNode);
+    SpinlockRelease(&rq->lock);
+    irq_restore(flags);
+
+    FpuStateFree(process->fpuState);
 
-    // Free process structure
-    KFreeMemory(process);
+    // The first thread's PCB stands for the process and its address space,
+    // so its arena (and with it its unused stack) goes with the last thread
+    Process* owner = process->owner;
+    if (process != owner) {
+        ClkArenaDestroy(process->arena);
+    }
+    if (__atomic_sub_fetch(&owner->threadCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        ClkArenaDestroy(owner->arena);
+    }
 }
 
 /*
@@ -195,7 +558,17 @@ void ProcessDestroy(Process* process)
  */
 Process* ProcessGetCurrent(void)
 {
-    return currentProcess;
+    // Whichever CPU we are on when the read happens, we are its current
+    return PER_CPU_READ(current);
+}
+
+/*
+ * ProcessGetData - The pointer the current process was created with
+ */
+void* ProcessGetData(void)
+{
+    Process* current = ProcessGetCurrent();
+    return current ? current->data : NULL;
 }
 
 /*
@@ -205,8 +578,21 @@ void ProcessYield(void)
 {
     if (!schedulerEnabled) return;
 
-    // Software interrupt to trigger scheduler
-    __asm__ volatile ("int $0x81");
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = thisRq();
+    if (!rq->current) {
+        irq_restore(flags);
+        return;
+    }
+
+    SpinlockAcquire(&rq->lock);
+    chargeCurrent(rq);
+    if (rq->current->state == PROCESS_STATE_RUNNING && rq->current != rq->idle) {
+        classOf(rq->current)->yield(rq->current);
+    }
+    schedule(rq);
+
+    irq_restore(flags);
 }
 
 /*
@@ -216,48 +602,108 @@ void ProcessSchedule(registers_t* regs)
 {
     KAssert(regs != NULL, "ProcessSchedule called with NULL registers");
 
-    if (!schedulerEnabled || !currentProcess) {
+    // Only CPU 0 takes the PIT interrupt; the others get it as an IPI
+    if (SmpGetCurrentCpu() == 0) {
+        SmpForwardTick(false);
+    }
+
+    CpuRunQueue* rq = thisRq();
+    if (!schedulerEnabled || !rq->current) {
         return;
     }
 
-    // Save current process state
-    if (currentProcess->state == PROCESS_STATE_RUNNING) {
-        saveContext(currentProcess, regs);
-        currentProcess->state = PROCESS_STATE_READY;
-        currentProcess->timeslice--;
+    // A tick that interrupted neither a read-side section nor any other
+    // preemption-disabled code is a quiescent state
+    RcuTick(rq->current == rq->idle || PreemptGetCount() == 0);
 
-        // Re-queue if still has time or reset timeslice
-        if (currentProcess->timeslice == 0) {
-            currentProcess->timeslice = 10;
-        }
-        enqueueProcess(currentProcess);
-    } else if (currentProcess->state == PROCESS_STATE_TERMINATED) {
-        // Process is terminated, don't save context or re-queue
-        // It will be cleaned up later (for now just leave it)
+    // Charge the tick; ProcessPreemptIrq() switches if the turn is over
+    SpinlockAcquire(&rq->lock);
+    Process* current = rq->current;
+    chargeCurrent(rq);
+    if (runClassTimers(current)) {
+        rq->needResched = true;
+    }
+    if (current != rq->idle && classOf(current)->tick(current)) {
+        rq->needResched = true;
     }
 
-    // Get next process from ready queue
-    Process* nextProcess = dequeueProcess();
+    // An idle CPU looks for work on every tick, a busy one now and then;
+    // the search runs in the softirq, with interrupts back on
+    if (current == rq->idle) {
+        SoftirqRaise(SOFTIRQ_SCHED);
+    } else if (--rq->balanceTicks == 0) {
+        rq->balanceTicks = balanceInterval;
+        SoftirqRaise(SOFTIRQ_SCHED);
+    }
+    SpinlockRelease(&rq->lock);
+}
 
-    if (!nextProcess) {
-        // No process to run, keep current
-        currentProcess->state = PROCESS_STATE_RUNNING;
+/*
+ * ProcessPreemptIrq - Switch processes on the way out of an interrupt
+ */
+void ProcessPreemptIrq(void)
+{
+    CpuRunQueue* rq = thisRq();
+    if (!schedulerEnabled || !__atomic_load_n(&rq->needResched, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Interrupted a lock holder or a PreemptDisable() section; its
+    // PreemptEnable() switches instead
+    if (PreemptGetCount() != 0) {
         return;
     }
 
-    // Switch to next process
-    Process* oldProcess = currentProcess;
-    currentProcess = nextProcess;
-    currentProcess->state = PROCESS_STATE_RUNNING;
-    currentProcess->timeslice = 10;
+    SpinlockAcquire(&rq->lock);
+    chargeCurrent(rq);
+    schedule(rq);
+}
+
+/*
+ * ProcessGetSwitchCount - Number of context switches since boot
+ */
+uint64_t ProcessGetSwitchCount(void)
+{
+    uint64_t switches = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        CpuRunQueue* rq = &runQueues[cpu];
+        uint32_t flags = SpinlockAcquireIrqSave(&rq->lock);
+        switches += rq->switches;
+        SpinlockReleaseIrqRestore(&rq->lock, flags);
+    }
+
+    return switches;
+}
+
+/*
+ * ProcessScheduleSubTick - Scheduler work between ticks
+ */
+void ProcessScheduleSubTick(registers_t* regs)
+{
+    (void)regs;
 
-    // Switch page directory if different
-    if (oldProcess->pageDirectory != currentProcess->pageDirectory) {
-        PagingSwitchDirectory((uintptr_t)currentProcess->pageDirectory);
+    if (SmpGetCurrentCpu() == 0) {
+        SmpForwardTick(true);
+    }
+
+    CpuRunQueue* rq = thisRq();
+    if (!schedulerEnabled || !rq->current) {
+        return;
     }
 
-    // Restore new process context into interrupt frame
-    restoreContext(currentProcess, regs);
+    // Normal classes count their slices in whole ticks, so only deadline
+    // budgets are checked here; a pending preemption is honoured either way
+    SpinlockAcquire(&rq->lock);
+    Process* current = rq->current;
+    chargeCurrent(rq);
+    if (runClassTimers(current)) {
+        rq->needResched = true;
+    }
+    if (current->policy == PROCESS_POLICY_DEADLINE && deadlineClass->tick(current)) {
+        rq->needResched = true;
+    }
+    SpinlockRelease(&rq->lock);
 }
 
 /*
@@ -265,10 +711,131 @@ void ProcessSchedule(registers_t* regs)
  */
 void ProcessBlock(void)
 {
-    if (!currentProcess || !schedulerEnabled) return;
+    if (!schedulerEnabled) return;
+
+    // A wakeup must not find us BLOCKED but still running
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = thisRq();
+    if (!rq->current) {
+        irq_restore(flags);
+        return;
+    }
 
-    currentProcess->state = PROCESS_STATE_BLOCKED;
-    ProcessYield();  // Trigger scheduler
+    SpinlockAcquire(&rq->lock);
+    rq->current->state = PROCESS_STATE_BLOCKED;
+    chargeCurrent(rq);
+    schedule(rq);
+
+    irq_restore(flags);
+}
+
+/*
+ * ProcessSleep - Block the current process for a number of milliseconds
+ */
+void ProcessSleep(uint32_t ms)
+{
+    if (!schedulerEnabled) return;
+
+    Process* current = ProcessGetCurrent();
+    if (!current || isIdle(current)) return;
+
+    if (ms == 0) {
+        ProcessYield();
+        return;
+    }
+
+    // A delay of n ticks fires on the (n + 1)th tick from now, so at
+    // least n whole ticks pass however far into this one we are
+    Timer timer;
+    TimerSetup(&timer, sleepTimeout, current);
+
+    // The timer runs on CPU 0 and may fire before we are off this one;
+    // marking ourselves BLOCKED first means it then just sets us running
+    // again and ProcessBlockPrepared() returns at once. Interrupts stay
+    // off until then: a preemption while BLOCKED but before the timer is
+    // armed would switch us out with nothing left to wake us
+    uint32_t flags = irq_save();
+    ProcessPrepareBlock();
+    TimerStart(&timer, TimerMsToTicks(ms));
+    ProcessBlockPrepared();
+    irq_restore(flags);
+
+    // Woken early by someone else's ProcessUnblock()
+    TimerCancel(&timer);
+}
+
+/*
+ * ProcessPrepareBlock - Mark the current process blocked without switching
+ */
+void ProcessPrepareBlock(void)
+{
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = thisRq();
+    if (rq->current) {
+        SpinlockAcquire(&rq->lock);
+        rq->current->state = PROCESS_STATE_BLOCKED;
+        SpinlockRelease(&rq->lock);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * ProcessBlockPrepared - Switch out the current process if it is still blocked
+ */
+void ProcessBlockPrepared(void)
+{
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = thisRq();
+    if (!rq->current) {
+        irq_restore(flags);
+        return;
+    }
+
+    SpinlockAcquire(&rq->lock);
+
+    // Nothing to switch to before the scheduler runs; the caller polls
+    if (rq->current->state != PROCESS_STATE_BLOCKED || !schedulerEnabled) {
+        rq->current->state = PROCESS_STATE_RUNNING;
+        SpinlockRelease(&rq->lock);
+        irq_restore(flags);
+        return;
+    }
+
+    chargeCurrent(rq);
+    schedule(rq);
+    irq_restore(flags);
+}
+
+/*
+ * ProcessSetEffectivePriority - Change the priority a process is scheduled at
+ */
+void ProcessSetEffectivePriority(Process* process, uint32_t priority)
+{
+    if (!process || isIdle(process)) return;
+
+    if (priority > PROCESS_PRIORITY_LOWEST) {
+        priority = PROCESS_PRIORITY_LOWEST;
+    }
+
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
+
+    // Classes file ready processes by priority, so requeue around the change
+    if (process->priority != priority) {
+        bool queued = process->state == PROCESS_STATE_READY;
+        if (queued) {
+            classOf(process)->dequeue(process);
+        }
+        process->priority = priority;
+        if (queued) {
+            classOf(process)->enqueue(process);
+            wakePreempt(rq, process);
+        }
+    }
+
+    SpinlockRelease(&rq->lock);
+    irq_restore(flags);
+    PreemptCheck();
 }
 
 /*
@@ -278,10 +845,36 @@ void ProcessUnblock(Process* process)
 {
     if (!process) return;
 
+    uint32_t flags = irq_save();
+    CpuRunQueue* rq = lockRunQueue(process);
+    bool misplaced = false;
+
     if (process->state == PROCESS_STATE_BLOCKED) {
-        process->state = PROCESS_STATE_READY;
-        enqueueProcess(process);
+        if (process == rq->current) {
+            // Marked BLOCKED but not switched out yet: keep running
+            process->state = PROCESS_STATE_RUNNING;
+        } else {
+            process->state = PROCESS_STATE_READY;
+            classOf(process)->enqueue(process);
+            rq->nrRunning++;
+            if (cpuAllowed(process, process->cpu)) {
+                wakePreempt(rq, process);
+            } else {
+                misplaced = true;
+            }
+        }
     }
+
+    SpinlockRelease(&rq->lock);
+
+    // Its affinity changed while it slept
+    if (misplaced) {
+        fixAffinity(process);
+    }
+    irq_restore(flags);
+
+    // The lock went with interrupts off; switch now if it should run here
+    PreemptCheck();
 }
 
 /*
@@ -289,43 +882,269 @@ void ProcessUnblock(Process* process)
  */
 void ProcessExit(void)
 {
-    if (!currentProcess) return;
+    Process* current = ProcessGetCurrent();
+    if (!current || isIdle(current)) {
+        KPanic("ProcessExit called outside a process");
+    }
 
     ClcWriter* serial = EConGetWriter();
-    ClcPrintfWriter(serial, "Process %u (%s) exiting\n",
-                    currentProcess->pid, currentProcess->name);
+    if (current->owner != current) {
+        ClcPrintfWriter(serial, "Thread %u of process %u (%s) exiting\n",
+                        current->tid, current->pid, current->name);
+    } else {
+        ClcPrintfWriter(serial, "Process %u (%s) exiting\n", current->pid, current->name);
+    }
 
-    currentProcess->state = PROCESS_STATE_TERMINATED;
+    // Never turned back on: the next process runs with its own flags
+    __asm__ volatile ("cli");
+    CpuRunQueue* rq = thisRq();
+    SpinlockAcquire(&rq->lock);
 
-    // Just wait for the next timer interrupt to switch us out
-    // The scheduler will see we're terminated and won't reschedule us
+    current->state = PROCESS_STATE_TERMINATED;
+
+    // Nothing left to reserve time for
+    if (current->policy == PROCESS_POLICY_DEADLINE) {
+        SchedDeadlineRelease(current);
+        current->policy = PROCESS_POLICY_NORMAL;
+    }
+
+    // Nobody will read its FPU registers again; do not save them
+    FpuDrop(current->fpuState);
+
+    // Terminated processes are never picked again. The reaper cannot free
+    // the stack we are standing on, so finishSwitch() hands this process
+    // over once the next one is running
+    chargeCurrent(rq);
+    schedule(rq);
+    KPanic("Process %u resumed after exit", current->pid);
+}
+
+/*
+ * ProcessIdle - Idle loop for PID 0
+ */
+void ProcessIdle(void)
+{
     while (1) {
-        __asm__ volatile ("hlt");
+        __asm__ volatile ("cli");
+
+        // Nothing else to do: a good time to free exited processes
+        if (zombieCount > 0 && reaperProcess->state == PROCESS_STATE_BLOCKED) {
+            ProcessUnblock(reaperProcess);
+            __asm__ volatile ("sti");
+            ProcessYield();
+            continue;
+        }
+
+        // sti only takes effect after the next instruction, so an interrupt
+        // arriving between the check above and hlt still wakes the CPU
+        __asm__ volatile ("sti; hlt");
     }
 }
 
+/*
+ * ProcessGetCpuTimes - Idle and elapsed time of a CPU
+ */
+void ProcessGetCpuTimes(uint32_t cpu, uint64_t* idleNs, uint64_t* elapsedNs)
+{
+    uint64_t idle = 0;
+    uint64_t elapsed = 0;
+
+    if (cpu < SMP_MAX_CPUS && schedulerEnabled) {
+        CpuRunQueue* rq = &runQueues[cpu];
+        uint32_t flags = SpinlockAcquireIrqSave(&rq->lock);
+
+        if (rq->idle) {
+            uint64_t now = TscGetNanoseconds();
+            elapsed = now - rq->start;
+            idle = rq->idle->runtime;
+
+            // Time since the last charge belongs to idle if it is still running
+            if (rq->current == rq->idle) {
+                idle += now - rq->idle->execStart;
+            }
+        }
+
+        SpinlockReleaseIrqRestore(&rq->lock, flags);
+    }
+
+    if (idleNs) *idleNs = idle;
+    if (elapsedNs) *elapsedNs = elapsed;
+}
+
+/*
+ * ProcessGetBalanceStats - Load balancer counters of a CPU
+ */
+void ProcessGetBalanceStats(uint32_t cpu, uint64_t* steals, uint64_t* migrations)
+{
+    uint64_t stolen = 0;
+    uint64_t moved = 0;
+
+    if (cpu < SMP_MAX_CPUS) {
+        CpuRunQueue* rq = &runQueues[cpu];
+        uint32_t flags = SpinlockAcquireIrqSave(&rq->lock);
+        stolen = rq->steals;
+        moved = rq->migrations;
+        SpinlockReleaseIrqRestore(&rq->lock, flags);
+    }
+
+    if (steals) *steals = stolen;
+    if (migrations) *migrations = moved;
+}
+
 /*
  * ProcessEnableScheduler - Enable the scheduler
  */
 void ProcessEnableScheduler(void)
 {
+    // Boot work done before now is not idle time
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        CpuRunQueue* rq = &runQueues[cpu];
+        uint32_t flags = SpinlockAcquireIrqSave(&rq->lock);
+        if (rq->idle) {
+            rq->start = TscGetNanoseconds();
+            rq->idle->execStart = rq->start;
+            rq->idle->runtime = 0;
+        }
+        rq->balanceTicks = balanceInterval;
+        SpinlockReleaseIrqRestore(&rq->lock, flags);
+    }
+
     schedulerEnabled = true;
 }
 
+/*
+ * createIdle - Allocate the idle process of a CPU
+ *
+ * It stands for whatever is already running there (the boot stack on
+ * CPU 0, the AP's startup stack elsewhere) and is never queued.
+ */
+static Process* createIdle(uint32_t cpu)
+{
+    Process* idle = (Process*)KAllocateMemory(sizeof(Process));
+    if (!idle) {
+        return NULL;
+    }
+
+    idle->pid = 0;
+    idle->tid = 0;
+    idle->owner = idle;
+    idle->threadCount = 1;
+    idle->arena = NULL;     // Never destroyed
+    const char* idleName = "idle";
+    for (int i = 0; i < 32; i++) idle->name[i] = 0;
+    for (int i = 0; idleName[i] && i < 31; i++) {
+        idle->name[i] = idleName[i];
+    }
+
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->mode = PROCESS_MODE_KERNEL;
+    idle->cpu = cpu;
+    idle->affinity = 1u << cpu;
+    idle->policy = PROCESS_POLICY_NORMAL;
+    idle->pageDirectory = PagingGetCurrentDirectory();
+    idle->kernelEsp = 0;    // Saved on its first switch out
+    idle->kernelStack = 0;  // Not ours to free
+    idle->userStack = 0;
+    idle->fpuState = FpuStateAllocate();
+    if (!idle->fpuState) {
+        KPanic("Failed to allocate idle FPU state");
+    }
+    idle->priority = PROCESS_PRIORITY_LOWEST;  // Only runs when nothing else can
+    idle->basePriority = PROCESS_PRIORITY_LOWEST;
+    idle->blockedOn = NULL;
+    ClkListInit(&idle->heldMutexes);
+    idle->runtime = 0;
+    idle->execStart = TscGetNanoseconds();
+    idle->quantum = 0;
+    idle->timeslice = 0;
+    idle->vruntime = 0;
+    idle->data = NULL;
+    idle->next = NULL;
+
+    return idle;
+}
+
+/*
+ * pickCpu - Allowed CPU with the fewest runnable processes
+ *
+ * Falls back to CPU 0 if no CPU in the mask is online.
+ */
+static uint32_t pickCpu(uint32_t affinity)
+{
+    uint32_t best = 0;
+    uint32_t bestLoad = 0xFFFFFFFFu;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(affinity & (1u << cpu)) || !SmpIsCpuOnline(cpu) || !runQueues[cpu].idle) {
+            continue;
+        }
+        uint32_t load = __atomic_load_n(&runQueues[cpu].nrRunning, __ATOMIC_RELAXED);
+        if (load < bestLoad) {
+            best = cpu;
+            bestLoad = load;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * parseCpuList - Parse a CPU list such as "1,3" or "2-5" into a mask
+ *
+ * CPUs past SMP_MAX_CPUS and malformed entries are ignored.
+ */
+static uint32_t parseCpuList(const char* list)
+{
+    uint32_t mask = 0;
+    const char* p = list;
+
+    while (*p) {
+        uint32_t first = 0;
+        bool digits = false;
+        while (*p >= '0' && *p <= '9') {
+            first = first * 10 + (uint32_t)(*p++ - '0');
+            digits = true;
+        }
+
+        uint32_t last = first;
+        if (*p == '-') {
+            p++;
+            last = 0;
+            while (*p >= '0' && *p <= '9') {
+                last = last * 10 + (uint32_t)(*p++ - '0');
+            }
+        }
+
+        for (uint32_t cpu = first; digits && cpu <= last && cpu < SMP_MAX_CPUS; cpu++) {
+            mask |= 1u << cpu;
+        }
+
+        // Skip to the next entry
+        while (*p && *p != ',') {
+            p++;
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+
+    return mask;
+}
+
 /*
  * processEntry - Entry wrapper for all processes
  *
- * This function is the first thing that runs when a process starts.
- * The actual entry point is passed on the stack.
+ * This function is the first thing that runs when a process starts:
+ * switchTo() returns into it on the new stack, with interrupts still
+ * disabled and the run queue still locked by whoever called the scheduler.
  */
-static void processEntry(void)
+static void processEntry(void (*entryPoint)(void))
 {
-    // Enable interrupts
+    finishSwitch();
     __asm__ volatile ("sti");
 
-    // Get entry point from stack (placed there during process creation)
-    void (*entryPoint)(void);
-    __asm__ volatile ("mov 4(%%ebp), %0" : "=r"(entryPoint));
+    // Whoever switched to us may have woken something more urgent
+    PreemptCheck();
 
     // Call the actual entry point
     if (entryPoint) {
@@ -337,100 +1156,435 @@ static void processEntry(void)
 }
 
 /*
- * saveContext - Save CPU context from interrupt frame to process
+ * reaperMain - Free exited processes in batches
+ *
+ * Woken once REAPER_BATCH processes have piled up, or by an idle loop as
+ * soon as there is nothing else to run.
  */
-static void saveContext(Process* process, registers_t* regs)
+static void reaperMain(void)
 {
-    if (!process || !regs) return;
+    while (1) {
+        // Take the whole list, or sleep if it is empty; marking ourselves
+        // BLOCKED before letting go of the list means a wakeup from an
+        // exit in between cannot be lost
+        uint32_t flags = SpinlockAcquireIrqSave(&zombieLock);
+        Process* batch = zombieList;
+        zombieList = NULL;
+        zombieCount = 0;
+        if (!batch) {
+            ProcessPrepareBlock();
+        }
+        SpinlockReleaseIrqRestore(&zombieLock, flags);
 
-    // Save general purpose registers (from pusha)
-    process->context.edi = regs->edi;
-    process->context.esi = regs->esi;
-    process->context.ebp = regs->ebp;
-    process->context.esp = regs->esp;
-    process->context.ebx = regs->ebx;
-    process->context.edx = regs->edx;
-    process->context.ecx = regs->ecx;
-    process->context.eax = regs->eax;
+        if (!batch) {
+            ProcessBlockPrepared();
+        }
 
-    // Save segment registers
-    process->context.ds = regs->ds;
-    process->context.es = process->context.fs = process->context.gs = regs->ds;
+        while (batch) {
+            Process* next = batch->next;
+            ProcessDestroy(batch);
+            batch = next;
+        }
+    }
+}
 
-    // Save instruction pointer and flags (from CPU)
-    process->context.eip = regs->eip;
-    process->context.cs = regs->cs;
-    process->context.eflags = regs->eflags;
+/*
+ * reapLater - Hand an exited process that is off the CPU to the reaper
+ */
+static void reapLater(Process* process)
+{
+    SpinlockAcquire(&zombieLock);
+    process->next = zombieList;
+    zombieList = process;
+    bool wake = ++zombieCount >= REAPER_BATCH;
+    SpinlockRelease(&zombieLock);
+
+    if (wake) {
+        ProcessUnblock(reaperProcess);
+    }
+}
 
-    // Save user ESP and SS if available
-    process->context.useresp = regs->useresp;
-    process->context.ss = regs->ss;
+/*
+ * sleepTimeout - Timer callback ending a ProcessSleep()
+ */
+static void sleepTimeout(void* data)
+{
+    ProcessUnblock((Process*)data);
 }
 
 /*
- * restoreContext - Restore CPU context from process to interrupt frame
+ * chargeCurrent - Charge CPU time since the last charge to the running process
  */
-static void restoreContext(Process* process, registers_t* regs)
+static void chargeCurrent(CpuRunQueue* rq)
 {
-    if (!process || !regs) return;
+    Process* current = rq->current;
+    uint64_t now = TscGetNanoseconds();
+    uint64_t delta = now - current->execStart;
 
-    // Restore general purpose registers (will be restored by popa)
-    regs->edi = process->context.edi;
-    regs->esi = process->context.esi;
-    regs->ebp = process->context.ebp;
-    regs->esp = process->context.esp;
-    regs->ebx = process->context.ebx;
-    regs->edx = process->context.edx;
-    regs->ecx = process->context.ecx;
-    regs->eax = process->context.eax;
+    current->execStart = now;
+    current->runtime += delta;
 
-    // Restore segment registers
-    regs->ds = process->context.ds;
+    if (current != rq->idle) {
+        classOf(current)->account(current, delta);
+    }
+}
 
-    // Restore instruction pointer and flags (will be restored by iret)
-    regs->eip = process->context.eip;
-    regs->cs = process->context.cs;
-    regs->eflags = process->context.eflags;
+/*
+ * runClassTimers - Run the classes' timer hooks
+ *
+ * Returns true if one of them wants the running process preempted.
+ */
+static bool runClassTimers(Process* current)
+{
+    bool preempt = deadlineClass->timer(current);
+
+    if (schedClass->timer && schedClass->timer(current)) {
+        preempt = true;
+    }
 
-    // Restore user ESP and SS
-    regs->useresp = process->context.useresp;
-    regs->ss = process->context.ss;
+    return preempt;
 }
 
 /*
- * enqueueProcess - Add process to ready queue
+ * schedule - Put the current process back and switch to the best one
+ *
+ * Called with interrupts disabled and the run queue locked, once the
+ * caller has charged the current process and set its state. Returns with
+ * the lock released when the current process is next switched in, or at
+ * once if it is still the best choice.
  */
-static void enqueueProcess(Process* process)
+static void schedule(CpuRunQueue* rq)
 {
-    if (!process) return;
+    uint32_t cpu = (uint32_t)(rq - runQueues);
+    KAssert(PreemptGetCount() == 1, "Scheduling while atomic: preempt count %u on CPU %u",
+            PreemptGetCount(), cpu);
+    rq->needResched = false;
+
+    // Blocked processes are re-queued by ProcessUnblock(); terminated ones
+    // go to the reaper once off the CPU
+    Process* prev = rq->current;
+    if (prev->state == PROCESS_STATE_RUNNING) {
+        prev->state = PROCESS_STATE_READY;
+        if (prev != rq->idle) {
+            classOf(prev)->putPrev(prev);
+        }
+    } else if (prev != rq->idle) {
+        rq->nrRunning--;
+    }
 
-    process->next = NULL;
+    // Deadline processes first, then the normal class; idle if neither has one
+    Process* next = deadlineClass->pickNext(cpu);
+    if (!next) {
+        next = schedClass->pickNext(cpu);
+    }
+    if (!next && idleSteal(rq)) {
+        next = schedClass->pickNext(cpu);
+    }
+    if (!next) {
+        next = rq->idle;
+    }
+
+    next->state = PROCESS_STATE_RUNNING;
+    if (next == prev) {
+        SpinlockRelease(&rq->lock);
+        return;
+    }
+
+    rq->current = next;
+    PER_CPU_WRITE(current, next);
+    RcuNoteContextSwitch();
+    next->execStart = prev->execStart;
+    prev->lastRan = prev->execStart;
+    rq->switches++;
+
+    // Switch page directory if different; threads of one process share
+    // it, so switching between them keeps the TLB
+    if (prev->pageDirectory != next->pageDirectory) {
+        PagingSwitchDirectory((uintptr_t)next->pageDirectory);
+    }
 
-    if (!readyQueueHead) {
-        readyQueueHead = process;
-        readyQueueTail = process;
+    // prev's FPU registers stay loaded until someone else uses the FPU
+    FpuSwitch(next->fpuState);
+
+    // Interrupts from ring 3 would land on the top of next's stack
+    if (next->kernelStack) {
+        GdtSetKernelStack(cpu, next->kernelStack + KERNEL_STACK_SIZE);
+    }
+
+    // Anything interrupted (and its interrupt frame) stays on prev's stack;
+    // the lock stays held until next is off it
+    rq->prev = prev;
+    switchTo(&prev->kernelEsp, next->kernelEsp);
+    finishSwitch();
+}
+
+/*
+ * finishSwitch - Complete a switch on the side of the process switched in
+ *
+ * Releases the run queue lock schedule() took on the way out, and hands
+ * the previous process to the reaper if it exited.
+ */
+static void finishSwitch(void)
+{
+    CpuRunQueue* rq = thisRq();
+    Process* prev = rq->prev;
+    rq->prev = NULL;
+    SpinlockRelease(&rq->lock);
+
+    if (!prev) {
+        return;
+    }
+    if (prev->state == PROCESS_STATE_TERMINATED) {
+        reapLater(prev);
+    } else if (!cpuAllowed(prev, prev->cpu)) {
+        fixAffinity(prev);
+    }
+}
+
+/*
+ * wakePreempt - Request a reschedule if a newly ready process should run now
+ *
+ * Called with the process's run queue locked. A CPU other than ours is
+ * sent an IPI so it notices on its way out of the interrupt.
+ */
+static void wakePreempt(CpuRunQueue* rq, Process* process)
+{
+    Process* current = rq->current;
+    if (!current) return;
+
+    bool preempt = false;
+    if (current == rq->idle) {
+        preempt = true;
+    } else if (process->policy != current->policy) {
+        // Deadline processes always preempt normal ones, never the reverse
+        preempt = process->policy == PROCESS_POLICY_DEADLINE;
     } else {
-        readyQueueTail->next = process;
-        readyQueueTail = process;
+        preempt = classOf(process)->checkPreempt(current, process);
+    }
+
+    if (!preempt) {
+        return;
+    }
+
+    rq->needResched = true;
+    if (rq != thisRq()) {
+        SmpSendIpi((uint32_t)(rq - runQueues), SMP_VECTOR_RESCHEDULE);
     }
 }
 
 /*
- * dequeueProcess - Remove and return next process from ready queue
+ * canMigrate - Check whether the balancer may move a process to cpu right now
  */
-static Process* dequeueProcess(void)
+static bool canMigrate(Process* process, uint32_t cpu, uint64_t now)
 {
-    if (!readyQueueHead) {
-        return NULL;
+    if (!cpuAllowed(process, cpu)) {
+        return false;
+    }
+
+    // Only processes waiting in a class queue; deadline admission is per CPU
+    if (process->state != PROCESS_STATE_READY || process->policy == PROCESS_POLICY_DEADLINE) {
+        return false;
+    }
+
+    // Only the CPU holding its FPU registers can save them
+    if (FpuIsLoaded(process->fpuState)) {
+        return false;
     }
 
-    Process* process = readyQueueHead;
-    readyQueueHead = process->next;
+    // Ran moments ago: its working set is probably still in that CPU's cache
+    return now - process->lastRan >= BALANCE_HOT_NS;
+}
 
-    if (!readyQueueHead) {
-        readyQueueTail = NULL;
+/*
+ * findBusiest - Online CPU other than rq's with the most runnable processes
+ *
+ * Read without the other run queues' locks, so only a hint.
+ */
+static CpuRunQueue* findBusiest(CpuRunQueue* rq)
+{
+    CpuRunQueue* busiest = NULL;
+    uint32_t busiestLoad = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        CpuRunQueue* other = &runQueues[cpu];
+        if (other == rq || !SmpIsCpuOnline(cpu) || !other->idle ||
+            (isolatedCpus & (1u << cpu))) {
+            continue;
+        }
+        uint32_t load = __atomic_load_n(&other->nrRunning, __ATOMIC_RELAXED);
+        if (load > busiestLoad) {
+            busiest = other;
+            busiestLoad = load;
+        }
     }
 
-    process->next = NULL;
-    return process;
+    return busiest;
+}
+
+/*
+ * moveProcess - Move a ready process between two locked run queues
+ */
+static void moveProcess(Process* process, CpuRunQueue* src, CpuRunQueue* dst)
+{
+    uint32_t cpu = (uint32_t)(dst - runQueues);
+    const SchedClass* sched = classOf(process);
+
+    sched->dequeue(process);
+    if (sched->migrate) {
+        sched->migrate(process, cpu);
+    }
+    ClkListRemove(&process->cpuNode);
+    src->nrRunning--;
+
+    __atomic_store_n(&process->cpu, cpu, __ATOMIC_RELAXED);
+    ClkListAddTail(&dst->processes, &process->cpuNode);
+    sched->enqueue(process);
+    dst->nrRunning++;
+}
+
+/*
+ * pullProcesses - Move up to count ready processes from src to rq
+ *
+ * Both run queues must be locked. The process that has waited longest
+ * since it last ran goes first, as the one with the least left in src's
+ * cache. Returns the number moved.
+ */
+static uint32_t pullProcesses(CpuRunQueue* rq, CpuRunQueue* src, uint32_t count)
+{
+    uint32_t cpu = (uint32_t)(rq - runQueues);
+    uint64_t now = TscGetNanoseconds();
+    uint32_t moved = 0;
+
+    while (moved < count) {
+        Process* coldest = NULL;
+        for (ClkListNode* node = src->processes.next; node != &src->processes; node = node->next) {
+            Process* process = CLK_LIST_ENTRY(node, Process, cpuNode);
+            if (canMigrate(process, cpu, now) && (!coldest || process->lastRan < coldest->lastRan)) {
+                coldest = process;
+            }
+        }
+        if (!coldest) {
+            break;
+        }
+
+        moveProcess(coldest, src, rq);
+        rq->migrations++;
+        moved++;
+    }
+
+    return moved;
+}
+
+/*
+ * idleSteal - Take one ready process from the busiest CPU
+ *
+ * Called with rq locked when it has nothing to run. Only try-locks the
+ * other run queue: waiting for it while holding ours could deadlock
+ * against a CPU stealing the other way. Returns true if it got one.
+ */
+static bool idleSteal(CpuRunQueue* rq)
+{
+    // Isolated CPUs only run what is pinned to them
+    if (isolatedCpus & (1u << (rq - runQueues))) {
+        return false;
+    }
+
+    CpuRunQueue* busiest = findBusiest(rq);
+
+    // Its running process is counted too, so it needs two to spare one
+    if (!busiest || busiest->nrRunning < 2 || !SpinlockTryAcquire(&busiest->lock)) {
+        return false;
+    }
+
+    uint32_t moved = busiest->nrRunning >= 2 ? pullProcesses(rq, busiest, 1) : 0;
+    SpinlockRelease(&busiest->lock);
+
+    rq->steals += moved;
+    return moved > 0;
+}
+
+/*
+ * rebalance - Periodic pass evening out rq and the busiest CPU
+ *
+ * Called with rq locked; pulls half the difference in queue length.
+ * Returns true if anything moved.
+ */
+static bool rebalance(CpuRunQueue* rq)
+{
+    if (isolatedCpus & (1u << (rq - runQueues))) {
+        return false;
+    }
+
+    CpuRunQueue* busiest = findBusiest(rq);
+    if (!busiest || busiest->nrRunning < rq->nrRunning + 2 ||
+        !SpinlockTryAcquire(&busiest->lock)) {
+        return false;
+    }
+
+    uint32_t moved = 0;
+    if (busiest->nrRunning >= rq->nrRunning + 2) {
+        moved = pullProcesses(rq, busiest, (busiest->nrRunning - rq->nrRunning) / 2);
+    }
+    SpinlockRelease(&busiest->lock);
+
+    return moved > 0;
+}
+
+/*
+ * balanceSoftirq - Look for work on other CPUs (raised by the tick)
+ *
+ * Idle, steal one process; busy, even out with the busiest CPU. Whatever
+ * is pulled in is switched to on the way out of the interrupt.
+ */
+static void balanceSoftirq(void)
+{
+    CpuRunQueue* rq = thisRq();
+    uint32_t flags = SpinlockAcquireIrqSave(&rq->lock);
+
+    bool pulled = rq->current == rq->idle ? idleSteal(rq) : rebalance(rq);
+    if (pulled) {
+        rq->needResched = true;
+    }
+
+    SpinlockReleaseIrqRestore(&rq->lock, flags);
+}
+
+/*
+ * fixAffinity - Move a ready process off a CPU its affinity no longer allows
+ *
+ * Called with interrupts off and no run queue locked. Takes both run
+ * queue locks in index order, so it cannot deadlock against itself on
+ * another CPU, and rechecks everything once it has them.
+ */
+static void fixAffinity(Process* process)
+{
+    uint32_t srcCpu = __atomic_load_n(&process->cpu, __ATOMIC_RELAXED);
+    uint32_t dstCpu = pickCpu(process->affinity);
+    if (srcCpu == dstCpu) {
+        return;
+    }
+
+    // Its FPU registers must be in memory before another CPU runs it. If
+    // they are loaded on a CPU other than this one, leave the process be:
+    // it runs there once more and is moved when switched out
+    FpuFlush(process->fpuState);
+    if (FpuIsLoaded(process->fpuState)) {
+        return;
+    }
+
+    CpuRunQueue* src = &runQueues[srcCpu];
+    CpuRunQueue* dst = &runQueues[dstCpu];
+    CpuRunQueue* first = srcCpu < dstCpu ? src : dst;
+    CpuRunQueue* second = srcCpu < dstCpu ? dst : src;
+    SpinlockAcquire(&first->lock);
+    SpinlockAcquire(&second->lock);
+
+    if (process->cpu == srcCpu && process->state == PROCESS_STATE_READY &&
+        !cpuAllowed(process, srcCpu) && cpuAllowed(process, dstCpu)) {
+        moveProcess(process, src, dst);
+        wakePreempt(dst, process);
+    }
+
+    SpinlockRelease(&second->lock);
+    SpinlockRelease(&first->lock);
 }
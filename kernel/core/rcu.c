@@ -0,0 +1,261 @@
+/* rcu.c - Read-copy-update for read-mostly data */
+
+#include "rcu.h"
+#include "semaphore.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "panic.h"
+#include "x86.h"
+#include <stddef.h>
+
+/*
+ * RcuCallbackList - Callbacks in the order they were queued
+ */
+typedef struct {
+    RcuHead* head;
+    RcuHead** tail;
+} RcuCallbackList;
+
+/*
+ * RcuCpu - One CPU's view of the grace periods
+ *
+ * Only touched by its own CPU, with interrupts off, so needs no lock.
+ * Callbacks queue on next; once wait is empty they move there as a batch
+ * and wait for grace period waitGp to complete.
+ */
+typedef struct {
+    uint32_t gpSeen;            // Latest grace period this CPU has noticed
+    bool qsPending;             // gpSeen still needs a quiescent state from us
+    bool qsPassed;              // One has happened since gpSeen was noticed
+    RcuCallbackList next;       // Queued since the wait batch was formed
+    RcuCallbackList wait;       // Batch waiting for waitGp
+    uint32_t waitGp;
+} __attribute__((aligned(PER_CPU_ALIGN))) RcuCpu;
+
+/*
+ * Global grace period state. A grace period starts by recording which
+ * CPUs must pass a quiescent state, and completes when the last of them
+ * has. current == completed means none is in progress.
+ */
+static Spinlock gpLock = SPINLOCK_INIT;
+static uint32_t gpCurrent = 0;      // Latest grace period started
+static uint32_t gpCompleted = 0;    // Latest grace period completed
+static uint32_t gpWaiting = 0;      // CPUs yet to report, bit N = CPU N
+static bool gpAnother = false;      // Callbacks need one after the current
+
+static RcuCpu rcuCpus[SMP_MAX_CPUS];
+
+/* Forward declarations */
+static void rcuSoftirq(void);
+static void startGracePeriod(void);
+static bool cpuHasWork(RcuCpu* rcu);
+static void listInit(RcuCallbackList* list);
+static void listSplice(RcuCallbackList* to, RcuCallbackList* from);
+static void synchronizeCallback(void* data);
+
+/*
+ * RcuInitialize - Set up grace period tracking
+ */
+void RcuInitialize(void)
+{
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        listInit(&rcuCpus[cpu].next);
+        listInit(&rcuCpus[cpu].wait);
+    }
+    SoftirqRegister(SOFTIRQ_RCU, rcuSoftirq);
+}
+
+/*
+ * RcuCall - Run a callback after a grace period
+ */
+void RcuCall(RcuHead* head, RcuCallback callback, void* data)
+{
+    head->next = NULL;
+    head->callback = callback;
+    head->data = data;
+
+    uint32_t flags = irq_save();
+    RcuCpu* rcu = &rcuCpus[SmpGetCurrentCpu()];
+    *rcu->next.tail = head;
+    rcu->next.tail = &head->next;
+    irq_restore(flags);
+}
+
+/*
+ * RcuSynchronize - Sleep until a grace period has passed
+ *
+ * Queues a callback like any other writer and sleeps until it runs.
+ */
+void RcuSynchronize(void)
+{
+    KAssert(PreemptGetCount() == 0, "RcuSynchronize with preempt count %u",
+            PreemptGetCount());
+
+    RcuHead head;
+    Semaphore done;
+    SemaphoreInit(&done, 0);
+    RcuCall(&head, synchronizeCallback, &done);
+    SemaphoreDown(&done);
+}
+
+/*
+ * RcuTick - Account a timer tick on this CPU
+ *
+ * The softirq does the rest, so it is only raised when this CPU has
+ * something to report or callbacks to move along.
+ */
+void RcuTick(bool quiescent)
+{
+    RcuCpu* rcu = &rcuCpus[SmpGetCurrentCpu()];
+    if (quiescent) {
+        rcu->qsPassed = true;
+    }
+    if (cpuHasWork(rcu)) {
+        SoftirqRaise(SOFTIRQ_RCU);
+    }
+}
+
+/*
+ * RcuNoteContextSwitch - Account a context switch on this CPU
+ *
+ * The scheduler refuses to switch inside a read-side section, so every
+ * switch is a quiescent state.
+ */
+void RcuNoteContextSwitch(void)
+{
+    rcuCpus[SmpGetCurrentCpu()].qsPassed = true;
+}
+
+/*
+ * RcuGetGracePeriods - Number of grace periods completed since boot
+ */
+uint32_t RcuGetGracePeriods(void)
+{
+    return __atomic_load_n(&gpCompleted, __ATOMIC_RELAXED);
+}
+
+/*
+ * rcuSoftirq - Advance this CPU's part in the grace periods
+ *
+ * Notices a new grace period, or reports a quiescent state for the one
+ * it noticed, then moves its callbacks along and runs those whose grace
+ * period is over. A quiescent state only counts once the grace period
+ * has been noticed, so it cannot predate a read-side section the grace
+ * period must wait for.
+ */
+static void rcuSoftirq(void)
+{
+    uint32_t cpu = SmpGetCurrentCpu();
+    RcuCpu* rcu = &rcuCpus[cpu];
+    RcuCallbackList done;
+    listInit(&done);
+
+    uint32_t flags = SpinlockAcquireIrqSave(&gpLock);
+
+    if (rcu->gpSeen != gpCurrent) {
+        rcu->gpSeen = gpCurrent;
+        rcu->qsPassed = false;
+        rcu->qsPending = (gpWaiting & (1u << cpu)) != 0;
+    } else if (rcu->qsPending && rcu->qsPassed) {
+        rcu->qsPending = false;
+        gpWaiting &= ~(1u << cpu);
+        if (gpWaiting == 0) {
+            __atomic_store_n(&gpCompleted, gpCurrent, __ATOMIC_RELAXED);
+            if (gpAnother) {
+                startGracePeriod();
+            }
+        }
+    }
+
+    // The wait batch is done once its grace period has completed
+    if (rcu->wait.head && (int32_t)(gpCompleted - rcu->waitGp) >= 0) {
+        listSplice(&done, &rcu->wait);
+    }
+
+    // Callbacks queued now may be seen by readers of the grace period in
+    // progress, so they need the one after it
+    if (!rcu->wait.head && rcu->next.head) {
+        listSplice(&rcu->wait, &rcu->next);
+        rcu->waitGp = gpCurrent + 1;
+        if (gpCurrent == gpCompleted) {
+            startGracePeriod();
+        } else {
+            gpAnother = true;
+        }
+    }
+
+    SpinlockReleaseIrqRestore(&gpLock, flags);
+
+    for (RcuHead* head = done.head; head; ) {
+        RcuHead* next = head->next;
+        head->callback(head->data);
+        head = next;
+    }
+}
+
+/*
+ * startGracePeriod - Begin a grace period over the online CPUs
+ *
+ * Called with gpLock held.
+ */
+static void startGracePeriod(void)
+{
+    uint32_t waiting = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (SmpIsCpuOnline(cpu)) {
+            waiting |= 1u << cpu;
+        }
+    }
+
+    gpCurrent++;
+    gpWaiting = waiting;
+    gpAnother = false;
+}
+
+/*
+ * cpuHasWork - Check whether the softirq has anything to do on a CPU
+ *
+ * Read without gpLock: a stale answer only delays the work by a tick.
+ */
+static bool cpuHasWork(RcuCpu* rcu)
+{
+    if (rcu->gpSeen != __atomic_load_n(&gpCurrent, __ATOMIC_RELAXED)) {
+        return true;
+    }
+    if (rcu->qsPending && rcu->qsPassed) {
+        return true;
+    }
+    return rcu->wait.head != NULL || rcu->next.head != NULL;
+}
+
+/*
+ * listInit - Empty a callback list
+ */
+static void listInit(RcuCallbackList* list)
+{
+    list->head = NULL;
+    list->tail = &list->head;
+}
+
+/*
+ * listSplice - Move every callback of one list to the end of another
+ */
+static void listSplice(RcuCallbackList* to, RcuCallbackList* from)
+{
+    if (!from->head) {
+        return;
+    }
+    *to->tail = from->head;
+    to->tail = from->tail;
+    listInit(from);
+}
+
+/*
+ * synchronizeCallback - Wake the RcuSynchronize() caller
+ */
+static void synchronizeCallback(void* data)
+{
+    SemaphoreUp((Semaphore*)data);
+}
@@ -0,0 +1,393 @@
+/* sched_deadline.c - Earliest deadline first scheduling class */
+
+#include "sched.h"
+#include "process.h"
+#include "pit.h"
+#include "tsc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "clk/rbtree.h"
+#include "clc/math.h"
+#include <stddef.h>
+
+/* Bandwidth is runtime/period in fixed point; 1 << DEADLINE_BW_SHIFT is the whole CPU */
+#define DEADLINE_BW_SHIFT   20
+
+/*
+ * Admission limit: deadline processes on a CPU together may reserve at
+ * most 95% of it, so normal processes (and the kernel's own
+ * housekeeping) always get some time.
+ */
+#define DEADLINE_BW_LIMIT   ((95u << DEADLINE_BW_SHIFT) / 100)
+
+/* Timer interrupts per tick while any deadline process exists (1 ms at 100 Hz) */
+#define DEADLINE_SUBTICKS   10
+
+/*
+ * Class state, one per CPU. Scheduling is partitioned: a deadline
+ * process is admitted against, and runs on, the CPU it belongs to.
+ */
+typedef struct {
+    ClkRbTree readyTree;        // Runnable, ordered by absolute deadline
+    Process* throttledList;     // Out of budget, waiting for their next period
+    uint32_t totalBandwidth;    // Sum of admitted dlBandwidth
+} DeadlineRunQueue;
+
+static DeadlineRunQueue runQueues[SMP_MAX_CPUS];
+
+/* Admitted processes on all CPUs; sub-ticks run while there are any */
+static Spinlock reservationLock = SPINLOCK_INIT;
+static uint32_t reservations = 0;
+
+/* Forward declarations */
+static bool deadlineLess(const ClkRbNode* a, const ClkRbNode* b);
+static void startJob(Process* process, uint64_t now);
+static void replenish(Process* process, uint64_t now);
+static void throttle(Process* process);
+static void countReservation(int32_t delta);
+
+/*
+ * rqOf - Class state of the CPU a process belongs to
+ */
+static inline DeadlineRunQueue* rqOf(Process* process)
+{
+    return &runQueues[process->cpu];
+}
+
+/*
+ * deadlineBefore - Wrap-safe clock comparison
+ */
+static inline bool deadlineBefore(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) < 0;
+}
+
+/*
+ * replenishTime - Start of the period after the current job's
+ */
+static inline uint64_t replenishTime(Process* process)
+{
+    return process->dlAbsDeadline - process->dlDeadline + process->dlPeriod;
+}
+
+/*
+ * deadlineInitialize - Empty the tree and the throttled list
+ */
+static void deadlineInitialize(void)
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        ClkRbInit(&runQueues[cpu].readyTree);
+        runQueues[cpu].throttledList = NULL;
+        runQueues[cpu].totalBandwidth = 0;
+    }
+    reservations = 0;
+}
+
+/*
+ * deadlineEnqueue - Admit a woken process under the CBS wakeup rule
+ *
+ * If the budget left could not be used up by the current deadline
+ * without exceeding the reserved bandwidth, or the deadline has already
+ * passed, the process starts a fresh job. Otherwise it carries on with
+ * the current one. A process that blocked with its budget spent waits
+ * out the rest of its period.
+ */
+static void deadlineEnqueue(Process* process)
+{
+    uint64_t now = TscGetNanoseconds();
+
+    if (!deadlineBefore(now, process->dlAbsDeadline)) {
+        startJob(process, now);
+    } else if (process->dlBudget > 0) {
+        // budget / (deadline - now) > runtime / relative deadline, cross-multiplied
+        uint64_t left = process->dlAbsDeadline - now;
+        if ((uint64_t)process->dlBudget * process->dlDeadline > left * process->dlRuntime) {
+            startJob(process, now);
+        }
+    }
+
+    if (process->dlBudget <= 0) {
+        throttle(process);
+        return;
+    }
+
+    ClkRbInsert(&rqOf(process)->readyTree, &process->runNode, deadlineLess);
+}
+
+/*
+ * deadlineDequeue - Take a ready or throttled process out of the class
+ */
+static void deadlineDequeue(Process* process)
+{
+    DeadlineRunQueue* rq = rqOf(process);
+
+    if (!process->dlThrottled) {
+        ClkRbErase(&rq->readyTree, &process->runNode);
+        return;
+    }
+
+    for (Process** link = &rq->throttledList; *link; link = &(*link)->next) {
+        if (*link == process) {
+            *link = process->next;
+            break;
+        }
+    }
+    process->next = NULL;
+    process->dlThrottled = false;
+}
+
+/*
+ * deadlinePutPrev - Requeue the switched-out process, or throttle it
+ */
+static void deadlinePutPrev(Process* process)
+{
+    if (process->dlBudget <= 0) {
+        throttle(process);
+        return;
+    }
+
+    ClkRbInsert(&rqOf(process)->readyTree, &process->runNode, deadlineLess);
+}
+
+/*
+ * deadlinePickNext - Remove and return a CPU's process with the earliest deadline
+ */
+static Process* deadlinePickNext(uint32_t cpu)
+{
+    DeadlineRunQueue* rq = &runQueues[cpu];
+    ClkRbNode* node = ClkRbFirst(&rq->readyTree);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    Process* process = CLK_RB_ENTRY(node, Process, runNode);
+    ClkRbErase(&rq->readyTree, node);
+
+    process->sliceStart = process->runtime;
+    return process;
+}
+
+/*
+ * deadlineAccount - Consume budget and note a missed deadline
+ *
+ * execStart is the time of this charge. A job that is still being
+ * charged after its deadline has missed it; count it once per job.
+ */
+static void deadlineAccount(Process* current, uint64_t deltaNs)
+{
+    current->dlBudget -= (int64_t)deltaNs;
+
+    if (!current->dlMissed && deadlineBefore(current->dlAbsDeadline, current->execStart)) {
+        current->dlMissed = true;
+        current->dlMisses++;
+    }
+}
+
+/*
+ * deadlineTick - Preempt once the budget is spent
+ *
+ * Called on sub-ticks as well as ticks, so an overrun is caught within
+ * one sub-tick.
+ */
+static bool deadlineTick(Process* current)
+{
+    return current->dlBudget <= 0;
+}
+
+/*
+ * deadlineYield - Done for this period; sleep until the next one
+ */
+static void deadlineYield(Process* current)
+{
+    if (current->dlBudget > 0) {
+        current->dlBudget = 0;
+    }
+}
+
+/*
+ * deadlineCheckPreempt - An earlier deadline preempts
+ */
+static bool deadlineCheckPreempt(Process* current, Process* woken)
+{
+    return deadlineBefore(woken->dlAbsDeadline, current->dlAbsDeadline);
+}
+
+/*
+ * deadlineTimer - Replenish throttled processes whose next period has begun
+ *
+ * Runs on each CPU for its own processes (current is that CPU's running
+ * or idle process).
+ */
+static bool deadlineTimer(Process* current)
+{
+    DeadlineRunQueue* rq = rqOf(current);
+    if (rq->throttledList == NULL) {
+        return false;
+    }
+
+    uint64_t now = TscGetNanoseconds();
+    bool woke = false;
+
+    Process** link = &rq->throttledList;
+    while (*link) {
+        Process* process = *link;
+        if (deadlineBefore(now, replenishTime(process))) {
+            link = &process->next;
+            continue;
+        }
+
+        *link = process->next;
+        process->next = NULL;
+        process->dlThrottled = false;
+        replenish(process, now);
+        ClkRbInsert(&rq->readyTree, &process->runNode, deadlineLess);
+        woke = true;
+    }
+
+    if (!woke) {
+        return false;
+    }
+
+    // Any deadline process beats a normal one; otherwise earliest deadline wins
+    Process* first = CLK_RB_ENTRY(ClkRbFirst(&rq->readyTree), Process, runNode);
+    return current->policy != PROCESS_POLICY_DEADLINE ||
+           deadlineBefore(first->dlAbsDeadline, current->dlAbsDeadline);
+}
+
+const SchedClass SchedDeadlineClass = {
+    .name = "deadline",
+    .initialize = deadlineInitialize,
+    .enqueue = deadlineEnqueue,
+    .dequeue = deadlineDequeue,
+    .putPrev = deadlinePutPrev,
+    .pickNext = deadlinePickNext,
+    .account = deadlineAccount,
+    .tick = deadlineTick,
+    .yield = deadlineYield,
+    .checkPreempt = deadlineCheckPreempt,
+    .timer = deadlineTimer,
+};
+
+/*
+ * SchedDeadlineAdmit - Reserve bandwidth for a deadline process
+ */
+bool SchedDeadlineAdmit(Process* process, uint32_t runtimeNs,
+                        uint32_t deadlineNs, uint32_t periodNs)
+{
+    if (runtimeNs == 0 || runtimeNs > deadlineNs || deadlineNs > periodNs) {
+        return false;
+    }
+
+    uint32_t bandwidth = (uint32_t)ClcDivU64((uint64_t)runtimeNs << DEADLINE_BW_SHIFT,
+                                             periodNs, NULL);
+    if (bandwidth == 0) {
+        bandwidth = 1;
+    }
+
+    // Re-admission replaces the process's existing reservation
+    DeadlineRunQueue* rq = rqOf(process);
+    bool readmit = process->policy == PROCESS_POLICY_DEADLINE;
+    uint32_t others = rq->totalBandwidth;
+    if (readmit) {
+        others -= process->dlBandwidth;
+    }
+    if (others + bandwidth > DEADLINE_BW_LIMIT) {
+        return false;
+    }
+
+    rq->totalBandwidth = others + bandwidth;
+    process->dlRuntime = runtimeNs;
+    process->dlDeadline = deadlineNs;
+    process->dlPeriod = periodNs;
+    process->dlBandwidth = bandwidth;
+    process->dlThrottled = false;
+    startJob(process, TscGetNanoseconds());
+
+    if (!readmit) {
+        countReservation(1);
+    }
+    return true;
+}
+
+/*
+ * SchedDeadlineRelease - Give back a deadline process's reservation
+ */
+void SchedDeadlineRelease(Process* process)
+{
+    rqOf(process)->totalBandwidth -= process->dlBandwidth;
+    process->dlBandwidth = 0;
+    countReservation(-1);
+}
+
+/*
+ * deadlineLess - Tree ordering: ascending absolute deadline
+ */
+static bool deadlineLess(const ClkRbNode* a, const ClkRbNode* b)
+{
+    const Process* processA = CLK_RB_ENTRY(a, Process, runNode);
+    const Process* processB = CLK_RB_ENTRY(b, Process, runNode);
+    return deadlineBefore(processA->dlAbsDeadline, processB->dlAbsDeadline);
+}
+
+/*
+ * startJob - Begin a new job now with a full budget
+ */
+static void startJob(Process* process, uint64_t now)
+{
+    process->dlAbsDeadline = now + process->dlDeadline;
+    process->dlBudget = process->dlRuntime;
+    process->dlMissed = false;
+}
+
+/*
+ * replenish - Move a throttled process into its next period
+ *
+ * Any overrun carries over and is paid back out of the new budget. If
+ * the replenishment is so late that the new deadline has passed too, a
+ * fresh job starts from now instead.
+ */
+static void replenish(Process* process, uint64_t now)
+{
+    while (process->dlBudget <= 0) {
+        process->dlAbsDeadline += process->dlPeriod;
+        process->dlBudget += process->dlRuntime;
+    }
+    process->dlMissed = false;
+
+    if (!deadlineBefore(now, process->dlAbsDeadline)) {
+        startJob(process, now);
+    }
+}
+
+/*
+ * throttle - Park a process with no budget until its next period
+ */
+static void throttle(Process* process)
+{
+    DeadlineRunQueue* rq = rqOf(process);
+    process->dlThrottled = true;
+    process->next = rq->throttledList;
+    rq->throttledList = process;
+}
+
+/*
+ * countReservation - Track admitted processes and switch sub-ticks on and off
+ *
+ * Budgets need enforcing at finer than tick granularity while any
+ * deadline process exists on any CPU. The lock keeps the PIT setting in
+ * step with the count when CPUs admit and release at the same time.
+ */
+static void countReservation(int32_t delta)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&reservationLock);
+
+    uint32_t before = reservations;
+    reservations += (uint32_t)delta;
+    if (before == 0 && reservations > 0) {
+        PitSetSubTicks(DEADLINE_SUBTICKS);
+    } else if (before > 0 && reservations == 0) {
+        PitSetSubTicks(1);
+    }
+
+    SpinlockReleaseIrqRestore(&reservationLock, flags);
+}
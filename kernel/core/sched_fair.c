@@ -0,0 +1,304 @@
+/* sched_fair.c - Completely fair scheduling class */
+
+#include "sched.h"
+#include "process.h"
+#include "smp.h"
+#include "clk/rbtree.h"
+#include "clc/math.h"
+#include <stddef.h>
+
+/*
+ * Tunables (nanoseconds). Every ready process should get a turn within
+ * one latency period; with many processes the period stretches so no
+ * turn is shorter than the minimum granularity. A waking process only
+ * preempts if it is behind by more than the wakeup granularity.
+ */
+#define FAIR_LATENCY_NS             20000000u
+#define FAIR_MIN_GRANULARITY_NS     4000000u
+#define FAIR_WAKEUP_GRANULARITY_NS  2000000u
+
+/* Weight of PROCESS_PRIORITY_DEFAULT; vruntime advances at wall-clock rate */
+#define FAIR_WEIGHT_DEFAULT         1024
+
+/* Fixed-point shift for the precomputed inverse weights */
+#define FAIR_INVERSE_SHIFT          22
+
+/*
+ * Weight per priority: each level is worth about 1.25x the CPU of the
+ * next, so two processes one level apart split the CPU roughly 55/45.
+ * Priority 16 (the default) is 1024.
+ */
+static const uint32_t priorityWeights[PROCESS_PRIORITY_LEVELS] = {
+    36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    6100,  4904,  3906,  3121,  2501,  1991,  1586, 1277,
+    1024,  820,   655,   526,   423,   335,   272,  215,
+    172,   137,   110,   87,    70,    56,    45,   36,
+};
+
+/* 2^32 / weight, so weighting a delta is a multiply instead of a divide */
+static uint32_t inverseWeights[PROCESS_PRIORITY_LEVELS];
+
+/* Run queue state, one per CPU */
+typedef struct {
+    ClkRbTree runTree;              // Ready processes (not the running one)
+    uint64_t minVruntime;           // Monotonic floor for placing wakeups
+    uint32_t queuedWeight;          // Sum of weights in runTree
+} FairRunQueue;
+
+static FairRunQueue runQueues[SMP_MAX_CPUS];
+
+/* Forward declarations */
+static bool vruntimeLess(const ClkRbNode* a, const ClkRbNode* b);
+static void insertProcess(FairRunQueue* rq, Process* process);
+static void updateMinVruntime(FairRunQueue* rq, Process* current);
+static uint64_t scaleToVirtual(uint64_t deltaNs, uint32_t priority);
+static uint64_t idealSlice(FairRunQueue* rq, Process* current);
+
+/*
+ * rqOf - Run queue of the CPU a process belongs to
+ */
+static inline FairRunQueue* rqOf(Process* process)
+{
+    return &runQueues[process->cpu];
+}
+
+/*
+ * vruntimeBefore - Wrap-safe vruntime comparison
+ */
+static inline bool vruntimeBefore(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) < 0;
+}
+
+/*
+ * fairInitialize - Empty the run tree and precompute inverse weights
+ */
+static void fairInitialize(void)
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        ClkRbInit(&runQueues[cpu].runTree);
+        runQueues[cpu].minVruntime = 0;
+        runQueues[cpu].queuedWeight = 0;
+    }
+
+    for (int i = 0; i < PROCESS_PRIORITY_LEVELS; i++) {
+        inverseWeights[i] = 0xFFFFFFFFu / priorityWeights[i];
+    }
+}
+
+/*
+ * fairEnqueue - Place a new or woken process in the tree
+ *
+ * A new process starts at the current minimum so it cannot monopolise
+ * the CPU. A process that slept keeps its vruntime, but is pulled up to
+ * at most half a latency period behind the minimum: enough credit to
+ * run promptly on wakeup, not enough to starve everyone else.
+ */
+static void fairEnqueue(Process* process)
+{
+    FairRunQueue* rq = rqOf(process);
+
+    if (process->runtime == 0) {
+        process->vruntime = rq->minVruntime;
+    } else {
+        uint64_t floor = rq->minVruntime - FAIR_LATENCY_NS / 2;
+        if (vruntimeBefore(process->vruntime, floor)) {
+            process->vruntime = floor;
+        }
+    }
+
+    insertProcess(rq, process);
+}
+
+/*
+ * fairDequeue - Take a ready process out of the tree
+ */
+static void fairDequeue(Process* process)
+{
+    FairRunQueue* rq = rqOf(process);
+    ClkRbErase(&rq->runTree, &process->runNode);
+    rq->queuedWeight -= priorityWeights[process->priority];
+}
+
+/*
+ * fairPutPrev - Return the switched-out process to the tree
+ */
+static void fairPutPrev(Process* process)
+{
+    insertProcess(rqOf(process), process);
+}
+
+/*
+ * fairPickNext - Remove and return a CPU's leftmost (least vruntime) process
+ */
+static Process* fairPickNext(uint32_t cpu)
+{
+    FairRunQueue* rq = &runQueues[cpu];
+    ClkRbNode* node = ClkRbFirst(&rq->runTree);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    Process* process = CLK_RB_ENTRY(node, Process, runNode);
+    ClkRbErase(&rq->runTree, node);
+    rq->queuedWeight -= priorityWeights[process->priority];
+
+    process->sliceStart = process->runtime;
+    updateMinVruntime(rq, process);
+    return process;
+}
+
+/*
+ * fairMigrate - Carry a process's lag behind the minimum to another CPU
+ *
+ * Each CPU's minVruntime advances independently, so the raw value means
+ * nothing on the new CPU; what carries over is how far ahead of or
+ * behind the old CPU's minimum the process was.
+ */
+static void fairMigrate(Process* process, uint32_t toCpu)
+{
+    process->vruntime = process->vruntime - rqOf(process)->minVruntime
+                        + runQueues[toCpu].minVruntime;
+}
+
+/*
+ * fairAccount - Advance the running process's vruntime
+ */
+static void fairAccount(Process* current, uint64_t deltaNs)
+{
+    current->vruntime += scaleToVirtual(deltaNs, current->priority);
+    updateMinVruntime(rqOf(current), current);
+}
+
+/*
+ * fairTick - Preempt once the process has had its share of the period
+ */
+static bool fairTick(Process* current)
+{
+    FairRunQueue* rq = rqOf(current);
+    if (ClkRbFirst(&rq->runTree) == NULL) {
+        return false;
+    }
+
+    return current->runtime - current->sliceStart >= idealSlice(rq, current);
+}
+
+/*
+ * fairYield - Step behind the next process in line
+ */
+static void fairYield(Process* current)
+{
+    ClkRbNode* node = ClkRbFirst(&rqOf(current)->runTree);
+    if (node == NULL) {
+        return;
+    }
+
+    Process* next = CLK_RB_ENTRY(node, Process, runNode);
+    if (!vruntimeBefore(next->vruntime, current->vruntime)) {
+        current->vruntime = next->vruntime + 1;
+    }
+}
+
+/*
+ * fairCheckPreempt - Preempt if the woken process is far enough behind
+ *
+ * The granularity is scaled to the woken process's weight, so heavier
+ * processes preempt more readily.
+ */
+static bool fairCheckPreempt(Process* current, Process* woken)
+{
+    uint64_t granularity = scaleToVirtual(FAIR_WAKEUP_GRANULARITY_NS, woken->priority);
+    return vruntimeBefore(woken->vruntime + granularity, current->vruntime);
+}
+
+const SchedClass SchedFairClass = {
+    .name = "cfs",
+    .initialize = fairInitialize,
+    .enqueue = fairEnqueue,
+    .dequeue = fairDequeue,
+    .putPrev = fairPutPrev,
+    .pickNext = fairPickNext,
+    .migrate = fairMigrate,
+    .account = fairAccount,
+    .tick = fairTick,
+    .yield = fairYield,
+    .checkPreempt = fairCheckPreempt,
+};
+
+/*
+ * vruntimeLess - Tree ordering: ascending vruntime
+ */
+static bool vruntimeLess(const ClkRbNode* a, const ClkRbNode* b)
+{
+    const Process* processA = CLK_RB_ENTRY(a, Process, runNode);
+    const Process* processB = CLK_RB_ENTRY(b, Process, runNode);
+    return vruntimeBefore(processA->vruntime, processB->vruntime);
+}
+
+/*
+ * insertProcess - Add a process to the run tree
+ */
+static void insertProcess(FairRunQueue* rq, Process* process)
+{
+    ClkRbInsert(&rq->runTree, &process->runNode, vruntimeLess);
+    rq->queuedWeight += priorityWeights[process->priority];
+}
+
+/*
+ * updateMinVruntime - Move the floor up to the smallest live vruntime
+ *
+ * Never goes backwards, so a process that sleeps for a long time cannot
+ * drag new arrivals down with it.
+ */
+static void updateMinVruntime(FairRunQueue* rq, Process* current)
+{
+    uint64_t candidate = current->vruntime;
+
+    ClkRbNode* node = ClkRbFirst(&rq->runTree);
+    if (node != NULL) {
+        uint64_t leftmost = CLK_RB_ENTRY(node, Process, runNode)->vruntime;
+        if (vruntimeBefore(leftmost, candidate)) {
+            candidate = leftmost;
+        }
+    }
+
+    if (vruntimeBefore(rq->minVruntime, candidate)) {
+        rq->minVruntime = candidate;
+    }
+}
+
+/*
+ * scaleToVirtual - Convert CPU time to virtual time for a priority
+ *
+ * deltaNs * FAIR_WEIGHT_DEFAULT / weight, done as a multiply by the
+ * precomputed inverse. Deltas are clamped to 32 bits (about 4 seconds).
+ */
+static uint64_t scaleToVirtual(uint64_t deltaNs, uint32_t priority)
+{
+    if (priorityWeights[priority] == FAIR_WEIGHT_DEFAULT) {
+        return deltaNs;
+    }
+
+    uint32_t delta = deltaNs > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)deltaNs;
+    return ((uint64_t)delta * inverseWeights[priority]) >> FAIR_INVERSE_SHIFT;
+}
+
+/*
+ * idealSlice - CPU time the running process is due in one period
+ *
+ * The period is split in proportion to weight among every ready process
+ * plus the running one.
+ */
+static uint64_t idealSlice(FairRunQueue* rq, Process* current)
+{
+    uint32_t running = (uint32_t)rq->runTree.count + 1;
+    uint64_t period = FAIR_LATENCY_NS;
+    if (running > FAIR_LATENCY_NS / FAIR_MIN_GRANULARITY_NS) {
+        period = (uint64_t)running * FAIR_MIN_GRANULARITY_NS;
+    }
+
+    uint32_t weight = priorityWeights[current->priority];
+    uint32_t totalWeight = rq->queuedWeight + weight;
+
+    return ClcDivU64(period * weight, totalWeight, NULL);
+}
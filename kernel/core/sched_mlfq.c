@@ -0,0 +1,326 @@
+/* sched_mlfq.c - Multi-level feedback queue scheduling class */
+
+#include "sched.h"
+#include "process.h"
+#include "smp.h"
+#include <stddef.h>
+
+/*
+ * Levels and quanta. Level 0 is the top; each level down doubles the
+ * quantum, so processes that have sunk switch less often. A process
+ * moves down a level once it has used MLFQ_ALLOTMENT_QUANTA quanta of
+ * CPU at its level, however many times it blocked along the way, so
+ * blocking just before the quantum ends does not keep a CPU hog on top.
+ */
+#define MLFQ_LEVELS             6
+#define MLFQ_BASE_QUANTUM_NS    10000000ull     // Level 0: one tick at 100 Hz
+#define MLFQ_ALLOTMENT_QUANTA   2
+
+/* CPU time between boosts that lift every process back to level 0 */
+#define MLFQ_BOOST_NS           1000000000ull
+
+/*
+ * FIFO per level, plus a bitmap of non-empty levels (as in sched_rr.c).
+ * Each CPU has its own queues and boosts them on its own schedule.
+ */
+typedef struct {
+    Process* head[MLFQ_LEVELS];
+    Process* tail[MLFQ_LEVELS];
+    uint32_t bitmap;
+    uint64_t sinceBoost;        // CPU time charged since the last boost
+    uint32_t boostEpoch;        // Incremented on every boost
+} MlfqRunQueue;
+
+static MlfqRunQueue runQueues[SMP_MAX_CPUS];
+
+/* Forward declarations */
+static void enqueueTail(Process* process);
+static void enqueueFront(Process* process);
+static void refreshLevel(Process* process);
+static void boost(MlfqRunQueue* rq);
+
+/*
+ * rqOf - Run queue of the CPU a process belongs to
+ */
+static inline MlfqRunQueue* rqOf(Process* process)
+{
+    return &runQueues[process->cpu];
+}
+
+/*
+ * quantumFor - Timeslice at a level
+ */
+static inline uint64_t quantumFor(uint32_t level)
+{
+    return MLFQ_BASE_QUANTUM_NS << level;
+}
+
+/*
+ * mlfqInitialize - Empty the queues
+ */
+static void mlfqInitialize(void)
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        MlfqRunQueue* rq = &runQueues[cpu];
+        for (int i = 0; i < MLFQ_LEVELS; i++) {
+            rq->head[i] = NULL;
+            rq->tail[i] = NULL;
+        }
+        rq->bitmap = 0;
+        rq->sinceBoost = 0;
+        rq->boostEpoch = 0;
+    }
+}
+
+/*
+ * mlfqEnqueue - New or unblocked process joins the back of its level
+ *
+ * New processes start at the top. A process that blocked keeps its
+ * level unless a boost happened while it slept.
+ */
+static void mlfqEnqueue(Process* process)
+{
+    if (process->runtime == 0) {
+        process->mlfqLevel = 0;
+        process->mlfqUsed = 0;
+        process->mlfqBoostEpoch = rqOf(process)->boostEpoch;
+    }
+
+    refreshLevel(process);
+    enqueueTail(process);
+}
+
+/*
+ * mlfqDequeue - Unlink a ready process from its level
+ */
+static void mlfqDequeue(Process* process)
+{
+    MlfqRunQueue* rq = rqOf(process);
+    uint32_t level = process->mlfqLevel;
+    Process* prev = NULL;
+
+    for (Process* p = rq->head[level]; p; prev = p, p = p->next) {
+        if (p != process) {
+            continue;
+        }
+
+        if (prev) {
+            prev->next = p->next;
+        } else {
+            rq->head[level] = p->next;
+        }
+        if (rq->tail[level] == p) {
+            rq->tail[level] = prev;
+        }
+        if (!rq->head[level]) {
+            rq->bitmap &= ~(1u << level);
+        }
+        break;
+    }
+
+    process->next = NULL;
+}
+
+/*
+ * mlfqPutPrev - Requeue the process being switched out
+ *
+ * Preempted with quantum left (a higher level woke up) it goes back to
+ * the front of its level; otherwise to the back.
+ */
+static void mlfqPutPrev(Process* process)
+{
+    if (process->runtime - process->sliceStart < quantumFor(process->mlfqLevel)) {
+        enqueueFront(process);
+    } else {
+        enqueueTail(process);
+    }
+}
+
+/*
+ * mlfqPickNext - Remove and return the head of a CPU's highest non-empty level
+ */
+static Process* mlfqPickNext(uint32_t cpu)
+{
+    MlfqRunQueue* rq = &runQueues[cpu];
+    if (rq->bitmap == 0) {
+        return NULL;
+    }
+
+    uint32_t level = (uint32_t)__builtin_ctz(rq->bitmap);
+    Process* process = rq->head[level];
+    rq->head[level] = process->next;
+
+    if (!rq->head[level]) {
+        rq->tail[level] = NULL;
+        rq->bitmap &= ~(1u << level);
+    }
+
+    process->next = NULL;
+    process->sliceStart = process->runtime;
+    return process;
+}
+
+/*
+ * mlfqMigrate - Keep a process's level when it moves to another CPU
+ *
+ * Boost epochs are counted per CPU. Any boost the process missed on the
+ * old CPU is applied first, then its epoch is matched to the new CPU's
+ * so that it is not boosted again for the move itself.
+ */
+static void mlfqMigrate(Process* process, uint32_t toCpu)
+{
+    refreshLevel(process);
+    process->mlfqBoostEpoch = runQueues[toCpu].boostEpoch;
+}
+
+/*
+ * mlfqAccount - Charge CPU time against the allotment at this level
+ */
+static void mlfqAccount(Process* current, uint64_t deltaNs)
+{
+    refreshLevel(current);
+    current->mlfqUsed += deltaNs;
+    rqOf(current)->sinceBoost += deltaNs;
+
+    // Allotment used up: sink one level, ending the current quantum
+    if (current->mlfqLevel < MLFQ_LEVELS - 1 &&
+        current->mlfqUsed >= MLFQ_ALLOTMENT_QUANTA * quantumFor(current->mlfqLevel)) {
+        current->mlfqLevel++;
+        current->mlfqUsed = 0;
+        current->sliceStart = current->runtime - quantumFor(current->mlfqLevel);
+    }
+}
+
+/*
+ * mlfqTick - Boost when due; preempt at the end of the quantum
+ */
+static bool mlfqTick(Process* current)
+{
+    MlfqRunQueue* rq = rqOf(current);
+    if (rq->sinceBoost >= MLFQ_BOOST_NS) {
+        boost(rq);
+        refreshLevel(current);
+    }
+
+    if (rq->bitmap == 0) {
+        return false;
+    }
+
+    return current->runtime - current->sliceStart >= quantumFor(current->mlfqLevel);
+}
+
+/*
+ * mlfqYield - Yielding counts as the end of the quantum
+ */
+static void mlfqYield(Process* current)
+{
+    current->sliceStart = current->runtime - quantumFor(current->mlfqLevel);
+}
+
+/*
+ * mlfqCheckPreempt - A process at a higher level preempts
+ */
+static bool mlfqCheckPreempt(Process* current, Process* woken)
+{
+    return woken->mlfqLevel < current->mlfqLevel;
+}
+
+const SchedClass SchedFeedbackClass = {
+    .name = "mlfq",
+    .initialize = mlfqInitialize,
+    .enqueue = mlfqEnqueue,
+    .dequeue = mlfqDequeue,
+    .putPrev = mlfqPutPrev,
+    .pickNext = mlfqPickNext,
+    .migrate = mlfqMigrate,
+    .account = mlfqAccount,
+    .tick = mlfqTick,
+    .yield = mlfqYield,
+    .checkPreempt = mlfqCheckPreempt,
+};
+
+/*
+ * refreshLevel - Apply a boost the process missed while not queued
+ *
+ * Blocked and running processes are not on any queue when boost() runs,
+ * so they pick it up lazily by comparing epochs.
+ */
+static void refreshLevel(Process* process)
+{
+    uint32_t boostEpoch = rqOf(process)->boostEpoch;
+    if (process->mlfqBoostEpoch != boostEpoch) {
+        process->mlfqBoostEpoch = boostEpoch;
+        process->mlfqLevel = 0;
+        process->mlfqUsed = 0;
+    }
+}
+
+/*
+ * boost - Move every process queued on a CPU to level 0
+ *
+ * O(levels): the lower queues are spliced onto level 0 in order, so
+ * processes keep their relative position.
+ */
+static void boost(MlfqRunQueue* rq)
+{
+    rq->boostEpoch++;
+    rq->sinceBoost = 0;
+
+    for (uint32_t level = 0; level < MLFQ_LEVELS; level++) {
+        for (Process* process = rq->head[level]; process; process = process->next) {
+            process->mlfqLevel = 0;
+            process->mlfqUsed = 0;
+            process->mlfqBoostEpoch = rq->boostEpoch;
+        }
+
+        if (level == 0 || !rq->head[level]) {
+            continue;
+        }
+
+        if (rq->tail[0]) {
+            rq->tail[0]->next = rq->head[level];
+        } else {
+            rq->head[0] = rq->head[level];
+        }
+        rq->tail[0] = rq->tail[level];
+        rq->head[level] = NULL;
+        rq->tail[level] = NULL;
+    }
+
+    rq->bitmap = rq->head[0] ? 1u : 0;
+}
+
+/*
+ * enqueueTail - Add process to the tail of its level
+ */
+static void enqueueTail(Process* process)
+{
+    MlfqRunQueue* rq = rqOf(process);
+    uint32_t level = process->mlfqLevel;
+    process->next = NULL;
+
+    if (!rq->head[level]) {
+        rq->head[level] = process;
+        rq->tail[level] = process;
+        rq->bitmap |= (1u << level);
+    } else {
+        rq->tail[level]->next = process;
+        rq->tail[level] = process;
+    }
+}
+
+/*
+ * enqueueFront - Add process to the head of its level
+ */
+static void enqueueFront(Process* process)
+{
+    MlfqRunQueue* rq = rqOf(process);
+    uint32_t level = process->mlfqLevel;
+    process->next = rq->head[level];
+    rq->head[level] = process;
+
+    if (!rq->tail[level]) {
+        rq->tail[level] = process;
+        rq->bitmap |= (1u << level);
+    }
+}
@@ -0,0 +1,258 @@
+/* sched_rr.c - Priority round-robin scheduling class */
+
+#include "sched.h"
+#include "process.h"
+#include "pit.h"
+#include "smp.h"
+#include "kcmdline.h"
+#include "clc/printf.h"
+#include "clc/string.h"
+#include "clc/math.h"
+#include "econ_writer.h"
+#include <stddef.h>
+
+/*
+ * Ready queues: one FIFO per priority level, plus a bitmap with bit N set
+ * when queue N is non-empty. The next process is found with a single
+ * find-first-set on the bitmap, independent of how many are ready. Each
+ * CPU has its own set.
+ */
+typedef struct {
+    Process* head[PROCESS_PRIORITY_LEVELS];
+    Process* tail[PROCESS_PRIORITY_LEVELS];
+    uint32_t bitmap;
+} RrRunQueue;
+
+static RrRunQueue runQueues[SMP_MAX_CPUS];
+
+static uint32_t baseQuantum = 10;       // Ticks at PROCESS_PRIORITY_DEFAULT
+
+/* Largest base quantum whose scaling in quantumFor() cannot overflow */
+#define RR_MAX_BASE_QUANTUM (UINT32_MAX / PROCESS_PRIORITY_LEVELS)
+
+/* Forward declarations */
+static void enqueueTail(Process* process);
+static void enqueueFront(Process* process);
+static uint32_t quantumFor(Process* process);
+
+/*
+ * rrInitialize - Empty the queues and read quantum= from the command line
+ */
+static void rrInitialize(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int i = 0; i < PROCESS_PRIORITY_LEVELS; i++) {
+            runQueues[cpu].head[i] = NULL;
+            runQueues[cpu].tail[i] = NULL;
+        }
+        runQueues[cpu].bitmap = 0;
+    }
+
+    // Base quantum: quantum=<ms> on the command line, rounded to ticks
+    uint32_t quantumMs = PROCESS_QUANTUM_DEFAULT_MS;
+    const char* quantumArg = KCmdLineGetValue("quantum");
+    if (quantumArg && !ClcStrToUInt(quantumArg, &quantumMs)) {
+        ClcPrintfWriter(serial, "Ignoring invalid quantum=%s\n", quantumArg);
+        quantumMs = PROCESS_QUANTUM_DEFAULT_MS;
+    }
+    uint64_t ticks = ClcDivU64((uint64_t)quantumMs * PitGetFrequency() + 999, 1000, NULL);
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > RR_MAX_BASE_QUANTUM) {
+        ticks = RR_MAX_BASE_QUANTUM;
+    }
+    baseQuantum = (uint32_t)ticks;
+
+    ClcPrintfWriter(serial, "Round-robin quantum: %u ticks\n", baseQuantum);
+}
+
+/*
+ * rrEnqueue - New or unblocked process joins the back of its queue
+ *
+ * An unblocked process keeps whatever was left of its slice.
+ */
+static void rrEnqueue(Process* process)
+{
+    if (process->timeslice == 0) {
+        process->timeslice = quantumFor(process);
+    }
+    enqueueTail(process);
+}
+
+/*
+ * rrDequeue - Unlink a ready process from its queue
+ */
+static void rrDequeue(Process* process)
+{
+    RrRunQueue* rq = &runQueues[process->cpu];
+    uint32_t priority = process->priority;
+    Process* prev = NULL;
+
+    for (Process* p = rq->head[priority]; p; prev = p, p = p->next) {
+        if (p != process) {
+            continue;
+        }
+
+        if (prev) {
+            prev->next = p->next;
+        } else {
+            rq->head[priority] = p->next;
+        }
+        if (rq->tail[priority] == p) {
+            rq->tail[priority] = prev;
+        }
+        if (!rq->head[priority]) {
+            rq->bitmap &= ~(1u << priority);
+        }
+        break;
+    }
+
+    process->next = NULL;
+}
+
+/*
+ * rrPutPrev - Requeue the process being switched out
+ *
+ * With slice left it was preempted by a higher-priority wakeup, so it
+ * goes to the front of its queue and keeps the remainder. Otherwise it
+ * gets a fresh slice at the back.
+ */
+static void rrPutPrev(Process* process)
+{
+    if (process->timeslice > 0) {
+        enqueueFront(process);
+    } else {
+        process->timeslice = quantumFor(process);
+        enqueueTail(process);
+    }
+}
+
+/*
+ * rrPickNext - Remove and return the head of a CPU's highest-priority queue
+ *
+ * O(1): the lowest set bit of the bitmap is the highest-priority
+ * non-empty queue.
+ */
+static Process* rrPickNext(uint32_t cpu)
+{
+    RrRunQueue* rq = &runQueues[cpu];
+    if (rq->bitmap == 0) {
+        return NULL;
+    }
+
+    uint32_t priority = (uint32_t)__builtin_ctz(rq->bitmap);
+    Process* process = rq->head[priority];
+    rq->head[priority] = process->next;
+
+    if (!rq->head[priority]) {
+        rq->tail[priority] = NULL;
+        rq->bitmap &= ~(1u << priority);
+    }
+
+    process->next = NULL;
+    return process;
+}
+
+/*
+ * rrAccount - Nothing to do; slices are counted in ticks
+ */
+static void rrAccount(Process* current, uint64_t deltaNs)
+{
+    (void)current;
+    (void)deltaNs;
+}
+
+/*
+ * rrTick - Charge one tick against the slice
+ */
+static bool rrTick(Process* current)
+{
+    if (current->timeslice > 0) {
+        current->timeslice--;
+    }
+    return current->timeslice == 0;
+}
+
+/*
+ * rrYield - Give up the rest of the slice, going to the back of the queue
+ */
+static void rrYield(Process* current)
+{
+    current->timeslice = 0;
+}
+
+/*
+ * rrCheckPreempt - Only a strictly higher priority preempts
+ */
+static bool rrCheckPreempt(Process* current, Process* woken)
+{
+    return woken->priority < current->priority;
+}
+
+const SchedClass SchedRoundRobinClass = {
+    .name = "rr",
+    .initialize = rrInitialize,
+    .enqueue = rrEnqueue,
+    .dequeue = rrDequeue,
+    .putPrev = rrPutPrev,
+    .pickNext = rrPickNext,
+    .account = rrAccount,
+    .tick = rrTick,
+    .yield = rrYield,
+    .checkPreempt = rrCheckPreempt,
+};
+
+/*
+ * enqueueTail - Add process to the tail of its priority's ready queue
+ */
+static void enqueueTail(Process* process)
+{
+    RrRunQueue* rq = &runQueues[process->cpu];
+    uint32_t priority = process->priority;
+    process->next = NULL;
+
+    if (!rq->head[priority]) {
+        rq->head[priority] = process;
+        rq->tail[priority] = process;
+        rq->bitmap |= (1u << priority);
+    } else {
+        rq->tail[priority]->next = process;
+        rq->tail[priority] = process;
+    }
+}
+
+/*
+ * enqueueFront - Add process to the head of its priority's ready queue
+ */
+static void enqueueFront(Process* process)
+{
+    RrRunQueue* rq = &runQueues[process->cpu];
+    uint32_t priority = process->priority;
+    process->next = rq->head[priority];
+    rq->head[priority] = process;
+
+    if (!rq->tail[priority]) {
+        rq->tail[priority] = process;
+        rq->bitmap |= (1u << priority);
+    }
+}
+
+/*
+ * quantumFor - Full timeslice length in ticks for a process
+ *
+ * An explicit per-process quantum wins. Otherwise the base quantum is
+ * scaled by priority: twice the base at the highest priority, the base
+ * itself at PROCESS_PRIORITY_DEFAULT, and never less than one tick.
+ */
+static uint32_t quantumFor(Process* process)
+{
+    if (process->quantum) {
+        return process->quantum;
+    }
+
+    uint32_t ticks = baseQuantum * (PROCESS_PRIORITY_LEVELS - process->priority)
+                     / (PROCESS_PRIORITY_LEVELS - PROCESS_PRIORITY_DEFAULT);
+    return ticks ? ticks : 1;
+}
@@ -0,0 +1,1316 @@
+/* selftest.c - Boot-flag tests and benchmarks */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "selftest.h"
+#include "irq.h"
+#include "pit.h"
+#include "rtc.h"
+#include "tsc.h"
+#include "timer.h"
+#include "fpu.h"
+#include "x86.h"
+#include "clc/printf.h"
+#include "clc/math.h"
+#include "vid_writer.h"
+#include "econ_writer.h"
+#include "kheap.h"
+#include "kcmdline.h"
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "semaphore.h"
+#include "mutex.h"
+#include "workqueue.h"
+#include "rcu.h"
+#include "panic.h"
+
+/* Yields each side of the switchbench ping-pong makes */
+#define SWITCH_BENCH_ROUNDS 100000
+
+/* Busy processes balancetest starts, each with 1-4 units of work */
+#define BALANCE_TEST_WORKERS 12
+
+/* latencybench: wakeups measured, heap churners loading CPU 0, priorities */
+#define LATENCY_BENCH_ROUNDS        200
+#define LATENCY_BENCH_CHURNERS      2
+#define LATENCY_BENCH_HIGH_PRIORITY 2
+#define LATENCY_BENCH_LOW_PRIORITY  20
+
+/* irqbench: RTC interrupts timed per mode, their rate, threaded handler priority */
+#define IRQ_BENCH_SAMPLES   512
+#define IRQ_BENCH_HZ        1024
+#define IRQ_BENCH_PRIORITY  2
+
+/* apicbench: EOIs timed, RTC rate and length of the throughput run */
+#define APIC_BENCH_EOIS 10000
+#define APIC_BENCH_HZ   8192
+#define APIC_BENCH_MS   500
+
+/* irqsharetest: RTC rate, and how long each half of the test runs */
+#define IRQ_SHARE_TEST_HZ   1024
+#define IRQ_SHARE_TEST_MS   500
+
+/* worktest: hand-offs measured, and the gap between them */
+#define WORK_TEST_ROUNDS        50
+#define WORK_TEST_INTERVAL_MS   20
+
+/* rcutorture: elements the writer cycles through, and how long it runs */
+#define RCU_TORTURE_ELEMENTS    32
+#define RCU_TORTURE_MS          3000
+
+/* rcubench: reads each reader times per run */
+#define RCU_BENCH_READS 100000
+
+/* How long after boot lockstat reports */
+#define LOCK_STAT_REPORT_MS 5000
+
+/* How long after boot irqstat reports */
+#define IRQ_STAT_REPORT_MS 5000
+
+/* threadtest: extra threads per process, their yields, and time left for the reaper */
+#define THREAD_TEST_THREADS     3
+#define THREAD_TEST_ROUNDS      50
+#define THREAD_TEST_SETTLE_MS   200
+
+/* pitest: the three priorities, and how many medium CPU hogs to start */
+#define PI_TEST_HIGH_PRIORITY   4
+#define PI_TEST_MEDIUM_PRIORITY 12
+#define PI_TEST_LOW_PRIORITY    24
+#define PI_TEST_MEDIUM_HOGS     2
+
+/*
+ * SelfTest - A boot flag and what it starts
+ *
+ * A test made of one process gives its name and entry point; one that
+ * needs several, or other setup, gives a start function instead.
+ */
+typedef struct {
+    const char* flag;
+    const char* name;
+    void (*entry)(void);
+    bool (*start)(void);
+} SelfTest;
+
+/* Forward declarations */
+static bool startTest(const SelfTest* test);
+static void testProcess1(void);
+static void testProcess2(void);
+static void testProcess3(void);
+static bool demoStart(void);
+static void switchBenchPing(void);
+static void switchBenchPong(void);
+static bool switchBenchStart(void);
+static void balanceTestWorker(void);
+static void balanceTestReport(void);
+static bool balanceTestStart(void);
+static void piTestLow(void);
+static void piTestMedium(void);
+static void piTestHigh(void);
+static bool piTestStart(void);
+static void lockStatReport(void);
+static void irqStatReport(void);
+static void latencyBenchSleeper(void);
+static void latencyBenchWaker(void);
+static void latencyBenchChurn(void);
+static bool latencyBenchStart(void);
+static void irqBenchHandler(void);
+static void irqBenchPhase(const char* mode);
+static void irqBench(void);
+static void apicBenchHandler(void);
+static uint64_t apicBenchSpin(uint64_t cycles);
+static void apicBench(void);
+static IrqReturn irqShareTestIdle(void* cookie);
+static IrqReturn irqShareTestRtc(void* cookie);
+static void irqShareTest(void);
+static void workTestTimer(void* data);
+static void workTestRun(void* data);
+static bool workTestStart(void);
+static void rcuTortureFree(void* data);
+static void rcuTortureReader(void);
+static void rcuTortureWriter(void);
+static bool rcuTortureStart(void);
+static void rcuBenchReader(void);
+static uint64_t rcuBenchRun(bool useRcu, uint32_t readers);
+static void rcuBench(void);
+static void threadTestWorker(void);
+static void threadTestOwner(void);
+static bool threadTestPhase(bool ownerFirst);
+static void threadTest(void);
+
+/* Tests that replace the demo processes; the first flag given wins */
+static const SelfTest selfTests[] = {
+    { "switchbench",  NULL,           NULL,         switchBenchStart },
+    { "balancetest",  NULL,           NULL,         balanceTestStart },
+    { "latencybench", NULL,           NULL,         latencyBenchStart },
+    { "irqbench",     "irqbench",     irqBench,     NULL },
+    { "apicbench",    "apicbench",    apicBench,    NULL },
+    { "irqsharetest", "irqsharetest", irqShareTest, NULL },
+    { "rcutorture",   NULL,           NULL,         rcuTortureStart },
+    { "rcubench",     "rcubench",     rcuBench,     NULL },
+    { "threadtest",   "threadtest",   threadTest,   NULL },
+    { "pitest",       NULL,           NULL,         piTestStart },
+};
+
+/* Reports and tests that run alongside whatever else runs */
+static const SelfTest selfTestExtras[] = {
+    { "lockstat", "lockstat", lockStatReport, NULL },   // Once the tests have contended
+    { "irqstat",  "irqstat",  irqStatReport,  NULL },   // Likewise interrupt counts and costs
+    { "worktest", NULL,       NULL,           workTestStart },
+};
+
+#define SELF_TESTS          (sizeof(selfTests) / sizeof(selfTests[0]))
+#define SELF_TEST_EXTRAS    (sizeof(selfTestExtras) / sizeof(selfTestExtras[0]))
+
+/*
+ * SelfTestStart - Create the processes of the test asked for at boot
+ */
+bool SelfTestStart(void)
+{
+    size_t i = 0;
+    while (i < SELF_TESTS && !KCmdLineHasFlag(selfTests[i].flag)) {
+        i++;
+    }
+    bool ok = i < SELF_TESTS ? startTest(&selfTests[i]) : demoStart();
+
+    for (i = 0; i < SELF_TEST_EXTRAS; i++) {
+        if (KCmdLineHasFlag(selfTestExtras[i].flag) && !startTest(&selfTestExtras[i])) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * startTest - Create a test's process, or run its start function
+ */
+static bool startTest(const SelfTest* test)
+{
+    if (test->start) {
+        return test->start();
+    }
+
+    return ProcessCreate(test->name, test->entry, PROCESS_MODE_KERNEL) != NULL;
+}
+
+/*
+ * Test processes - demonstrate multitasking
+ */
+
+static void testProcess1(void)
+{
+    ClcWriter* vga = VidGetWriter();
+    ClcWriter* serial = EConGetWriter();
+
+    for (int i = 0; i < 5; i++) {
+        ClcPrintfWriter(vga, "[P1:%d] ", i);
+        ClcPrintfWriter(serial, "Process 1 iteration %d\n", i);
+
+        // Busy wait to simulate work
+        for (volatile int j = 0; j < 1000000; j++);
+    }
+
+    ClcPrintfWriter(serial, "Process 1 exiting\n");
+}
+
+static void testProcess2(void)
+{
+    ClcWriter* vga = VidGetWriter();
+    ClcWriter* serial = EConGetWriter();
+
+    for (int i = 0; i < 5; i++) {
+        ClcPrintfWriter(vga, "[P2:%d] ", i);
+        ClcPrintfWriter(serial, "Process 2 iteration %d\n", i);
+
+        // Busy wait to simulate work
+        for (volatile int j = 0; j < 1000000; j++);
+    }
+
+    ClcPrintfWriter(serial, "Process 2 exiting\n");
+}
+
+static void testProcess3(void)
+{
+    ClcWriter* vga = VidGetWriter();
+    ClcWriter* serial = EConGetWriter();
+
+    for (int i = 0; i < 5; i++) {
+        ClcPrintfWriter(vga, "[P3:%d] ", i);
+        ClcPrintfWriter(serial, "Process 3 iteration %d\n", i);
+
+        // Busy wait to simulate work
+        for (volatile int j = 0; j < 1000000; j++);
+    }
+
+    ClcPrintfWriter(serial, "Process 3 exiting\n");
+}
+
+/*
+ * demoStart - Create the three demo processes (no test flag given)
+ */
+static bool demoStart(void)
+{
+    return ProcessCreate("test1", testProcess1, PROCESS_MODE_KERNEL) &&
+           ProcessCreate("test2", testProcess2, PROCESS_MODE_KERNEL) &&
+           ProcessCreate("test3", testProcess3, PROCESS_MODE_KERNEL);
+}
+
+/*
+ * switchBenchPing - Time a yield ping-pong between two processes
+ *
+ * With nothing else runnable each yield switches straight to the other
+ * side, so the cost per switch is the whole round trip through
+ * ProcessYield() and the scheduling class, not just the stack swap.
+ * Only ping touches the FPU, so its registers should stay loaded and no
+ * switch should need to save them.
+ */
+static void switchBenchPing(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    bool haveTsc = TscGetKhz() != 0;   // rdtsc faults on CPUs without one
+
+    volatile double sum = 0.0;
+
+    uint64_t startSwitches = ProcessGetSwitchCount();
+    uint64_t startCycles = haveTsc ? TscRead() : 0;
+    for (int i = 0; i < SWITCH_BENCH_ROUNDS; i++) {
+        sum += 1.0;
+        ProcessYield();
+    }
+    uint64_t cycles = haveTsc ? TscRead() - startCycles : 0;
+    uint32_t switches = (uint32_t)(ProcessGetSwitchCount() - startSwitches);
+
+    if (!haveTsc || switches == 0) {
+        ClcPrintfWriter(serial, "switchbench: %u switches, no timing (%s)\n", switches,
+                        haveTsc ? "nothing to switch to" : "TSC unavailable");
+        return;
+    }
+
+    ClcPrintfWriter(serial, "switchbench: %u switches, %u cycles/switch\n", switches,
+                    (uint32_t)ClcDivU64(cycles, switches, NULL));
+
+    uint64_t traps, saves, avoided;
+    FpuGetStats(&traps, &saves, &avoided);
+    ClcPrintfWriter(serial, "switchbench: FPU %u traps, %u saves, %u switches avoided a save\n",
+                    (uint32_t)traps, (uint32_t)saves, (uint32_t)avoided);
+}
+
+/*
+ * switchBenchPong - Other half of the switchbench ping-pong
+ */
+static void switchBenchPong(void)
+{
+    for (int i = 0; i < SWITCH_BENCH_ROUNDS; i++) {
+        ProcessYield();
+    }
+}
+
+/*
+ * switchBenchStart - Create the two halves of the switchbench ping-pong
+ */
+static bool switchBenchStart(void)
+{
+    return ProcessCreate("ping", switchBenchPing, PROCESS_MODE_KERNEL) &&
+           ProcessCreate("pong", switchBenchPong, PROCESS_MODE_KERNEL);
+}
+
+/* Counts up once per balancetest worker that finishes */
+static Semaphore balanceTestDone = SEMAPHORE_INIT(balanceTestDone, 0);
+
+/*
+ * balanceTestWorker - Burn CPU for one to four units of work
+ *
+ * New processes are spread evenly over the CPUs, so the uneven amounts
+ * are what leave some CPUs short of work and make them steal.
+ */
+static void balanceTestWorker(void)
+{
+    uint32_t units = ProcessGetCurrent()->pid % 4 + 1;
+    for (uint32_t i = 0; i < units * 20; i++) {
+        for (volatile int j = 0; j < 1000000; j++);
+    }
+
+    SemaphoreUp(&balanceTestDone);
+}
+
+/*
+ * balanceTestReport - Print the load balancer counters once the workers are done
+ */
+static void balanceTestReport(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    for (uint32_t i = 0; i < BALANCE_TEST_WORKERS; i++) {
+        SemaphoreDown(&balanceTestDone);
+    }
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!SmpIsCpuOnline(cpu)) {
+            continue;
+        }
+
+        uint64_t steals, migrations, idle, elapsed;
+        ProcessGetBalanceStats(cpu, &steals, &migrations);
+        ProcessGetCpuTimes(cpu, &idle, &elapsed);
+        uint32_t busy = elapsed ? 100 - (uint32_t)ClcDivU64(idle * 100, elapsed, NULL) : 0;
+        ClcPrintfWriter(serial, "balancetest: CPU %u: %u steals, %u migrations, %u%% busy\n",
+                        cpu, (uint32_t)steals, (uint32_t)migrations, busy);
+    }
+}
+
+/*
+ * balanceTestStart - Create the balancetest reporter and workers
+ */
+static bool balanceTestStart(void)
+{
+    if (!ProcessCreate("report", balanceTestReport, PROCESS_MODE_KERNEL)) {
+        return false;
+    }
+
+    for (int i = 0; i < BALANCE_TEST_WORKERS; i++) {
+        if (!ProcessCreate("worker", balanceTestWorker, PROCESS_MODE_KERNEL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Mutex the pitest processes fight over */
+static Mutex piTestLock = MUTEX_INIT(piTestLock);
+
+/* Highest priority low ran at while holding piTestLock */
+static volatile uint32_t piTestLowPriority;
+
+/*
+ * piTestBurn - Busy work, in units of a few milliseconds
+ */
+static void piTestBurn(uint32_t units)
+{
+    for (uint32_t i = 0; i < units; i++) {
+        for (volatile int j = 0; j < 1000000; j++);
+    }
+}
+
+/*
+ * piTestLow - Hold the mutex across a little work
+ *
+ * Samples its own priority as it goes, to show the boost it inherits
+ * once high is waiting.
+ */
+static void piTestLow(void)
+{
+    Process* self = ProcessGetCurrent();
+    piTestLowPriority = self->priority;
+
+    MutexLock(&piTestLock);
+    for (int i = 0; i < 20; i++) {
+        piTestBurn(1);
+        if (self->priority < piTestLowPriority) {
+            piTestLowPriority = self->priority;
+        }
+    }
+    MutexUnlock(&piTestLock);
+}
+
+/*
+ * piTestMedium - Wake after low has the mutex and hog the CPU
+ *
+ * Without priority inheritance this keeps low, and so high, off the CPU
+ * until it is done.
+ */
+static void piTestMedium(void)
+{
+    ProcessSleep(10);
+    piTestBurn(400);
+}
+
+/*
+ * piTestHigh - Wait for the mutex behind low and report how long it took
+ */
+static void piTestHigh(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    ProcessSleep(20);
+    uint64_t start = PitGetTicks();
+    MutexLock(&piTestLock);
+    uint64_t waited = PitGetTicks() - start;
+    MutexUnlock(&piTestLock);
+
+    ClcPrintfWriter(serial, "pitest: high waited %u ms; low held the mutex at priority %u"
+                    " (own priority %u)\n",
+                    (uint32_t)ClcDivU64(waited * 1000, PitGetFrequency(), NULL),
+                    piTestLowPriority, PI_TEST_LOW_PRIORITY);
+}
+
+/*
+ * piTestStart - Create the pitest processes, all pinned to CPU 0
+ *
+ * Returns: false if any of them could not be created
+ */
+static bool piTestStart(void)
+{
+    Process* low = ProcessCreateWithPriority("low", piTestLow, PROCESS_MODE_KERNEL,
+                                             PI_TEST_LOW_PRIORITY);
+    if (!low || !ProcessSetAffinity(low, 1u << 0)) {
+        return false;
+    }
+
+    for (int i = 0; i < PI_TEST_MEDIUM_HOGS; i++) {
+        Process* medium = ProcessCreateWithPriority("medium", piTestMedium, PROCESS_MODE_KERNEL,
+                                                    PI_TEST_MEDIUM_PRIORITY);
+        if (!medium || !ProcessSetAffinity(medium, 1u << 0)) {
+            return false;
+        }
+    }
+
+    Process* high = ProcessCreateWithPriority("high", piTestHigh, PROCESS_MODE_KERNEL,
+                                              PI_TEST_HIGH_PRIORITY);
+    return high && ProcessSetAffinity(high, 1u << 0);
+}
+
+/*
+ * lockStatReport - Dump the lock statistics a few seconds into the run
+ */
+static void lockStatReport(void)
+{
+    ProcessSleep(LOCK_STAT_REPORT_MS);
+    SpinlockStatDump();
+}
+
+/*
+ * irqStatReport - Dump the interrupt statistics a few seconds into the run
+ */
+static void irqStatReport(void)
+{
+    ProcessSleep(IRQ_STAT_REPORT_MS);
+    IrqStatDump();
+}
+
+/* The latencybench sleeper waits on this; the waker stamps each wakeup */
+static Semaphore latencyBenchWake = SEMAPHORE_INIT(latencyBenchWake, 0);
+static volatile uint64_t latencyBenchStamp;
+static volatile bool latencyBenchDone = false;
+
+/*
+ * churnHeap - Kernel work: allocate and free a batch of heap blocks
+ *
+ * Every allocation and free takes the heap lock, so this is mostly time
+ * spent in the kernel with preemption briefly disabled, over and over.
+ */
+static void churnHeap(void)
+{
+    void* blocks[16];
+    for (int i = 0; i < 16; i++) {
+        blocks[i] = KAllocateMemory(64 + 32 * i);
+    }
+    for (int i = 0; i < 16; i++) {
+        KFreeMemory(blocks[i]);
+    }
+}
+
+/*
+ * latencyBenchSleeper - Measure how soon each wakeup gets the CPU
+ */
+static void latencyBenchSleeper(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    uint64_t total = 0;
+    uint64_t min = ~0ull;
+    uint64_t max = 0;
+
+    for (int i = 0; i < LATENCY_BENCH_ROUNDS; i++) {
+        SemaphoreDown(&latencyBenchWake);
+        uint64_t latency = TscRead() - latencyBenchStamp;
+        total += latency;
+        min = latency < min ? latency : min;
+        max = latency > max ? latency : max;
+    }
+    latencyBenchDone = true;
+
+    uint32_t khz = TscGetKhz();
+    ClcPrintfWriter(serial, "latencybench: %u wakeups, wakeup-to-run min %u avg %u max %u ns\n",
+                    LATENCY_BENCH_ROUNDS,
+                    (uint32_t)ClcDivU64(min * 1000000, khz, NULL),
+                    (uint32_t)ClcDivU64(ClcDivU64(total, LATENCY_BENCH_ROUNDS, NULL) * 1000000,
+                                        khz, NULL),
+                    (uint32_t)ClcDivU64(max * 1000000, khz, NULL));
+}
+
+/*
+ * latencyBenchWaker - Wake the sleeper from the middle of kernel work
+ *
+ * Runs at low priority, so every wakeup should preempt it at once: at
+ * the semaphore's lock release, not at the next timer tick.
+ */
+static void latencyBenchWaker(void)
+{
+    for (int i = 0; i < LATENCY_BENCH_ROUNDS; i++) {
+        for (int j = 0; j < 20; j++) {
+            churnHeap();
+        }
+        latencyBenchStamp = TscRead();
+        SemaphoreUp(&latencyBenchWake);
+    }
+}
+
+/*
+ * latencyBenchChurn - Keep the CPU busy in the kernel until the bench is done
+ */
+static void latencyBenchChurn(void)
+{
+    while (!latencyBenchDone) {
+        churnHeap();
+    }
+}
+
+/*
+ * latencyBenchStart - Create the latencybench processes, all pinned to CPU 0
+ *
+ * Returns: false without a TSC or if any of them could not be created
+ */
+static bool latencyBenchStart(void)
+{
+    if (TscGetKhz() == 0) {
+        ClcPrintfWriter(EConGetWriter(), "latencybench: needs a TSC\n");
+        return false;
+    }
+
+    Process* sleeper = ProcessCreateWithPriority("sleeper", latencyBenchSleeper,
+                                                 PROCESS_MODE_KERNEL,
+                                                 LATENCY_BENCH_HIGH_PRIORITY);
+    if (!sleeper || !ProcessSetAffinity(sleeper, 1u << 0)) {
+        return false;
+    }
+
+    for (int i = 0; i < LATENCY_BENCH_CHURNERS; i++) {
+        Process* churn = ProcessCreateWithPriority("churn", latencyBenchChurn,
+                                                   PROCESS_MODE_KERNEL,
+                                                   LATENCY_BENCH_LOW_PRIORITY);
+        if (!churn || !ProcessSetAffinity(churn, 1u << 0)) {
+            return false;
+        }
+    }
+
+    Process* waker = ProcessCreateWithPriority("waker", latencyBenchWaker, PROCESS_MODE_KERNEL,
+                                               LATENCY_BENCH_LOW_PRIORITY);
+    return waker && ProcessSetAffinity(waker, 1u << 0);
+}
+
+/* irqbench state, written by the handler and reset for each mode */
+static Semaphore irqBenchDone = SEMAPHORE_INIT(irqBenchDone, 0);
+static volatile uint32_t irqBenchCount;
+static uint64_t irqBenchTotal;
+static uint64_t irqBenchMin;
+static uint64_t irqBenchMax;
+
+/*
+ * irqBenchHandler - RTC interrupt: time how long since it reached irqHandler()
+ *
+ * The same handler serves both modes, so the only difference measured is
+ * whether it runs in the interrupt or in the irq/8 process.
+ */
+static void irqBenchHandler(void)
+{
+    uint64_t latency = TscRead() - IrqGetRaisedAt(IRQ8);
+    RtcAcknowledge();
+
+    if (irqBenchCount >= IRQ_BENCH_SAMPLES) {
+        return;
+    }
+    irqBenchTotal += latency;
+    irqBenchMin = latency < irqBenchMin ? latency : irqBenchMin;
+    irqBenchMax = latency > irqBenchMax ? latency : irqBenchMax;
+    if (++irqBenchCount == IRQ_BENCH_SAMPLES) {
+        SemaphoreUp(&irqBenchDone);
+    }
+}
+
+/*
+ * irqBenchPhase - Run the RTC until enough interrupts are timed, and report
+ */
+static void irqBenchPhase(const char* mode)
+{
+    irqBenchCount = 0;
+    irqBenchTotal = 0;
+    irqBenchMin = ~0ull;
+    irqBenchMax = 0;
+
+    uint32_t hz = RtcStartPeriodic(IRQ_BENCH_HZ);
+    IrqUnmask(IRQ8);
+    SemaphoreDown(&irqBenchDone);
+    RtcStopPeriodic();
+    IrqMask(IRQ8);
+
+    uint32_t khz = TscGetKhz();
+    ClcPrintfWriter(EConGetWriter(),
+                    "irqbench: %s, %u interrupts at %u Hz, interrupt-to-handler "
+                    "min %u avg %u max %u ns\n",
+                    mode, IRQ_BENCH_SAMPLES, hz,
+                    (uint32_t)ClcDivU64(irqBenchMin * 1000000, khz, NULL),
+                    (uint32_t)ClcDivU64(ClcDivU64(irqBenchTotal, IRQ_BENCH_SAMPLES, NULL) * 1000000,
+                                        khz, NULL),
+                    (uint32_t)ClcDivU64(irqBenchMax * 1000000, khz, NULL));
+}
+
+/*
+ * irqBench - Time the RTC handler run directly, then threaded
+ *
+ * The threaded handler's process is pinned to CPU 0, which takes the PIC
+ * interrupts, so its wakeups need no IPI.
+ */
+static void irqBench(void)
+{
+    if (TscGetKhz() == 0) {
+        ClcPrintfWriter(EConGetWriter(), "irqbench: needs a TSC\n");
+        return;
+    }
+
+    IrqRegisterHandler(IRQ8, irqBenchHandler);
+    irqBenchPhase("direct");
+    IrqUnregisterHandler(IRQ8);
+
+    Process* thread = IrqRegisterThreadedHandler(IRQ8, irqBenchHandler, IRQ_BENCH_PRIORITY);
+    if (!thread || !ProcessSetAffinity(thread, 1u << 0)) {
+        ClcPrintfWriter(EConGetWriter(), "irqbench: cannot start the handler process\n");
+        return;
+    }
+    irqBenchPhase("threaded");
+    IrqUnregisterHandler(IRQ8);
+}
+
+/* Interrupts the apicbench handler has seen */
+static volatile uint32_t apicBenchCount;
+
+/*
+ * apicBenchHandler - RTC interrupt: just count it
+ */
+static void apicBenchHandler(void)
+{
+    RtcAcknowledge();
+    apicBenchCount++;
+}
+
+/*
+ * apicBenchSpin - Count loop iterations until some cycles have passed
+ *
+ * Time spent in interrupts meanwhile is time the loop does not count.
+ */
+static uint64_t apicBenchSpin(uint64_t cycles)
+{
+    uint64_t loops = 0;
+    uint64_t end = TscRead() + cycles;
+    while (TscRead() < end) {
+        loops++;
+    }
+    return loops;
+}
+
+/*
+ * apicBench - Time EOIs and whole interrupts on the controller in use
+ *
+ * The EOIs are sent with nothing in service, which both controllers
+ * ignore, so only the write itself is timed. The cost of a whole
+ * interrupt (entry, dispatch, EOI, exit) is what a busy loop on the
+ * same CPU loses while the RTC interrupts it at full rate.
+ */
+static void apicBench(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    uint32_t khz = TscGetKhz();
+    if (khz == 0) {
+        ClcPrintfWriter(serial, "apicbench: needs a TSC\n");
+        return;
+    }
+
+    // The RTC interrupts CPU 0, so the busy loop must run there too; a
+    // running process moves when it is next switched out
+    if (!ProcessSetAffinity(ProcessGetCurrent(), 1u << 0)) {
+        ClcPrintfWriter(serial, "apicbench: cannot move to CPU 0\n");
+        return;
+    }
+    ProcessYield();
+
+    uint32_t flags = irq_save();
+    uint64_t start = TscRead();
+    for (uint32_t i = 0; i < APIC_BENCH_EOIS; i++) {
+        IrqSendEoi(IRQ8);
+    }
+    uint64_t eoiCycles = TscRead() - start;
+    irq_restore(flags);
+
+    uint64_t window = (uint64_t)khz * APIC_BENCH_MS;
+    uint64_t quiet = apicBenchSpin(window);
+
+    apicBenchCount = 0;
+    IrqRegisterHandler(IRQ8, apicBenchHandler);
+    uint32_t hz = RtcStartPeriodic(APIC_BENCH_HZ);
+    IrqUnmask(IRQ8);
+    uint64_t busy = apicBenchSpin(window);
+    RtcStopPeriodic();
+    IrqMask(IRQ8);
+    IrqUnregisterHandler(IRQ8);
+
+    uint32_t count = apicBenchCount;
+    uint64_t lost = quiet > busy ? ClcDivU64((quiet - busy) * window, quiet, NULL) : 0;
+    ClcPrintfWriter(serial, "apicbench: %s, EOI %u ns, %u interrupts/s at %u Hz, "
+                    "%u ns per interrupt\n",
+                    IrqUsesApic() ? "I/O APIC" : "8259 PIC",
+                    (uint32_t)ClcDivU64(eoiCycles * 1000000, (uint64_t)khz * APIC_BENCH_EOIS, NULL),
+                    (uint32_t)ClcDivU64((uint64_t)count * 1000, APIC_BENCH_MS, NULL), hz,
+                    count ? (uint32_t)ClcDivU64(lost * 1000000, (uint64_t)khz * count, NULL) : 0);
+}
+
+/* irqsharetest: the two devices on IRQ 8; the first is never interrupting */
+static IrqAction irqShareTestIdleAction;
+static IrqAction irqShareTestRtcAction;
+static uint32_t irqShareTestIdleDevice;
+static uint32_t irqShareTestRtcDevice;
+
+/*
+ * irqShareTestIdle - Shared handler of a device that never interrupts
+ */
+static IrqReturn irqShareTestIdle(void* cookie)
+{
+    (void)cookie;
+    return IRQ_NONE;
+}
+
+/*
+ * irqShareTestRtc - Shared RTC handler: claim the interrupt if the RTC raised it
+ */
+static IrqReturn irqShareTestRtc(void* cookie)
+{
+    (void)cookie;
+    return RtcAcknowledge() ? IRQ_HANDLED : IRQ_NONE;
+}
+
+/*
+ * irqShareTest - Share IRQ 8 between two handlers, then take one away
+ *
+ * The idle handler is first in the chain, so it is asked about every RTC
+ * interrupt and declines each one. Halfway through it is removed while
+ * the RTC keeps interrupting.
+ */
+static void irqShareTest(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    IrqActionSetup(&irqShareTestIdleAction, "idle", irqShareTestIdle, &irqShareTestIdleDevice);
+    IrqActionSetup(&irqShareTestRtcAction, "rtc", irqShareTestRtc, &irqShareTestRtcDevice);
+    if (!IrqAddSharedHandler(IRQ8, &irqShareTestIdleAction) ||
+        !IrqAddSharedHandler(IRQ8, &irqShareTestRtcAction)) {
+        ClcPrintfWriter(serial, "irqsharetest: IRQ 8 is not free\n");
+        return;
+    }
+
+    uint32_t hz = RtcStartPeriodic(IRQ_SHARE_TEST_HZ);
+    ProcessSleep(IRQ_SHARE_TEST_MS);
+    bool removed = IrqRemoveSharedHandler(IRQ8, &irqShareTestIdleDevice) == &irqShareTestIdleAction;
+    ProcessSleep(IRQ_SHARE_TEST_MS);
+    RtcStopPeriodic();
+    IrqRemoveSharedHandler(IRQ8, &irqShareTestRtcDevice);
+
+    ClcPrintfWriter(serial, "irqsharetest: RTC at %u Hz, idle handler %s after %u ms, "
+                    "%u calls, rtc handler %u calls, %u handled\n",
+                    hz, removed ? "removed" : "NOT removed", IRQ_SHARE_TEST_MS,
+                    (uint32_t)irqShareTestIdleAction.calls,
+                    (uint32_t)irqShareTestRtcAction.calls,
+                    (uint32_t)irqShareTestRtcAction.handled);
+    IrqStatDump();
+}
+
+/* worktest state: the timer queues the work item, which times the hand-off */
+static Timer workTestTick;
+static Work workTestWork;
+static volatile uint64_t workTestStamp;
+static uint32_t workTestRounds = 0;
+static uint64_t workTestTotal = 0;
+static uint64_t workTestMin = ~0ull;
+static uint64_t workTestMax = 0;
+
+/*
+ * workTestTimer - Timer callback: stamp the TSC and queue the work
+ *
+ * Runs in the timer softirq, where it could not sleep.
+ */
+static void workTestTimer(void* data)
+{
+    (void)data;
+
+    workTestStamp = TscRead();
+    WorkQueueAdd(WORK_QUEUE_HIGHPRI, &workTestWork);
+}
+
+/*
+ * workTestRun - Work item: measure how soon the worker got to it
+ *
+ * Sleeps before re-arming the timer, which only a worker may do.
+ */
+static void workTestRun(void* data)
+{
+    (void)data;
+
+    uint64_t latency = TscRead() - workTestStamp;
+    workTestTotal += latency;
+    workTestMin = latency < workTestMin ? latency : workTestMin;
+    workTestMax = latency > workTestMax ? latency : workTestMax;
+
+    if (++workTestRounds < WORK_TEST_ROUNDS) {
+        ProcessSleep(WORK_TEST_INTERVAL_MS);
+        TimerStart(&workTestTick, 0);
+        return;
+    }
+
+    uint32_t khz = TscGetKhz();
+    ClcPrintfWriter(EConGetWriter(),
+                    "worktest: %u hand-offs, softirq-to-worker min %u avg %u max %u ns\n",
+                    WORK_TEST_ROUNDS,
+                    (uint32_t)ClcDivU64(workTestMin * 1000000, khz, NULL),
+                    (uint32_t)ClcDivU64(ClcDivU64(workTestTotal, WORK_TEST_ROUNDS, NULL) * 1000000,
+                                        khz, NULL),
+                    (uint32_t)ClcDivU64(workTestMax * 1000000, khz, NULL));
+}
+
+/*
+ * workTestStart - Arm the first worktest timer
+ *
+ * Returns: false if there is no TSC to time with
+ */
+static bool workTestStart(void)
+{
+    if (TscGetKhz() == 0) {
+        ClcPrintfWriter(EConGetWriter(), "worktest: needs a TSC\n");
+        return false;
+    }
+
+    TimerSetup(&workTestTick, workTestTimer, NULL);
+    WorkSetup(&workTestWork, workTestRun, NULL);
+    TimerStart(&workTestTick, TimerMsToTicks(WORK_TEST_INTERVAL_MS));
+    return true;
+}
+
+/* Values of RcuTortureElement.magic */
+#define RCU_TORTURE_LIVE    0x4C495645u
+#define RCU_TORTURE_FREED   0x46524545u
+
+/*
+ * RcuTortureElement - What the rcutorture writer publishes
+ *
+ * Readers check the magic; it only reads FREED if an element was freed
+ * while a reader could still see it.
+ */
+typedef struct RcuTortureElement {
+    RcuHead rcu;
+    volatile uint32_t magic;
+    struct RcuTortureElement* nextFree;
+} RcuTortureElement;
+
+/* rcutorture state: the element pool, the published one, and the results */
+static RcuTortureElement rcuTorturePool[RCU_TORTURE_ELEMENTS];
+static RcuTortureElement* rcuTortureFreeList;
+static Spinlock rcuTortureFreeLock = SPINLOCK_INIT;   // Also taken in the RCU softirq
+static RcuTortureElement* rcuTorturePublished;
+static volatile bool rcuTortureStop = false;
+static Semaphore rcuTortureReadersDone = SEMAPHORE_INIT(rcuTortureReadersDone, 0);
+static uint32_t rcuTortureReaders = 0;
+static volatile uint32_t rcuTortureErrors = 0;
+static volatile uint32_t rcuTortureReads = 0;
+
+/*
+ * rcuTortureAlloc - Take an element off the free list
+ *
+ * Returns: The element, or NULL if all are published or awaiting a grace period
+ */
+static RcuTortureElement* rcuTortureAlloc(void)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&rcuTortureFreeLock);
+    RcuTortureElement* element = rcuTortureFreeList;
+    if (element) {
+        rcuTortureFreeList = element->nextFree;
+    }
+    SpinlockReleaseIrqRestore(&rcuTortureFreeLock, flags);
+    return element;
+}
+
+/*
+ * rcuTortureFree - Mark an element freed and put it back on the free list
+ *
+ * The RCU callback, and the writer's own path after RcuSynchronize().
+ */
+static void rcuTortureFree(void* data)
+{
+    RcuTortureElement* element = (RcuTortureElement*)data;
+    if (element->magic != RCU_TORTURE_LIVE) {
+        __atomic_add_fetch(&rcuTortureErrors, 1, __ATOMIC_RELAXED);
+    }
+    element->magic = RCU_TORTURE_FREED;
+
+    uint32_t flags = SpinlockAcquireIrqSave(&rcuTortureFreeLock);
+    element->nextFree = rcuTortureFreeList;
+    rcuTortureFreeList = element;
+    SpinlockReleaseIrqRestore(&rcuTortureFreeLock, flags);
+}
+
+/*
+ * rcuTortureReader - Check the published element, over and over
+ *
+ * Holds each element a while between the two checks, so a grace period
+ * that ends too soon has time to free it under the reader.
+ */
+static void rcuTortureReader(void)
+{
+    uint32_t reads = 0;
+
+    while (!rcuTortureStop) {
+        RcuReadLock();
+        RcuTortureElement* element = RCU_DEREFERENCE(rcuTorturePublished);
+        bool ok = element->magic == RCU_TORTURE_LIVE;
+        for (volatile int i = 0; i < 100; i++);
+        ok = ok && element->magic == RCU_TORTURE_LIVE;
+        RcuReadUnlock();
+
+        if (!ok) {
+            __atomic_add_fetch(&rcuTortureErrors, 1, __ATOMIC_RELAXED);
+        }
+        reads++;
+    }
+
+    __atomic_add_fetch(&rcuTortureReads, reads, __ATOMIC_RELAXED);
+    SemaphoreUp(&rcuTortureReadersDone);
+}
+
+/*
+ * rcuTortureWriter - Replace the published element until time is up
+ *
+ * Most old elements go through RcuCall(); every eighth waits in
+ * RcuSynchronize() instead, to exercise both paths.
+ */
+static void rcuTortureWriter(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    uint64_t end = PitGetTicks() + TimerMsToTicks(RCU_TORTURE_MS);
+    uint32_t startGps = RcuGetGracePeriods();
+    uint32_t updates = 0;
+    uint32_t stalls = 0;
+
+    while (PitGetTicks() < end) {
+        RcuTortureElement* element = rcuTortureAlloc();
+        if (!element) {
+            // Every element is in use or waiting out a grace period
+            stalls++;
+            ProcessSleep(1);
+            continue;
+        }
+        element->magic = RCU_TORTURE_LIVE;
+
+        RcuTortureElement* old = rcuTorturePublished;
+        RCU_ASSIGN_POINTER(rcuTorturePublished, element);
+        if (++updates % 8 == 0) {
+            RcuSynchronize();
+            rcuTortureFree(old);
+        } else {
+            RcuCall(&old->rcu, rcuTortureFree, old);
+        }
+        ProcessYield();
+    }
+
+    rcuTortureStop = true;
+    for (uint32_t i = 0; i < rcuTortureReaders; i++) {
+        SemaphoreDown(&rcuTortureReadersDone);
+    }
+
+    ClcPrintfWriter(serial, "rcutorture: %u readers, %u reads, %u updates (%u stalled), "
+                    "%u grace periods, %u errors: %s\n",
+                    rcuTortureReaders, rcuTortureReads, updates, stalls,
+                    RcuGetGracePeriods() - startGps, rcuTortureErrors,
+                    rcuTortureErrors ? "FAILED" : "OK");
+}
+
+/*
+ * rcuTortureStart - Publish the first element and create the processes
+ *
+ * One reader is pinned to each CPU, so every CPU has read-side sections
+ * for the grace periods to wait out.
+ *
+ * Returns: false if any of them could not be created
+ */
+static bool rcuTortureStart(void)
+{
+    for (uint32_t i = 1; i < RCU_TORTURE_ELEMENTS; i++) {
+        rcuTorturePool[i].magic = RCU_TORTURE_FREED;
+        rcuTorturePool[i].nextFree = rcuTortureFreeList;
+        rcuTortureFreeList = &rcuTorturePool[i];
+    }
+    rcuTorturePool[0].magic = RCU_TORTURE_LIVE;
+    rcuTorturePublished = &rcuTorturePool[0];
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!SmpIsCpuOnline(cpu)) {
+            continue;
+        }
+        Process* reader = ProcessCreate("rcureader", rcuTortureReader, PROCESS_MODE_KERNEL);
+        if (!reader || !ProcessSetAffinity(reader, 1u << cpu)) {
+            return false;
+        }
+        rcuTortureReaders++;
+    }
+
+    return ProcessCreate("rcuwriter", rcuTortureWriter, PROCESS_MODE_KERNEL) != NULL;
+}
+
+/*
+ * RcuBenchReader - One rcubench reader's orders and result
+ */
+typedef struct {
+    bool useRcu;
+    uint64_t cycles;
+} RcuBenchReader;
+
+/* rcubench state: the data read, its lock, and the readers of the current run */
+static volatile uint32_t rcuBenchValue = 1;
+static Spinlock rcuBenchLock = SPINLOCK_INIT;
+static RcuBenchReader rcuBenchReaders[SMP_MAX_CPUS];
+static Semaphore rcuBenchGo = SEMAPHORE_INIT(rcuBenchGo, 0);
+static Semaphore rcuBenchDone = SEMAPHORE_INIT(rcuBenchDone, 0);
+
+/*
+ * rcuBenchReader - Time RCU_BENCH_READS reads under RCU or under the lock
+ *
+ * Waits for the go so all readers of a run start together.
+ */
+static void rcuBenchReader(void)
+{
+    RcuBenchReader* self = (RcuBenchReader*)ProcessGetData();
+    uint32_t sum = 0;
+
+    SemaphoreDown(&rcuBenchGo);
+    uint64_t start = TscRead();
+    if (self->useRcu) {
+        for (uint32_t i = 0; i < RCU_BENCH_READS; i++) {
+            RcuReadLock();
+            sum += rcuBenchValue;
+            RcuReadUnlock();
+        }
+    } else {
+        for (uint32_t i = 0; i < RCU_BENCH_READS; i++) {
+            SpinlockAcquire(&rcuBenchLock);
+            sum += rcuBenchValue;
+            SpinlockRelease(&rcuBenchLock);
+        }
+    }
+    self->cycles = TscRead() - start;
+
+    KAssert(sum == RCU_BENCH_READS, "rcubench: read %u, expected %u", sum, RCU_BENCH_READS);
+    SemaphoreUp(&rcuBenchDone);
+}
+
+/*
+ * rcuBenchRun - Time one run with a reader pinned to each of the first CPUs
+ *
+ * Returns: Average cycles per read over all readers, times ten, or 0 on failure
+ */
+static uint64_t rcuBenchRun(bool useRcu, uint32_t readers)
+{
+    uint32_t started = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS && started < readers; cpu++) {
+        if (!SmpIsCpuOnline(cpu)) {
+            continue;
+        }
+        RcuBenchReader* reader = &rcuBenchReaders[started];
+        reader->useRcu = useRcu;
+        reader->cycles = 0;
+        Process* process = ProcessCreateWithData("rcubench", rcuBenchReader,
+                                                 PROCESS_PRIORITY_DEFAULT, reader);
+        if (!process || !ProcessSetAffinity(process, 1u << cpu)) {
+            break;
+        }
+        started++;
+    }
+
+    for (uint32_t i = 0; i < started; i++) {
+        SemaphoreUp(&rcuBenchGo);
+    }
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < started; i++) {
+        SemaphoreDown(&rcuBenchDone);
+    }
+    for (uint32_t i = 0; i < started; i++) {
+        total += rcuBenchReaders[i].cycles;
+    }
+
+    return started == readers ? ClcDivU64(total * 10, (uint64_t)readers * RCU_BENCH_READS, NULL)
+                              : 0;
+}
+
+/*
+ * rcuBench - Compare read-side cost of RCU and a spinlock as readers are added
+ *
+ * RCU readers touch nothing shared, so their cost should stay flat; lock
+ * readers all write the lock's cache line and slow each other down.
+ */
+static void rcuBench(void)
+{
+    ClcWriter* serial = EConGetWriter();
+    uint32_t khz = TscGetKhz();
+    if (khz == 0) {
+        ClcPrintfWriter(serial, "rcubench: needs a TSC\n");
+        return;
+    }
+
+    uint32_t cpus = SmpGetCpuCount();
+    for (uint32_t readers = 1; readers <= cpus; readers++) {
+        uint64_t rcu = rcuBenchRun(true, readers);
+        uint64_t lock = rcuBenchRun(false, readers);
+        if (rcu == 0 || lock == 0) {
+            ClcPrintfWriter(serial, "rcubench: cannot start %u readers\n", readers);
+            return;
+        }
+
+        // Tenths of a cycle per read to tenths of a nanosecond
+        uint32_t rcuNs = (uint32_t)ClcDivU64(rcu * 1000000, khz, NULL);
+        uint32_t lockNs = (uint32_t)ClcDivU64(lock * 1000000, khz, NULL);
+        ClcPrintfWriter(serial, "rcubench: %u reader%s, rcu %u.%u ns/read, spinlock %u.%u ns/read\n",
+                        readers, readers == 1 ? "" : "s", rcuNs / 10, rcuNs % 10,
+                        lockNs / 10, lockNs % 10);
+    }
+}
+
+/*
+ * threadtest state for the current phase. The threads all run on CPU 0,
+ * so the plain counters only race with themselves across yields.
+ */
+static bool threadTestOwnerFirst;               // Owner exits before its threads
+static Semaphore threadTestWorkerDone;          // Upped by each thread as it finishes
+static Semaphore threadTestPhaseDone;           // Upped by an owner that exits last
+static volatile uint32_t threadTestLastTid;     // Thread that yielded last
+static volatile uint32_t threadTestInterleaved; // Yields that returned after another thread ran
+static volatile uint32_t threadTestErrors;
+
+/*
+ * threadTestWorker - Thread of a threadtest process: check and ping-pong
+ *
+ * When the owner exits first, waits until it has, so every check after
+ * that reads an owner whose own stack is already gone.
+ */
+static void threadTestWorker(void)
+{
+    Process* self = ProcessGetCurrent();
+    Process* owner = self->owner;
+
+    if (threadTestOwnerFirst) {
+        while (owner->state != PROCESS_STATE_TERMINATED) {
+            ProcessYield();
+        }
+    }
+
+    uintptr_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    if (self == owner || self->pid != owner->pid || self->tid == owner->tid ||
+        self->pageDirectory != owner->pageDirectory ||
+        cr3 != (uintptr_t)owner->pageDirectory) {
+        threadTestErrors++;
+    }
+
+    for (int round = 0; round < THREAD_TEST_ROUNDS; round++) {
+        if (threadTestLastTid != self->tid) {
+            threadTestInterleaved++;
+        }
+        threadTestLastTid = self->tid;
+        ProcessYield();
+    }
+
+    SemaphoreUp(&threadTestWorkerDone);
+}
+
+/*
+ * threadTestOwner - First thread of a threadtest process
+ *
+ * Starts the other threads on CPU 0 with it, then either exits at once or
+ * waits for all of them to finish and exits last.
+ */
+static void threadTestOwner(void)
+{
+    // Threads inherit the owner's affinity, so they all share CPU 0
+    Process* self = ProcessGetCurrent();
+    if (!ProcessSetAffinity(self, 1u << 0)) {
+        threadTestErrors++;
+    }
+    for (int i = 0; i < THREAD_TEST_THREADS; i++) {
+        if (!ProcessCreateThread(self, "threadtest-thread", threadTestWorker)) {
+            threadTestErrors++;
+            SemaphoreUp(&threadTestWorkerDone);
+        }
+    }
+
+    if (!threadTestOwnerFirst) {
+        for (int i = 0; i < THREAD_TEST_THREADS; i++) {
+            SemaphoreDown(&threadTestWorkerDone);
+        }
+        SemaphoreUp(&threadTestPhaseDone);
+    }
+}
+
+/*
+ * threadTestPhase - Run one threaded process to the end and reap it
+ *
+ * Returns: false if the threads saw anything wrong or memory was left over
+ */
+static bool threadTestPhase(bool ownerFirst)
+{
+    ClcWriter* serial = EConGetWriter();
+    size_t usedBefore;
+    size_t usedAfter;
+
+    threadTestOwnerFirst = ownerFirst;
+    SemaphoreInit(&threadTestWorkerDone, 0);
+    SemaphoreInit(&threadTestPhaseDone, 0);
+    threadTestLastTid = 0;
+    threadTestInterleaved = 0;
+    threadTestErrors = 0;
+    KHeapGetStats(NULL, &usedBefore, NULL);
+
+    if (!ProcessCreate("threadtest-owner", threadTestOwner, PROCESS_MODE_KERNEL)) {
+        ClcPrintfWriter(serial, "threadtest: cannot start the owner\n");
+        return false;
+    }
+
+    if (ownerFirst) {
+        for (int i = 0; i < THREAD_TEST_THREADS; i++) {
+            SemaphoreDown(&threadTestWorkerDone);
+        }
+    } else {
+        SemaphoreDown(&threadTestPhaseDone);
+    }
+
+    // Time for the last thread to exit and the reaper to free everything
+    ProcessSleep(THREAD_TEST_SETTLE_MS);
+    KHeapGetStats(NULL, &usedAfter, NULL);
+
+    bool ok = threadTestErrors == 0 && threadTestInterleaved > 0 && usedAfter == usedBefore;
+    ClcPrintfWriter(serial, "threadtest: owner exits %s, %u threads, %u interleaved yields, "
+                    "%u errors, heap %u -> %u bytes: %s\n",
+                    ownerFirst ? "first" : "last", THREAD_TEST_THREADS,
+                    threadTestInterleaved, threadTestErrors, usedBefore, usedAfter,
+                    ok ? "OK" : "FAILED");
+    return ok;
+}
+
+/*
+ * threadTest - Exercise threads of one process, exiting in both orders
+ *
+ * Each phase starts a process whose threads check they share its PID and
+ * address space and yield to each other on one CPU. In the first the
+ * owner exits before its threads, so its structure must outlive it; in
+ * the second it exits after them. Every PCB and stack must be back on the
+ * heap once the reaper has run.
+ */
+static void threadTest(void)
+{
+    bool ok = threadTestPhase(true);
+    ok = threadTestPhase(false) && ok;
+    ClcPrintfWriter(EConGetWriter(), "threadtest: %s\n", ok ? "passed" : "FAILED");
+}
@@ -0,0 +1,50 @@
+/* semaphore.c - Counting semaphores */
+
+#include "semaphore.h"
+
+/*
+ * SemaphoreInit - Initialize a semaphore
+ */
+void SemaphoreInit(Semaphore* sem, uint32_t count)
+{
+    sem->count = count;
+    WaitQueueInit(&sem->waiters);
+}
+
+/*
+ * SemaphoreDown - Take one from the count, sleeping while it is zero
+ */
+void SemaphoreDown(Semaphore* sem)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&sem->waiters.lock);
+    while (sem->count == 0) {
+        WaitQueueSleepLocked(&sem->waiters);
+    }
+    sem->count--;
+    SpinlockReleaseIrqRestore(&sem->waiters.lock, flags);
+}
+
+/*
+ * SemaphoreTryDown - Take one from the count if it is not zero
+ */
+bool SemaphoreTryDown(Semaphore* sem)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&sem->waiters.lock);
+    bool taken = sem->count > 0;
+    if (taken) {
+        sem->count--;
+    }
+    SpinlockReleaseIrqRestore(&sem->waiters.lock, flags);
+    return taken;
+}
+
+/*
+ * SemaphoreUp - Add one to the count, waking a waiter
+ */
+void SemaphoreUp(Semaphore* sem)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&sem->waiters.lock);
+    sem->count++;
+    WaitQueueWakeOneLocked(&sem->waiters);
+    SpinlockReleaseIrqRestore(&sem->waiters.lock, flags);
+}
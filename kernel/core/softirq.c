@@ -0,0 +1,75 @@
+/* softirq.c - Deferred halves of interrupt handlers */
+
+#include "softirq.h"
+#include "percpu.h"
+#include "preempt.h"
+#include "x86.h"
+#include <stddef.h>
+
+/*
+ * Rounds one interrupt exit makes while handlers keep raising softirqs.
+ * Whatever is still pending after that waits for the next interrupt, so
+ * a softirq that always re-raises itself cannot starve the process.
+ */
+#define SOFTIRQ_MAX_ROUNDS 10
+
+static SoftirqHandler handlers[SOFTIRQ_COUNT];
+
+/*
+ * SoftirqRegister - Set the handler of a softirq
+ */
+void SoftirqRegister(SoftirqType type, SoftirqHandler handler)
+{
+    if (type < SOFTIRQ_COUNT) {
+        handlers[type] = handler;
+    }
+}
+
+/*
+ * SoftirqRaise - Mark a softirq pending on this CPU
+ */
+void SoftirqRaise(SoftirqType type)
+{
+    uint32_t flags = irq_save();
+    PER_CPU_WRITE(softirqPending, PER_CPU_READ(softirqPending) | (1u << type));
+    irq_restore(flags);
+}
+
+/*
+ * SoftirqRunPending - Run the softirqs pending on this CPU
+ *
+ * The bitmap is taken and cleared with interrupts off, then the handlers
+ * run with them on. The raised preempt count keeps interrupts that
+ * arrive meanwhile from switching processes on their way out; the switch
+ * happens once the outermost interrupt has finished with the softirqs.
+ */
+void SoftirqRunPending(void)
+{
+    if (PER_CPU_READ(softirqPending) == 0 || PER_CPU_READ(inSoftirq)) {
+        return;
+    }
+
+    PER_CPU_WRITE(inSoftirq, 1);
+    PreemptDisable();
+
+    for (uint32_t round = 0; round < SOFTIRQ_MAX_ROUNDS; round++) {
+        uint32_t pending = PER_CPU_READ(softirqPending);
+        if (pending == 0) {
+            break;
+        }
+        PER_CPU_WRITE(softirqPending, 0);
+
+        __asm__ volatile ("sti");
+        while (pending) {
+            uint32_t type = (uint32_t)__builtin_ctz(pending);
+            pending &= pending - 1;
+            if (handlers[type]) {
+                handlers[type]();
+            }
+        }
+        __asm__ volatile ("cli");
+    }
+
+    PreemptEnableNoResched();
+    PER_CPU_WRITE(inSoftirq, 0);
+}
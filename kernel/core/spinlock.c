@@ -0,0 +1,326 @@
+/* spinlock.c - Busy-waiting locks for data shared between CPUs */
+
+#include "spinlock.h"
+#include "preempt.h"
+#include "x86.h"
+#include "tsc.h"
+#include "econ_writer.h"
+#include "clc/printf.h"
+#include "clc/math.h"
+#include <stddef.h>
+
+/* Locks lockstat can tell apart (a power of two) */
+#define STAT_LOCKS          128
+
+/* Locks SpinlockStatDump() lists */
+#define STAT_DUMP_LOCKS     20
+
+/*
+ * Statistics for one lock. Apart from claiming the slot, every field is
+ * only written by the CPU holding the lock, so the lock itself protects
+ * them.
+ */
+typedef struct {
+    Spinlock* lock;             // NULL while the slot is free
+    void* site;                 // Where the lock was first taken
+    uint32_t acquisitions;
+    uint32_t contended;         // Acquisitions that had to wait
+    uint64_t waitCycles;
+    uint64_t maxWaitCycles;
+    uint64_t holdCycles;
+    uint64_t maxHoldCycles;
+    uint64_t acquiredAt;        // TSC when taken, 0 if this hold is not timed
+} LockStat;
+
+static volatile bool statEnabled = false;
+static LockStat statLocks[STAT_LOCKS];
+static volatile uint32_t statDropped = 0;  // Acquisitions with no free slot
+
+/* Forward declarations */
+static void acquire(Spinlock* lock, void* site);
+static void release(Spinlock* lock);
+static LockStat* statFind(Spinlock* lock, bool claim);
+static void statAcquired(Spinlock* lock, void* site, bool contended, uint64_t waitCycles);
+static void statReleased(Spinlock* lock);
+static uint32_t cyclesToNs(uint64_t cycles);
+
+/*
+ * SpinlockInit - Initialize an unlocked spinlock
+ */
+void SpinlockInit(Spinlock* lock)
+{
+    lock->tickets = 0;
+}
+
+/*
+ * SpinlockAcquire - Take a lock, spinning until it is free
+ */
+void SpinlockAcquire(Spinlock* lock)
+{
+    PreemptDisable();
+    acquire(lock, __builtin_return_address(0));
+}
+
+/*
+ * SpinlockTryAcquire - Take a lock if it is free
+ *
+ * Free means nobody holds it and nobody is queued, so taking the next
+ * ticket is the same as being served; both halves change in one
+ * compare-and-swap.
+ */
+bool SpinlockTryAcquire(Spinlock* lock)
+{
+    PreemptDisable();
+
+    // Bump next; it is the top half, so wrapping cannot carry into owner
+    uint32_t tickets = __atomic_load_n(&lock->tickets, __ATOMIC_RELAXED);
+    if ((tickets & 0xFFFF) != (tickets >> 16) ||
+        !__atomic_compare_exchange_n(&lock->tickets, &tickets, tickets + 0x10000, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        PreemptEnable();
+        return false;
+    }
+
+    if (statEnabled) {
+        statAcquired(lock, __builtin_return_address(0), false, 0);
+    }
+    return true;
+}
+
+/*
+ * SpinlockRelease - Release a lock taken by this CPU
+ *
+ * A preemption point: a reschedule that came up while the lock was held
+ * happens here, unless interrupts are off.
+ */
+void SpinlockRelease(Spinlock* lock)
+{
+    release(lock);
+    PreemptEnable();
+}
+
+/*
+ * SpinlockAcquireIrqSave - Disable interrupts, then take a lock
+ */
+uint32_t SpinlockAcquireIrqSave(Spinlock* lock)
+{
+    uint32_t flags = irq_save();
+    PreemptDisable();
+    acquire(lock, __builtin_return_address(0));
+    return flags;
+}
+
+/*
+ * SpinlockReleaseIrqRestore - Release a lock and restore interrupts
+ *
+ * Interrupts come back on before preemption does, so a reschedule that
+ * came up while the lock was held happens here.
+ */
+void SpinlockReleaseIrqRestore(Spinlock* lock, uint32_t flags)
+{
+    release(lock);
+    irq_restore(flags);
+    PreemptEnable();
+}
+
+/*
+ * SpinlockIsLocked - Check whether anyone holds a lock
+ */
+bool SpinlockIsLocked(Spinlock* lock)
+{
+    uint32_t tickets = __atomic_load_n(&lock->tickets, __ATOMIC_RELAXED);
+    return (tickets & 0xFFFF) != (tickets >> 16);
+}
+
+/*
+ * SpinlockStatEnable - Start recording lock statistics (lockstat)
+ */
+bool SpinlockStatEnable(void)
+{
+    if (TscGetKhz() == 0) {
+        return false;
+    }
+
+    statEnabled = true;
+    return true;
+}
+
+/*
+ * SpinlockStatDump - Print the lock statistics to the serial console
+ */
+void SpinlockStatDump(void)
+{
+    ClcWriter* serial = EConGetWriter();
+
+    if (!statEnabled) {
+        ClcPrintfWriter(serial, "Lock statistics disabled (boot with lockstat)\n");
+        return;
+    }
+
+    uint32_t used = 0;
+    for (size_t i = 0; i < STAT_LOCKS; i++) {
+        if (statLocks[i].lock) {
+            used++;
+        }
+    }
+
+    ClcPrintfWriter(serial, "\n=== Lock Statistics ===\n");
+    ClcPrintfWriter(serial, "%u locks seen, longest waits first (times in ns)\n", used);
+    if (statDropped > 0) {
+        ClcPrintfWriter(serial, "Untracked acquisitions (table full): %u\n", statDropped);
+    }
+
+    // Selection by total wait: the table is small and this runs rarely
+    bool listed[STAT_LOCKS] = { false };
+    for (uint32_t n = 0; n < STAT_DUMP_LOCKS && n < used; n++) {
+        LockStat* top = NULL;
+        size_t topIndex = 0;
+        for (size_t i = 0; i < STAT_LOCKS; i++) {
+            LockStat* stat = &statLocks[i];
+            if (!stat->lock || listed[i]) {
+                continue;
+            }
+            if (!top || stat->waitCycles > top->waitCycles) {
+                top = stat;
+                topIndex = i;
+            }
+        }
+        listed[topIndex] = true;
+
+        uint32_t acquisitions = top->acquisitions ? top->acquisitions : 1;
+        uint32_t contended = top->contended ? top->contended : 1;
+        ClcPrintfWriter(serial, "  lock %p (first taken at %p): %u acquisitions, %u contended\n",
+                        (void*)top->lock, top->site, top->acquisitions, top->contended);
+        ClcPrintfWriter(serial, "    wait avg %u max %u, hold avg %u max %u\n",
+                        cyclesToNs(ClcDivU64(top->waitCycles, contended, NULL)),
+                        cyclesToNs(top->maxWaitCycles),
+                        cyclesToNs(ClcDivU64(top->holdCycles, acquisitions, NULL)),
+                        cyclesToNs(top->maxHoldCycles));
+    }
+}
+
+/*
+ * acquire - Take a ticket and spin until it is served
+ *
+ * site is the caller of the public function, for lockstat.
+ */
+static void acquire(Spinlock* lock, void* site)
+{
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) == ticket) {
+        if (statEnabled) {
+            statAcquired(lock, site, false, 0);
+        }
+        return;
+    }
+
+    uint64_t start = statEnabled ? TscRead() : 0;
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        cpu_relax();
+    }
+
+    if (statEnabled && start) {
+        statAcquired(lock, site, true, TscRead() - start);
+    }
+}
+
+/*
+ * release - Serve the next ticket
+ */
+static void release(Spinlock* lock)
+{
+    if (statEnabled) {
+        statReleased(lock);
+    }
+
+    // Only the holder writes owner, so a plain increment is enough
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+/*
+ * statFind - Slot for a lock, optionally claiming a free one
+ *
+ * Open addressing on the lock's address. Slots are never given back, so
+ * a lock keeps its slot once it has one.
+ */
+static LockStat* statFind(Spinlock* lock, bool claim)
+{
+    uint32_t hash = (((uint32_t)(uintptr_t)lock >> 2) * 2654435761u) >> 25;
+    for (uint32_t probe = 0; probe < STAT_LOCKS; probe++) {
+        LockStat* stat = &statLocks[(hash + probe) & (STAT_LOCKS - 1)];
+        Spinlock* owner = __atomic_load_n(&stat->lock, __ATOMIC_ACQUIRE);
+        if (owner == lock) {
+            return stat;
+        }
+        if (owner) {
+            continue;
+        }
+        if (!claim) {
+            return NULL;
+        }
+
+        // Another lock may claim the same free slot at the same moment
+        if (__atomic_compare_exchange_n(&stat->lock, &owner, lock, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return stat;
+        }
+        if (owner == lock) {
+            return stat;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * statAcquired - Account an acquisition and start timing the hold
+ */
+static void statAcquired(Spinlock* lock, void* site, bool contended, uint64_t waitCycles)
+{
+    LockStat* stat = statFind(lock, true);
+    if (!stat) {
+        __atomic_add_fetch(&statDropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!stat->site) {
+        stat->site = site;
+    }
+    stat->acquisitions++;
+    if (contended) {
+        stat->contended++;
+        stat->waitCycles += waitCycles;
+        if (waitCycles > stat->maxWaitCycles) {
+            stat->maxWaitCycles = waitCycles;
+        }
+    }
+    stat->acquiredAt = TscRead();
+}
+
+/*
+ * statReleased - Account the time a lock was held
+ *
+ * Holds that began before lockstat was enabled are not timed.
+ */
+static void statReleased(Spinlock* lock)
+{
+    LockStat* stat = statFind(lock, false);
+    if (!stat || stat->acquiredAt == 0) {
+        return;
+    }
+
+    uint64_t held = TscRead() - stat->acquiredAt;
+    stat->acquiredAt = 0;
+    stat->holdCycles += held;
+    if (held > stat->maxHoldCycles) {
+        stat->maxHoldCycles = held;
+    }
+}
+
+/*
+ * cyclesToNs - Convert a short TSC interval to nanoseconds
+ */
+static uint32_t cyclesToNs(uint64_t cycles)
+{
+    return (uint32_t)ClcDivU64(cycles * 1000000, TscGetKhz(), NULL);
+}
@@ -0,0 +1,249 @@
+/* timer.c - Kernel timers (hierarchical timing wheel) */
+
+#include "timer.h"
+#include "pit.h"
+#include "spinlock.h"
+#include "softirq.h"
+#include "smp.h"
+#include "x86.h"
+#include "clk/list.h"
+#include "clc/math.h"
+#include <stddef.h>
+
+/*
+ * Wheel geometry. The root wheel has one slot per tick for the next 256
+ * ticks; each outer level has 64 slots, each covering a whole turn of
+ * the level inside it. Together they reach 2^32 ticks ahead.
+ *
+ * Inserting and cancelling are O(1): a timer goes straight into the slot
+ * for its expiry. Each tick empties one root slot. When the root wheel
+ * wraps, the matching slot of the next level is cascaded down (its
+ * timers re-inserted closer in), and so on outwards. A timer is cascaded
+ * at most once per level, so however many are outstanding, each tick
+ * only costs the timers that expire plus an amortised constant.
+ */
+#define WHEEL_ROOT_BITS     8
+#define WHEEL_LEVEL_BITS    6
+#define WHEEL_ROOT_SIZE     (1u << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE    (1u << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK     (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK    (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_LEVELS        4
+#define WHEEL_MAX_DELAY     ((1ull << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+
+/* Wheel state */
+static ClkListNode rootSlots[WHEEL_ROOT_SIZE];
+static ClkListNode levelSlots[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+static uint64_t wheelTime = 0;      // Next tick to process
+static bool wheelReady = false;
+static Spinlock wheelLock = SPINLOCK_INIT;  // Timers are started from every CPU
+static Timer* volatile runningTimer = NULL; // Callback in progress, if any
+static uint32_t runningCpu;                 // Where it runs
+
+/* Forward declarations */
+static void addTimer(Timer* timer);
+static uint32_t cascade(uint32_t level);
+static void timerSoftirq(void);
+
+/*
+ * TimerInitialize - Set up an empty timer wheel
+ */
+void TimerInitialize(void)
+{
+    for (uint32_t i = 0; i < WHEEL_ROOT_SIZE; i++) {
+        ClkListInit(&rootSlots[i]);
+    }
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for (uint32_t i = 0; i < WHEEL_LEVEL_SIZE; i++) {
+            ClkListInit(&levelSlots[level][i]);
+        }
+    }
+
+    // The current tick has already happened
+    wheelTime = PitGetTicks() + 1;
+    wheelReady = true;
+
+    SoftirqRegister(SOFTIRQ_TIMER, timerSoftirq);
+}
+
+/*
+ * TimerSetup - Prepare a timer for use
+ */
+void TimerSetup(Timer* timer, TimerCallback callback, void* data)
+{
+    ClkListInit(&timer->node);
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+/*
+ * TimerStart - Arm (or re-arm) a timer
+ */
+void TimerStart(Timer* timer, uint64_t delayTicks)
+{
+    if (delayTicks > WHEEL_MAX_DELAY) {
+        delayTicks = WHEEL_MAX_DELAY;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&wheelLock);
+
+    if (TimerPending(timer)) {
+        ClkListRemove(&timer->node);
+    }
+
+    // wheelTime is the next tick processed, so a delay of 0 fires on it
+    timer->expires = wheelTime + delayTicks;
+    addTimer(timer);
+
+    SpinlockReleaseIrqRestore(&wheelLock, flags);
+}
+
+/*
+ * TimerCancel - Disarm a timer, waiting out a callback already running
+ */
+bool TimerCancel(Timer* timer)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&wheelLock);
+    bool pending = false;
+
+    for (;;) {
+        if (TimerPending(timer)) {
+            ClkListRemove(&timer->node);
+            pending = true;
+        }
+
+        // A callback cancelling its own timer cannot wait for itself
+        if (runningTimer != timer || runningCpu == SmpGetCurrentCpu()) {
+            break;
+        }
+
+        // The callback may re-arm the timer, so look again once it is done
+        SpinlockReleaseIrqRestore(&wheelLock, flags);
+        while (runningTimer == timer) {
+            cpu_relax();
+        }
+        flags = SpinlockAcquireIrqSave(&wheelLock);
+    }
+
+    SpinlockReleaseIrqRestore(&wheelLock, flags);
+    return pending;
+}
+
+/*
+ * TimerMsToTicks - Convert milliseconds to timer ticks, rounding up
+ */
+uint64_t TimerMsToTicks(uint32_t ms)
+{
+    return ClcDivU64((uint64_t)ms * PitGetFrequency() + 999, 1000, NULL);
+}
+
+/*
+ * TimerTick - Advance the wheel and run expired timers
+ *
+ * Callbacks run without the wheel lock held, so they may start and
+ * cancel timers themselves; TimerCancel() of a timer whose callback is
+ * running waits for it to return.
+ */
+void TimerTick(uint64_t now)
+{
+    if (!wheelReady) {
+        return;
+    }
+
+    uint32_t flags = SpinlockAcquireIrqSave(&wheelLock);
+
+    while ((int64_t)(now - wheelTime) >= 0) {
+        uint32_t index = (uint32_t)(wheelTime & WHEEL_ROOT_MASK);
+
+        // Root wheel wrapped: pull the next level's slot in, and further
+        // out while each level wraps too
+        if (index == 0) {
+            for (uint32_t level = 0; level < WHEEL_LEVELS && cascade(level) == 0; level++) {
+                // Keep cascading
+            }
+        }
+
+        // Detach the slot first, so callbacks that re-arm land elsewhere
+        ClkListNode expired;
+        ClkListInit(&expired);
+        ClkListSpliceTail(&rootSlots[index], &expired);
+        wheelTime++;
+
+        while (!ClkListEmpty(&expired)) {
+            Timer* timer = CLK_LIST_ENTRY(expired.next, Timer, node);
+            ClkListRemove(&timer->node);
+
+            // Once off the list the timer may be re-armed elsewhere, so
+            // take what the callback needs before letting go of the lock.
+            // TimerCancel() waits while runningTimer names it
+            TimerCallback callback = timer->callback;
+            void* data = timer->data;
+            runningTimer = timer;
+            runningCpu = SmpGetCurrentCpu();
+            SpinlockRelease(&wheelLock);
+            callback(data);
+            SpinlockAcquire(&wheelLock);
+            runningTimer = NULL;
+        }
+    }
+
+    SpinlockReleaseIrqRestore(&wheelLock, flags);
+}
+
+/*
+ * timerSoftirq - Run the timers due by now (raised by every PIT tick)
+ */
+static void timerSoftirq(void)
+{
+    TimerTick(PitGetTicks());
+}
+
+/*
+ * addTimer - Put a timer in the slot for its expiry
+ */
+static void addTimer(Timer* timer)
+{
+    uint64_t delta = timer->expires - wheelTime;
+    ClkListNode* slot;
+
+    if ((int64_t)delta < 0) {
+        // Already due (cascaded late): run on the next tick processed
+        slot = &rootSlots[wheelTime & WHEEL_ROOT_MASK];
+    } else if (delta < WHEEL_ROOT_SIZE) {
+        slot = &rootSlots[timer->expires & WHEEL_ROOT_MASK];
+    } else {
+        uint32_t level = 0;
+        uint32_t shift = WHEEL_ROOT_BITS;
+        while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (shift + WHEEL_LEVEL_BITS))) {
+            level++;
+            shift += WHEEL_LEVEL_BITS;
+        }
+        slot = &levelSlots[level][(timer->expires >> shift) & WHEEL_LEVEL_MASK];
+    }
+
+    ClkListAddTail(slot, &timer->node);
+}
+
+/*
+ * cascade - Re-insert the timers of a level's current slot
+ *
+ * Returns the slot index; 0 means this level wrapped as well.
+ */
+static uint32_t cascade(uint32_t level)
+{
+    uint32_t shift = WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS;
+    uint32_t index = (uint32_t)((wheelTime >> shift) & WHEEL_LEVEL_MASK);
+
+    ClkListNode moving;
+    ClkListInit(&moving);
+    ClkListSpliceTail(&levelSlots[level][index], &moving);
+
+    while (!ClkListEmpty(&moving)) {
+        Timer* timer = CLK_LIST_ENTRY(moving.next, Timer, node);
+        ClkListRemove(&timer->node);
+        addTimer(timer);
+    }
+
+    return index;
+}
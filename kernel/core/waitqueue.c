@@ -0,0 +1,85 @@
+/* waitqueue.c - Queues of processes sleeping until an event */
+
+#include "waitqueue.h"
+#include <stddef.h>
+
+/*
+ * WaitQueueInit - Initialize an empty wait queue
+ */
+void WaitQueueInit(WaitQueue* queue)
+{
+    SpinlockInit(&queue->lock);
+    ClkListInit(&queue->waiters);
+}
+
+/*
+ * WaitQueueSleepLocked - Sleep until woken, with the queue's lock held
+ */
+void WaitQueueSleepLocked(WaitQueue* queue)
+{
+    WaitQueueEntry entry;
+    entry.process = ProcessGetCurrent();
+    ClkListAddTail(&queue->waiters, &entry.node);
+
+    // Blocked before the lock goes, so a waker that takes it next finds
+    // us on the list and its ProcessUnblock() is not lost
+    ProcessPrepareBlock();
+    SpinlockRelease(&queue->lock);
+    ProcessBlockPrepared();
+    SpinlockAcquire(&queue->lock);
+
+    // Wakers unlink the entry; anyone else waking us leaves it queued
+    if (ClkListLinked(&entry.node)) {
+        ClkListRemove(&entry.node);
+    }
+}
+
+/*
+ * WaitQueueWakeOneLocked - Wake the oldest waiter (queue->lock held)
+ */
+Process* WaitQueueWakeOneLocked(WaitQueue* queue)
+{
+    if (ClkListEmpty(&queue->waiters)) {
+        return NULL;
+    }
+
+    WaitQueueEntry* entry = CLK_LIST_ENTRY(queue->waiters.next, WaitQueueEntry, node);
+    Process* process = entry->process;
+    ClkListRemove(&entry->node);
+    ProcessUnblock(process);
+    return process;
+}
+
+/*
+ * WaitQueueWakeAllLocked - Wake every waiter (queue->lock held)
+ */
+uint32_t WaitQueueWakeAllLocked(WaitQueue* queue)
+{
+    uint32_t woken = 0;
+    while (WaitQueueWakeOneLocked(queue)) {
+        woken++;
+    }
+    return woken;
+}
+
+/*
+ * WaitQueueWakeOne - Wake the oldest waiter
+ */
+bool WaitQueueWakeOne(WaitQueue* queue)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&queue->lock);
+    bool woken = WaitQueueWakeOneLocked(queue) != NULL;
+    SpinlockReleaseIrqRestore(&queue->lock, flags);
+    return woken;
+}
+
+/*
+ * WaitQueueWakeAll - Wake every waiter
+ */
+uint32_t WaitQueueWakeAll(WaitQueue* queue)
+{
+    uint32_t flags = SpinlockAcquireIrqSave(&queue->lock);
+    uint32_t woken = WaitQueueWakeAllLocked(queue);
+    SpinlockReleaseIrqRestore(&queue->lock, flags);
+    return woken;
+}
@@ -0,0 +1,137 @@
+/* workqueue.c - Deferred work run by kernel worker processes */
+
+#include "workqueue.h"
+#include "waitqueue.h"
+#include "process.h"
+#include "panic.h"
+#include <stddef.h>
+
+/* Priority of the WORK_QUEUE_HIGHPRI worker */
+#define WORK_HIGHPRI_PRIORITY 2
+
+/*
+ * WorkQueueState - Pending items and the worker that runs them
+ *
+ * The wait queue's lock also covers the list of items, so the worker
+ * checks for work and goes to sleep under one lock.
+ */
+typedef struct {
+    const char* name;
+    uint32_t priority;
+    ClkListNode items;          // Work, oldest first
+    WaitQueue idle;             // The worker, while there is nothing to do
+    Process* worker;
+} WorkQueueState;
+
+static WorkQueueState queues[WORK_QUEUES] = {
+    [WORK_QUEUE_SYSTEM] = {
+        "events", PROCESS_PRIORITY_DEFAULT,
+        { &queues[WORK_QUEUE_SYSTEM].items, &queues[WORK_QUEUE_SYSTEM].items },
+        WAIT_QUEUE_INIT(queues[WORK_QUEUE_SYSTEM].idle), NULL
+    },
+    [WORK_QUEUE_HIGHPRI] = {
+        "events_highpri", WORK_HIGHPRI_PRIORITY,
+        { &queues[WORK_QUEUE_HIGHPRI].items, &queues[WORK_QUEUE_HIGHPRI].items },
+        WAIT_QUEUE_INIT(queues[WORK_QUEUE_HIGHPRI].idle), NULL
+    },
+};
+
+/* Forward declarations */
+static void workerMain(void);
+
+/*
+ * WorkQueueInitialize - Start the worker processes
+ */
+void WorkQueueInitialize(void)
+{
+    for (uint32_t i = 0; i < WORK_QUEUES; i++) {
+        WorkQueueState* queue = &queues[i];
+        queue->worker = ProcessCreateWithData(queue->name, workerMain, queue->priority, queue);
+        if (!queue->worker) {
+            KPanic("Cannot start work queue %s", queue->name);
+        }
+    }
+}
+
+/*
+ * WorkSetup - Prepare a work item for use
+ */
+void WorkSetup(Work* work, WorkFunc func, void* data)
+{
+    ClkListInit(&work->node);
+    work->queue = WORK_QUEUE_SYSTEM;
+    work->func = func;
+    work->data = data;
+}
+
+/*
+ * WorkQueueAdd - Queue a work item
+ */
+bool WorkQueueAdd(WorkQueueId id, Work* work)
+{
+    WorkQueueState* queue = &queues[id];
+    uint32_t flags = SpinlockAcquireIrqSave(&queue->idle.lock);
+
+    bool queued = !WorkPending(work);
+    if (queued) {
+        work->queue = id;
+        ClkListAddTail(&queue->items, &work->node);
+        WaitQueueWakeOneLocked(&queue->idle);
+    }
+
+    SpinlockReleaseIrqRestore(&queue->idle.lock, flags);
+    return queued;
+}
+
+/*
+ * WorkSchedule - Queue a work item on the system queue
+ */
+bool WorkSchedule(Work* work)
+{
+    return WorkQueueAdd(WORK_QUEUE_SYSTEM, work);
+}
+
+/*
+ * WorkCancel - Take a work item off its queue
+ *
+ * work->queue only changes while the item is idle, so if it is pending
+ * this is the lock that covers it.
+ */
+bool WorkCancel(Work* work)
+{
+    WorkQueueState* queue = &queues[work->queue];
+    uint32_t flags = SpinlockAcquireIrqSave(&queue->idle.lock);
+
+    bool pending = WorkPending(work);
+    if (pending) {
+        ClkListRemove(&work->node);
+    }
+
+    SpinlockReleaseIrqRestore(&queue->idle.lock, flags);
+    return pending;
+}
+
+/*
+ * workerMain - Run a queue's items for ever, sleeping while it is empty
+ */
+static void workerMain(void)
+{
+    WorkQueueState* queue = (WorkQueueState*)ProcessGetData();
+
+    while (1) {
+        uint32_t flags = SpinlockAcquireIrqSave(&queue->idle.lock);
+        while (ClkListEmpty(&queue->items)) {
+            WaitQueueSleepLocked(&queue->idle);
+        }
+
+        // Off the list before it runs, so it can be queued again meanwhile;
+        // take what the call needs while the item still cannot change
+        Work* work = CLK_LIST_ENTRY(queue->items.next, Work, node);
+        ClkListRemove(&work->node);
+        WorkFunc func = work->func;
+        void* data = work->data;
+        SpinlockReleaseIrqRestore(&queue->idle.lock, flags);
+
+        func(data);
+    }
+}
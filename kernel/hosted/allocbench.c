@@ -0,0 +1,390 @@
+/* allocbench.c - Host benchmark suite for the PMM and kernel heap
+ *
+ * Usage: allocbench [-v] [-m <ram MB>] [trace files...]
+ *
+ * Runs each benchmark in a forked child so every run starts from a
+ * freshly initialised allocator. Trace files hold one operation per line:
+ *   a <id> <size>   allocate size bytes and remember it as id
+ *   r <id> <size>   reallocate id to size bytes
+ *   f <id>          free id
+ * Lines starting with '#' are ignored.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "host_shim.h"
+#include "pmm.h"
+#include "kheap.h"
+
+/* Benchmark sizes */
+#define PMM_BENCH_PAGES     16384   // 64 MB worth of pages
+#define HEAP_BENCH_OBJECTS  8192
+#define TRACE_MAX_IDS       65536
+#define TRACE_MAX_OPS       1000000
+
+/* One replayable allocator operation */
+typedef struct {
+    char op;                // 'a', 'r' or 'f'
+    uint32_t id;
+    uint32_t size;
+} TraceOp;
+
+/* Benchmark entry point, run in a child process */
+typedef void (*BenchFunc)(const void* arg);
+
+/* Options */
+static size_t ramBytes = HOST_DEFAULT_RAM;
+static bool verbose = false;
+
+/* Trace storage (in the parent before fork, inherited by the child) */
+static TraceOp* traceOps;
+static size_t traceCount;
+
+/* Forward declarations */
+static void runBench(const char* name, BenchFunc func, const void* arg);
+static void printResult(size_t ops, uint64_t ns);
+static void printHeapShape(void);
+static void benchPmmAlloc(const void* arg);
+static void benchPmmFree(const void* arg);
+static void benchHeapAlloc(const void* arg);
+static void benchHeapFree(const void* arg);
+static void benchReplay(const void* arg);
+static void traceGenerate(const char* kind, uint32_t seed);
+static bool traceLoad(const char* path);
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "vm:")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = true;
+            break;
+        case 'm':
+            ramBytes = (size_t)strtoul(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [-m <ram MB>] [trace files...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    traceOps = calloc(TRACE_MAX_OPS, sizeof(TraceOp));
+    if (traceOps == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    printf("%-22s %9s %10s %9s\n", "benchmark", "ops", "time ms", "ns/op");
+
+    // Page allocator
+    runBench("pmm-alloc", benchPmmAlloc, NULL);
+    runBench("pmm-free", benchPmmFree, NULL);
+
+    // Heap, fixed and mixed object sizes
+    static const uint32_t fixedSize = 64;
+    static const uint32_t mixedSize = 0;
+    runBench("heap-alloc-64", benchHeapAlloc, &fixedSize);
+    runBench("heap-free-64", benchHeapFree, &fixedSize);
+    runBench("heap-alloc-mixed", benchHeapAlloc, &mixedSize);
+    runBench("heap-free-mixed", benchHeapFree, &mixedSize);
+
+    // Built-in synthetic traces
+    static const char* builtinTraces[] = { "churn", "fifo", "longlived" };
+    for (size_t i = 0; i < sizeof(builtinTraces) / sizeof(builtinTraces[0]); i++) {
+        char name[64];
+        traceGenerate(builtinTraces[i], 12345);
+        snprintf(name, sizeof(name), "replay-%s", builtinTraces[i]);
+        runBench(name, benchReplay, NULL);
+    }
+
+    // Traces from files
+    for (int i = optind; i < argc; i++) {
+        if (!traceLoad(argv[i])) {
+            return 1;
+        }
+        runBench(argv[i], benchReplay, NULL);
+    }
+
+    free(traceOps);
+    return 0;
+}
+
+/*
+ * runBench - Run one benchmark in a fresh child process
+ */
+static void runBench(const char* name, BenchFunc func, const void* arg)
+{
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        HostShimInitialize(ramBytes, verbose);
+        printf("%-22s ", name);
+        func(arg);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%-22s FAILED (status %d)\n", name, status);
+    }
+}
+
+/*
+ * printResult - Print ops, elapsed time and per-operation cost
+ */
+static void printResult(size_t ops, uint64_t ns)
+{
+    printf("%9zu %10.2f %9.1f\n", ops, ns / 1e6, ops ? (double)ns / ops : 0.0);
+}
+
+/*
+ * printHeapShape - Print heap usage and fragmentation after a run
+ */
+static void printHeapShape(void)
+{
+    size_t total, used, freeBytes, freeBlocks, largestFree;
+    KHeapGetStats(&total, &used, &freeBytes);
+    KHeapGetFreeListStats(&freeBlocks, &largestFree);
+
+    double frag = freeBytes ? 100.0 * (1.0 - (double)largestFree / freeBytes) : 0.0;
+    printf("%22s heap %zu KB, used %zu KB, free %zu KB in %zu blocks, "
+           "largest %zu KB, fragmentation %.1f%%\n",
+           "", total / 1024, used / 1024, freeBytes / 1024, freeBlocks,
+           largestFree / 1024, frag);
+}
+
+/*
+ * benchPmmAlloc - Time PMM page allocation
+ */
+static void benchPmmAlloc(const void* arg)
+{
+    (void)arg;
+
+    uint64_t start = HostNanoseconds();
+    size_t count = 0;
+    for (; count < PMM_BENCH_PAGES; count++) {
+        if (PmmAllocPage() == 0) {
+            break;
+        }
+    }
+    printResult(count, HostNanoseconds() - start);
+}
+
+/*
+ * benchPmmFree - Time PMM page free (random order)
+ */
+static void benchPmmFree(const void* arg)
+{
+    (void)arg;
+
+    static uintptr_t pages[PMM_BENCH_PAGES];
+    size_t count = 0;
+    for (; count < PMM_BENCH_PAGES; count++) {
+        pages[count] = PmmAllocPage();
+        if (pages[count] == 0) {
+            break;
+        }
+    }
+
+    // Shuffle so frees are scattered through the bitmap
+    uint32_t rng = 42;
+    for (size_t i = count; i > 1; i--) {
+        size_t j = HostRandom(&rng) % i;
+        uintptr_t tmp = pages[i - 1];
+        pages[i - 1] = pages[j];
+        pages[j] = tmp;
+    }
+
+    uint64_t start = HostNanoseconds();
+    for (size_t i = 0; i < count; i++) {
+        PmmFreePage(pages[i]);
+    }
+    printResult(count, HostNanoseconds() - start);
+}
+
+/*
+ * objectSize - Size of the i-th benchmark object (0 = mixed sizes)
+ */
+static size_t objectSize(uint32_t fixedSize, uint32_t* rng)
+{
+    if (fixedSize != 0) {
+        return fixedSize;
+    }
+    return 16 + HostRandom(rng) % 1024;
+}
+
+/*
+ * benchHeapAlloc - Time KAllocateMemory
+ */
+static void benchHeapAlloc(const void* arg)
+{
+    uint32_t fixedSize = *(const uint32_t*)arg;
+    uint32_t rng = 7;
+
+    uint64_t start = HostNanoseconds();
+    size_t count = 0;
+    for (; count < HEAP_BENCH_OBJECTS; count++) {
+        if (KAllocateMemory(objectSize(fixedSize, &rng)) == NULL) {
+            break;
+        }
+    }
+    printResult(count, HostNanoseconds() - start);
+    printHeapShape();
+}
+
+/*
+ * benchHeapFree - Time KFreeMemory (every other object, then the rest)
+ */
+static void benchHeapFree(const void* arg)
+{
+    uint32_t fixedSize = *(const uint32_t*)arg;
+    uint32_t rng = 7;
+
+    static void* objects[HEAP_BENCH_OBJECTS];
+    size_t count = 0;
+    for (; count < HEAP_BENCH_OBJECTS; count++) {
+        objects[count] = KAllocateMemory(objectSize(fixedSize, &rng));
+        if (objects[count] == NULL) {
+            break;
+        }
+    }
+
+    // Odd objects first leaves holes that the even frees then coalesce
+    uint64_t start = HostNanoseconds();
+    for (size_t i = 1; i < count; i += 2) {
+        KFreeMemory(objects[i]);
+    }
+    for (size_t i = 0; i < count; i += 2) {
+        KFreeMemory(objects[i]);
+    }
+    printResult(count, HostNanoseconds() - start);
+    printHeapShape();
+}
+
+/*
+ * benchReplay - Replay the loaded trace and report fragmentation
+ */
+static void benchReplay(const void* arg)
+{
+    (void)arg;
+
+    static void* live[TRACE_MAX_IDS];
+
+    uint64_t start = HostNanoseconds();
+    for (size_t i = 0; i < traceCount; i++) {
+        const TraceOp* op = &traceOps[i];
+        switch (op->op) {
+        case 'a':
+            live[op->id] = KAllocateMemory(op->size);
+            break;
+        case 'r':
+            live[op->id] = KReallocateMemory(live[op->id], op->size);
+            break;
+        case 'f':
+            KFreeMemory(live[op->id]);
+            live[op->id] = NULL;
+            break;
+        }
+    }
+    printResult(traceCount, HostNanoseconds() - start);
+    printHeapShape();
+}
+
+/*
+ * traceGenerate - Build a synthetic trace
+ *
+ *   churn     - ~1000 live objects of random size, random frees
+ *   fifo      - request/response buffers freed in arrival order
+ *   longlived - small permanent objects interleaved with large temporaries
+ */
+static void traceGenerate(const char* kind, uint32_t seed)
+{
+    uint32_t rng = seed;
+    static bool isLive[TRACE_MAX_IDS];
+    memset(isLive, 0, sizeof(isLive));
+    traceCount = 0;
+
+    if (strcmp(kind, "churn") == 0) {
+        for (size_t i = 0; i < 60000; i++) {
+            uint32_t id = HostRandom(&rng) % 2000;
+            if (isLive[id]) {
+                traceOps[traceCount++] = (TraceOp){ 'f', id, 0 };
+            } else {
+                traceOps[traceCount++] = (TraceOp){ 'a', id, 16 + HostRandom(&rng) % 2048 };
+            }
+            isLive[id] = !isLive[id];
+        }
+    } else if (strcmp(kind, "fifo") == 0) {
+        static const uint32_t sizes[] = { 64, 512, 4096 };
+        const uint32_t window = 256;
+        for (uint32_t id = 0; id < 40000; id++) {
+            uint32_t slot = id % TRACE_MAX_IDS;
+            traceOps[traceCount++] = (TraceOp){ 'a', slot, sizes[HostRandom(&rng) % 3] };
+            if (id >= window) {
+                traceOps[traceCount++] = (TraceOp){ 'f', (id - window) % TRACE_MAX_IDS, 0 };
+            }
+        }
+    } else if (strcmp(kind, "longlived") == 0) {
+        uint32_t nextPermanent = 0;
+        for (uint32_t round = 0; round < 4000; round++) {
+            // A large temporary, a small object that stays, then free the temporary
+            traceOps[traceCount++] = (TraceOp){ 'a', 60000, 512 + HostRandom(&rng) % 4096 };
+            traceOps[traceCount++] = (TraceOp){ 'a', nextPermanent++, 16 + HostRandom(&rng) % 48 };
+            traceOps[traceCount++] = (TraceOp){ 'f', 60000, 0 };
+        }
+    }
+}
+
+/*
+ * traceLoad - Load a trace file
+ */
+static bool traceLoad(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[128];
+    size_t lineNo = 0;
+    traceCount = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNo++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        TraceOp op = { 0, 0, 0 };
+        int fields = sscanf(line, " %c %u %u", &op.op, &op.id, &op.size);
+        bool valid = (op.op == 'f' && fields >= 2) ||
+                     ((op.op == 'a' || op.op == 'r') && fields == 3);
+        if (!valid || op.id >= TRACE_MAX_IDS || traceCount >= TRACE_MAX_OPS) {
+            fprintf(stderr, "%s:%zu: bad trace line\n", path, lineNo);
+            fclose(file);
+            return false;
+        }
+
+        traceOps[traceCount++] = op;
+    }
+
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,288 @@
+/* allocfuzz.c - Randomized stress test for the PMM and kernel heap
+ *
+ * Usage: allocfuzz [seed] [iterations]
+ *
+ * Drives a random mix of allocate, reallocate and free calls. Every heap
+ * object is filled with a pattern derived from its slot and checked before
+ * it is freed or resized, so overlapping blocks or header corruption show
+ * up as pattern mismatches. PMM pages are tracked in a shadow bitmap to
+ * catch double allocation and bad free-page accounting. Exits non-zero
+ * with the seed and iteration on the first failure.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host_shim.h"
+#include "pmm.h"
+#include "kheap.h"
+
+/* Fuzz parameters */
+#define FUZZ_SLOTS          1024    // Heap objects live at once (at most)
+#define FUZZ_PAGE_SLOTS     512     // PMM pages live at once (at most)
+#define FUZZ_MAX_SIZE       16384
+#define FUZZ_CHECK_INTERVAL 1024    // Iterations between full consistency checks
+
+/* A live heap object */
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    uint8_t seed;           // Pattern seed
+} FuzzObject;
+
+/* Fuzz state */
+static FuzzObject objects[FUZZ_SLOTS];
+static uintptr_t pages[FUZZ_PAGE_SLOTS];
+static uint8_t* pageShadow;             // 1 bit per physical page
+static uint32_t fuzzSeed;
+static unsigned long iteration;
+
+/* Forward declarations */
+static void fail(const char* what, size_t slot);
+static size_t randomSize(uint32_t* rng);
+static void fillObject(size_t slot);
+static void checkObject(size_t slot, size_t length);
+static void checkHeapTotals(void);
+static void fuzzHeap(uint32_t* rng);
+static void fuzzPmm(uint32_t* rng);
+
+int main(int argc, char** argv)
+{
+    fuzzSeed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+    unsigned long iterations = argc > 2 ? strtoul(argv[2], NULL, 0) : 200000;
+    if (fuzzSeed == 0) {
+        fuzzSeed = 1;  // xorshift state must be non-zero
+    }
+
+    HostShimInitialize(HOST_DEFAULT_RAM, false);
+
+    pageShadow = calloc(HOST_DEFAULT_RAM / PAGE_SIZE / 8, 1);
+    if (pageShadow == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    size_t pmmFreeAtStart = PmmGetFreeMemory();
+    uint32_t rng = fuzzSeed;
+
+    for (iteration = 0; iteration < iterations; iteration++) {
+        // Mostly heap traffic; the heap also pulls pages from the PMM
+        if (HostRandom(&rng) % 8 == 0) {
+            fuzzPmm(&rng);
+        } else {
+            fuzzHeap(&rng);
+        }
+
+        if (iteration % FUZZ_CHECK_INTERVAL == 0) {
+            for (size_t slot = 0; slot < FUZZ_SLOTS; slot++) {
+                checkObject(slot, objects[slot].size);
+            }
+            checkHeapTotals();
+        }
+    }
+
+    // Release everything and make sure the books balance
+    for (size_t slot = 0; slot < FUZZ_SLOTS; slot++) {
+        checkObject(slot, objects[slot].size);
+        KFreeMemory(objects[slot].ptr);
+        objects[slot].ptr = NULL;
+        objects[slot].size = 0;
+    }
+    for (size_t slot = 0; slot < FUZZ_PAGE_SLOTS; slot++) {
+        if (pages[slot] != 0) {
+            PmmFreePage(pages[slot]);
+            pages[slot] = 0;
+        }
+    }
+
+    size_t used;
+    size_t freeBlocks;
+    KHeapGetStats(NULL, &used, NULL);
+    KHeapGetFreeListStats(&freeBlocks, NULL);
+    if (used != 0) {
+        fail("heap reports bytes in use after freeing everything", 0);
+    }
+    if (freeBlocks != 1) {
+        fail("free list did not coalesce back to one block", 0);
+    }
+
+    // Heap growth keeps its pages, so the PMM can only have fewer free pages
+    if (PmmGetFreeMemory() > pmmFreeAtStart) {
+        fail("PMM has more free memory than at start", 0);
+    }
+
+    printf("allocfuzz: seed %u, %lu iterations OK\n", fuzzSeed, iterations);
+    free(pageShadow);
+    return 0;
+}
+
+/*
+ * fail - Report a failure with enough context to reproduce it
+ */
+static void fail(const char* what, size_t slot)
+{
+    fprintf(stderr, "allocfuzz: FAIL seed %u iteration %lu slot %zu: %s\n",
+            fuzzSeed, iteration, slot, what);
+    exit(1);
+}
+
+/*
+ * randomSize - Allocation size skewed towards small objects
+ */
+static size_t randomSize(uint32_t* rng)
+{
+    uint32_t r = HostRandom(rng);
+    switch (r % 4) {
+    case 0:
+    case 1:
+        return 1 + (r >> 8) % 64;
+    case 2:
+        return 1 + (r >> 8) % 1024;
+    default:
+        return 1 + (r >> 8) % FUZZ_MAX_SIZE;
+    }
+}
+
+/*
+ * patternByte - Expected content of byte i of an object
+ */
+static inline uint8_t patternByte(uint8_t seed, size_t i)
+{
+    return (uint8_t)(seed + i * 131);
+}
+
+/*
+ * fillObject - Write the slot's pattern over the whole object
+ */
+static void fillObject(size_t slot)
+{
+    FuzzObject* object = &objects[slot];
+    for (size_t i = 0; i < object->size; i++) {
+        object->ptr[i] = patternByte(object->seed, i);
+    }
+}
+
+/*
+ * checkObject - Verify the first length bytes of an object's pattern
+ */
+static void checkObject(size_t slot, size_t length)
+{
+    FuzzObject* object = &objects[slot];
+    for (size_t i = 0; i < length; i++) {
+        if (object->ptr[i] != patternByte(object->seed, i)) {
+            fail("heap object contents corrupted", slot);
+        }
+    }
+}
+
+/*
+ * checkHeapTotals - Cross-check heap statistics against live objects
+ */
+static void checkHeapTotals(void)
+{
+    size_t total, used, freeBytes;
+    KHeapGetStats(&total, &used, &freeBytes);
+
+    size_t requested = 0;
+    for (size_t slot = 0; slot < FUZZ_SLOTS; slot++) {
+        requested += objects[slot].size;
+    }
+
+    if (used < requested) {
+        fail("heap reports fewer used bytes than are live", 0);
+    }
+    if (freeBytes > total) {
+        fail("heap free bytes exceed heap size", 0);
+    }
+}
+
+/*
+ * fuzzHeap - One random heap operation
+ */
+static void fuzzHeap(uint32_t* rng)
+{
+    size_t slot = HostRandom(rng) % FUZZ_SLOTS;
+    FuzzObject* object = &objects[slot];
+
+    if (object->ptr == NULL) {
+        // Allocate
+        size_t size = randomSize(rng);
+        object->ptr = KAllocateMemory(size);
+        if (object->ptr == NULL) {
+            fail("KAllocateMemory returned NULL", slot);
+        }
+        object->size = size;
+        object->seed = (uint8_t)HostRandom(rng);
+        fillObject(slot);
+    } else if (HostRandom(rng) % 4 == 0) {
+        // Reallocate: the common prefix must survive the move
+        size_t size = randomSize(rng);
+        size_t keep = size < object->size ? size : object->size;
+        checkObject(slot, object->size);
+
+        uint8_t* ptr = KReallocateMemory(object->ptr, size);
+        if (ptr == NULL) {
+            fail("KReallocateMemory returned NULL", slot);
+        }
+        object->ptr = ptr;
+        checkObject(slot, keep);
+
+        object->size = size;
+        fillObject(slot);
+    } else {
+        // Free
+        checkObject(slot, object->size);
+        KFreeMemory(object->ptr);
+        object->ptr = NULL;
+        object->size = 0;
+    }
+}
+
+/*
+ * fuzzPmm - One random page allocator operation
+ */
+static void fuzzPmm(uint32_t* rng)
+{
+    size_t slot = HostRandom(rng) % FUZZ_PAGE_SLOTS;
+    size_t freeBefore = PmmGetFreeMemory();
+
+    if (pages[slot] == 0) {
+        uintptr_t page = PmmAllocPage();
+        if (page == 0) {
+            fail("PmmAllocPage out of memory", slot);
+        }
+        if (page & (PAGE_SIZE - 1)) {
+            fail("PmmAllocPage returned unaligned page", slot);
+        }
+        if (page < 0x100000) {
+            fail("PmmAllocPage returned low memory", slot);
+        }
+
+        size_t index = page / PAGE_SIZE;
+        if (pageShadow[index / 8] & (1 << (index % 8))) {
+            fail("PmmAllocPage returned a page that is already allocated", slot);
+        }
+        pageShadow[index / 8] |= (uint8_t)(1 << (index % 8));
+        pages[slot] = page;
+
+        if (PmmGetFreeMemory() != freeBefore - PAGE_SIZE) {
+            fail("free memory did not drop by one page", slot);
+        }
+    } else {
+        size_t index = pages[slot] / PAGE_SIZE;
+        pageShadow[index / 8] &= (uint8_t)~(1 << (index % 8));
+        PmmFreePage(pages[slot]);
+        pages[slot] = 0;
+
+        if (PmmGetFreeMemory() != freeBefore + PAGE_SIZE) {
+            fail("free memory did not rise by one page", slot);
+        }
+    }
+
+    if (PmmGetFreeMemory() + PmmGetUsedMemory() != PmmGetTotalMemory()) {
+        fail("PMM free + used != total", slot);
+    }
+}
@@ -0,0 +1,242 @@
+/* arenafuzz.c - Randomized stress test for the libclankerk arena
+ *
+ * Usage: arenafuzz [seed] [iterations]
+ *
+ * Drives a heap-backed arena with small chunks through random allocations,
+ * so it grows a chunk at a time and takes oversized requests in chunks of
+ * their own, with a reset every few hundred allocations and a destroy and
+ * re-create now and then. Every allocation is filled with a pattern and
+ * checked before the reset that releases it, so overlapping allocations
+ * show up as mismatches. The backing allocator counts live chunks, so a
+ * reset that keeps more than the first chunk, or a destroy that keeps any,
+ * is caught too. Exits non-zero with the seed and iteration on the first
+ * failure.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "clk/arena.h"
+
+/* Fuzz parameters */
+#define FUZZ_CHUNK_SIZE     256     // Small, so the arena grows often
+#define FUZZ_MAX_LIVE       512     // Allocations between resets (at most)
+#define FUZZ_MAX_SIZE       1024    // Well past a chunk, for oversized requests
+#define FUZZ_RECREATE_ODDS  16      // One reset in this many destroys instead
+
+/* An allocation since the last reset */
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    uint8_t seed;           // Pattern seed
+} FuzzObject;
+
+/* Fuzz state */
+static FuzzObject objects[FUZZ_MAX_LIVE];
+static size_t liveObjects;
+static size_t liveChunks;               // Held by the arena from the backing allocator
+static uint32_t fuzzSeed;
+static unsigned long iteration;
+
+/* Forward declarations */
+static void fail(const char* what);
+static uint32_t fuzzRandom(uint32_t* state);
+static void* backingAllocate(void* data, size_t size);
+static void backingFree(void* data, void* ptr);
+static void checkObjects(ClkArena* arena);
+static void checkOversized(ClkArena* arena);
+static void checkBuffer(void);
+
+/* Backing allocator: malloc, counting the chunks it hands out */
+static const ClkAllocatorVTable backingVTable = { backingAllocate, backingFree };
+static ClkAllocator backing = { NULL, &backingVTable };
+
+int main(int argc, char** argv)
+{
+    fuzzSeed = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+    unsigned long iterations = argc > 2 ? strtoul(argv[2], NULL, 0) : 200000;
+    if (fuzzSeed == 0) {
+        fuzzSeed = 1;  // xorshift state must be non-zero
+    }
+
+    uint32_t rng = fuzzSeed;
+    ClkArena* arena = ClkArenaCreate(&backing, FUZZ_CHUNK_SIZE);
+    if (arena == NULL || liveChunks != 1) {
+        fail("create did not take exactly one chunk");
+    }
+    checkOversized(arena);
+
+    for (iteration = 0; iteration < iterations; iteration++) {
+        uint32_t r = fuzzRandom(&rng);
+
+        // Release everything once the table fills, and at random before that
+        if (liveObjects == FUZZ_MAX_LIVE || r % 256 == 0) {
+            checkObjects(arena);
+            if ((r >> 8) % FUZZ_RECREATE_ODDS == 0) {
+                ClkArenaDestroy(arena);
+                if (liveChunks != 0) {
+                    fail("destroy left chunks allocated");
+                }
+                arena = ClkArenaCreate(&backing, FUZZ_CHUNK_SIZE);
+                if (arena == NULL) {
+                    fail("re-create failed");
+                }
+            } else {
+                ClkArenaReset(arena);
+                if (liveChunks != 1) {
+                    fail("reset kept more than the first chunk");
+                }
+            }
+            if (ClkArenaGetUsed(arena) != 0) {
+                fail("arena reports bytes in use after a reset");
+            }
+            liveObjects = 0;
+            continue;
+        }
+
+        // Mostly small requests, with a few larger than a whole chunk
+        size_t size = (r >> 8) % 8 == 0 ? 1 + (r >> 11) % FUZZ_MAX_SIZE
+                                        : 1 + (r >> 11) % 64;
+        FuzzObject* object = &objects[liveObjects];
+        object->ptr = ClkArenaAlloc(arena, size);
+        if (object->ptr == NULL) {
+            fail("allocation failed with memory to spare");
+        }
+        if ((uintptr_t)object->ptr % CLK_ARENA_ALIGN != 0) {
+            fail("allocation is misaligned");
+        }
+        object->size = size;
+        object->seed = (uint8_t)r;
+        for (size_t i = 0; i < size; i++) {
+            object->ptr[i] = (uint8_t)(object->seed + i * 131);
+        }
+        liveObjects++;
+    }
+
+    checkObjects(arena);
+    ClkArenaDestroy(arena);
+    if (liveChunks != 0) {
+        fail("destroy left chunks allocated");
+    }
+    checkBuffer();
+
+    printf("arenafuzz: seed %u, %lu iterations OK\n", fuzzSeed, iterations);
+    return 0;
+}
+
+/*
+ * fail - Report a failure with enough context to reproduce it
+ */
+static void fail(const char* what)
+{
+    fprintf(stderr, "arenafuzz: FAIL seed %u iteration %lu: %s\n",
+            fuzzSeed, iteration, what);
+    exit(1);
+}
+
+/*
+ * fuzzRandom - xorshift32
+ */
+static uint32_t fuzzRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * backingAllocate - Hand the arena a chunk
+ */
+static void* backingAllocate(void* data, size_t size)
+{
+    (void)data;
+    void* ptr = malloc(size);
+    if (ptr != NULL) {
+        liveChunks++;
+    }
+    return ptr;
+}
+
+/*
+ * backingFree - Take a chunk back
+ */
+static void backingFree(void* data, void* ptr)
+{
+    (void)data;
+    if (ptr != NULL) {
+        liveChunks--;
+    }
+    free(ptr);
+}
+
+/*
+ * checkObjects - Verify every allocation since the last reset
+ */
+static void checkObjects(ClkArena* arena)
+{
+    size_t requested = 0;
+    for (size_t slot = 0; slot < liveObjects; slot++) {
+        FuzzObject* object = &objects[slot];
+        for (size_t i = 0; i < object->size; i++) {
+            if (object->ptr[i] != (uint8_t)(object->seed + i * 131)) {
+                fail("allocation contents corrupted");
+            }
+        }
+        requested += object->size;
+    }
+
+    if (ClkArenaGetUsed(arena) < requested) {
+        fail("arena reports fewer used bytes than were allocated");
+    }
+}
+
+/*
+ * checkOversized - Sizes near SIZE_MAX must fail without touching the arena
+ *
+ * Aligning them up, or adding a chunk header, would wrap to a small size.
+ */
+static void checkOversized(ClkArena* arena)
+{
+    static const size_t sizes[] = {
+        SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - CLK_ARENA_ALIGN, SIZE_MAX / 2 + 1,
+    };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (ClkArenaAlloc(arena, sizes[i]) != NULL) {
+            fail("impossible allocation succeeded");
+        }
+    }
+    if (liveChunks != 1 || ClkArenaGetUsed(arena) != 0) {
+        fail("impossible allocation changed the arena");
+    }
+}
+
+/*
+ * checkBuffer - A buffer arena fills up and then refuses, without growing
+ */
+static void checkBuffer(void)
+{
+    static uint8_t buffer[1024];
+    ClkArena* arena = ClkArenaCreateInBuffer(buffer, sizeof(buffer));
+    if (arena == NULL) {
+        fail("buffer arena create failed");
+    }
+
+    size_t allocations = 0;
+    while (ClkArenaAlloc(arena, 16) != NULL) {
+        allocations++;
+    }
+    if (allocations == 0 || allocations * 16 > sizeof(buffer) || liveChunks != 0) {
+        fail("buffer arena did not fill within its buffer");
+    }
+
+    ClkArenaReset(arena);
+    if (ClkArenaGetUsed(arena) != 0 || ClkArenaAlloc(arena, 16) == NULL) {
+        fail("buffer arena reset did not rewind it");
+    }
+}
@@ -0,0 +1,204 @@
+/* host_shim.c - Hosted environment for running kernel allocators on Linux */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "host_shim.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "paging.h"
+#include "kheap.h"
+#include "econ_writer.h"
+#include "spinlock.h"
+#include "percpu.h"
+#include "clc/writer.h"
+
+/*
+ * Fixed addresses, matching the kernel's own layout:
+ *   0x00010000  multiboot memory map (must be below 4 GB: mmap_addr is 32-bit)
+ *   0x00200000  kernelEnd, where PmmInitialize() places its bitmap
+ *   0x00500000  kernel heap window (HEAP_START .. HEAP_MAX in kheap.c)
+ */
+#define MMAP_TABLE_ADDR     0x00010000
+#define KERNEL_END_ADDR     0x00200000
+#define HEAP_WINDOW_START   0x00500000
+#define HEAP_WINDOW_END     0x10000000
+
+/* Kernel end symbol (pinned to KERNEL_END_ADDR by the Makefile) */
+extern uint32_t kernelEnd;
+
+/* Serial output forwarding */
+static bool shimVerbose = false;
+
+/* Forward declarations */
+static void* mapFixed(uintptr_t addr, size_t size);
+static void shimWriterPutChar(void* data, char c);
+
+static const ClcWriterVTable shimWriterVTable = {
+    .putchar = shimWriterPutChar
+};
+
+static ClcWriter shimWriter = {
+    .data = NULL,
+    .vtable = &shimWriterVTable
+};
+
+/*
+ * HostShimInitialize - Bring up PMM and kernel heap inside this process
+ */
+void HostShimInitialize(size_t ramBytes, bool verbose)
+{
+    shimVerbose = verbose;
+
+    if (ramBytes < 8u * 1024 * 1024 || ramBytes > HOST_MAX_RAM) {
+        fprintf(stderr, "host shim: RAM size must be 8 MB - 1 GB\n");
+        exit(2);
+    }
+
+    if ((uintptr_t)&kernelEnd != KERNEL_END_ADDR) {
+        fprintf(stderr, "host shim: kernelEnd not pinned (check LDFLAGS)\n");
+        exit(2);
+    }
+
+    // Bitmap (1 bit per page) lives at kernelEnd
+    size_t bitmapBytes = (ramBytes / PAGE_SIZE + 31) / 32 * 4;
+    mapFixed(KERNEL_END_ADDR, (bitmapBytes + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1));
+
+    // Heap window is reserved up front; PagingMapPage() only checks bounds
+    mapFixed(HEAP_WINDOW_START, HEAP_WINDOW_END - HEAP_WINDOW_START);
+
+    // QEMU-like memory map: low memory, BIOS holes, then RAM from 1 MB
+    multiboot_mmap_entry_t* entries = mapFixed(MMAP_TABLE_ADDR, PAGE_SIZE);
+    const multiboot_mmap_entry_t layout[] = {
+        { 20, 0x00000000, 0x0009FC00, MULTIBOOT_MEMORY_AVAILABLE },
+        { 20, 0x0009FC00, 0x00000400, MULTIBOOT_MEMORY_RESERVED },
+        { 20, 0x000F0000, 0x00010000, MULTIBOOT_MEMORY_RESERVED },
+        { 20, 0x00100000, ramBytes - 0x00100000, MULTIBOOT_MEMORY_AVAILABLE },
+    };
+    size_t entryCount = sizeof(layout) / sizeof(layout[0]);
+    for (size_t i = 0; i < entryCount; i++) {
+        entries[i] = layout[i];
+    }
+
+    static multiboot_info_t info;
+    info.flags = (1 << 6);
+    info.mem_lower = 639;
+    info.mem_upper = (uint32_t)(ramBytes / 1024 - 1024);
+    info.mmap_addr = MMAP_TABLE_ADDR;
+    info.mmap_length = (uint32_t)(entryCount * sizeof(multiboot_mmap_entry_t));
+
+    PmmInitialize(&info);
+    KHeapInitialize();
+}
+
+/*
+ * HostNanoseconds - Monotonic time in nanoseconds
+ */
+uint64_t HostNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * HostRandom - Deterministic xorshift32 generator
+ */
+uint32_t HostRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * Kernel interfaces used by pmm.c and kheap.c
+ */
+
+/*
+ * PagingMapPage - Heap pages are pre-mapped; just check the window
+ */
+bool PagingMapPage(uintptr_t virtualAddr, uintptr_t physicalAddr, uint32_t flags)
+{
+    (void)physicalAddr;
+    (void)flags;
+    return virtualAddr >= HEAP_WINDOW_START && virtualAddr < HEAP_WINDOW_END;
+}
+
+/*
+ * Spinlocks - The harness is single-threaded and must not touch EFLAGS.IF
+ */
+void SpinlockInit(Spinlock* lock)
+{
+    lock->tickets = 0;
+}
+
+uint32_t SpinlockAcquireIrqSave(Spinlock* lock)
+{
+    lock->next++;
+    return 0;
+}
+
+void SpinlockReleaseIrqRestore(Spinlock* lock, uint32_t flags)
+{
+    (void)flags;
+    lock->owner++;
+}
+
+/*
+ * Per-CPU counters - One CPU, so one plain delta per counter
+ */
+static int32_t shimCounters[PER_CPU_COUNTERS];
+
+void PerCpuCounterAdd(PerCpuCounter counter, int32_t delta)
+{
+    shimCounters[counter] += delta;
+}
+
+int64_t PerCpuCounterSum(PerCpuCounter counter)
+{
+    return shimCounters[counter];
+}
+
+/*
+ * EConGetWriter - Kernel serial output goes to stderr in verbose mode
+ */
+ClcWriter* EConGetWriter(void)
+{
+    return &shimWriter;
+}
+
+/*
+ * mapFixed - Map anonymous memory at an exact address or die
+ */
+static void* mapFixed(uintptr_t addr, size_t size)
+{
+    void* ptr = mmap((void*)addr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE,
+                     -1, 0);
+    if (ptr == MAP_FAILED || (uintptr_t)ptr != addr) {
+        fprintf(stderr, "host shim: cannot map %#lx (+%zu bytes)\n",
+                (unsigned long)addr, size);
+        exit(2);
+    }
+    return ptr;
+}
+
+/*
+ * shimWriterPutChar - ClcWriter putchar forwarding to stderr
+ */
+static void shimWriterPutChar(void* data, char c)
+{
+    (void)data;
+    if (shimVerbose) {
+        fputc(c, stderr);
+    }
+}
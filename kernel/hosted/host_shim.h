@@ -0,0 +1,41 @@
+/* host_shim.h - Hosted environment for running kernel allocators on Linux */
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Simulated physical memory size when none is given */
+#define HOST_DEFAULT_RAM (128u * 1024 * 1024)
+
+/* Largest simulated memory the bitmap area at kernelEnd can describe */
+#define HOST_MAX_RAM (1024u * 1024 * 1024)
+
+/*
+ * HostShimInitialize - Bring up PMM and kernel heap inside this process
+ *
+ * Maps the fixed low addresses the kernel code expects (multiboot memory
+ * map, PMM bitmap at kernelEnd, heap window), builds a QEMU-like memory
+ * map covering ramBytes, then runs PmmInitialize() and KHeapInitialize().
+ * Kernel allocator state is static, so call this once per process.
+ *
+ * @ramBytes: Simulated physical memory size (at most HOST_MAX_RAM)
+ * @verbose: Forward kernel serial output to stderr
+ */
+void HostShimInitialize(size_t ramBytes, bool verbose);
+
+/*
+ * HostNanoseconds - Monotonic time in nanoseconds
+ */
+uint64_t HostNanoseconds(void);
+
+/*
+ * HostRandom - Deterministic xorshift32 generator
+ *
+ * @state: Generator state (must be non-zero)
+ * @return: Next pseudo-random value
+ */
+uint32_t HostRandom(uint32_t* state);
+
+#endif /* HOST_SHIM_H */
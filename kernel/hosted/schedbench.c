@@ -0,0 +1,474 @@
+/* schedbench.c - Fairness and latency benchmark for the scheduling classes
+ *
+ * Usage: schedbench [-s <seconds>] [class...]
+ *
+ * Runs the kernel's scheduling classes (core/sched_*.c) against a
+ * simulated CPU. The driver below mirrors the decisions ProcessSchedule()
+ * makes in process.c: a timer tick every 10 ms charges the running
+ * process and asks the class whether to preempt, wakeups are enqueued and
+ * may request a switch at the next tick, and a process that blocks gives
+ * up the CPU at once. Each workload mixes CPU-bound processes with
+ * interactive ones that run a short burst and then sleep. The last one
+ * adds periodic deadline processes (SchedDeadlineClass, run ahead of the
+ * class under test as in process.c) that yield when a period's work is
+ * done; while they exist the timer also fires between ticks, as with
+ * PitSetSubTicks().
+ *
+ * For every class and workload it reports each process's share of the
+ * CPU, Jain's fairness index over the CPU-bound processes (1.0 means
+ * every one got exactly its weighted share), wakeup latency of the
+ * interactive processes and the context switch rate. Deadline processes
+ * report their reserved share and missed deadlines instead.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "process.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "clc/writer.h"
+
+/* Simulated machine */
+#define TICK_NS             10000000ull     // 100 Hz, as set up in KMain()
+#define DEFAULT_SECONDS     60
+#define MAX_TASKS           16
+#define NEVER               UINT64_MAX
+
+/* One process in a workload */
+typedef struct {
+    const char* name;
+    uint32_t priority;
+    uint64_t burstNs;       // CPU per wakeup (0 = never blocks)
+    uint64_t sleepNs;       // Time blocked between bursts
+    uint32_t dlRuntimeNs;   // Deadline reservation per period (0 = normal)
+    uint32_t dlPeriodNs;    // Reservation period; burstNs is the work per period
+} TaskSpec;
+
+/* A workload: up to MAX_TASKS processes, NULL-name terminated */
+typedef struct {
+    const char* name;
+    TaskSpec tasks[MAX_TASKS];
+} Workload;
+
+/* Simulated process state alongside the kernel's Process */
+typedef struct {
+    Process process;
+    const TaskSpec* spec;
+    uint64_t burstLeft;     // CPU left in the current burst
+    uint64_t wakeAt;        // Time of the next wakeup while blocked
+    uint64_t readySince;    // Time it became ready after sleeping (NEVER if not)
+    uint64_t latencyTotal;
+    uint64_t latencyMax;
+    uint64_t wakeups;
+} SimTask;
+
+static const Workload workloads[] = {
+    {
+        "equal priority: 4 CPU-bound + 2 interactive",
+        {
+            { "cpu0", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "cpu1", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "cpu2", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "cpu3", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "ia0", PROCESS_PRIORITY_DEFAULT, 1000000, 20000000, 0, 0 },
+            { "ia1", PROCESS_PRIORITY_DEFAULT, 2000000, 35000000, 0, 0 },
+            { NULL, 0, 0, 0, 0, 0 },
+        },
+    },
+    {
+        "mixed priority: 3 CPU-bound (14/16/18) + 2 interactive",
+        {
+            { "cpu-p14", 14, 0, 0, 0, 0 },
+            { "cpu-p16", 16, 0, 0, 0, 0 },
+            { "cpu-p18", 18, 0, 0, 0, 0 },
+            { "ia0", PROCESS_PRIORITY_DEFAULT, 1000000, 20000000, 0, 0 },
+            { "ia1", PROCESS_PRIORITY_DEFAULT, 500000, 5000000, 0, 0 },
+            { NULL, 0, 0, 0, 0, 0 },
+        },
+    },
+    {
+        "deadline: 3 reservations (one overrunning) + 2 CPU-bound + 1 interactive",
+        {
+            { "dl-2/10", PROCESS_PRIORITY_DEFAULT, 2000000, 0, 2000000, 10000000 },
+            { "dl-5/30", PROCESS_PRIORITY_DEFAULT, 4000000, 0, 5000000, 30000000 },
+            { "dl-hog", PROCESS_PRIORITY_DEFAULT, 50000000, 0, 3000000, 20000000 },
+            { "cpu0", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "cpu1", PROCESS_PRIORITY_DEFAULT, 0, 0, 0, 0 },
+            { "ia0", PROCESS_PRIORITY_DEFAULT, 1000000, 20000000, 0, 0 },
+            { NULL, 0, 0, 0, 0, 0 },
+        },
+    },
+};
+
+/* Same weights as sched_fair.c, to compute each process's fair share */
+static const uint32_t referenceWeights[PROCESS_PRIORITY_LEVELS] = {
+    36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    6100,  4904,  3906,  3121,  2501,  1991,  1586, 1277,
+    1024,  820,   655,   526,   423,   335,   272,  215,
+    172,   137,   110,   87,    70,    56,    45,   36,
+};
+
+/* Simulation state */
+static SimTask tasks[MAX_TASKS];
+static size_t taskCount;
+static SimTask idleTask;
+static SimTask* current;
+static uint64_t now;
+static uint64_t chargedAt;
+static bool needResched;
+static uint64_t switches;
+static uint32_t subTicks;           // Timer interrupts per tick (PitSetSubTicks())
+
+/* Forward declarations */
+static void runWorkload(const SchedClass* sched, const Workload* workload, uint64_t durationNs);
+static const SchedClass* classOf(const SchedClass* sched, SimTask* task);
+static void charge(const SchedClass* sched);
+static void switchTask(const SchedClass* sched);
+static void wakeTask(const SchedClass* sched, SimTask* task);
+static void report(const Workload* workload, uint64_t durationNs);
+
+/*
+ * Kernel services used by the scheduling classes
+ */
+
+static void discardPutChar(void* data, char c)
+{
+    (void)data;
+    (void)c;
+}
+
+static const ClcWriterVTable discardVTable = { discardPutChar };
+static ClcWriter discardWriter = { NULL, &discardVTable };
+
+ClcWriter* EConGetWriter(void)
+{
+    return &discardWriter;
+}
+
+const char* KCmdLineGetValue(const char* key)
+{
+    (void)key;
+    return NULL;
+}
+
+uint32_t PitGetFrequency(void)
+{
+    return (uint32_t)(1000000000ull / TICK_NS);
+}
+
+void PitSetSubTicks(uint32_t count)
+{
+    subTicks = count ? count : 1;
+}
+
+uint64_t TscGetNanoseconds(void)
+{
+    return now;
+}
+
+uint32_t SpinlockAcquireIrqSave(Spinlock* lock)
+{
+    (void)lock;
+    return 0;
+}
+
+void SpinlockReleaseIrqRestore(Spinlock* lock, uint32_t flags)
+{
+    (void)lock;
+    (void)flags;
+}
+
+int main(int argc, char** argv)
+{
+    static const SchedClass* const classes[] = {
+        &SchedRoundRobinClass,
+        &SchedFairClass,
+        &SchedFeedbackClass,
+    };
+    uint64_t seconds = DEFAULT_SECONDS;
+    const char* only[8];
+    size_t onlyCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = strtoull(argv[++i], NULL, 0);
+        } else if (onlyCount < 8) {
+            only[onlyCount++] = argv[i];
+        }
+    }
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        for (size_t c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+            bool selected = onlyCount == 0;
+            for (size_t i = 0; i < onlyCount; i++) {
+                selected |= strcmp(only[i], classes[c]->name) == 0;
+            }
+            if (!selected) {
+                continue;
+            }
+
+            printf("== %s, sched=%s, %llu s ==\n", workloads[w].name, classes[c]->name,
+                   (unsigned long long)seconds);
+            runWorkload(classes[c], &workloads[w], seconds * 1000000000ull);
+            report(&workloads[w], seconds * 1000000000ull);
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * runWorkload - Simulate one workload under one class
+ */
+static void runWorkload(const SchedClass* sched, const Workload* workload, uint64_t durationNs)
+{
+    memset(tasks, 0, sizeof(tasks));
+    memset(&idleTask, 0, sizeof(idleTask));
+    now = 0;
+    chargedAt = 0;
+    needResched = false;
+    switches = 0;
+    subTicks = 1;
+
+    sched->initialize();
+    SchedDeadlineClass.initialize();
+
+    idleTask.process.state = PROCESS_STATE_RUNNING;
+    idleTask.process.priority = PROCESS_PRIORITY_LOWEST;
+    idleTask.readySince = NEVER;
+    current = &idleTask;
+
+    // Everything starts ready, as if just created by ProcessCreate()
+    for (taskCount = 0; workload->tasks[taskCount].name; taskCount++) {
+        SimTask* task = &tasks[taskCount];
+        task->spec = &workload->tasks[taskCount];
+        task->process.pid = (uint32_t)taskCount + 1;
+        task->process.priority = task->spec->priority;
+        task->process.state = PROCESS_STATE_READY;
+        task->burstLeft = task->spec->burstNs;
+        task->wakeAt = NEVER;
+        task->readySince = task->spec->burstNs ? 0 : NEVER;
+
+        if (task->spec->dlRuntimeNs) {
+            task->readySince = NEVER;
+            if (SchedDeadlineAdmit(&task->process, task->spec->dlRuntimeNs,
+                                   task->spec->dlPeriodNs, task->spec->dlPeriodNs)) {
+                task->process.policy = PROCESS_POLICY_DEADLINE;
+            }
+        }
+        classOf(sched, task)->enqueue(&task->process);
+    }
+    needResched = true;
+
+    uint64_t nextTick = TICK_NS / subTicks;
+    while (now < durationNs) {
+        // Next event: (sub-)tick, end of the running burst, or a wakeup
+        uint64_t next = nextTick;
+        if (current != &idleTask && current->spec->burstNs) {
+            uint64_t burstEnd = now + current->burstLeft;
+            if (burstEnd < next) {
+                next = burstEnd;
+            }
+        }
+        for (size_t i = 0; i < taskCount; i++) {
+            if (tasks[i].wakeAt < next) {
+                next = tasks[i].wakeAt;
+            }
+        }
+
+        if (current != &idleTask && current->spec->burstNs) {
+            current->burstLeft -= next - now;
+        }
+        now = next;
+
+        // Wakeups: like ProcessUnblock() from an interrupt handler
+        for (size_t i = 0; i < taskCount; i++) {
+            if (tasks[i].wakeAt == now) {
+                wakeTask(sched, &tasks[i]);
+            }
+        }
+
+        // Burst done: the process blocks, or a deadline process yields
+        // until its next period, switching immediately
+        if (current != &idleTask && current->spec->burstNs && current->burstLeft == 0) {
+            charge(sched);
+            if (current->process.policy == PROCESS_POLICY_DEADLINE) {
+                SchedDeadlineClass.yield(&current->process);
+            } else {
+                current->process.state = PROCESS_STATE_BLOCKED;
+                current->wakeAt = now + current->spec->sleepNs;
+            }
+            switchTask(sched);
+        }
+
+        // Timer interrupt: ProcessSchedule() on a tick, otherwise
+        // ProcessScheduleSubTick(), which only checks deadline budgets
+        if (now == nextTick) {
+            bool fullTick = now % TICK_NS == 0;
+            nextTick += TICK_NS / subTicks;
+            charge(sched);
+            if (SchedDeadlineClass.timer(&current->process)) {
+                needResched = true;
+            }
+            if (current != &idleTask &&
+                (fullTick || current->process.policy == PROCESS_POLICY_DEADLINE) &&
+                classOf(sched, current)->tick(&current->process)) {
+                needResched = true;
+            }
+            if (needResched) {
+                switchTask(sched);
+            }
+        }
+    }
+
+    charge(sched);
+}
+
+/*
+ * classOf - Class a simulated process belongs to
+ */
+static const SchedClass* classOf(const SchedClass* sched, SimTask* task)
+{
+    return task->process.policy == PROCESS_POLICY_DEADLINE ? &SchedDeadlineClass : sched;
+}
+
+/*
+ * charge - Charge elapsed time to the running process (chargeCurrent())
+ */
+static void charge(const SchedClass* sched)
+{
+    uint64_t delta = now - chargedAt;
+    chargedAt = now;
+    current->process.runtime += delta;
+
+    if (current != &idleTask) {
+        classOf(sched, current)->account(&current->process, delta);
+    }
+}
+
+/*
+ * switchTask - Requeue the running process and dispatch the next one
+ */
+static void switchTask(const SchedClass* sched)
+{
+    needResched = false;
+
+    if (current->process.state == PROCESS_STATE_RUNNING) {
+        current->process.state = PROCESS_STATE_READY;
+        if (current != &idleTask) {
+            classOf(sched, current)->putPrev(&current->process);
+        }
+    }
+
+    Process* nextProcess = SchedDeadlineClass.pickNext(0);
+    if (!nextProcess) {
+        nextProcess = sched->pickNext(0);
+    }
+    SimTask* next = nextProcess ? (SimTask*)nextProcess : &idleTask;
+
+    if (next != current) {
+        switches++;
+    }
+    current = next;
+    current->process.state = PROCESS_STATE_RUNNING;
+
+    // A deadline process that finished its work is back for a new period
+    if (current->process.policy == PROCESS_POLICY_DEADLINE && current->burstLeft == 0) {
+        current->burstLeft = current->spec->burstNs;
+    }
+
+    // Wakeup latency: from becoming ready to first getting the CPU
+    if (current->readySince != NEVER) {
+        uint64_t latency = now - current->readySince;
+        current->latencyTotal += latency;
+        if (latency > current->latencyMax) {
+            current->latencyMax = latency;
+        }
+        current->wakeups++;
+        current->readySince = NEVER;
+    }
+}
+
+/*
+ * wakeTask - Unblock a sleeping process (ProcessUnblock())
+ */
+static void wakeTask(const SchedClass* sched, SimTask* task)
+{
+    task->wakeAt = NEVER;
+    task->burstLeft = task->spec->burstNs;
+    task->readySince = now;
+    task->process.state = PROCESS_STATE_READY;
+    classOf(sched, task)->enqueue(&task->process);
+
+    if (current == &idleTask) {
+        needResched = true;
+    } else if (task->process.policy != current->process.policy) {
+        needResched |= task->process.policy == PROCESS_POLICY_DEADLINE;
+    } else if (classOf(sched, task)->checkPreempt(&current->process, &task->process)) {
+        needResched = true;
+    }
+}
+
+/*
+ * report - Print per-process results and summary metrics
+ */
+static void report(const Workload* workload, uint64_t durationNs)
+{
+    (void)workload;
+
+    // Fair share of the CPU-bound processes, relative to their weights
+    uint64_t cpuBoundTime = 0;
+    uint64_t cpuBoundWeight = 0;
+    for (size_t i = 0; i < taskCount; i++) {
+        if (tasks[i].spec->burstNs == 0) {
+            cpuBoundTime += tasks[i].process.runtime;
+            cpuBoundWeight += referenceWeights[tasks[i].spec->priority];
+        }
+    }
+
+    printf("  %-10s %4s %8s %8s %10s %10s\n",
+           "process", "prio", "cpu %", "fair %", "lat avg", "lat max");
+
+    double sum = 0;
+    double sumSquares = 0;
+    size_t cpuBound = 0;
+    for (size_t i = 0; i < taskCount; i++) {
+        SimTask* task = &tasks[i];
+        double share = 100.0 * (double)task->process.runtime / (double)durationNs;
+
+        if (task->process.policy == PROCESS_POLICY_DEADLINE) {
+            double reserved = 100.0 * task->spec->dlRuntimeNs / task->spec->dlPeriodNs;
+            printf("  %-10s %4s %7.2f%% %7.2f%% %10s %7u miss\n",
+                   task->spec->name, "dl", share, reserved, "-", task->process.dlMisses);
+        } else if (task->spec->burstNs == 0) {
+            double fair = 100.0 * (double)cpuBoundTime / (double)durationNs
+                          * referenceWeights[task->spec->priority] / (double)cpuBoundWeight;
+            double normalized = fair > 0 ? share / fair : 0;
+            sum += normalized;
+            sumSquares += normalized * normalized;
+            cpuBound++;
+            printf("  %-10s %4u %7.2f%% %7.2f%% %10s %10s\n",
+                   task->spec->name, task->spec->priority, share, fair, "-", "-");
+        } else {
+            // Still waiting at the end (possibly starved from the start)
+            if (task->readySince != NEVER && durationNs - task->readySince > task->latencyMax) {
+                task->latencyMax = durationNs - task->readySince;
+            }
+
+            double average = task->wakeups ? (double)task->latencyTotal / task->wakeups / 1e6 : 0;
+            printf("  %-10s %4u %7.2f%% %8s %8.2fms %8.2fms\n",
+                   task->spec->name, task->spec->priority, share, "-",
+                   average, (double)task->latencyMax / 1e6);
+        }
+    }
+
+    double jain = sumSquares > 0 ? sum * sum / (cpuBound * sumSquares) : 0;
+    printf("  fairness (Jain, CPU-bound): %.3f\n", jain);
+    printf("  context switches: %.1f/s\n", (double)switches * 1e9 / (double)durationNs);
+}
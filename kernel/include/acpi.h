@@ -0,0 +1,109 @@
+/* acpi.h - ACPI table discovery */
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * AcpiSdtHeader - Header shared by every ACPI system description table
+ */
+typedef struct {
+    char signature[4];
+    uint32_t length;            // Whole table, header included
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} __attribute__((packed)) AcpiSdtHeader;
+
+/*
+ * AcpiMadt - Multiple APIC Description Table ("APIC")
+ *
+ * Followed by variable-length entries, each starting with a type and a
+ * length byte.
+ */
+typedef struct {
+    AcpiSdtHeader header;
+    uint32_t lapicAddress;      // Physical address of the local APICs
+    uint32_t flags;             // Bit 0: 8259 PICs present as well
+} __attribute__((packed)) AcpiMadt;
+
+/* MADT entry types */
+#define ACPI_MADT_LAPIC             0
+#define ACPI_MADT_IOAPIC            1
+#define ACPI_MADT_INTERRUPT_OVERRIDE 2
+
+/* Local APIC entry flags */
+#define ACPI_MADT_LAPIC_ENABLED     0x1
+
+/*
+ * AcpiMadtLapic - Processor local APIC entry
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processorId;
+    uint8_t apicId;
+    uint32_t flags;
+} __attribute__((packed)) AcpiMadtLapic;
+
+/*
+ * AcpiMadtIoapic - I/O APIC entry
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t ioapicId;
+    uint8_t reserved;
+    uint32_t address;           // Physical address of its registers
+    uint32_t gsiBase;           // Global system interrupt of its first input
+} __attribute__((packed)) AcpiMadtIoapic;
+
+/* Interrupt source override flags (MPS INTI flags) */
+#define ACPI_MADT_POLARITY_MASK     0x3
+#define ACPI_MADT_POLARITY_LOW      0x3
+#define ACPI_MADT_TRIGGER_MASK      0xC
+#define ACPI_MADT_TRIGGER_LEVEL     0xC
+
+/*
+ * AcpiMadtInterruptOverride - Interrupt source override entry
+ *
+ * An ISA IRQ wired to a different I/O APIC input than its own number, or
+ * with a different polarity or trigger mode than ISA's edge, active high.
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t bus;                // 0 (ISA)
+    uint8_t source;             // ISA IRQ
+    uint32_t gsi;               // Global system interrupt it arrives on
+    uint16_t flags;
+} __attribute__((packed)) AcpiMadtInterruptOverride;
+
+/*
+ * AcpiInitialize - Find the RSDP and root table
+ *
+ * Searches the EBDA and the BIOS area below 1 MB for the RSDP and checks
+ * the RSDT (or XSDT). Tables are mapped into a reserved kernel window as
+ * they are looked up, so physical memory anywhere below 4 GB works.
+ * Calling it again after a success does nothing.
+ *
+ * Returns: true if valid ACPI tables were found
+ */
+bool AcpiInitialize(void);
+
+/*
+ * AcpiFindTable - Look up a table by signature
+ *
+ * Parameters:
+ *   signature - Four-character signature, e.g. "APIC"
+ *
+ * Returns: Mapped, checksum-verified table, or NULL if absent
+ */
+const AcpiSdtHeader* AcpiFindTable(const char* signature);
+
+#endif /* ACPI_H */
@@ -0,0 +1,58 @@
+/* condvar.h - Condition variables */
+#ifndef CONDVAR_H
+#define CONDVAR_H
+
+#include <stdint.h>
+#include "waitqueue.h"
+#include "mutex.h"
+
+/*
+ * CondVar - Wait for a condition protected by a mutex
+ *
+ * The usual pattern; the condition is always rechecked, as another
+ * process may get the mutex first after a signal:
+ *
+ *   MutexLock(&lock);
+ *   while (!condition) {
+ *       CondVarWait(&cv, &lock);
+ *   }
+ *   ...
+ *   MutexUnlock(&lock);
+ *
+ * Whoever makes the condition true does so with the mutex held, then
+ * calls CondVarSignal() or CondVarBroadcast().
+ */
+typedef struct CondVar {
+    WaitQueue waiters;
+} CondVar;
+
+/* Static initializer for a condition variable */
+#define CONDVAR_INIT(name) { WAIT_QUEUE_INIT((name).waiters) }
+
+/*
+ * CondVarInit - Initialize a condition variable
+ */
+void CondVarInit(CondVar* cv);
+
+/*
+ * CondVarWait - Unlock a mutex and sleep until signalled, then relock it
+ *
+ * The process is on the condition variable's queue before the mutex is
+ * unlocked, so a signal sent by the next holder of the mutex is not lost.
+ *
+ * @cv: Condition variable to wait on
+ * @mutex: Mutex held by the caller
+ */
+void CondVarWait(CondVar* cv, Mutex* mutex);
+
+/*
+ * CondVarSignal - Wake one waiter, if any
+ */
+void CondVarSignal(CondVar* cv);
+
+/*
+ * CondVarBroadcast - Wake every waiter
+ */
+void CondVarBroadcast(CondVar* cv);
+
+#endif /* CONDVAR_H */
@@ -0,0 +1,131 @@
+/* fpu.h - x87/SSE state management */
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* FXSAVE image size; FNSAVE (no FXSR) only uses the first 108 bytes */
+#define FPU_STATE_SIZE 512
+
+/*
+ * FpuState - Saved FPU/SSE registers of one process
+ *
+ * FXSAVE needs 16-byte alignment, which the kernel heap does not give,
+ * so these come from FpuStateAllocate() rather than KAllocateMemory().
+ */
+typedef struct FpuState {
+    uint8_t area[FPU_STATE_SIZE];   // FXSAVE/FNSAVE image
+    void* block;                    // Heap block the state was carved from
+    bool used;                      // area holds a saved state (else start from FNINIT)
+} __attribute__((aligned(16))) FpuState;
+
+/*
+ * FpuInitialize - Enable the x87 FPU and SSE and install the lazy switch trap
+ *
+ * Sets CR0.MP/NE (and clears EM), and CR4.OSFXSR/OSXMMEXCPT when the CPU
+ * has FXSAVE and SSE. Leaves CR0.TS set, so the first FPU instruction
+ * anyone executes traps (ISR 7) and claims the registers.
+ *
+ * Returns: true if an FPU is present
+ */
+bool FpuInitialize(void);
+
+/*
+ * FpuInitializeCpu - Enable the FPU on an application processor
+ *
+ * Same control register setup as FpuInitialize(), for a CPU started
+ * after it. Each CPU switches its own registers lazily.
+ */
+void FpuInitializeCpu(void);
+
+/*
+ * FpuStateAllocate - Allocate an empty, aligned FPU save area
+ *
+ * Returns: New state, or NULL if out of memory
+ */
+FpuState* FpuStateAllocate(void);
+
+/*
+ * FpuStateFree - Free a save area from FpuStateAllocate()
+ *
+ * Forgets it first if its registers are still loaded.
+ */
+void FpuStateFree(FpuState* state);
+
+/*
+ * FpuSwitch - Arm the lazy switch for the next process
+ *
+ * Called by the scheduler on every context switch. Saves nothing: if the
+ * next process does not already own the FPU registers, CR0.TS is set so
+ * that its first FPU instruction traps and the registers change hands
+ * then. Processes that never touch the FPU never pay for a save.
+ *
+ * Parameters:
+ *   next - Save area of the process being switched to
+ */
+void FpuSwitch(FpuState* next);
+
+/*
+ * FpuDrop - Forget the live registers of a state without saving them
+ *
+ * For processes that are exiting; their FPU contents are dead.
+ */
+void FpuDrop(FpuState* state);
+
+/*
+ * FpuIsLoaded - Check whether a state's registers are live on some CPU
+ *
+ * A process whose registers are still loaded where it last ran cannot
+ * run anywhere else until they are saved, and only that CPU can save
+ * them. The load balancer leaves such processes where they are.
+ *
+ * Parameters:
+ *   state - Save area to look for
+ *
+ * Returns: true if some CPU's registers belong to state
+ */
+bool FpuIsLoaded(const FpuState* state);
+
+/*
+ * FpuFlush - Save a state's registers if they are live on this CPU
+ *
+ * For a process about to be moved to another CPU, which would otherwise
+ * find stale contents in its save area. Does nothing if another CPU (or
+ * none) holds the registers. The process must not be running.
+ *
+ * Parameters:
+ *   state - Save area of the process
+ */
+void FpuFlush(FpuState* state);
+
+/*
+ * FpuKernelBegin - Let kernel code use the FPU/SSE registers
+ *
+ * Saves the owning process's registers, disables interrupts and clears
+ * CR0.TS. The code between FpuKernelBegin() and FpuKernelEnd() must not
+ * block or yield.
+ *
+ * Returns: Interrupt flags to pass to FpuKernelEnd()
+ */
+uint32_t FpuKernelBegin(void);
+
+/*
+ * FpuKernelEnd - End a FpuKernelBegin() section
+ *
+ * The registers are left unowned; the next process to use them traps
+ * and reloads its own.
+ */
+void FpuKernelEnd(uint32_t flags);
+
+/*
+ * FpuGetStats - Lazy switching counters since boot
+ *
+ * Parameters:
+ *   traps - Device-not-available traps taken (may be NULL)
+ *   saves - Register saves performed (may be NULL)
+ *   avoided - Context switches that saved nothing (may be NULL)
+ */
+void FpuGetStats(uint64_t* traps, uint64_t* saves, uint64_t* avoided);
+
+#endif /* FPU_H */
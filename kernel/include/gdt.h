@@ -26,6 +26,30 @@ struct gdt_ptr {
     uint32_t base;          // Address of first GDT entry
 } __attribute__((packed));
 
+/*
+ * TSS structure
+ * Only ss0/esp0 matter: the stack the CPU loads when an interrupt
+ * arrives in ring 3. Hardware task switching is not used.
+ */
+struct tss_entry {
+    uint32_t prevTss;
+    uint32_t esp0;          // Kernel stack pointer on entry from ring 3
+    uint32_t ss0;           // Kernel stack segment on entry from ring 3
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomapBase;     // Past the limit: no I/O permission bitmap
+} __attribute__((packed));
+
+/* Segment selectors */
+#define GDT_KERNEL_CODE_SELECTOR 0x08
+#define GDT_KERNEL_DATA_SELECTOR 0x10
+#define GDT_TSS_SELECTOR         0x28
+#define GDT_PERCPU_SELECTOR      0x30  // GS: this CPU's PerCpu area
+
 /* Access byte flags */
 #define GDT_ACCESS_PRESENT      0x80  // Segment is present
 #define GDT_ACCESS_PRIV_RING0   0x00  // Ring 0 (kernel)
@@ -34,6 +58,7 @@ struct gdt_ptr {
 #define GDT_ACCESS_EXECUTABLE   0x08  // Code segment
 #define GDT_ACCESS_RW           0x02  // Readable (code) / Writable (data)
 #define GDT_ACCESS_ACCESSED     0x01  // Accessed bit
+#define GDT_ACCESS_TSS32        0x09  // System segment: available 32-bit TSS
 
 /* Granularity byte flags */
 #define GDT_GRAN_4K             0x80  // 4KB granularity
@@ -43,4 +68,19 @@ struct gdt_ptr {
 /* Public functions */
 void GdtInitialize(void);
 
+/*
+ * GdtInitializeCpu - Build and load the GDT and TSS of one CPU
+ *
+ * Also points GS at the CPU's per-CPU area (percpu.h), so this must run
+ * before anything takes a spinlock or asks which CPU it is on.
+ * GdtInitialize() does this for CPU 0; application processors call it
+ * for themselves as they start.
+ */
+void GdtInitializeCpu(uint32_t cpu);
+
+/*
+ * GdtSetKernelStack - Set the stack a CPU switches to on entry from ring 3
+ */
+void GdtSetKernelStack(uint32_t cpu, uint32_t esp0);
+
 #endif /* GDT_H */
@@ -39,4 +39,11 @@ struct idt_ptr {
 void IdtInitialize(void);
 void IdtSetGate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
 
+/*
+ * IdtLoad - Load the (shared) IDT on the calling CPU
+ *
+ * For application processors; IdtInitialize() loads it on the boot CPU.
+ */
+void IdtLoad(void);
+
 #endif /* IDT_H */
@@ -0,0 +1,71 @@
+/* ioapic.h - I/O APIC */
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The I/O APICs listed in the ACPI MADT take over device interrupts from
+ * the 8259 PIC. Each input pin has a redirection entry naming the vector
+ * and the local APIC to deliver to, so any line can go to any CPU, and
+ * the interrupt is acknowledged with an EOI write to that local APIC.
+ *
+ * Lines are named by IRQ number as with the PIC. ISA IRQs 0-15 are
+ * translated through the MADT's interrupt source overrides (on most
+ * machines the PIT's IRQ 0 arrives on input 2); higher IRQ numbers are
+ * global system interrupts, level-triggered and active low as PCI wires
+ * them.
+ */
+
+/*
+ * IoapicInitialize - Find and map the I/O APICs
+ *
+ * Reads the I/O APIC and interrupt source override entries of the MADT
+ * and masks every input.
+ *
+ * Returns: true if at least one I/O APIC was found
+ */
+bool IoapicInitialize(void);
+
+/*
+ * IoapicRoute - Program the redirection entry of a line
+ *
+ * The entry is left masked.
+ *
+ * Parameters:
+ *   irq - IRQ number
+ *   vector - Interrupt vector to deliver
+ *   apicId - Local APIC to deliver to
+ *
+ * Returns: false if no I/O APIC has an input for the line, or an
+ *          override gave it to another ISA IRQ
+ */
+bool IoapicRoute(uint8_t irq, uint8_t vector, uint8_t apicId);
+
+/*
+ * IoapicSetDestination - Deliver a routed line to another local APIC
+ *
+ * Parameters:
+ *   irq - IRQ number, already routed
+ *   apicId - Local APIC to deliver to
+ */
+void IoapicSetDestination(uint8_t irq, uint8_t apicId);
+
+/*
+ * IoapicMask - Disable a routed line
+ *
+ * Parameters:
+ *   irq - IRQ number
+ */
+void IoapicMask(uint8_t irq);
+
+/*
+ * IoapicUnmask - Enable a routed line
+ *
+ * Parameters:
+ *   irq - IRQ number
+ */
+void IoapicUnmask(uint8_t irq);
+
+#endif /* IOAPIC_H */
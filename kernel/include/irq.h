@@ -3,9 +3,21 @@
 #define IRQ_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "isr.h"
+#include "process.h"
 
-/* IRQ numbers (mapped to IDT entries 32-47) */
+/*
+ * IRQ lines. 0-15 are the ISA lines, on the 8259 PIC pair or the I/O
+ * APIC; 16-23 are further I/O APIC inputs (PCI), and never fire on the
+ * PIC, so registering a handler on them fails there. Line N is delivered
+ * on vector IRQ_VECTOR_BASE + N either way.
+ */
+#define IRQ_LINES       24
+#define IRQ_PIC_LINES   16
+#define IRQ_VECTOR_BASE 32
+
+/* ISA IRQ numbers */
 #define IRQ0  0   /* System timer (PIT) */
 #define IRQ1  1   /* Keyboard */
 #define IRQ2  2   /* Cascade (used internally by PICs) */
@@ -26,8 +38,11 @@
 /*
  * IrqHandlerFunc - IRQ handler function type
  *
- * Called when an IRQ occurs. The handler should return quickly
- * and not block.
+ * Called when an IRQ occurs, with interrupts disabled. The handler
+ * should return quickly and not block: it does what cannot wait and
+ * leaves the rest to a softirq (softirq.h) or a work queue (workqueue.h).
+ * Threaded handlers (IrqRegisterThreadedHandler()) run in a process
+ * instead, and may block.
  */
 typedef void (*IrqHandlerFunc)(void);
 
@@ -39,38 +54,251 @@ typedef void (*IrqHandlerFunc)(void);
  */
 typedef void (*IrqHandlerRegFunc)(registers_t* regs);
 
+/*
+ * IrqReturn - What a shared handler made of an interrupt
+ */
+typedef enum {
+    IRQ_NONE,                   // Its device was not interrupting
+    IRQ_HANDLED                 // Its device was, and has been serviced
+} IrqReturn;
+
+/*
+ * IrqSharedFunc - Handler on a shared IRQ line
+ *
+ * Called for every interrupt on the line, in the same context as an
+ * IrqHandlerFunc. Several devices may be raising the line at once, so it
+ * checks its own device's status and services it if it is interrupting.
+ */
+typedef IrqReturn (*IrqSharedFunc)(void* cookie);
+
+/*
+ * IrqAction - One handler in a line's chain
+ *
+ * Embedded in the driver's own structure and set up with
+ * IrqActionSetup(); the IRQ code never allocates. The cookie, usually
+ * the driver's device structure, is passed to the handler and names the
+ * action to IrqRemoveSharedHandler(). The statistics are for IrqStatDump().
+ */
+typedef struct IrqAction {
+    struct IrqAction* next;     // Next handler on the line (RCU-protected)
+    const char* name;
+    IrqSharedFunc handler;
+    void* cookie;
+    uint64_t calls;
+    uint64_t handled;           // Calls that returned IRQ_HANDLED
+    uint64_t cycles;            // TSC cycles spent in the handler
+} IrqAction;
+
+/*
+ * IrqExitFunc - Hook run at the end of every IRQ
+ *
+ * Runs after the handler, the EOI and any pending softirqs, with
+ * interrupts disabled, just before returning to the interrupted code. The scheduler switches
+ * processes here, so another IRQ can be taken on the next process's
+ * stack without waiting for this one to be acknowledged.
+ */
+typedef void (*IrqExitFunc)(void);
+
 /*
  * IrqInitialize - Initialize IRQ infrastructure
  *
- * Sets up IRQ handlers in the IDT (entries 32-47).
+ * Sets up IRQ handlers in the IDT (entries 32-55).
  * Must be called after IdtInitialize().
  */
 void IrqInitialize(void);
 
+/*
+ * IrqInitializeApic - Move device interrupts from the 8259 to the I/O APIC
+ *
+ * Looks for I/O APICs in the ACPI MADT and routes every line through
+ * them to the boot CPU's local APIC, then masks the PIC. Lines enabled at
+ * the PIC stay enabled. From then on EOIs are a single store to the local
+ * APIC rather than port writes, and lines can be sent to other CPUs with
+ * IrqSetAffinity(). Without an I/O APIC, or with the boot parameter
+ * noapic, nothing changes and the PIC stays in use. Call with paging on,
+ * before SmpInitialize().
+ *
+ * Returns: true if the I/O APIC took over
+ */
+bool IrqInitializeApic(void);
+
+/*
+ * IrqUsesApic - Check whether device interrupts come through the I/O APIC
+ */
+bool IrqUsesApic(void);
+
+/*
+ * IrqMask - Disable an IRQ line at its interrupt controller
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ */
+void IrqMask(uint8_t irq);
+
+/*
+ * IrqUnmask - Enable an IRQ line at its interrupt controller
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ */
+void IrqUnmask(uint8_t irq);
+
+/*
+ * IrqSendEoi - Acknowledge an interrupt at its controller
+ *
+ * irqHandler() does this for every line; exported for measuring it.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ */
+void IrqSendEoi(uint8_t irq);
+
+/*
+ * IrqSetAffinity - Deliver an IRQ line to another CPU
+ *
+ * Only with the I/O APIC; on the PIC every line goes to CPU 0. IRQ 0
+ * cannot move, as CPU 0 forwards its ticks to the other CPUs.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ *   cpu - Online CPU to deliver it to
+ *
+ * Returns: false if the line cannot be moved there
+ */
+bool IrqSetAffinity(uint8_t irq, uint32_t cpu);
+
 /*
  * IrqRegisterHandler - Register a handler for an IRQ
  *
+ * The handler has the line to itself: registration fails while the line
+ * has any other handler, threaded or shared.
+ *
  * Parameters:
- *   irq - IRQ number (0-15)
+ *   irq - IRQ number (below IRQ_LINES)
  *   handler - Function to call when IRQ occurs
+ *
+ * Returns: false if the line is taken
  */
-void IrqRegisterHandler(uint8_t irq, IrqHandlerFunc handler);
+bool IrqRegisterHandler(uint8_t irq, IrqHandlerFunc handler);
 
 /*
  * IrqUnregisterHandler - Unregister a handler for an IRQ
  *
+ * Removes the line's own handler, plain, with registers or threaded.
+ * Shared handlers are removed with IrqRemoveSharedHandler().
+ *
  * Parameters:
- *   irq - IRQ number (0-15)
+ *   irq - IRQ number (below IRQ_LINES)
  */
 void IrqUnregisterHandler(uint8_t irq);
 
 /*
  * IrqRegisterHandlerWithRegs - Register a handler that receives register state
  *
+ * Like IrqRegisterHandler(), the handler has the line to itself.
+ *
  * Parameters:
- *   irq - IRQ number (0-15)
+ *   irq - IRQ number (below IRQ_LINES)
  *   handler - Function to call when IRQ occurs (receives register state)
+ *
+ * Returns: false if the line is taken
+ */
+bool IrqRegisterHandlerWithRegs(uint8_t irq, IrqHandlerRegFunc handler);
+
+/*
+ * IrqRegisterThreadedHandler - Run an IRQ's handler in its own kernel process
+ *
+ * The top half in irqHandler() only masks the line and wakes the
+ * process ("irq/<n>"), which calls the handler and then unmasks the
+ * line. The handler runs like any process code: it may sleep, and the
+ * process can be given a priority and pinned to CPUs with
+ * ProcessSetAffinity() alongside the processes it serves. The price is
+ * a context switch before the handler starts.
+ *
+ * The process is created on the first threaded registration for a line
+ * and kept for later ones. A threaded handler has the line to itself,
+ * like IrqRegisterHandler(): unregister it before registering another.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ *   handler - Function the process calls for each interrupt
+ *   priority - Priority of the process, if it has to be created
+ *
+ * Returns: The handler's process, or NULL if it could not be created or
+ *          the line is taken
+ */
+Process* IrqRegisterThreadedHandler(uint8_t irq, IrqHandlerFunc handler, uint32_t priority);
+
+/*
+ * IrqActionSetup - Prepare a shared handler for IrqAddSharedHandler()
+ *
+ * Parameters:
+ *   action - Action to set up
+ *   name - Name for IrqStatDump(), usually the driver's
+ *   handler - Function to call for each interrupt on the line
+ *   cookie - Argument passed to handler, and the key for removing it
+ */
+void IrqActionSetup(IrqAction* action, const char* name, IrqSharedFunc handler, void* cookie);
+
+/*
+ * IrqAddSharedHandler - Add a handler to a line's chain
+ *
+ * Every interrupt on the line calls each handler in the chain, in the
+ * order they were added, whichever of them handles it. The first handler
+ * added unmasks the line. Lines with a handler of their own
+ * (IrqRegisterHandler() and the like) cannot be shared.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ *   action - Action set up with IrqActionSetup(), not on any chain
+ *
+ * Returns: false if the line has a handler of its own
+ */
+bool IrqAddSharedHandler(uint8_t irq, IrqAction* action);
+
+/*
+ * IrqRemoveSharedHandler - Take a handler off a line's chain
+ *
+ * Removing the last handler masks the line. Sleeps until no CPU can
+ * still be running the handler, so only call from a process; the action
+ * may be reused or freed once this returns.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ *   cookie - Cookie the action was set up with
+ *
+ * Returns: The action removed, or NULL if none on the line had that cookie
+ */
+IrqAction* IrqRemoveSharedHandler(uint8_t irq, void* cookie);
+
+/*
+ * IrqStatDump - Print interrupt statistics to the serial console
+ *
+ * For each line that has taken interrupts or has handlers: how many
+ * interrupts, how many no handler claimed, and each handler's calls and
+ * average cost. Then the spurious interrupts seen by the PIC and the
+ * local APICs. Costs need a TSC.
+ */
+void IrqStatDump(void);
+
+/*
+ * IrqGetRaisedAt - TSC when the latest interrupt on a line reached irqHandler()
+ *
+ * Lets a handler measure how long it took to get to run.
+ *
+ * Parameters:
+ *   irq - IRQ number (below IRQ_LINES)
+ *
+ * Returns: TSC value, or 0 without a TSC
+ */
+uint64_t IrqGetRaisedAt(uint8_t irq);
+
+/*
+ * IrqSetExitHook - Set the hook run at the end of every IRQ
+ *
+ * Parameters:
+ *   hook - Function to call, or NULL for none
  */
-void IrqRegisterHandlerWithRegs(uint8_t irq, IrqHandlerRegFunc handler);
+void IrqSetExitHook(IrqExitFunc hook);
 
 #endif /* IRQ_H */
@@ -9,7 +9,7 @@
  * Pushed onto the stack by ISR stubs
  */
 typedef struct {
-    uint32_t ds;                                    // Data segment
+    uint32_t gs, fs, es, ds;                        // Segment registers
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; // Pushed by pusha
     uint32_t intNo, errCode;                        // Interrupt number and error code
     uint32_t eip, cs, eflags, useresp, ss;          // Pushed by CPU
@@ -56,4 +56,11 @@ extern void isr29(void);
 extern void isr30(void);
 extern void isr31(void);
 
+/* Inter-processor interrupt stubs (vectors in smp.h) */
+extern void isr240(void);
+extern void isr241(void);
+extern void isr242(void);
+extern void isr243(void);
+extern void isr255(void);
+
 #endif /* ISR_H */
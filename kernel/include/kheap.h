@@ -4,6 +4,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "clk/allocator.h"
 
 /*
  * KHeapInitialize - Initialize the kernel heap
@@ -45,4 +46,40 @@ void* KReallocateMemory(void* ptr, size_t size);
  */
 void KHeapGetStats(size_t* totalSize, size_t* usedSize, size_t* freeSize);
 
+/*
+ * KHeapGetFreeListStats - Get free-list shape for fragmentation metrics
+ *
+ * Walks the block list, so cost is linear in the number of blocks.
+ *
+ * @freeBlocks: Output parameter for number of free blocks
+ * @largestFree: Output parameter for size of largest free block
+ */
+void KHeapGetFreeListStats(size_t* freeBlocks, size_t* largestFree);
+
+/*
+ * KHeapProfileEnable - Enable the heap allocation profiler
+ *
+ * Called from KMain when the 'heapprof' flag is present. From then on each
+ * allocation is attributed to its caller's return address in a fixed-size
+ * table. When disabled the allocator only pays a single flag test.
+ */
+void KHeapProfileEnable(void);
+
+/*
+ * KHeapProfileDump - Dump the heap allocation profile to the serial console
+ *
+ * Prints per-call-site allocation counts, live bytes and size histograms,
+ * plus free-list fragmentation. Can be called at any time.
+ */
+void KHeapProfileDump(void);
+
+/*
+ * KHeapGetAllocator - Get ClkAllocator interface for the kernel heap
+ *
+ * Lets libclankerk code (e.g. arenas) allocate from the kernel heap.
+ *
+ * @return: Pointer to static ClkAllocator backed by KAllocateMemory
+ */
+ClkAllocator* KHeapGetAllocator(void);
+
 #endif /* KHEAP_H */
@@ -0,0 +1,106 @@
+/* lapic.h - Local APIC */
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * LapicInitialize - Map and enable the boot CPU's local APIC
+ *
+ * The registers are identity-mapped uncached. Only software-enables the
+ * APIC (with SMP_VECTOR_SPURIOUS as its spurious vector); the LINT0
+ * virtual-wire setup the firmware left for the 8259 PIC is kept, so PIC
+ * interrupts keep arriving as before. Also installs the handler that
+ * counts spurious interrupts. Calling it again after a success does
+ * nothing (irq.c may have enabled it for the I/O APIC already).
+ *
+ * Parameters:
+ *   physBase - Register block address (from the MADT or MP table; 0 to
+ *              read it from the IA32_APIC_BASE MSR)
+ *
+ * Returns: true if the CPU has a local APIC
+ */
+bool LapicInitialize(uintptr_t physBase);
+
+/*
+ * LapicInitializeCpu - Enable the local APIC of an application processor
+ *
+ * Call on the AP itself, after LapicInitialize() has run on the boot CPU.
+ */
+void LapicInitializeCpu(void);
+
+/*
+ * LapicMaskLint0 - Stop 8259 interrupts reaching this CPU
+ *
+ * Masks the LINT0 virtual wire, once the I/O APIC has taken over and the
+ * PIC is masked; otherwise a spurious PIC interrupt could still arrive.
+ */
+void LapicMaskLint0(void);
+
+/*
+ * LapicIsEnabled - Check whether LapicInitialize() succeeded
+ */
+bool LapicIsEnabled(void);
+
+/*
+ * LapicGetId - APIC ID of the calling CPU
+ */
+uint8_t LapicGetId(void);
+
+/*
+ * LapicGetSpuriousCount - Spurious interrupts seen since boot, all CPUs
+ */
+uint32_t LapicGetSpuriousCount(void);
+
+/*
+ * LapicSendEoi - Acknowledge the interrupt being handled
+ *
+ * For interrupts delivered through the local APIC: IPIs, and device
+ * interrupts from the I/O APIC. One uncached store, where the 8259 needs
+ * one or two port writes. Interrupts from the 8259 are acknowledged at
+ * the PIC.
+ */
+void LapicSendEoi(void);
+
+/*
+ * LapicSendIpi - Send a fixed interrupt to one CPU
+ *
+ * Parameters:
+ *   apicId - Destination APIC ID
+ *   vector - Interrupt vector
+ */
+void LapicSendIpi(uint8_t apicId, uint8_t vector);
+
+/*
+ * LapicSendIpiAllOthers - Send a fixed interrupt to every other CPU
+ *
+ * Parameters:
+ *   vector - Interrupt vector
+ */
+void LapicSendIpiAllOthers(uint8_t vector);
+
+/*
+ * LapicStartAp - Start an application processor with INIT-SIPI-SIPI
+ *
+ * The AP begins in real mode at startPage << 12. Returns once the
+ * sequence has been sent; the caller waits for the AP to check in.
+ *
+ * Parameters:
+ *   apicId - APIC ID of the AP
+ *   startPage - Page number of the real-mode entry point (below 1 MB)
+ */
+void LapicStartAp(uint8_t apicId, uint8_t startPage);
+
+/*
+ * LapicStopAp - Put an application processor back to waiting for a STARTUP
+ *
+ * Sends INIT, which resets the AP wherever it is. Used on an AP that did
+ * not check in, so that it cannot run later.
+ *
+ * Parameters:
+ *   apicId - APIC ID of the AP
+ */
+void LapicStopAp(uint8_t apicId);
+
+#endif /* LAPIC_H */
@@ -0,0 +1,79 @@
+/* mutex.h - Sleeping locks with priority inheritance */
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "waitqueue.h"
+#include "process.h"
+#include "clk/list.h"
+
+/*
+ * Mutex - Lock that puts contended waiters to sleep
+ *
+ * Uncontended, locking is a single compare-and-swap on the owner. A
+ * process that finds the mutex held spins for a while if the owner is
+ * running on another CPU (it will likely let go soon, and sleeping costs
+ * two context switches), and otherwise sleeps on the mutex's wait queue.
+ *
+ * While processes wait, the owner runs at the highest priority among
+ * them (priority inheritance), so a low-priority owner cannot be starved
+ * by medium-priority processes while a high-priority one waits. Boosts
+ * follow chains of owners that are themselves blocked on mutexes, and
+ * are undone when the mutex is unlocked.
+ *
+ * Only processes may lock mutexes: never from interrupt handlers, and
+ * not recursively. Must be unlocked by the process that locked it.
+ */
+typedef struct Mutex {
+    Process* volatile owner;            // NULL when unlocked
+    volatile uint32_t waiterCount;      // Processes in the slow path
+    volatile uint32_t inherited;        // Top waiter priority, owed to the owner
+    WaitQueue waiters;
+    ClkListNode heldNode;               // Link in owner->heldMutexes
+} Mutex;
+
+/* Static initializer for an unlocked mutex */
+#define MUTEX_INIT(name) \
+    { NULL, 0, PROCESS_PRIORITY_LEVELS, WAIT_QUEUE_INIT((name).waiters), \
+      { &(name).heldNode, &(name).heldNode } }
+
+/*
+ * MutexInit - Initialize an unlocked mutex
+ */
+void MutexInit(Mutex* mutex);
+
+/*
+ * MutexLock - Lock a mutex, sleeping until it is free
+ *
+ * @mutex: Mutex to lock
+ */
+void MutexLock(Mutex* mutex);
+
+/*
+ * MutexTryLock - Lock a mutex if it is free
+ *
+ * @mutex: Mutex to lock
+ * @return: true if the mutex was locked
+ */
+bool MutexTryLock(Mutex* mutex);
+
+/*
+ * MutexUnlock - Unlock a mutex held by the current process
+ *
+ * Wakes the highest-priority waiter and drops any priority the current
+ * process inherited through this mutex.
+ *
+ * @mutex: Mutex to unlock
+ */
+void MutexUnlock(Mutex* mutex);
+
+/*
+ * MutexIsLocked - Check whether a mutex is held by anyone
+ *
+ * @mutex: Mutex to check
+ * @return: true if locked
+ */
+bool MutexIsLocked(Mutex* mutex);
+
+#endif /* MUTEX_H */
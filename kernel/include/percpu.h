@@ -0,0 +1,155 @@
+/* percpu.h - Per-CPU data area addressed through GS */
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "smp.h"
+
+struct Process;
+
+/* Per-CPU areas are cache-line aligned so CPUs never share a line */
+#define PER_CPU_ALIGN 64
+
+/*
+ * PerCpuCounter - Statistics kept as one delta per CPU
+ *
+ * Updating one is a single instruction on the CPU's own cache line, with
+ * no lock and no cache line bouncing between CPUs. Reading one sums the
+ * deltas of every CPU, which is slower and only exact while nobody is
+ * updating it: fine for statistics, not for decisions. The deltas are
+ * 32-bit so that each update, and each read of it from another CPU, is
+ * one access that cannot be seen half done; the sum is 64-bit.
+ */
+typedef enum {
+    PER_CPU_PMM_USED_PAGES,
+    PER_CPU_PMM_FREE_PAGES,
+    PER_CPU_HEAP_TOTAL_BYTES,
+    PER_CPU_HEAP_USED_BYTES,
+    PER_CPU_HEAP_FREE_BYTES,
+    PER_CPU_COUNTERS
+} PerCpuCounter;
+
+/*
+ * PerCpu - Data private to one CPU
+ *
+ * Every CPU's GDT has a segment covering just its own area, loaded into
+ * GS by GdtInitializeCpu() and never changed, so the running CPU's copy
+ * of a field is always at %gs:offsetof(PerCpu, field). Other CPUs' areas
+ * are reached with PerCpuGetArea().
+ */
+typedef struct PerCpu {
+    struct PerCpu* self;            // This area, for PerCpuGet()
+    uint32_t cpu;                   // Index of this CPU
+    struct Process* current;        // Process running on this CPU
+    void* runQueue;                 // This CPU's run queue (process.c)
+    uint32_t preemptCount;          // See preempt.h
+    uint32_t softirqPending;        // Raised softirqs, bit N = type N (softirq.h)
+    uint32_t inSoftirq;             // Running them; nested interrupts leave them be
+    int32_t counters[PER_CPU_COUNTERS];
+} __attribute__((aligned(PER_CPU_ALIGN))) PerCpu;
+
+/*
+ * The accessors below each compile to one GS-relative instruction. They
+ * only handle 32-bit fields (integers and pointers). Reads and writes of
+ * the running CPU's area are safe without disabling interrupts, but a
+ * value read can be stale by the time it is used if the process may move
+ * to another CPU in between: disable preemption when that matters.
+ */
+
+/*
+ * perCpuRead - Read a 32-bit field of the running CPU's area
+ */
+static inline __attribute__((always_inline)) uint32_t perCpuRead(const uint32_t offset)
+{
+    uint32_t value;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(value) : "i"(offset));
+    return value;
+}
+
+/*
+ * perCpuWrite - Write a 32-bit field of the running CPU's area
+ */
+static inline __attribute__((always_inline)) void perCpuWrite(const uint32_t offset,
+                                                              uint32_t value)
+{
+    __asm__ volatile ("movl %0, %%gs:%c1" : : "ri"(value), "i"(offset) : "memory");
+}
+
+/*
+ * perCpuAdd - Add to a 32-bit field of the running CPU's area
+ *
+ * One read-modify-write instruction, so an interrupt cannot split it.
+ */
+static inline __attribute__((always_inline)) void perCpuAdd(const uint32_t offset,
+                                                            uint32_t value)
+{
+    __asm__ volatile ("addl %0, %%gs:%c1" : : "ri"(value), "i"(offset) : "memory", "cc");
+}
+
+/* Read, write or add to a field of the running CPU's PerCpu */
+#define PER_CPU_READ(field) \
+    ((__typeof__(((PerCpu*)0)->field))perCpuRead(offsetof(PerCpu, field)))
+#define PER_CPU_WRITE(field, value) \
+    perCpuWrite(offsetof(PerCpu, field), (uint32_t)(value))
+#define PER_CPU_ADD(field, value) \
+    perCpuAdd(offsetof(PerCpu, field), (uint32_t)(value))
+
+/*
+ * PerCpuGet - The running CPU's area
+ */
+static inline PerCpu* PerCpuGet(void)
+{
+    return PER_CPU_READ(self);
+}
+
+/*
+ * PerCpuSetup - Initialize a CPU's area
+ *
+ * Called by GdtInitializeCpu() before it points GS at the area.
+ *
+ * @cpu: CPU index
+ * @return: The CPU's area
+ */
+PerCpu* PerCpuSetup(uint32_t cpu);
+
+/*
+ * PerCpuGetArea - Any CPU's area
+ *
+ * @cpu: CPU index (below SMP_MAX_CPUS)
+ * @return: The CPU's area
+ */
+PerCpu* PerCpuGetArea(uint32_t cpu);
+
+/*
+ * PerCpuCounterAdd - Add to the running CPU's delta of a counter
+ *
+ * @counter: Counter to change
+ * @delta: Amount to add (negative to subtract)
+ */
+void PerCpuCounterAdd(PerCpuCounter counter, int32_t delta);
+
+/*
+ * PerCpuCounterSum - Total of a counter over all CPUs
+ *
+ * @counter: Counter to read
+ * @return: Sum of the per-CPU deltas
+ */
+int64_t PerCpuCounterSum(PerCpuCounter counter);
+
+/*
+ * PerCpuCounterRead - Total of a counter that cannot go negative
+ *
+ * A sum taken while other CPUs update the counter can briefly dip below
+ * zero (a free counted before the allocation it undoes); that reads as 0.
+ *
+ * @counter: Counter to read
+ * @return: Sum of the per-CPU deltas, at least 0
+ */
+static inline size_t PerCpuCounterRead(PerCpuCounter counter)
+{
+    int64_t sum = PerCpuCounterSum(counter);
+    return sum > 0 ? (size_t)sum : 0;
+}
+
+#endif /* PERCPU_H */
@@ -3,6 +3,7 @@
 #define PIC_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /*
  * PicInitialize - Initialize the 8259 PIC
@@ -34,9 +35,44 @@ void PicSetMask(uint8_t irq);
 /*
  * PicClearMask - Enable an IRQ line
  *
+ * Lines on the slave PIC (8-15) also unmask its cascade line (IRQ 2).
+ *
  * Parameters:
  *   irq - IRQ number (0-15)
  */
 void PicClearMask(uint8_t irq);
 
+/*
+ * PicGetMask - Read both mask registers
+ *
+ * Returns: Bit N set if IRQ N is masked
+ */
+uint16_t PicGetMask(void);
+
+/*
+ * PicDisable - Mask every line for good
+ *
+ * Used once the I/O APIC has taken over device interrupts (irq.c).
+ */
+void PicDisable(void);
+
+/*
+ * PicIsSpurious - Check whether an IRQ 7 or 15 was really raised
+ *
+ * Reads the in-service register of the PIC the line belongs to. A
+ * spurious interrupt must not be handled or acknowledged; this sends the
+ * one EOI a spurious IRQ 15 needs (to the master) itself.
+ *
+ * Parameters:
+ *   irq - IRQ number being handled (other than 7 and 15 is never spurious)
+ *
+ * Returns: true if the interrupt was spurious
+ */
+bool PicIsSpurious(uint8_t irq);
+
+/*
+ * PicGetSpuriousCount - Spurious IRQ 7s and 15s seen since boot
+ */
+uint32_t PicGetSpuriousCount(void);
+
 #endif /* PIC_H */
@@ -5,6 +5,9 @@
 #include <stdint.h>
 #include "isr.h"
 
+/* PIT input clock (1.193182 MHz) */
+#define PIT_BASE_FREQ 1193182
+
 /*
  * PitTickHandler - Handler function called on each timer tick
  *
@@ -44,4 +47,28 @@ uint32_t PitGetFrequency(void);
  */
 void PitRegisterTickHandler(PitTickHandler handler);
 
+/*
+ * PitSetSubTicks - Split each tick into several timer interrupts
+ *
+ * Reprograms channel 0 to fire count times per tick. Ticks, and the tick
+ * handler, keep their rate; the interrupts in between go to the sub-tick
+ * handler instead. Used for timing finer than a tick without paying for
+ * a faster tick when nothing needs it. A count of 1 restores the normal
+ * rate.
+ *
+ * Parameters:
+ *   count - Interrupts per tick
+ */
+void PitSetSubTicks(uint32_t count);
+
+/*
+ * PitRegisterSubTickHandler - Register a handler for sub-tick interrupts
+ *
+ * Called on each interrupt that does not complete a tick.
+ *
+ * Parameters:
+ *   handler - Function to call (receives register state)
+ */
+void PitRegisterSubTickHandler(PitTickHandler handler);
+
 #endif /* PIT_H */
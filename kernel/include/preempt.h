@@ -0,0 +1,59 @@
+/* preempt.h - Per-CPU preemption control */
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Each CPU counts the reasons the process running on it must not be
+ * switched out: every spinlock held, plus explicit PreemptDisable()
+ * sections. While the count is non-zero a pending reschedule waits, even
+ * with interrupts enabled, and is acted on the moment the count drops
+ * back to zero.
+ *
+ * Preemption happens at these points, whenever a reschedule is pending,
+ * the count is zero and interrupts are enabled:
+ *   - on the way out of an interrupt (ProcessPreemptIrq())
+ *   - at PreemptEnable(), so at every spinlock release
+ *   - at PreemptCheck(), after code that may have woken a process with
+ *     interrupts off
+ *
+ * A process must not sleep with preemption disabled. Since the count is
+ * per CPU, whoever disables preemption must enable it again on the same
+ * CPU, which it cannot leave in between.
+ */
+
+/*
+ * PreemptDisable - Keep the current process on this CPU until PreemptEnable()
+ *
+ * Nests.
+ */
+void PreemptDisable(void);
+
+/*
+ * PreemptEnable - Undo PreemptDisable(), switching if a reschedule is pending
+ */
+void PreemptEnable(void);
+
+/*
+ * PreemptEnableNoResched - Undo PreemptDisable() without a preemption point
+ *
+ * For paths that switch themselves straight afterwards, or that must not
+ * switch at all.
+ */
+void PreemptEnableNoResched(void);
+
+/*
+ * PreemptCheck - Switch now if a reschedule is pending and allowed
+ */
+void PreemptCheck(void);
+
+/*
+ * PreemptGetCount - This CPU's preempt count
+ *
+ * Returns: 0 if the running process may be switched out
+ */
+uint32_t PreemptGetCount(void);
+
+#endif /* PREEMPT_H */
@@ -6,6 +6,27 @@
 #include <stdbool.h>
 #include "paging.h"
 #include "isr.h"
+#include "fpu.h"
+#include "smp.h"
+#include "clk/list.h"
+#include "clk/arena.h"
+#include "clk/rbtree.h"
+
+/* Scheduling priorities (lower value = higher priority) */
+#define PROCESS_PRIORITY_LEVELS  32
+#define PROCESS_PRIORITY_HIGHEST 0
+#define PROCESS_PRIORITY_LOWEST  (PROCESS_PRIORITY_LEVELS - 1)
+#define PROCESS_PRIORITY_DEFAULT 16
+
+/*
+ * Quantum at PROCESS_PRIORITY_DEFAULT, overridable with quantum=<ms>.
+ * Other priorities scale from it: priority 0 gets twice as long, the
+ * lowest priorities a single tick.
+ */
+#define PROCESS_QUANTUM_DEFAULT_MS 100
+
+/* Affinity mask allowing every CPU (bit N = CPU N) */
+#define PROCESS_AFFINITY_ALL ((1u << SMP_MAX_CPUS) - 1)
 
 /* Process states */
 typedef enum {
@@ -15,46 +36,79 @@ typedef enum {
     PROCESS_STATE_TERMINATED  // Process has terminated
 } ProcessState;
 
+/* Scheduling policies */
+typedef enum {
+    PROCESS_POLICY_NORMAL,    // Scheduled by the class chosen with sched=
+    PROCESS_POLICY_DEADLINE   // Runtime/period reservation (ProcessSetDeadline)
+} ProcessPolicy;
+
 /* Process privilege levels */
 typedef enum {
     PROCESS_MODE_KERNEL,      // Ring 0 - kernel mode
     PROCESS_MODE_USER         // Ring 3 - user mode
 } ProcessMode;
 
-/* CPU context for context switching */
-typedef struct {
-    // General purpose registers (saved by pusha)
-    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
-
-    // Segment registers
-    uint32_t ds, es, fs, gs;
-
-    // Instruction pointer and flags (saved by CPU on interrupt)
-    uint32_t eip;
-    uint32_t cs;
-    uint32_t eflags;
-
-    // Stack pointer and segment (for user mode)
-    uint32_t useresp;
-    uint32_t ss;
-} __attribute__((packed)) CpuContext;
+struct Mutex;
 
 /* Process Control Block (PCB) */
 typedef struct Process {
-    uint32_t pid;                    // Process ID
+    uint32_t pid;                    // Process ID (shared by all its threads)
+    uint32_t tid;                    // Thread ID (the PID for a process's first thread)
+    struct Process* owner;           // First thread, holding the address space
+    uint32_t threadCount;            // On the owner: threads not yet destroyed
+    ClkArena* arena;                 // Holds this PCB and its kernel stack
     char name[32];                   // Process name
     ProcessState state;              // Current state
     ProcessMode mode;                // Kernel or user mode
 
-    CpuContext context;              // CPU context for context switching
-    uintptr_t kernelStack;           // Kernel stack pointer (virtual address)
+    uintptr_t kernelEsp;             // Saved stack pointer while switched out
+    uintptr_t kernelStack;           // Kernel stack base (virtual address)
     uintptr_t userStack;             // User stack pointer (for user mode processes)
+    FpuState* fpuState;              // FPU/SSE registers, switched lazily (fpu.h)
 
     PageDirectory* pageDirectory;    // Page directory (physical address)
 
     // Scheduling
-    uint32_t timeslice;              // Time slices remaining
-    uint32_t priority;               // Priority level (unused for now)
+    uint32_t cpu;                    // CPU whose run queue the process is on
+    uint32_t affinity;               // CPUs it may run on (bit N = CPU N)
+    ClkListNode cpuNode;             // Link in that CPU's list of processes
+    uint64_t lastRan;                // Clock when last switched out (ns)
+    ProcessPolicy policy;            // Which class the process belongs to
+    uint32_t priority;               // Priority level (0 = highest), boosts included
+    uint32_t basePriority;           // Priority without priority inheritance boosts
+    uint64_t runtime;                // Total CPU time used (ns)
+    uint64_t execStart;              // Clock when runtime was last charged (ns)
+    uint64_t sliceStart;             // runtime when last picked to run
+
+    // Round-robin class
+    uint32_t timeslice;              // Timer ticks left in current slice
+    uint32_t quantum;                // Full slice in ticks (0 = from priority)
+
+    // Fair class
+    uint64_t vruntime;               // Runtime weighted by priority (ns)
+    ClkRbNode runNode;               // Link in the fair or deadline class tree
+
+    // Feedback queue class
+    uint32_t mlfqLevel;              // Queue level (0 = top)
+    uint32_t mlfqBoostEpoch;         // Boost count when the level was last set
+    uint64_t mlfqUsed;               // CPU time used at this level (ns)
+
+    // Deadline class
+    uint32_t dlRuntime;              // Budget per period (ns)
+    uint32_t dlDeadline;             // Deadline relative to period start (ns)
+    uint32_t dlPeriod;               // Period (ns)
+    uint32_t dlBandwidth;            // dlRuntime / dlPeriod, fixed point
+    uint64_t dlAbsDeadline;          // Absolute deadline of the current job (ns)
+    int64_t dlBudget;                // Budget left in the current job (ns)
+    bool dlThrottled;                // Out of budget until the next period
+    bool dlMissed;                   // Current job already counted as a miss
+    uint32_t dlMisses;               // Jobs still unfinished at their deadline
+
+    // Mutexes (mutex.h)
+    ClkListNode heldMutexes;         // Mutexes held, for undoing inherited priority
+    struct Mutex* blockedOn;         // Mutex being waited for, if any
+
+    void* data;                      // Handed over at creation (ProcessGetData())
 
     // Linked list for process queue
     struct Process* next;
@@ -67,6 +121,16 @@ typedef struct Process {
  */
 void ProcessInitialize(void);
 
+/*
+ * ProcessInitializeCpu - Give an application processor its run queue
+ *
+ * Called on the AP itself during SMP bring-up. The calling context
+ * becomes that CPU's idle process, and should go on to ProcessIdle().
+ *
+ * @cpu: Index of the calling CPU
+ */
+void ProcessInitializeCpu(uint32_t cpu);
+
 /*
  * ProcessCreate - Create a new process
  *
@@ -77,6 +141,121 @@ void ProcessInitialize(void);
  */
 Process* ProcessCreate(const char* name, void (*entryPoint)(void), ProcessMode mode);
 
+/*
+ * ProcessCreateThread - Start another thread in an existing process
+ *
+ * Each Process structure is one schedulable thread with its own kernel
+ * stack, saved context, FPU state and scheduling parameters. A thread
+ * created here shares the address space of parent's process, along with
+ * its PID, mode and priority, and starts with parent's affinity. Its
+ * own ID is in tid. Switching between threads of one process does not
+ * reload CR3, so the TLB stays warm.
+ *
+ * The process's first thread (owner) holds the address space, and its
+ * structure is only freed once every thread has been destroyed.
+ *
+ * @parent: Any thread of the process
+ * @name: Thread name
+ * @entryPoint: Entry point function
+ * @return: The new thread, or NULL on failure
+ */
+Process* ProcessCreateThread(Process* parent, const char* name, void (*entryPoint)(void));
+
+/*
+ * ProcessCreateWithPriority - Create a new process with a given priority
+ *
+ * Higher-priority processes are always picked first and get longer
+ * timeslices. ProcessCreate() uses PROCESS_PRIORITY_DEFAULT. The new
+ * process goes on the run queue of the online CPU with the fewest
+ * runnable processes; the load balancer may move it later.
+ *
+ * @name: Process name
+ * @entryPoint: Entry point function
+ * @mode: Kernel or user mode
+ * @priority: PROCESS_PRIORITY_HIGHEST (0) to PROCESS_PRIORITY_LOWEST
+ * @return: Pointer to created process, or NULL on failure
+ */
+Process* ProcessCreateWithPriority(const char* name, void (*entryPoint)(void),
+                                   ProcessMode mode, uint32_t priority);
+
+/*
+ * ProcessCreateWithData - Create a kernel process handed a pointer
+ *
+ * Like ProcessCreateWithPriority() in kernel mode, with data set before
+ * the process can first run, so one entry point can serve several
+ * processes (one per device or queue) that each find their own state
+ * with ProcessGetData().
+ *
+ * @name: Process name
+ * @entryPoint: Entry point function
+ * @priority: PROCESS_PRIORITY_HIGHEST (0) to PROCESS_PRIORITY_LOWEST
+ * @data: Pointer for the process
+ * @return: Pointer to created process, or NULL on failure
+ */
+Process* ProcessCreateWithData(const char* name, void (*entryPoint)(void), uint32_t priority,
+                               void* data);
+
+/*
+ * ProcessGetData - The pointer the current process was created with
+ *
+ * @return: data given to ProcessCreateWithData(), or NULL
+ */
+void* ProcessGetData(void);
+
+/*
+ * ProcessSetQuantum - Override the timeslice length of a process
+ *
+ * Takes effect when the process next gets a fresh slice. Only the
+ * round-robin class uses fixed slices; the fair class ignores this.
+ *
+ * @process: Process to configure
+ * @ticks: Slice length in timer ticks, or 0 to derive it from priority
+ */
+void ProcessSetQuantum(Process* process, uint32_t ticks);
+
+/*
+ * ProcessSetDeadline - Give a process a real-time CPU reservation
+ *
+ * The process is guaranteed runtimeNs of CPU in every periodNs, finished
+ * within deadlineNs of the period starting, and runs ahead of every
+ * normal process while it has budget left. Admission fails if the
+ * reservations of all deadline processes would add up to more than the
+ * CPU can give. A runtime of 0 returns the process to the normal class.
+ *
+ * A periodic process should call ProcessYield() when done with a period's
+ * work; it then sleeps until the next period. Deadlines it misses are
+ * counted in dlMisses. Admission is per CPU, against the other
+ * reservations on the process's CPU, and the process then stays on that
+ * CPU. A process waiting to move off a CPU its affinity excludes is not
+ * admitted.
+ *
+ * @process: Process to configure
+ * @runtimeNs: CPU time per period, or 0 to drop the reservation
+ * @deadlineNs: Relative deadline (runtimeNs <= deadlineNs <= periodNs)
+ * @periodNs: Period length
+ * @return: true on success, false if the reservation was rejected
+ */
+bool ProcessSetDeadline(Process* process, uint32_t runtimeNs,
+                        uint32_t deadlineNs, uint32_t periodNs);
+
+/*
+ * ProcessSetAffinity - Restrict the CPUs a process may run on
+ *
+ * New processes may run on every CPU except those named by isolcpus=.
+ * The scheduler only ever queues a process on an allowed CPU and the
+ * load balancer never moves it elsewhere. A process on a CPU the new
+ * mask excludes is moved at once if it is waiting to run, once it is
+ * switched out if it is running, and when woken if it is blocked.
+ * Isolated CPUs are left out of load balancing, so a process pinned to
+ * one has it to itself.
+ *
+ * @process: Process to configure
+ * @mask: Allowed CPUs, bit N for CPU N (PROCESS_AFFINITY_ALL for any)
+ * @return: false if the mask has no online CPU, or excludes the CPU of a
+ *          deadline process (nothing is changed)
+ */
+bool ProcessSetAffinity(Process* process, uint32_t mask);
+
 /*
  * ProcessDestroy - Destroy a process
  *
@@ -87,27 +266,60 @@ void ProcessDestroy(Process* process);
 /*
  * ProcessGetCurrent - Get currently running process
  *
- * @return: Pointer to current process
+ * @return: Pointer to the process running on the calling CPU
  */
 Process* ProcessGetCurrent(void);
 
 /*
  * ProcessYield - Voluntarily yield CPU to another process
  *
- * Triggers a context switch to the next ready process.
+ * Calls straight into the scheduler (no software interrupt) and switches
+ * to the next ready process, if there is one.
  */
 void ProcessYield(void);
 
 /*
- * ProcessSchedule - Schedule next process to run
+ * ProcessSchedule - Timer tick bookkeeping for the scheduler
  *
- * Called by timer interrupt or when process yields/blocks.
- * Performs context switch to next ready process.
+ * Called on every timer tick, on each CPU. Charges the CPU time used
+ * since the last tick to the running process and asks the scheduling
+ * class (see sched.h) whether its turn is over. If so, or if a process
+ * that should preempt it has become ready, the switch happens in
+ * ProcessPreemptIrq() once the interrupt has been acknowledged. On CPU 0
+ * (which owns the PIT) it also forwards the tick to the other CPUs.
  *
  * @regs: Pointer to interrupt register state
  */
 void ProcessSchedule(registers_t* regs);
 
+/*
+ * ProcessPreemptIrq - Switch processes on the way out of an interrupt
+ *
+ * Installed as the IRQ exit hook, and also the switch behind the
+ * preemption points in preempt.h; called with interrupts off. Does
+ * nothing unless a reschedule is pending and the preempt count is zero.
+ * The interrupted process's frame stays on its own kernel stack, and it
+ * returns from the interrupt when next switched in.
+ */
+void ProcessPreemptIrq(void);
+
+/*
+ * ProcessGetSwitchCount - Number of context switches since boot, on all CPUs
+ */
+uint64_t ProcessGetSwitchCount(void);
+
+/*
+ * ProcessScheduleSubTick - Scheduler work between ticks
+ *
+ * Called on the timer interrupts between ticks while deadline processes
+ * exist (see PitSetSubTicks()). Enforces deadline budgets and
+ * replenishments at sub-tick precision; like ProcessSchedule(), any
+ * switch happens in ProcessPreemptIrq().
+ *
+ * @regs: Pointer to interrupt register state
+ */
+void ProcessScheduleSubTick(registers_t* regs);
+
 /*
  * ProcessBlock - Block current process
  *
@@ -115,9 +327,57 @@ void ProcessSchedule(registers_t* regs);
  */
 void ProcessBlock(void);
 
+/*
+ * ProcessSleep - Block the current process for a number of milliseconds
+ *
+ * The process is off the run queues while it sleeps and is woken by a
+ * kernel timer (see timer.h), so sleeping costs no CPU. Sleeps for at
+ * least ms, rounded up to whole timer ticks; 0 just yields.
+ *
+ * @ms: Time to sleep
+ */
+void ProcessSleep(uint32_t ms);
+
+/*
+ * ProcessPrepareBlock - Mark the current process blocked without switching
+ *
+ * The first half of a race-free wait: mark the process blocked, publish
+ * it where a waker will find it (a wait queue, say), drop any locks, then
+ * call ProcessBlockPrepared(). A ProcessUnblock() anywhere in between
+ * sets the process running again and ProcessBlockPrepared() returns at
+ * once, so the wakeup is not lost.
+ */
+void ProcessPrepareBlock(void);
+
+/*
+ * ProcessBlockPrepared - Switch out the current process if it is still blocked
+ *
+ * Second half of ProcessPrepareBlock(). Before the scheduler is enabled
+ * there is nothing to switch to; the process is set running again and
+ * the caller has to poll.
+ */
+void ProcessBlockPrepared(void);
+
+/*
+ * ProcessSetEffectivePriority - Change the priority a process is scheduled at
+ *
+ * For priority inheritance: basePriority is left alone, so the boost can
+ * be undone by setting the effective priority back to it. A ready
+ * process is requeued at the new priority and may preempt.
+ *
+ * @process: Process to change
+ * @priority: New effective priority
+ */
+void ProcessSetEffectivePriority(Process* process, uint32_t priority);
+
 /*
  * ProcessUnblock - Unblock a process
  *
+ * If the scheduling class says it should preempt the running process,
+ * it is switched in on the way out of the current interrupt (or of the
+ * next one, when called from process context). A process on another CPU
+ * gets there through a reschedule IPI.
+ *
  * @process: Process to unblock
  */
 void ProcessUnblock(Process* process);
@@ -126,8 +386,50 @@ void ProcessUnblock(Process* process);
  * ProcessExit - Terminate current process
  *
  * Marks current process as terminated and schedules another process.
+ * The process's kernel stack and PCB are freed later by the reaper
+ * process, in batches or when the CPU goes idle. Does not return.
+ */
+void ProcessExit(void) __attribute__((noreturn));
+
+/*
+ * ProcessIdle - Idle loop for PID 0
+ *
+ * The boot context becomes the idle process once it calls this after
+ * ProcessEnableScheduler(), and each AP's startup context becomes its
+ * own. Halts the CPU until the next interrupt whenever nothing else is
+ * ready, and wakes the reaper when exited processes are waiting to be
+ * freed. Does not return.
+ */
+void ProcessIdle(void) __attribute__((noreturn));
+
+/*
+ * ProcessGetCpuTimes - Idle and elapsed time of a CPU
+ *
+ * Both count from ProcessEnableScheduler(); utilisation is
+ * 1 - idle / elapsed. Idle time includes interrupts handled while idle.
+ *
+ * @cpu: CPU index (CPUs that are not online report zero)
+ * @idleNs: Receives the time spent in the idle process (may be NULL)
+ * @elapsedNs: Receives the time since the scheduler started (may be NULL)
+ */
+void ProcessGetCpuTimes(uint32_t cpu, uint64_t* idleNs, uint64_t* elapsedNs);
+
+/*
+ * ProcessGetBalanceStats - Load balancer counters of a CPU
+ *
+ * A CPU that runs out of work steals a ready process from the busiest
+ * other CPU, and every 100 ms each CPU pulls processes from the busiest
+ * one until their queue lengths are within one of each other. Processes
+ * that ran in the last half millisecond (their data is probably still in
+ * that CPU's cache), deadline processes, and processes whose FPU
+ * registers are still loaded where they last ran are not moved.
+ *
+ * @cpu: CPU index (CPUs that are not online report zero)
+ * @steals: Receives the processes stolen while out of work (may be NULL)
+ * @migrations: Receives all processes moved to this CPU, steals
+ *              included (may be NULL)
  */
-void ProcessExit(void);
+void ProcessGetBalanceStats(uint32_t cpu, uint64_t* steals, uint64_t* migrations);
 
 /*
  * ProcessEnableScheduler - Enable the process scheduler
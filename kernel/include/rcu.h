@@ -0,0 +1,123 @@
+/* rcu.h - Read-copy-update for read-mostly data */
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "percpu.h"
+#include "preempt.h"
+
+/*
+ * Readers of RCU-protected data take no lock and write nothing shared:
+ * RcuReadLock() only disables preemption on the reader's own CPU. A
+ * writer publishes a new version with RCU_ASSIGN_POINTER() and frees the
+ * old one only after a grace period, once every CPU has passed a
+ * quiescent state, a point where it cannot be inside a read-side
+ * section. Readers that could still see the old version are gone by then.
+ *
+ * Quiescent states are context switches, and timer ticks that find a
+ * CPU idle or with preemption enabled. Each CPU notices grace periods and
+ * reports its quiescent states from the RCU softirq, which also runs the
+ * callbacks whose grace period is over. A grace period therefore takes a
+ * few ticks; writers that cannot wait use RcuCall() rather than
+ * RcuSynchronize().
+ *
+ * Read-side sections nest, may be used from interrupt handlers, and must
+ * not sleep. Writers still need a lock against each other.
+ */
+
+/* Publish a pointer to fully initialised data to readers */
+#define RCU_ASSIGN_POINTER(pointer, value) \
+    __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
+/* Fetch an RCU-protected pointer inside a read-side section */
+#define RCU_DEREFERENCE(pointer) \
+    __atomic_load_n(&(pointer), __ATOMIC_CONSUME)
+
+/*
+ * RcuCallback - Function run once a grace period has passed
+ *
+ * Runs in the RCU softirq, so it must not sleep. Typically frees the old
+ * version of the data.
+ */
+typedef void (*RcuCallback)(void* data);
+
+/*
+ * RcuHead - A pending RCU callback
+ *
+ * Embedded in the data it will free; the RCU code never allocates.
+ */
+typedef struct RcuHead {
+    struct RcuHead* next;
+    RcuCallback callback;
+    void* data;
+} RcuHead;
+
+/*
+ * RcuReadLock - Enter a read-side section
+ *
+ * One increment of this CPU's preempt count.
+ */
+static inline void RcuReadLock(void)
+{
+    PER_CPU_ADD(preemptCount, 1);
+}
+
+/*
+ * RcuReadUnlock - Leave a read-side section
+ *
+ * A preemption point, like any PreemptEnable().
+ */
+static inline void RcuReadUnlock(void)
+{
+    PreemptEnable();
+}
+
+/*
+ * RcuInitialize - Set up grace period tracking
+ *
+ * Call before the scheduler is enabled; grace periods advance with its
+ * ticks.
+ */
+void RcuInitialize(void);
+
+/*
+ * RcuCall - Run a callback after a grace period
+ *
+ * Never sleeps, so may be called from interrupt context and inside
+ * read-side sections.
+ *
+ * @head: Storage for the pending callback, untouched by the caller until it runs
+ * @callback: Function to run
+ * @data: Argument passed to callback
+ */
+void RcuCall(RcuHead* head, RcuCallback callback, void* data);
+
+/*
+ * RcuSynchronize - Sleep until a grace period has passed
+ *
+ * Only from a process, outside read-side sections. Every read-side
+ * section that had begun when this was called has ended when it returns.
+ */
+void RcuSynchronize(void);
+
+/*
+ * RcuTick - Account a timer tick on this CPU (called by the scheduler)
+ *
+ * @quiescent: The tick found the CPU idle or with preemption enabled
+ */
+void RcuTick(bool quiescent);
+
+/*
+ * RcuNoteContextSwitch - Account a context switch on this CPU
+ *
+ * Called by the scheduler with interrupts off.
+ */
+void RcuNoteContextSwitch(void);
+
+/*
+ * RcuGetGracePeriods - Number of grace periods completed since boot
+ */
+uint32_t RcuGetGracePeriods(void);
+
+#endif /* RCU_H */
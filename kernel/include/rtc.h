@@ -0,0 +1,37 @@
+/* rtc.h - CMOS real-time clock periodic interrupt */
+#ifndef RTC_H
+#define RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * RtcStartPeriodic - Have the RTC raise IRQ 8 at a fixed rate
+ *
+ * The RTC only supports powers of two from 2 to 8192 Hz; the nearest one
+ * at or above frequency is used. Each interrupt must be acknowledged with
+ * RtcAcknowledge() before the next one can arrive. The caller registers
+ * the IRQ 8 handler and unmasks the line.
+ *
+ * Parameters:
+ *   frequency - Desired interrupt rate in Hz
+ *
+ * Returns: The rate actually programmed, in Hz
+ */
+uint32_t RtcStartPeriodic(uint32_t frequency);
+
+/*
+ * RtcStopPeriodic - Stop the periodic interrupt
+ */
+void RtcStopPeriodic(void);
+
+/*
+ * RtcAcknowledge - Acknowledge an RTC interrupt
+ *
+ * Reads status register C, which re-arms the interrupt.
+ *
+ * Returns: true if the RTC was interrupting, for handlers on a shared line
+ */
+bool RtcAcknowledge(void);
+
+#endif /* RTC_H */
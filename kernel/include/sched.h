@@ -0,0 +1,131 @@
+/* sched.h - Scheduling classes */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "process.h"
+
+/*
+ * SchedClass - Scheduling policy operations
+ *
+ * process.c owns the running process, CPU time accounting and the
+ * context switch; a class only decides which ready process runs next and
+ * when the running one should give way. The idle process is never handed
+ * to a class; it runs whenever pickNext() comes back empty.
+ *
+ * One normal class is selected at boot with sched=<name>. Processes with
+ * PROCESS_POLICY_DEADLINE belong to SchedDeadlineClass instead, which is
+ * always consulted first.
+ *
+ * Every class keeps separate queues per CPU and files a process under
+ * process->cpu. process.c calls the operations for a CPU's processes
+ * with that CPU's run queue lock held, so classes need no locking of
+ * their own for per-CPU state.
+ */
+typedef struct {
+    const char* name;
+
+    // Set up empty run queues (called once, before any other operation)
+    void (*initialize)(void);
+
+    // A process became ready: newly created or unblocked
+    void (*enqueue)(Process* process);
+
+    // A ready process is leaving the class without running (policy change)
+    void (*dequeue)(Process* process);
+
+    // The running process is being switched out but is still ready
+    void (*putPrev)(Process* process);
+
+    // Remove and return the process to run next on a CPU, or NULL if none is ready
+    Process* (*pickNext)(uint32_t cpu);
+
+    // Charge deltaNs of CPU time to the running process
+    void (*account)(Process* current, uint64_t deltaNs);
+
+    // Timer tick (after account); return true to preempt the running process
+    bool (*tick)(Process* current);
+
+    // The running process is giving up the CPU voluntarily
+    void (*yield)(Process* current);
+
+    // Return true if a process that just became ready should preempt current
+    bool (*checkPreempt)(Process* current, Process* woken);
+
+    // Optional: a ready process is moving to another CPU. Called between
+    // dequeue() and enqueue(), with both CPUs' run queue locks held and
+    // process->cpu still the old CPU, to rebase anything the class keeps
+    // relative to the old CPU's queues
+    void (*migrate)(Process* process, uint32_t toCpu);
+
+    // Optional: class-wide timer work, run on every tick and sub-tick on
+    // each CPU whatever is running there; return true to preempt current
+    bool (*timer)(Process* current);
+} SchedClass;
+
+/*
+ * SchedRoundRobinClass - Strict priority with round-robin inside a level
+ *
+ * One FIFO per priority level and a bitmap of non-empty levels. Slices
+ * are counted in timer ticks (see quantum= and ProcessSetQuantum()).
+ */
+extern const SchedClass SchedRoundRobinClass;
+
+/*
+ * SchedFairClass - Completely fair scheduler
+ *
+ * Ready processes sit in a red-black tree keyed by virtual runtime, the
+ * CPU time they have used scaled by a weight derived from priority. The
+ * process that has received the least weighted time runs next.
+ */
+extern const SchedClass SchedFairClass;
+
+/*
+ * SchedFeedbackClass - Multi-level feedback queue
+ *
+ * Processes start on the top level and sink as they use CPU; ones that
+ * block early stay high. A periodic boost lifts everyone back to the top
+ * so CPU-bound processes cannot starve. Ignores priority.
+ */
+extern const SchedClass SchedFeedbackClass;
+
+/*
+ * SchedDeadlineClass - Earliest deadline first with constant bandwidth servers
+ *
+ * Each process reserves runtime out of every period and is picked by
+ * absolute deadline, ahead of every normal process. A process that uses
+ * up its runtime is throttled until its next period, so an overrunning
+ * process cannot eat into anyone else's reservation. While any deadline
+ * process exists the PIT runs at sub-tick rate so budgets are enforced
+ * to within a millisecond rather than a tick.
+ */
+extern const SchedClass SchedDeadlineClass;
+
+/*
+ * SchedDeadlineAdmit - Reserve bandwidth for a deadline process
+ *
+ * Requires 0 < runtime <= deadline <= period. Rejected if the total
+ * runtime/period of the deadline processes on process->cpu would exceed
+ * the admission limit. Re-admitting a process replaces its old
+ * reservation and starts a fresh job.
+ *
+ * @process: Process to reserve for
+ * @runtimeNs: CPU time needed in every period
+ * @deadlineNs: Time from the start of a period by which it must be done
+ * @periodNs: Period length
+ * @return: true if admitted
+ */
+bool SchedDeadlineAdmit(Process* process, uint32_t runtimeNs,
+                        uint32_t deadlineNs, uint32_t periodNs);
+
+/*
+ * SchedDeadlineRelease - Give back a deadline process's reservation
+ *
+ * The process must not be queued in the class.
+ *
+ * @process: Process leaving the deadline policy
+ */
+void SchedDeadlineRelease(Process* process);
+
+#endif /* SCHED_H */
@@ -0,0 +1,21 @@
+/* selftest.h - Boot-flag tests and benchmarks */
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <stdbool.h>
+
+/*
+ * SelfTestStart - Create the processes of the test asked for at boot
+ *
+ * The first test or benchmark flag on the command line (switchbench,
+ * balancetest, latencybench, ...) replaces the three demo processes;
+ * with none, the demo runs. The lockstat and irqstat reports and the
+ * worktest timer are started as well when their flags are given. Call
+ * once, after the other CPUs, work queues and RCU are up and before the
+ * scheduler is enabled.
+ *
+ * Returns: false if anything could not be started
+ */
+bool SelfTestStart(void);
+
+#endif /* SELFTEST_H */
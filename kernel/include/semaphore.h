@@ -0,0 +1,54 @@
+/* semaphore.h - Counting semaphores */
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "waitqueue.h"
+
+/*
+ * Semaphore - Counter that processes sleep on while it is zero
+ *
+ * SemaphoreUp() never sleeps and may be called from interrupt handlers,
+ * so a semaphore can hand events from an interrupt to a process.
+ * Waiters are served in arrival order.
+ */
+typedef struct Semaphore {
+    uint32_t count;             // Under waiters.lock
+    WaitQueue waiters;
+} Semaphore;
+
+/* Static initializer for a semaphore with an initial count */
+#define SEMAPHORE_INIT(name, initial) { (initial), WAIT_QUEUE_INIT((name).waiters) }
+
+/*
+ * SemaphoreInit - Initialize a semaphore
+ *
+ * @sem: Semaphore to initialize
+ * @count: Initial count
+ */
+void SemaphoreInit(Semaphore* sem, uint32_t count);
+
+/*
+ * SemaphoreDown - Take one from the count, sleeping while it is zero
+ *
+ * @sem: Semaphore to take from
+ */
+void SemaphoreDown(Semaphore* sem);
+
+/*
+ * SemaphoreTryDown - Take one from the count if it is not zero
+ *
+ * @sem: Semaphore to take from
+ * @return: true if the count was taken
+ */
+bool SemaphoreTryDown(Semaphore* sem);
+
+/*
+ * SemaphoreUp - Add one to the count, waking a waiter
+ *
+ * @sem: Semaphore to add to
+ */
+void SemaphoreUp(Semaphore* sem);
+
+#endif /* SEMAPHORE_H */
@@ -0,0 +1,93 @@
+/* smp.h - Multiprocessor bring-up and inter-processor interrupts */
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "isr.h"
+
+/* Most CPUs the kernel will bring up; extra ones are left halted */
+#define SMP_MAX_CPUS 8
+
+/*
+ * Inter-processor interrupt vectors. Only the boot CPU takes PIT
+ * interrupts; it forwards each tick and sub-tick to the others.
+ */
+#define SMP_VECTOR_TICK       0xF0  // Timer tick, forwarded by CPU 0
+#define SMP_VECTOR_SUBTICK    0xF1  // Timer sub-tick, forwarded by CPU 0
+#define SMP_VECTOR_RESCHEDULE 0xF2  // Check needResched on the way out
+#define SMP_VECTOR_STOP       0xF3  // Halt for good (panic on another CPU)
+#define SMP_VECTOR_SPURIOUS   0xFF  // Local APIC spurious interrupt
+
+/*
+ * SmpInitialize - Find the other CPUs and start them
+ *
+ * CPUs are listed by the ACPI MADT, or the MP table if there is no ACPI.
+ * Each application processor is started with INIT-SIPI-SIPI through a
+ * real-mode trampoline in low memory, gets its own GDT, TSS and
+ * stack, and ends up in its own idle loop with its own run queue. Call
+ * after ProcessInitialize() with interrupts enabled. The boot parameter
+ * nosmp skips everything and leaves just the boot CPU.
+ *
+ * Returns: Number of CPUs online, including the boot CPU
+ */
+uint32_t SmpInitialize(void);
+
+/*
+ * SmpGetCurrentCpu - Index of the CPU this runs on
+ *
+ * 0 is the boot CPU; the others are numbered in the order they came up.
+ * Read from the per-CPU area (percpu.h). Only stable while preemption is
+ * disabled, since a process may be moved to another CPU once it is
+ * switched out.
+ */
+uint32_t SmpGetCurrentCpu(void);
+
+/*
+ * SmpGetCpuCount - Number of CPUs online
+ */
+uint32_t SmpGetCpuCount(void);
+
+/*
+ * SmpIsCpuOnline - Check whether a CPU index is online
+ */
+bool SmpIsCpuOnline(uint32_t cpu);
+
+/*
+ * SmpGetApicId - Local APIC ID of an online CPU
+ *
+ * Parameters:
+ *   cpu - CPU index
+ *
+ * Returns: The APIC ID, 0 if the CPU is offline or there is no local APIC
+ */
+uint8_t SmpGetApicId(uint32_t cpu);
+
+/*
+ * SmpSendIpi - Send an inter-processor interrupt to one CPU
+ *
+ * Parameters:
+ *   cpu - Target CPU index
+ *   vector - One of the SMP_VECTOR_* vectors
+ */
+void SmpSendIpi(uint32_t cpu, uint8_t vector);
+
+/*
+ * SmpForwardTick - Pass a timer tick or sub-tick on to the other CPUs
+ *
+ * Called by CPU 0 from its PIT handlers. Does nothing on a single CPU.
+ *
+ * Parameters:
+ *   subTick - true for a sub-tick, false for a full tick
+ */
+void SmpForwardTick(bool subTick);
+
+/*
+ * SmpStopOthers - Halt every other CPU
+ *
+ * For panics: the other CPUs stop touching shared state while this one
+ * prints its report.
+ */
+void SmpStopOthers(void);
+
+#endif /* SMP_H */
@@ -0,0 +1,63 @@
+/* softirq.h - Deferred halves of interrupt handlers */
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+
+/*
+ * An interrupt handler does only what cannot wait (acknowledge the
+ * device, collect its data) and raises a softirq for the rest. Each CPU
+ * keeps a bitmap of the softirqs raised on it, and runs them on the way
+ * out of its next interrupt: after the EOI and with interrupts enabled,
+ * so other interrupts are not held up behind them, but before the
+ * interrupted process gets the CPU back or is switched out.
+ *
+ * Softirq handlers still run in interrupt context, on the stack of
+ * whatever was interrupted and with preemption disabled: they must not
+ * sleep, and may only take spinlocks that are everywhere taken with
+ * interrupts off. Sleepable deferred work goes to a work queue
+ * (workqueue.h). A softirq raised while its handler runs goes round
+ * again; one raised on several CPUs runs on each of them.
+ */
+typedef enum {
+    SOFTIRQ_TIMER,              // Expire kernel timers (timer.c), CPU 0 only
+    SOFTIRQ_SCHED,              // Load balancing (process.c)
+    SOFTIRQ_RCU,                // Grace periods and RCU callbacks (rcu.c)
+    SOFTIRQ_COUNT
+} SoftirqType;
+
+/*
+ * SoftirqHandler - Function run when its softirq is pending
+ */
+typedef void (*SoftirqHandler)(void);
+
+/*
+ * SoftirqRegister - Set the handler of a softirq
+ *
+ * @type: Softirq to handle
+ * @handler: Function to run
+ */
+void SoftirqRegister(SoftirqType type, SoftirqHandler handler);
+
+/*
+ * SoftirqRaise - Mark a softirq pending on this CPU
+ *
+ * Safe from interrupt handlers and processes alike. Raised from a
+ * process, the softirq waits for the next interrupt on this CPU (a timer
+ * tick at the latest).
+ *
+ * @type: Softirq to raise
+ */
+void SoftirqRaise(SoftirqType type);
+
+/*
+ * SoftirqRunPending - Run the softirqs pending on this CPU
+ *
+ * Called at the end of interrupt handling, after the EOI, with interrupts
+ * disabled; returns with them disabled again. Does nothing in an
+ * interrupt that arrived while softirqs were already running, which pick
+ * up whatever it raised before they finish.
+ */
+void SoftirqRunPending(void);
+
+#endif /* SOFTIRQ_H */
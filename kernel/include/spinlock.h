@@ -0,0 +1,96 @@
+/* spinlock.h - Busy-waiting locks for data shared between CPUs */
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Spinlock - Ticket lock
+ *
+ * Each CPU that wants the lock takes the next ticket and spins until
+ * the ticket being served reaches it, so waiters get the lock in the
+ * order they arrived and none can be starved by luckier ones. Waiters
+ * only read the lock while spinning. Not recursive.
+ *
+ * Holding a lock disables preemption on the CPU (see preempt.h), and
+ * releasing it is a preemption point.
+ *
+ * A lock that is also taken from interrupt handlers must always be taken
+ * with SpinlockAcquireIrqSave(), or an interrupt on the CPU holding it
+ * would spin forever. Holding any spinlock with interrupts enabled also
+ * lets the holder be preempted while others spin, so the scheduler's own
+ * locks are only ever held with interrupts off.
+ */
+typedef struct Spinlock {
+    union {
+        volatile uint32_t tickets;      // Both halves, for try-acquire
+        struct {
+            volatile uint16_t owner;    // Ticket being served
+            volatile uint16_t next;     // Next ticket to hand out
+        };
+    };
+} Spinlock;
+
+/* Static initializer for an unlocked spinlock */
+#define SPINLOCK_INIT { { 0 } }
+
+/*
+ * SpinlockInit - Initialize an unlocked spinlock
+ */
+void SpinlockInit(Spinlock* lock);
+
+/*
+ * SpinlockAcquire - Take a lock, spinning until it is free
+ */
+void SpinlockAcquire(Spinlock* lock);
+
+/*
+ * SpinlockTryAcquire - Take a lock if it is free
+ *
+ * Returns: true if the lock was taken
+ */
+bool SpinlockTryAcquire(Spinlock* lock);
+
+/*
+ * SpinlockRelease - Release a lock taken by this CPU
+ */
+void SpinlockRelease(Spinlock* lock);
+
+/*
+ * SpinlockAcquireIrqSave - Disable interrupts, then take a lock
+ *
+ * Returns: Interrupt flags to pass to SpinlockReleaseIrqRestore()
+ */
+uint32_t SpinlockAcquireIrqSave(Spinlock* lock);
+
+/*
+ * SpinlockReleaseIrqRestore - Release a lock and restore interrupts
+ */
+void SpinlockReleaseIrqRestore(Spinlock* lock, uint32_t flags);
+
+/*
+ * SpinlockIsLocked - Check whether anyone holds a lock
+ */
+bool SpinlockIsLocked(Spinlock* lock);
+
+/*
+ * SpinlockStatEnable - Start recording lock statistics (lockstat)
+ *
+ * Called from KMain when the 'lockstat' flag is present. From then on
+ * every lock is timed with the TSC: how often it is taken, how often a
+ * CPU had to wait for it, and how long it was waited for and held.
+ * Locks are told apart by address and by where they were first taken.
+ *
+ * Returns: false if there is no TSC to time with
+ */
+bool SpinlockStatEnable(void);
+
+/*
+ * SpinlockStatDump - Print the lock statistics to the serial console
+ *
+ * The locks waited for longest come first.
+ */
+void SpinlockStatDump(void);
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,98 @@
+/* timer.h - Kernel timers (hierarchical timing wheel) */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clk/list.h"
+
+/*
+ * TimerCallback - Function run when a timer expires
+ *
+ * Runs from the timer softirq with interrupts disabled, so it must be
+ * short and must not block; sleepable work can be handed to a work queue
+ * (workqueue.h). It may re-arm its own timer.
+ */
+typedef void (*TimerCallback)(void* data);
+
+/*
+ * Timer - One-shot kernel timer
+ *
+ * Embedded in the caller's own structure (or on its stack) and set up
+ * with TimerSetup(); the wheel never allocates.
+ */
+typedef struct Timer {
+    ClkListNode node;           // Link in a wheel slot (self-linked when idle)
+    uint64_t expires;           // Tick at which the callback runs
+    TimerCallback callback;
+    void* data;
+} Timer;
+
+/*
+ * TimerInitialize - Set up an empty timer wheel
+ *
+ * Call before PitInitialize(); the wheel starts at the current tick.
+ */
+void TimerInitialize(void);
+
+/*
+ * TimerSetup - Prepare a timer for use
+ *
+ * @timer: Timer to set up
+ * @callback: Function to run on expiry
+ * @data: Argument passed to callback
+ */
+void TimerSetup(Timer* timer, TimerCallback callback, void* data);
+
+/*
+ * TimerStart - Arm (or re-arm) a timer
+ *
+ * O(1). A pending timer is moved to its new expiry. Delays longer than
+ * the wheel covers (2^32 ticks, about 16 months at 100 Hz) are clamped.
+ *
+ * @timer: Timer set up with TimerSetup()
+ * @delayTicks: Ticks from now; 0 fires on the next tick
+ */
+void TimerStart(Timer* timer, uint64_t delayTicks);
+
+/*
+ * TimerCancel - Disarm a timer
+ *
+ * Once this returns the callback is not running and will not run, so
+ * the timer and its data may be freed. If the callback is running in
+ * the timer softirq this spins until it returns: do not call it with a
+ * lock held that the callback takes. A callback may cancel its own
+ * timer, which then does not wait.
+ *
+ * @timer: Timer to cancel
+ * @return: true if it was pending, false if it had already fired or was idle
+ */
+bool TimerCancel(Timer* timer);
+
+/*
+ * TimerPending - Check whether a timer is armed
+ */
+static inline bool TimerPending(const Timer* timer)
+{
+    return ClkListLinked(&timer->node);
+}
+
+/*
+ * TimerMsToTicks - Convert milliseconds to timer ticks, rounding up
+ *
+ * @ms: Duration in milliseconds
+ * @return: Ticks at the current PIT frequency
+ */
+uint64_t TimerMsToTicks(uint32_t ms);
+
+/*
+ * TimerTick - Advance the wheel and run expired timers
+ *
+ * Called from the timer softirq, which every PIT tick raises. Catches up
+ * if ticks were missed.
+ *
+ * @now: Current tick count (PitGetTicks())
+ */
+void TimerTick(uint64_t now);
+
+#endif /* TIMER_H */
@@ -0,0 +1,46 @@
+/* tsc.h - Time Stamp Counter clock */
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * TscRead - Read the CPU time stamp counter
+ *
+ * Returns: Cycles since CPU reset
+ */
+static inline uint64_t TscRead(void)
+{
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * TscInitialize - Detect and calibrate the TSC
+ *
+ * Measures the TSC rate against a PIT channel 2 one-shot, so it does not
+ * need interrupts. Call after PitInitialize().
+ *
+ * Returns: true if a TSC is present and was calibrated
+ */
+bool TscInitialize(void);
+
+/*
+ * TscGetKhz - Get the calibrated TSC rate
+ *
+ * Returns: TSC frequency in kHz, or 0 if there is no usable TSC
+ */
+uint32_t TscGetKhz(void);
+
+/*
+ * TscGetNanoseconds - High-resolution monotonic clock
+ *
+ * Falls back to PIT tick resolution when no TSC is available.
+ *
+ * Returns: Nanoseconds since TscInitialize()
+ */
+uint64_t TscGetNanoseconds(void);
+
+#endif /* TSC_H */
@@ -0,0 +1,92 @@
+/* waitqueue.h - Queues of processes sleeping until an event */
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "process.h"
+#include "clk/list.h"
+
+/*
+ * WaitQueue - Processes blocked until someone wakes them
+ *
+ * The lock protects the list of waiters, and is also the lock a caller
+ * should hold while checking whatever condition it waits for: the
+ * primitives built on wait queues (mutex.h, semaphore.h, condvar.h) keep
+ * their state under it. Waiters are woken in the order they arrived.
+ */
+typedef struct WaitQueue {
+    Spinlock lock;
+    ClkListNode waiters;        // WaitQueueEntry, oldest first
+} WaitQueue;
+
+/*
+ * WaitQueueEntry - One sleeping process (lives on its stack)
+ */
+typedef struct {
+    ClkListNode node;
+    Process* process;
+} WaitQueueEntry;
+
+/* Static initializer for an empty wait queue */
+#define WAIT_QUEUE_INIT(name) { SPINLOCK_INIT, { &(name).waiters, &(name).waiters } }
+
+/*
+ * WaitQueueInit - Initialize an empty wait queue
+ */
+void WaitQueueInit(WaitQueue* queue);
+
+/*
+ * WaitQueueSleepLocked - Sleep until woken, with the queue's lock held
+ *
+ * The caller holds queue->lock (taken with SpinlockAcquireIrqSave()) and
+ * has found its condition false. The lock is released only once the
+ * process is queued and marked blocked, so a wakeup after the check
+ * cannot be lost, and is held again on return. Wakeups can race with
+ * other wakers, so callers recheck their condition in a loop:
+ *
+ *   uint32_t flags = SpinlockAcquireIrqSave(&queue->lock);
+ *   while (!condition) {
+ *       WaitQueueSleepLocked(queue);
+ *   }
+ *   ...
+ *   SpinlockReleaseIrqRestore(&queue->lock, flags);
+ *
+ * @queue: Queue to sleep on
+ */
+void WaitQueueSleepLocked(WaitQueue* queue);
+
+/*
+ * WaitQueueWakeOneLocked - Wake the oldest waiter (queue->lock held)
+ *
+ * @queue: Queue to wake from
+ * @return: The process woken, or NULL if nobody was waiting
+ */
+Process* WaitQueueWakeOneLocked(WaitQueue* queue);
+
+/*
+ * WaitQueueWakeAllLocked - Wake every waiter (queue->lock held)
+ *
+ * @queue: Queue to wake from
+ * @return: Number of processes woken
+ */
+uint32_t WaitQueueWakeAllLocked(WaitQueue* queue);
+
+/*
+ * WaitQueueWakeOne - Wake the oldest waiter
+ *
+ * @queue: Queue to wake from
+ * @return: true if a process was woken
+ */
+bool WaitQueueWakeOne(WaitQueue* queue);
+
+/*
+ * WaitQueueWakeAll - Wake every waiter
+ *
+ * @queue: Queue to wake from
+ * @return: Number of processes woken
+ */
+uint32_t WaitQueueWakeAll(WaitQueue* queue);
+
+#endif /* WAITQUEUE_H */
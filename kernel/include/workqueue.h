@@ -0,0 +1,98 @@
+/* workqueue.h - Deferred work run by kernel worker processes */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clk/list.h"
+
+/*
+ * Work queued from an interrupt handler, a softirq or a timer callback
+ * runs later in a worker process, which may sleep, lock mutexes and
+ * allocate memory like any other process. Each queue has one worker and
+ * runs its items one at a time, in the order they were queued, so a slow
+ * item delays the ones behind it: latency-sensitive work belongs on
+ * WORK_QUEUE_HIGHPRI.
+ */
+typedef enum {
+    WORK_QUEUE_SYSTEM,          // Default priority worker
+    WORK_QUEUE_HIGHPRI,         // Worker at a high priority, for device bottom halves
+    WORK_QUEUES
+} WorkQueueId;
+
+/*
+ * WorkFunc - Function run by the worker
+ *
+ * The item is no longer queued when it runs, so it may queue itself again.
+ */
+typedef void (*WorkFunc)(void* data);
+
+/*
+ * Work - One deferrable piece of work
+ *
+ * Embedded in the caller's own structure and set up with WorkSetup(); the
+ * queues never allocate.
+ */
+typedef struct Work {
+    ClkListNode node;           // Link in the queue (self-linked when idle)
+    WorkQueueId queue;          // Queue it was last added to
+    WorkFunc func;
+    void* data;
+} Work;
+
+/*
+ * WorkQueueInitialize - Start the worker processes
+ *
+ * Call after ProcessInitialize(). Work can be queued before this; it runs
+ * once the scheduler is enabled.
+ */
+void WorkQueueInitialize(void);
+
+/*
+ * WorkSetup - Prepare a work item for use
+ *
+ * @work: Work item to set up
+ * @func: Function the worker runs
+ * @data: Argument passed to func
+ */
+void WorkSetup(Work* work, WorkFunc func, void* data);
+
+/*
+ * WorkQueueAdd - Queue a work item
+ *
+ * Never sleeps, so may be called from interrupt context. Queuing an item
+ * that is already pending does nothing: it still runs once.
+ *
+ * @queue: Queue whose worker should run it
+ * @work: Work item set up with WorkSetup()
+ * @return: true if queued, false if it was already pending
+ */
+bool WorkQueueAdd(WorkQueueId queue, Work* work);
+
+/*
+ * WorkSchedule - Queue a work item on the system queue
+ *
+ * @work: Work item set up with WorkSetup()
+ * @return: true if queued, false if it was already pending
+ */
+bool WorkSchedule(Work* work);
+
+/*
+ * WorkCancel - Take a work item off its queue
+ *
+ * Does not wait for a call that has already started.
+ *
+ * @work: Work item to cancel
+ * @return: true if it was pending, false if it had run or was idle
+ */
+bool WorkCancel(Work* work);
+
+/*
+ * WorkPending - Check whether a work item is waiting to run
+ */
+static inline bool WorkPending(const Work* work)
+{
+    return ClkListLinked(&work->node);
+}
+
+#endif /* WORKQUEUE_H */
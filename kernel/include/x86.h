@@ -30,4 +30,93 @@ static inline void io_wait(void)
     __asm__ volatile ("outb %%al, $0x80" : : "a"(0));
 }
 
+/* EFLAGS interrupt enable bit, as saved by irq_save() */
+#define EFLAGS_IF 0x200
+
+/*
+ * irq_save - Disable interrupts, returning the previous EFLAGS
+ */
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/*
+ * irq_restore - Restore the interrupt flag saved by irq_save()
+ */
+static inline void irq_restore(uint32_t flags)
+{
+    __asm__ volatile ("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+/*
+ * cpu_relax - Tell the CPU we are spinning
+ *
+ * pause saves power and avoids a memory-order mis-speculation penalty
+ * when the wait ends; on CPUs without it, it is a nop.
+ */
+static inline void cpu_relax(void)
+{
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+/*
+ * bda_read16 - Read a 16-bit field of the (identity-mapped) BIOS data area
+ *
+ * Done in asm so the compiler does not take an address this low for a
+ * null pointer dereference.
+ */
+static inline uint16_t bda_read16(uint32_t offset)
+{
+    uint16_t value;
+    __asm__ volatile ("movw (%1), %0" : "=r"(value) : "r"(0x400 + offset) : "memory");
+    return value;
+}
+
+/*
+ * read_cr0 - Read control register 0
+ */
+static inline uint32_t read_cr0(void)
+{
+    uint32_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+/*
+ * write_cr0 - Write control register 0
+ */
+static inline void write_cr0(uint32_t value)
+{
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+/*
+ * read_cr4 - Read control register 4
+ */
+static inline uint32_t read_cr4(void)
+{
+    uint32_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+/*
+ * write_cr4 - Write control register 4
+ */
+static inline void write_cr4(uint32_t value)
+{
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/*
+ * clts - Clear CR0.TS, so FPU instructions stop trapping
+ */
+static inline void clts(void)
+{
+    __asm__ volatile ("clts" : : : "memory");
+}
+
 #endif /* X86_H */
@@ -0,0 +1,20 @@
+/* math.h - Integer math helpers for ClankerOS */
+#ifndef CLC_MATH_H
+#define CLC_MATH_H
+
+#include <stdint.h>
+
+/*
+ * ClcDivU64 - Divide a 64-bit value by a 32-bit value
+ *
+ * Freestanding i386 code is linked without libgcc, so a plain 64-bit '/'
+ * or '%' does not link. This divides using 32-bit operations only.
+ *
+ * @param dividend: Value to divide
+ * @param divisor: Value to divide by (must be non-zero)
+ * @param remainder: Receives the remainder (may be NULL)
+ * @return: Quotient
+ */
+uint64_t ClcDivU64(uint64_t dividend, uint32_t divisor, uint32_t* remainder);
+
+#endif /* CLC_MATH_H */
@@ -3,6 +3,7 @@
 #define CLC_STRING_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 /*
@@ -52,4 +53,16 @@ bool ClcStrStartsWith(const char* str, const char* prefix);
  */
 int ClcStrCompare(const char* a, const char* b);
 
+/*
+ * ClcStrToUInt - Parse an unsigned integer
+ *
+ * Accepts decimal digits, or hex digits after a "0x" prefix. The whole
+ * string must be consumed; trailing characters are an error.
+ *
+ * @param str: String to parse
+ * @param value: Receives the parsed value on success
+ * @return: true if str is a valid number that fits in 32 bits
+ */
+bool ClcStrToUInt(const char* str, uint32_t* value);
+
 #endif /* CLC_STRING_H */
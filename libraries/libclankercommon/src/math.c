@@ -0,0 +1,32 @@
+/* math.c - Integer math helpers implementation */
+
+#include "clc/math.h"
+#include <stdint.h>
+
+/*
+ * ClcDivU64 - Divide a 64-bit value by a 32-bit value
+ */
+uint64_t ClcDivU64(uint64_t dividend, uint32_t divisor, uint32_t* remainder)
+{
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+
+    // The high word divides directly
+    uint32_t quotientHigh = high / divisor;
+    uint64_t rem = high % divisor;
+
+    // Bring the low word down one bit at a time (schoolbook long division)
+    uint32_t quotientLow = 0;
+    for (int bit = 31; bit >= 0; bit--) {
+        rem = (rem << 1) | ((low >> bit) & 1);
+        if (rem >= divisor) {
+            rem -= divisor;
+            quotientLow |= 1u << bit;
+        }
+    }
+
+    if (remainder) {
+        *remainder = (uint32_t)rem;
+    }
+    return ((uint64_t)quotientHigh << 32) | quotientLow;
+}
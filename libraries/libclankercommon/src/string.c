@@ -2,6 +2,7 @@
 
 #include "clc/string.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 /*
@@ -73,3 +74,46 @@ int ClcStrCompare(const char* a, const char* b)
     }
     return (unsigned char)a[i] - (unsigned char)b[i];
 }
+
+/*
+ * ClcStrToUInt - Parse an unsigned decimal or 0x-prefixed hex number
+ */
+bool ClcStrToUInt(const char* str, uint32_t* value)
+{
+    if (!str || !value) {
+        return false;
+    }
+
+    uint32_t base = 10;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    }
+    if (!*str) {
+        return false;
+    }
+
+    uint32_t result = 0;
+    for (size_t i = 0; str[i]; i++) {
+        char c = str[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = (uint32_t)(c - '0');
+        } else if (base == 16 && c >= 'a' && c <= 'f') {
+            digit = (uint32_t)(c - 'a' + 10);
+        } else if (base == 16 && c >= 'A' && c <= 'F') {
+            digit = (uint32_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+
+        // Reject values that do not fit in 32 bits
+        if (result > (0xFFFFFFFFu - digit) / base) {
+            return false;
+        }
+        result = result * base + digit;
+    }
+
+    *value = result;
+    return true;
+}
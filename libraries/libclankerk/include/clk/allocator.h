@@ -0,0 +1,50 @@
+/* clk/allocator.h - Generic allocator interface for ClankerOS kernel code */
+#ifndef CLK_ALLOCATOR_H
+#define CLK_ALLOCATOR_H
+
+#include <stddef.h>
+
+/*
+ * ClkAllocatorVTable - Allocator virtual function table
+ *
+ * Same shape as ClcWriterVTable: the kernel supplies an implementation
+ * (e.g. the kernel heap) and library code allocates through it without
+ * depending on kernel headers.
+ */
+typedef struct {
+    void* (*allocate)(void* data, size_t size);
+    void (*free)(void* data, void* ptr);
+} ClkAllocatorVTable;
+
+/*
+ * ClkAllocator - Generic allocator (wide pointer)
+ */
+typedef struct {
+    void* data;                         // Pointer to the allocator state
+    const ClkAllocatorVTable* vtable;   // Pointer to the vtable
+} ClkAllocator;
+
+/*
+ * ClkAllocatorAllocate - Allocate memory through an allocator
+ *
+ * @return: Pointer to allocated memory, or NULL on failure
+ */
+static inline void* ClkAllocatorAllocate(ClkAllocator* allocator, size_t size)
+{
+    if (allocator && allocator->vtable && allocator->vtable->allocate) {
+        return allocator->vtable->allocate(allocator->data, size);
+    }
+    return NULL;
+}
+
+/*
+ * ClkAllocatorFree - Free memory through an allocator
+ */
+static inline void ClkAllocatorFree(ClkAllocator* allocator, void* ptr)
+{
+    if (allocator && allocator->vtable && allocator->vtable->free) {
+        allocator->vtable->free(allocator->data, ptr);
+    }
+}
+
+#endif /* CLK_ALLOCATOR_H */
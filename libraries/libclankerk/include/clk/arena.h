@@ -0,0 +1,94 @@
+/* clk/arena.h - Bump-pointer arena (region) allocator */
+#ifndef CLK_ARENA_H
+#define CLK_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "clk/allocator.h"
+
+/* Alignment of every pointer returned by ClkArenaAlloc */
+#define CLK_ARENA_ALIGN 8
+
+/* Default chunk size requested from the backing allocator */
+#define CLK_ARENA_DEFAULT_CHUNK 4096
+
+/*
+ * ClkArenaChunk - One contiguous region carved up by the arena
+ *
+ * Chunks form a singly linked list in allocation order. The payload
+ * follows the header directly.
+ */
+typedef struct ClkArenaChunk {
+    struct ClkArenaChunk* next;     // Next (newer) chunk
+    size_t size;                    // Payload size in bytes
+    size_t used;                    // Bytes handed out from the payload
+} ClkArenaChunk;
+
+/*
+ * ClkArena - Arena state
+ *
+ * Lives at the start of the first chunk, so an arena costs a single
+ * backing allocation until it outgrows that chunk.
+ */
+typedef struct {
+    ClkAllocator* backing;          // Backing allocator (NULL = fixed buffer)
+    ClkArenaChunk* first;           // Chunk holding this structure
+    ClkArenaChunk* current;         // Chunk allocations are bumped from
+    size_t chunkSize;               // Size of chunks requested when growing
+} ClkArena;
+
+/*
+ * ClkArenaCreate - Create an arena on top of a backing allocator
+ *
+ * @backing: Allocator that supplies chunks (e.g. KHeapGetAllocator())
+ * @chunkSize: Bytes to request per chunk (0 for CLK_ARENA_DEFAULT_CHUNK)
+ * @return: New arena, or NULL if the first chunk could not be allocated
+ */
+ClkArena* ClkArenaCreate(ClkAllocator* backing, size_t chunkSize);
+
+/*
+ * ClkArenaCreateInBuffer - Create a fixed-size arena inside a buffer
+ *
+ * For use before any allocator exists (early boot). The arena never
+ * grows; ClkArenaAlloc returns NULL once the buffer is exhausted.
+ *
+ * @buffer: Storage for the arena (must outlive it)
+ * @size: Size of buffer in bytes
+ * @return: New arena, or NULL if the buffer is too small
+ */
+ClkArena* ClkArenaCreateInBuffer(void* buffer, size_t size);
+
+/*
+ * ClkArenaAlloc - Allocate memory from an arena
+ *
+ * O(1): bumps a pointer in the current chunk, and only calls the backing
+ * allocator when that chunk is full. Memory is not individually freed.
+ *
+ * @arena: Arena to allocate from
+ * @size: Number of bytes to allocate
+ * @return: Pointer aligned to CLK_ARENA_ALIGN, or NULL if out of memory
+ *          (including sizes too large to ever fit a chunk)
+ */
+void* ClkArenaAlloc(ClkArena* arena, size_t size);
+
+/*
+ * ClkArenaReset - Release every allocation in an arena at once
+ *
+ * Returns all chunks except the first to the backing allocator and
+ * rewinds the first one. Pointers previously returned become invalid.
+ */
+void ClkArenaReset(ClkArena* arena);
+
+/*
+ * ClkArenaDestroy - Destroy an arena and return its memory
+ *
+ * For buffer-backed arenas the buffer itself is left to the caller.
+ */
+void ClkArenaDestroy(ClkArena* arena);
+
+/*
+ * ClkArenaGetUsed - Get number of bytes handed out since last reset
+ */
+size_t ClkArenaGetUsed(ClkArena* arena);
+
+#endif /* CLK_ARENA_H */
@@ -0,0 +1,114 @@
+/* clk/list.h - Intrusive circular doubly linked list */
+#ifndef CLK_LIST_H
+#define CLK_LIST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * ClkListNode - List linkage embedded in the object being listed
+ *
+ * A list is a head node linked in a ring with its entries; an empty list
+ * (and an unlinked entry) points at itself. Every operation is O(1) and
+ * nothing is allocated.
+ */
+typedef struct ClkListNode {
+    struct ClkListNode* next;
+    struct ClkListNode* prev;
+} ClkListNode;
+
+/*
+ * CLK_LIST_ENTRY - Get the structure containing a list node
+ */
+#define CLK_LIST_ENTRY(node, type, member) \
+    ((type*)((char*)(node) - offsetof(type, member)))
+
+/*
+ * ClkListInit - Initialize an empty list head or an unlinked entry
+ */
+static inline void ClkListInit(ClkListNode* node)
+{
+    node->next = node;
+    node->prev = node;
+}
+
+/*
+ * ClkListEmpty - Check whether a list has no entries
+ */
+static inline bool ClkListEmpty(const ClkListNode* head)
+{
+    return head->next == head;
+}
+
+/*
+ * ClkListLinked - Check whether an entry is on a list
+ *
+ * Only meaningful for entries set up with ClkListInit() and removed with
+ * ClkListRemove().
+ */
+static inline bool ClkListLinked(const ClkListNode* node)
+{
+    return node->next != node;
+}
+
+/*
+ * ClkListInsertBetween - Link node between two adjacent nodes
+ */
+static inline void ClkListInsertBetween(ClkListNode* node, ClkListNode* prev, ClkListNode* next)
+{
+    node->prev = prev;
+    node->next = next;
+    prev->next = node;
+    next->prev = node;
+}
+
+/*
+ * ClkListAddHead - Add an entry at the front of a list
+ */
+static inline void ClkListAddHead(ClkListNode* head, ClkListNode* node)
+{
+    ClkListInsertBetween(node, head, head->next);
+}
+
+/*
+ * ClkListAddTail - Add an entry at the back of a list
+ */
+static inline void ClkListAddTail(ClkListNode* head, ClkListNode* node)
+{
+    ClkListInsertBetween(node, head->prev, head);
+}
+
+/*
+ * ClkListRemove - Unlink an entry, leaving it pointing at itself
+ */
+static inline void ClkListRemove(ClkListNode* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    ClkListInit(node);
+}
+
+/*
+ * ClkListSpliceTail - Move every entry of one list to the back of another
+ *
+ * @from: List to empty
+ * @to: List to append to
+ */
+static inline void ClkListSpliceTail(ClkListNode* from, ClkListNode* to)
+{
+    if (ClkListEmpty(from)) {
+        return;
+    }
+
+    ClkListNode* first = from->next;
+    ClkListNode* last = from->prev;
+
+    first->prev = to->prev;
+    to->prev->next = first;
+    last->next = to;
+    to->prev = last;
+
+    ClkListInit(from);
+}
+
+#endif /* CLK_LIST_H */
@@ -0,0 +1,98 @@
+/* clk/rbtree.h - Intrusive red-black tree */
+#ifndef CLK_RBTREE_H
+#define CLK_RBTREE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Node colours */
+#define CLK_RB_RED   0
+#define CLK_RB_BLACK 1
+
+/*
+ * ClkRbNode - Tree linkage embedded in the object being sorted
+ *
+ * The tree never allocates; callers embed a node in their own structure
+ * and get back to it with CLK_RB_ENTRY().
+ */
+typedef struct ClkRbNode {
+    struct ClkRbNode* parent;
+    struct ClkRbNode* left;
+    struct ClkRbNode* right;
+    int color;
+} ClkRbNode;
+
+/*
+ * ClkRbTree - Tree root
+ *
+ * Keeps the leftmost (smallest) node cached so ClkRbFirst() is O(1).
+ */
+typedef struct {
+    ClkRbNode* root;
+    ClkRbNode* leftmost;
+    size_t count;
+} ClkRbTree;
+
+/*
+ * ClkRbLess - Ordering callback: true if a sorts before b
+ */
+typedef bool (*ClkRbLess)(const ClkRbNode* a, const ClkRbNode* b);
+
+/*
+ * CLK_RB_ENTRY - Get the structure containing a tree node
+ */
+#define CLK_RB_ENTRY(node, type, member) \
+    ((type*)((char*)(node) - offsetof(type, member)))
+
+/*
+ * ClkRbInit - Initialize an empty tree
+ */
+void ClkRbInit(ClkRbTree* tree);
+
+/*
+ * ClkRbInsert - Insert a node
+ *
+ * O(log n). Nodes that compare equal to existing ones are placed after
+ * them, so equal keys come out in insertion order.
+ *
+ * @tree: Tree to insert into
+ * @node: Node to insert (must not already be in a tree)
+ * @less: Ordering callback
+ */
+void ClkRbInsert(ClkRbTree* tree, ClkRbNode* node, ClkRbLess less);
+
+/*
+ * ClkRbErase - Remove a node
+ *
+ * O(log n).
+ *
+ * @tree: Tree containing the node
+ * @node: Node to remove
+ */
+void ClkRbErase(ClkRbTree* tree, ClkRbNode* node);
+
+/*
+ * ClkRbFirst - Get the smallest node
+ *
+ * @return: Leftmost node, or NULL if the tree is empty
+ */
+static inline ClkRbNode* ClkRbFirst(const ClkRbTree* tree)
+{
+    return tree->leftmost;
+}
+
+/*
+ * ClkRbLast - Get the largest node
+ *
+ * @return: Rightmost node, or NULL if the tree is empty
+ */
+ClkRbNode* ClkRbLast(const ClkRbTree* tree);
+
+/*
+ * ClkRbNext - Get the in-order successor of a node
+ *
+ * @return: Next larger node, or NULL if node is the last one
+ */
+ClkRbNode* ClkRbNext(const ClkRbNode* node);
+
+#endif /* CLK_RBTREE_H */
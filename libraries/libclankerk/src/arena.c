@@ -0,0 +1,203 @@
+/* arena.c - Bump-pointer arena (region) allocator implementation */
+
+#include "clk/arena.h"
+#include "clk/allocator.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Alignment */
+#define ALIGN_UP(n, align) (((n) + (align) - 1) & ~((align) - 1))
+
+/* Space taken by a chunk header and by the arena structure itself */
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(ClkArenaChunk), CLK_ARENA_ALIGN)
+#define ARENA_HEADER_SIZE ALIGN_UP(sizeof(ClkArena), CLK_ARENA_ALIGN)
+
+/* Largest request whose aligned size plus a chunk header cannot wrap */
+#define ARENA_MAX_ALLOC (SIZE_MAX - CLK_ARENA_ALIGN - CHUNK_HEADER_SIZE)
+
+/* Forward declarations */
+static ClkArenaChunk* chunkInit(void* memory, size_t totalSize);
+static void* chunkBump(ClkArenaChunk* chunk, size_t size);
+
+/*
+ * ClkArenaCreate - Create an arena on top of a backing allocator
+ */
+ClkArena* ClkArenaCreate(ClkAllocator* backing, size_t chunkSize)
+{
+    if (backing == NULL) {
+        return NULL;
+    }
+
+    if (chunkSize == 0) {
+        chunkSize = CLK_ARENA_DEFAULT_CHUNK;
+    }
+    if (chunkSize < CHUNK_HEADER_SIZE + ARENA_HEADER_SIZE + CLK_ARENA_ALIGN) {
+        chunkSize = CHUNK_HEADER_SIZE + ARENA_HEADER_SIZE + CLK_ARENA_ALIGN;
+    }
+
+    void* memory = ClkAllocatorAllocate(backing, chunkSize);
+    if (memory == NULL) {
+        return NULL;
+    }
+
+    // The arena structure is the first allocation of its own first chunk
+    ClkArenaChunk* chunk = chunkInit(memory, chunkSize);
+    ClkArena* arena = (ClkArena*)chunkBump(chunk, sizeof(ClkArena));
+
+    arena->backing = backing;
+    arena->first = chunk;
+    arena->current = chunk;
+    arena->chunkSize = chunkSize;
+
+    return arena;
+}
+
+/*
+ * ClkArenaCreateInBuffer - Create a fixed-size arena inside a buffer
+ */
+ClkArena* ClkArenaCreateInBuffer(void* buffer, size_t size)
+{
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    // Align the start of the buffer and shrink the size to match
+    uintptr_t start = ALIGN_UP((uintptr_t)buffer, CLK_ARENA_ALIGN);
+    size_t skew = start - (uintptr_t)buffer;
+    if (size < skew + CHUNK_HEADER_SIZE + ARENA_HEADER_SIZE) {
+        return NULL;
+    }
+
+    ClkArenaChunk* chunk = chunkInit((void*)start, size - skew);
+    ClkArena* arena = (ClkArena*)chunkBump(chunk, sizeof(ClkArena));
+
+    arena->backing = NULL;
+    arena->first = chunk;
+    arena->current = chunk;
+    arena->chunkSize = 0;
+
+    return arena;
+}
+
+/*
+ * ClkArenaAlloc - Allocate memory from an arena
+ */
+void* ClkArenaAlloc(ClkArena* arena, size_t size)
+{
+    if (arena == NULL || size == 0 || size > ARENA_MAX_ALLOC) {
+        return NULL;
+    }
+
+    // Fast path: bump within the current chunk
+    void* ptr = chunkBump(arena->current, size);
+    if (ptr != NULL) {
+        return ptr;
+    }
+
+    // Fixed buffers cannot grow
+    if (arena->backing == NULL) {
+        return NULL;
+    }
+
+    // Oversized requests get a chunk of their own
+    size_t chunkSize = arena->chunkSize;
+    if (CHUNK_HEADER_SIZE + ALIGN_UP(size, CLK_ARENA_ALIGN) > chunkSize) {
+        chunkSize = CHUNK_HEADER_SIZE + ALIGN_UP(size, CLK_ARENA_ALIGN);
+    }
+
+    void* memory = ClkAllocatorAllocate(arena->backing, chunkSize);
+    if (memory == NULL) {
+        return NULL;
+    }
+
+    ClkArenaChunk* chunk = chunkInit(memory, chunkSize);
+    arena->current->next = chunk;
+    arena->current = chunk;
+
+    return chunkBump(chunk, size);
+}
+
+/*
+ * ClkArenaReset - Release every allocation in an arena at once
+ */
+void ClkArenaReset(ClkArena* arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+    // Hand every chunk after the first back to the backing allocator
+    ClkArenaChunk* chunk = arena->first->next;
+    while (chunk != NULL) {
+        ClkArenaChunk* next = chunk->next;
+        ClkAllocatorFree(arena->backing, chunk);
+        chunk = next;
+    }
+
+    // Rewind the first chunk, keeping the arena structure itself
+    arena->first->next = NULL;
+    arena->first->used = ARENA_HEADER_SIZE;
+    arena->current = arena->first;
+}
+
+/*
+ * ClkArenaDestroy - Destroy an arena and return its memory
+ */
+void ClkArenaDestroy(ClkArena* arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+    ClkArenaReset(arena);
+
+    // The first chunk holds the arena, so it must be freed last
+    if (arena->backing != NULL) {
+        ClkAllocator* backing = arena->backing;
+        ClkAllocatorFree(backing, arena->first);
+    }
+}
+
+/*
+ * ClkArenaGetUsed - Get number of bytes handed out since last reset
+ */
+size_t ClkArenaGetUsed(ClkArena* arena)
+{
+    if (arena == NULL) {
+        return 0;
+    }
+
+    size_t used = arena->first->used - ARENA_HEADER_SIZE;
+    for (ClkArenaChunk* chunk = arena->first->next; chunk != NULL; chunk = chunk->next) {
+        used += chunk->used;
+    }
+
+    return used;
+}
+
+/*
+ * chunkInit - Place a chunk header at the start of a block of memory
+ */
+static ClkArenaChunk* chunkInit(void* memory, size_t totalSize)
+{
+    ClkArenaChunk* chunk = (ClkArenaChunk*)memory;
+    chunk->next = NULL;
+    chunk->size = totalSize - CHUNK_HEADER_SIZE;
+    chunk->used = 0;
+    return chunk;
+}
+
+/*
+ * chunkBump - Carve size bytes off the free end of a chunk
+ */
+static void* chunkBump(ClkArenaChunk* chunk, size_t size)
+{
+    size = ALIGN_UP(size, CLK_ARENA_ALIGN);
+    if (size > chunk->size - chunk->used) {
+        return NULL;
+    }
+
+    void* ptr = (uint8_t*)chunk + CHUNK_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
@@ -0,0 +1,341 @@
+/* rbtree.c - Intrusive red-black tree implementation */
+
+#include "clk/rbtree.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Forward declarations */
+static void rotateLeft(ClkRbTree* tree, ClkRbNode* node);
+static void rotateRight(ClkRbTree* tree, ClkRbNode* node);
+static void replaceChild(ClkRbTree* tree, ClkRbNode* old, ClkRbNode* new);
+static void insertFixup(ClkRbTree* tree, ClkRbNode* node);
+static void eraseFixup(ClkRbTree* tree, ClkRbNode* node, ClkRbNode* parent);
+
+/*
+ * isBlack - NULL leaves count as black
+ */
+static inline bool isBlack(const ClkRbNode* node)
+{
+    return node == NULL || node->color == CLK_RB_BLACK;
+}
+
+/*
+ * ClkRbInit - Initialize an empty tree
+ */
+void ClkRbInit(ClkRbTree* tree)
+{
+    tree->root = NULL;
+    tree->leftmost = NULL;
+    tree->count = 0;
+}
+
+/*
+ * ClkRbInsert - Insert a node
+ */
+void ClkRbInsert(ClkRbTree* tree, ClkRbNode* node, ClkRbLess less)
+{
+    ClkRbNode* parent = NULL;
+    ClkRbNode** link = &tree->root;
+    bool leftmost = true;
+
+    // Ordinary binary search tree descent
+    while (*link != NULL) {
+        parent = *link;
+        if (less(node, parent)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = CLK_RB_RED;
+    *link = node;
+
+    if (leftmost) {
+        tree->leftmost = node;
+    }
+    tree->count++;
+
+    insertFixup(tree, node);
+}
+
+/*
+ * ClkRbErase - Remove a node
+ */
+void ClkRbErase(ClkRbTree* tree, ClkRbNode* node)
+{
+    if (tree->leftmost == node) {
+        tree->leftmost = ClkRbNext(node);
+    }
+
+    ClkRbNode* child;
+    ClkRbNode* parent;
+    int removedColor = node->color;
+
+    if (node->left == NULL) {
+        child = node->right;
+        parent = node->parent;
+        replaceChild(tree, node, child);
+    } else if (node->right == NULL) {
+        child = node->left;
+        parent = node->parent;
+        replaceChild(tree, node, child);
+    } else {
+        // Two children: the successor takes the node's place
+        ClkRbNode* successor = node->right;
+        while (successor->left != NULL) {
+            successor = successor->left;
+        }
+
+        removedColor = successor->color;
+        child = successor->right;
+
+        if (successor->parent == node) {
+            parent = successor;
+        } else {
+            parent = successor->parent;
+            replaceChild(tree, successor, child);
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+
+        replaceChild(tree, node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->color = node->color;
+    }
+
+    tree->count--;
+
+    if (removedColor == CLK_RB_BLACK) {
+        eraseFixup(tree, child, parent);
+    }
+}
+
+/*
+ * ClkRbLast - Get the largest node
+ */
+ClkRbNode* ClkRbLast(const ClkRbTree* tree)
+{
+    ClkRbNode* node = tree->root;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    while (node->right != NULL) {
+        node = node->right;
+    }
+    return node;
+}
+
+/*
+ * ClkRbNext - Get the in-order successor of a node
+ */
+ClkRbNode* ClkRbNext(const ClkRbNode* node)
+{
+    // Leftmost node of the right subtree
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return (ClkRbNode*)node;
+    }
+
+    // Otherwise the first ancestor we reach from its left side
+    ClkRbNode* parent = node->parent;
+    while (parent != NULL && node == parent->right) {
+        node = parent;
+        parent = parent->parent;
+    }
+    return parent;
+}
+
+/*
+ * replaceChild - Put new where old hangs off its parent
+ */
+static void replaceChild(ClkRbTree* tree, ClkRbNode* old, ClkRbNode* new)
+{
+    if (old->parent == NULL) {
+        tree->root = new;
+    } else if (old == old->parent->left) {
+        old->parent->left = new;
+    } else {
+        old->parent->right = new;
+    }
+
+    if (new != NULL) {
+        new->parent = old->parent;
+    }
+}
+
+/*
+ * rotateLeft - Rotate node down to the left of its right child
+ */
+static void rotateLeft(ClkRbTree* tree, ClkRbNode* node)
+{
+    ClkRbNode* pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left != NULL) {
+        pivot->left->parent = node;
+    }
+
+    replaceChild(tree, node, pivot);
+    pivot->left = node;
+    node->parent = pivot;
+}
+
+/*
+ * rotateRight - Rotate node down to the right of its left child
+ */
+static void rotateRight(ClkRbTree* tree, ClkRbNode* node)
+{
+    ClkRbNode* pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right != NULL) {
+        pivot->right->parent = node;
+    }
+
+    replaceChild(tree, node, pivot);
+    pivot->right = node;
+    node->parent = pivot;
+}
+
+/*
+ * insertFixup - Restore red-black properties after inserting a red node
+ */
+static void insertFixup(ClkRbTree* tree, ClkRbNode* node)
+{
+    ClkRbNode* parent;
+
+    while ((parent = node->parent) != NULL && parent->color == CLK_RB_RED) {
+        // A red parent is never the root, so the grandparent exists
+        ClkRbNode* grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            ClkRbNode* uncle = grandparent->right;
+
+            if (!isBlack(uncle)) {
+                // Red uncle: recolour and continue from the grandparent
+                parent->color = CLK_RB_BLACK;
+                uncle->color = CLK_RB_BLACK;
+                grandparent->color = CLK_RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                rotateLeft(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = CLK_RB_BLACK;
+            grandparent->color = CLK_RB_RED;
+            rotateRight(tree, grandparent);
+        } else {
+            ClkRbNode* uncle = grandparent->left;
+
+            if (!isBlack(uncle)) {
+                parent->color = CLK_RB_BLACK;
+                uncle->color = CLK_RB_BLACK;
+                grandparent->color = CLK_RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                rotateRight(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = CLK_RB_BLACK;
+            grandparent->color = CLK_RB_RED;
+            rotateLeft(tree, grandparent);
+        }
+    }
+
+    tree->root->color = CLK_RB_BLACK;
+}
+
+/*
+ * eraseFixup - Restore red-black properties after removing a black node
+ *
+ * node is the child that took the removed node's place and may be NULL,
+ * so its parent is passed separately.
+ */
+static void eraseFixup(ClkRbTree* tree, ClkRbNode* node, ClkRbNode* parent)
+{
+    while (node != tree->root && isBlack(node)) {
+        if (node == parent->left) {
+            ClkRbNode* sibling = parent->right;
+
+            if (sibling->color == CLK_RB_RED) {
+                sibling->color = CLK_RB_BLACK;
+                parent->color = CLK_RB_RED;
+                rotateLeft(tree, parent);
+                sibling = parent->right;
+            }
+
+            if (isBlack(sibling->left) && isBlack(sibling->right)) {
+                sibling->color = CLK_RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (isBlack(sibling->right)) {
+                sibling->left->color = CLK_RB_BLACK;
+                sibling->color = CLK_RB_RED;
+                rotateRight(tree, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = CLK_RB_BLACK;
+            sibling->right->color = CLK_RB_BLACK;
+            rotateLeft(tree, parent);
+            node = tree->root;
+        } else {
+            ClkRbNode* sibling = parent->left;
+
+            if (sibling->color == CLK_RB_RED) {
+                sibling->color = CLK_RB_BLACK;
+                parent->color = CLK_RB_RED;
+                rotateRight(tree, parent);
+                sibling = parent->left;
+            }
+
+            if (isBlack(sibling->left) && isBlack(sibling->right)) {
+                sibling->color = CLK_RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (isBlack(sibling->left)) {
+                sibling->right->color = CLK_RB_BLACK;
+                sibling->color = CLK_RB_RED;
+                rotateLeft(tree, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = CLK_RB_BLACK;
+            sibling->left->color = CLK_RB_BLACK;
+            rotateRight(tree, parent);
+            node = tree->root;
+        }
+    }
+
+    if (node != NULL) {
+        node->color = CLK_RB_BLACK;
+    }
+}